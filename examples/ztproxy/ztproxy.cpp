@@ -84,6 +84,25 @@ namespace ZeroTier {
 		if (!_tcpListenSocket6) {
 			DEBUG_ERROR("Error binding on port %d for IPv6 HTTP listen socket", proxy_listen_port);
 		}
+		// libzt connections are watched through an epoll set whose host descriptor sits in the same
+		// Phy loop as the client sockets, so neither kind of socket waits on a timeout for the other.
+		// Phy closes what it wraps, so give it a duplicate and leave the original to the set
+		_zEventSocket = NULL;
+		_zepfd = zts_epoll_create(1);
+		int hostfd = _zepfd < 0 ? -1 : zts_epoll_host_fd(_zepfd);
+		if (_zepfd < 0 || hostfd < 0) {
+			DEBUG_ERROR("Error creating the epoll set for libzt connections (zepfd=%d, hostfd=%d)", _zepfd, hostfd);
+		}
+		else {
+			int fd = dup(hostfd);
+			if (fd < 0) {
+				DEBUG_ERROR("Error duplicating the epoll set's host descriptor (errno=%d)", errno);
+			}
+			else if (!(_zEventSocket = _phy.wrapSocket(fd, this))) {
+				DEBUG_ERROR("Error setting up event notification for libzt connections");
+				close(fd);
+			}
+		}
 		_thread = Thread::start(this);
 	} 
 
@@ -94,6 +113,8 @@ namespace ZeroTier {
 		Thread::join(_thread);
 		_phy.close(_tcpListenSocket,false);
 		_phy.close(_tcpListenSocket6,false);
+		_phy.close(_zEventSocket,false);
+		zts_close(_zepfd);
 	}
 
 	void ZTProxy::threadMain()
@@ -107,92 +128,31 @@ namespace ZeroTier {
 			zts_add_dns_nameserver((struct sockaddr*)&dns_address);
 		}
 
-		TcpConnection *conn = NULL;
-		uint32_t msecs = 1;
-		struct timeval tv;
-		tv.tv_sec = msecs / 1000;
-		tv.tv_usec = (msecs % 1000) * 1000;
-		int ret = 0;
-  		// Main I/O loop
-  		// Moves data between client application socket and libzt VirtualSocket 
+  		// Main I/O loop, client sockets and libzt connections (via _zEventSocket) both wake it
 		while(_run) {
+			_phy.poll(1000);
+		}
+	}
 
-			_phy.poll(5);
-
-			conn_m.lock();
-			// build fd_sets to select upon
-			FD_ZERO(&read_set);
-  			FD_ZERO(&write_set);
-			nfds = 0;
-  			for (int i=0; i<clist.size(); i++) {
-  				FD_SET(clist[i]->zfd, &read_set);
-  				FD_SET(clist[i]->zfd, &write_set);
-  				nfds = clist[i]->zfd > nfds ? clist[i]->zfd : nfds;
-  			}
-
-  			ret = zts_select(nfds + 1, &read_set, &write_set, NULL, &tv);
-			if (ret > 0) {
-				for (int fd_i=0; fd_i<nfds+1; fd_i++) { // I/O needs to be handled on at least one fd
-
-					// RX, Handle data incoming from libzt
-					if (FD_ISSET(fd_i, &read_set)) {
-						int wr = 0, rd = 0;
-						conn = zmap[fd_i];
-						if (conn == NULL) {
-							DEBUG_ERROR("invalid conn");
-							exit(0);
-						}
-						// read data from libzt and place it on ring buffer
-						conn->rx_m.lock();
-						if (conn->RXbuf->count() > 0) {
-							//DEBUG_INFO("libzt has incoming data on fd=%d, RXing via conn=%p, sock=%p", 
-							//	conn->zfd, conn, conn->client_sock);
-						}
-						if ((rd = zts_read(conn->zfd, conn->RXbuf->get_buf(),ZT_MAX_MTU)) < 0) {
-							DEBUG_ERROR("error while reading data from libzt, err=%d", rd);
-						}
-						else {
-							//DEBUG_INFO("LIBZT -> RXBUFFER = %d bytes", rd);
-							conn->RXbuf->produce(rd);
-						}
-						// attempt to write data to client from buffer
-						if ((wr = _phy.streamSend(conn->client_sock, conn->RXbuf->get_buf(), conn->RXbuf->count())) < 0) {
-							DEBUG_ERROR("error while writing the data from the RXbuf to the client PhySocket, err=%d", wr);
-						}
-						else {
-							//DEBUG_INFO("RXBUFFER -> CLIENT = %d bytes", wr);
-							conn->RXbuf->consume(wr);
-						}
-						conn->rx_m.unlock();
-					}
-
-					// TX, Handle data outgoing from client to libzt
-					if (FD_ISSET(fd_i, &write_set)) {
-						int wr = 0;
-						conn = zmap[fd_i];
-						if (conn == NULL) {
-							DEBUG_ERROR("invalid conn");
-							exit(0);
-						}
-						// read data from client and place it on ring buffer
-						conn->tx_m.lock();
-						if (conn->TXbuf->count() > 0) {
-							// DEBUG_INFO("client has outgoing data of len=%d on fd=%d, TXing via conn=%p, sock=%p", 
-							//	conn->TXbuf->count(), conn->zfd, conn, conn->client_sock);
-							if ((wr = zts_write(conn->zfd, conn->TXbuf->get_buf(), conn->TXbuf->count())) < 0) {
-								DEBUG_ERROR("error while sending the data over libzt, err=%d", wr);
-							}
-							else {
-								//DEBUG_INFO("TXBUFFER -> LIBZT = %d bytes", wr);
-								conn->TXbuf->consume(wr); // data is presumed sent, mark it as such in the ringbuffer
-							}
-						}
-						conn->tx_m.unlock();
-					}
-				}
+	void ZTProxy::flushTX(TcpConnection *conn)
+	{
+		int wr = 0;
+		conn->tx_m.lock();
+		if (conn->TXbuf->count() > 0) {
+			if ((wr = zts_write(conn->zfd, conn->TXbuf->get_buf(), conn->TXbuf->count())) < 0) {
+				DEBUG_ERROR("error while sending the data over libzt, err=%d", wr);
+			}
+			else {
+				//DEBUG_INFO("TXBUFFER -> LIBZT = %d bytes", wr);
+				conn->TXbuf->consume(wr); // data is presumed sent, mark it as such in the ringbuffer
 			}
-		conn_m.unlock();
 		}
+		// only ask to hear about writability while something is left to send
+		struct zts_epoll_event ev;
+		ev.events = ZTS_EPOLLIN | (conn->TXbuf->count() > 0 ? ZTS_EPOLLOUT : 0);
+		ev.data.fd = conn->zfd;
+		zts_epoll_ctl(_zepfd, ZTS_EPOLL_CTL_MOD, conn->zfd, &ev);
+		conn->tx_m.unlock();
 	}
 
 	bool isValidIPAddress(const char *ip)
@@ -285,12 +245,19 @@ namespace ZeroTier {
 			conn->client_sock = sock;
 			cmap[conn->client_sock] = conn;	
 			zmap[zfd] = conn;
+			struct zts_epoll_event ev;
+			ev.events = ZTS_EPOLLIN;
+			ev.data.fd = zfd;
+			if (zts_epoll_ctl(_zepfd, ZTS_EPOLL_CTL_ADD, zfd, &ev) < 0) {
+				DEBUG_ERROR("unable to watch connection (zfd=%d)", zfd);
+			}
 			conn_m.unlock();			
 		}
 		else {
 			DEBUG_INFO("connection already established, reusing...");
 		}
-		// Write data coming from client TCP connection to its TX buffer, later emptied into libzt by threadMain I/O loop
+		// Write data coming from client TCP connection to its TX buffer and pass on as much as libzt takes,
+		// the rest is sent once the connection becomes writable
 		conn->tx_m.lock();
 		if ((wr = conn->TXbuf->write((const unsigned char *)data, len)) < 0) {
 			DEBUG_ERROR("there was an error while writing data from client to tx buffer, err=%d", wr);
@@ -299,6 +266,7 @@ namespace ZeroTier {
 			// DEBUG_INFO("CLIENT -> TXBUFFER = %d bytes", wr);
 		}
 		conn->tx_m.unlock();
+		flushTX(conn);
 	}
 
 	void ZTProxy::phyOnTcpAccept(PhySocket *sockL, PhySocket *sockN, void **uptrL, void **uptrN, 
@@ -342,8 +310,48 @@ namespace ZeroTier {
 	void ZTProxy::phyOnTcpWritable(PhySocket *sock, void **uptr) {
 		DEBUG_INFO();
 	}
-	void ZTProxy::phyOnFileDescriptorActivity(PhySocket *sock, void **uptr, bool readable, bool writable) {
-		DEBUG_INFO("sock=%p", sock);
+	void ZTProxy::phyOnFileDescriptorActivity(PhySocket *sock, void **uptr, bool readable, bool writable)
+	{
+		if (sock != _zEventSocket || !readable) {
+			return;
+		}
+		// Moves data between libzt connections that are ready and their client application sockets
+		struct zts_epoll_event events[64];
+		conn_m.lock();
+		int n = zts_epoll_wait(_zepfd, events, 64, 0);
+		for (int i=0; i<n; i++) {
+			TcpConnection *conn = zmap[events[i].data.fd];
+			if (conn == NULL) {
+				continue;
+			}
+			// RX, Handle data incoming from libzt
+			if (events[i].events & (ZTS_EPOLLIN | ZTS_EPOLLERR)) {
+				int wr = 0, rd = 0;
+				// read data from libzt and place it on ring buffer
+				conn->rx_m.lock();
+				if ((rd = zts_read(conn->zfd, conn->RXbuf->get_buf(),ZT_MAX_MTU)) < 0) {
+					DEBUG_ERROR("error while reading data from libzt, err=%d", rd);
+				}
+				else {
+					//DEBUG_INFO("LIBZT -> RXBUFFER = %d bytes", rd);
+					conn->RXbuf->produce(rd);
+				}
+				// attempt to write data to client from buffer
+				if ((wr = _phy.streamSend(conn->client_sock, conn->RXbuf->get_buf(), conn->RXbuf->count())) < 0) {
+					DEBUG_ERROR("error while writing the data from the RXbuf to the client PhySocket, err=%d", wr);
+				}
+				else {
+					//DEBUG_INFO("RXBUFFER -> CLIENT = %d bytes", wr);
+					conn->RXbuf->consume(wr);
+				}
+				conn->rx_m.unlock();
+			}
+			// TX, Handle data outgoing from client to libzt
+			if (events[i].events & ZTS_EPOLLOUT) {
+				flushTX(conn);
+			}
+		}
+		conn_m.unlock();
 	}
 	void ZTProxy::phyOnTcpConnect(PhySocket *sock, void **uptr, bool success) {
 		DEBUG_INFO("sock=%p", sock);
@@ -37,7 +37,6 @@
 #include <queue>
 #include <vector>
 #include <stdio.h>
-#include <sys/select.h>
 
 #define BUF_SZ 1024*1024
 
@@ -94,6 +93,9 @@ namespace ZeroTier {
 		// Handle the closure of a TCP connection
 		void phyOnTcpClose(PhySocket *sock,void **uptr);
 
+		// Move buffered client data into libzt
+		void flushTX(TcpConnection *conn);
+
 		void threadMain()
 			throw();
 
@@ -104,8 +106,8 @@ namespace ZeroTier {
 		volatile bool _run;	
 
 		Mutex conn_m;
-		fd_set read_set, write_set;
-		int nfds;
+		// epoll set holding every libzt connection
+		int _zepfd;
 
 		int _proxy_listen_port;
 		int _internal_port;
@@ -117,6 +119,8 @@ namespace ZeroTier {
 		Phy<ZTProxy*> _phy;
 		PhySocket *_tcpListenSocket;
 		PhySocket *_tcpListenSocket6;
+		// host descriptor that is readable while connections in _zepfd are ready
+		PhySocket *_zEventSocket;
 
 		// mapping from ZeroTier VirtualSocket fd to TcpConnection pointer
 		std::map<int, TcpConnection*> zmap;
@@ -65,6 +65,22 @@
 #include "lwip/opt.h"
 #include "lwip/stats.h"
 
+/* Set LWIP_UNIX_MBOX_LOCKFREE to 1 to replace the mutex/condvar mailbox with a
+   bounded lock-free ring whose blocked readers and writers sleep on futexes.
+   Linux only. */
+#ifndef LWIP_UNIX_MBOX_LOCKFREE
+#define LWIP_UNIX_MBOX_LOCKFREE 0
+#endif
+
+#if LWIP_UNIX_MBOX_LOCKFREE
+#ifndef __linux__
+#error "LWIP_UNIX_MBOX_LOCKFREE requires Linux futexes"
+#endif
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif /* LWIP_UNIX_MBOX_LOCKFREE */
+
 static void
 get_monotonic_time(struct timespec *ts)
 {
@@ -95,6 +111,29 @@ struct sys_mbox_msg {
 
 #define SYS_MBOX_SIZE 128
 
+#if LWIP_UNIX_MBOX_LOCKFREE
+#define SYS_MBOX_CACHELINE 64
+
+/* Each cell carries a sequence number telling whose turn it is: a writer may
+   fill cell i when seq == pos, a reader may drain it when seq == pos + 1. */
+struct sys_mbox_cell {
+  u32_t seq;
+  void *msg;
+};
+
+struct sys_mbox {
+  struct sys_mbox_cell cells[SYS_MBOX_SIZE];
+  /* next slot to be claimed by a writer */
+  u32_t head __attribute__((aligned(SYS_MBOX_CACHELINE)));
+  /* next slot to be drained by a reader */
+  u32_t tail __attribute__((aligned(SYS_MBOX_CACHELINE)));
+  /* futex words, bumped whenever a sleeper might need waking */
+  u32_t not_empty __attribute__((aligned(SYS_MBOX_CACHELINE)));
+  u32_t wait_fetch;
+  u32_t not_full;
+  u32_t wait_send;
+};
+#else
 struct sys_mbox {
   int first, last;
   void *msgs[SYS_MBOX_SIZE];
@@ -103,6 +142,7 @@ struct sys_mbox {
   struct sys_sem *mutex;
   int wait_send;
 };
+#endif /* LWIP_UNIX_MBOX_LOCKFREE */
 
 struct sys_sem {
   unsigned int c;
@@ -182,6 +222,231 @@ sys_thread_new(const char *name, lwip_thread_fn function, void *arg, int stacksi
 
 /*-----------------------------------------------------------------------------------*/
 /* Mailbox */
+#if LWIP_UNIX_MBOX_LOCKFREE
+/* Writers claim cells with a CAS on head and readers with a CAS on tail, so no
+   lock is taken on either path. The tcpip thread is the only reader of its own
+   mailbox, but netconn mailboxes may be drained by several application threads,
+   so the read side stays safe for more than one reader. Sleeping is done on
+   the not_empty/not_full futex words; wait_fetch/wait_send count sleepers so
+   that the uncontended post and fetch never enter the kernel. */
+
+static int
+futex_wait(u32_t *addr, u32_t val, const struct timespec *rel)
+{
+  return (int)syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, rel, NULL, 0);
+}
+
+static void
+futex_wake(u32_t *addr, int n)
+{
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+static void
+mbox_wake(u32_t *word, u32_t *waiters)
+{
+  /* pairs with the fence in mbox_sleep(): either the sleeper sees the new
+     ring state on its re-check or we see its waiter count here */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(waiters, __ATOMIC_RELAXED)) {
+    __atomic_fetch_add(word, 1, __ATOMIC_RELEASE);
+    futex_wake(word, 1);
+  }
+}
+
+static int
+mbox_push(struct sys_mbox *mbox, void *msg)
+{
+  struct sys_mbox_cell *cell;
+  u32_t pos, seq;
+  s32_t dif;
+
+  pos = __atomic_load_n(&mbox->head, __ATOMIC_RELAXED);
+  for (;;) {
+    cell = &mbox->cells[pos % SYS_MBOX_SIZE];
+    seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    dif = (s32_t)(seq - pos);
+    if (dif == 0) {
+      if (__atomic_compare_exchange_n(&mbox->head, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (dif < 0) {
+      return 0; /* full */
+    } else {
+      pos = __atomic_load_n(&mbox->head, __ATOMIC_RELAXED);
+    }
+  }
+  cell->msg = msg;
+  __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+  mbox_wake(&mbox->not_empty, &mbox->wait_fetch);
+  return 1;
+}
+
+static int
+mbox_pop(struct sys_mbox *mbox, void **msg)
+{
+  struct sys_mbox_cell *cell;
+  u32_t pos, seq;
+  s32_t dif;
+  void *m;
+
+  pos = __atomic_load_n(&mbox->tail, __ATOMIC_RELAXED);
+  for (;;) {
+    cell = &mbox->cells[pos % SYS_MBOX_SIZE];
+    seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    dif = (s32_t)(seq - (pos + 1));
+    if (dif == 0) {
+      if (__atomic_compare_exchange_n(&mbox->tail, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (dif < 0) {
+      return 0; /* empty, or the next writer has not published yet */
+    } else {
+      pos = __atomic_load_n(&mbox->tail, __ATOMIC_RELAXED);
+    }
+  }
+  m = cell->msg;
+  __atomic_store_n(&cell->seq, pos + SYS_MBOX_SIZE, __ATOMIC_RELEASE);
+  mbox_wake(&mbox->not_full, &mbox->wait_send);
+  if (msg != NULL) {
+    *msg = m;
+  }
+  return 1;
+}
+
+/* Sleep on a futex word until woken or until the deadline passes. Returns 0
+   once the caller should retry, SYS_ARCH_TIMEOUT if the deadline expired. */
+static u32_t
+mbox_sleep(struct sys_mbox *mbox, u32_t *word, u32_t *waiters, int for_send,
+           const struct timespec *deadline)
+{
+  struct timespec now, rel, *relp = NULL;
+  u32_t val;
+  int ready;
+
+  if (deadline != NULL) {
+    get_monotonic_time(&now);
+    rel.tv_sec = deadline->tv_sec - now.tv_sec;
+    rel.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+    if (rel.tv_nsec < 0) {
+      rel.tv_sec--;
+      rel.tv_nsec += 1000000000L;
+    }
+    if (rel.tv_sec < 0) {
+      return SYS_ARCH_TIMEOUT;
+    }
+    relp = &rel;
+  }
+  val = __atomic_load_n(word, __ATOMIC_ACQUIRE);
+  __atomic_fetch_add(waiters, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  /* re-check after announcing ourselves, see mbox_wake() */
+  if (for_send) {
+    u32_t pos = __atomic_load_n(&mbox->head, __ATOMIC_RELAXED);
+    ready = __atomic_load_n(&mbox->cells[pos % SYS_MBOX_SIZE].seq, __ATOMIC_ACQUIRE) == pos;
+  } else {
+    u32_t pos = __atomic_load_n(&mbox->tail, __ATOMIC_RELAXED);
+    ready = __atomic_load_n(&mbox->cells[pos % SYS_MBOX_SIZE].seq, __ATOMIC_ACQUIRE) == pos + 1;
+  }
+  if (!ready) {
+    futex_wait(word, val, relp);
+  }
+  __atomic_fetch_sub(waiters, 1, __ATOMIC_RELAXED);
+  return 0;
+}
+
+err_t
+sys_mbox_new(struct sys_mbox **mb, int size)
+{
+  struct sys_mbox *mbox;
+  int i;
+  LWIP_UNUSED_ARG(size);
+
+  mbox = (struct sys_mbox *)aligned_alloc(SYS_MBOX_CACHELINE, sizeof(struct sys_mbox));
+  if (mbox == NULL) {
+    return ERR_MEM;
+  }
+  memset(mbox, 0, sizeof(struct sys_mbox));
+  for (i = 0; i < SYS_MBOX_SIZE; i++) {
+    mbox->cells[i].seq = (u32_t)i;
+  }
+
+  SYS_STATS_INC_USED(mbox);
+  *mb = mbox;
+  return ERR_OK;
+}
+
+void
+sys_mbox_free(struct sys_mbox **mb)
+{
+  if ((mb != NULL) && (*mb != SYS_MBOX_NULL)) {
+    SYS_STATS_DEC(mbox.used);
+    free(*mb);
+  }
+}
+
+err_t
+sys_mbox_trypost(struct sys_mbox **mb, void *msg)
+{
+  LWIP_ASSERT("invalid mbox", (mb != NULL) && (*mb != NULL));
+  LWIP_DEBUGF(SYS_DEBUG, ("sys_mbox_trypost: mbox %p msg %p\n",
+                          (void *)*mb, (void *)msg));
+  return mbox_push(*mb, msg) ? ERR_OK : ERR_MEM;
+}
+
+void
+sys_mbox_post(struct sys_mbox **mb, void *msg)
+{
+  struct sys_mbox *mbox;
+  LWIP_ASSERT("invalid mbox", (mb != NULL) && (*mb != NULL));
+  mbox = *mb;
+
+  LWIP_DEBUGF(SYS_DEBUG, ("sys_mbox_post: mbox %p msg %p\n", (void *)mbox, (void *)msg));
+
+  while (!mbox_push(mbox, msg)) {
+    mbox_sleep(mbox, &mbox->not_full, &mbox->wait_send, 1, NULL);
+  }
+}
+
+u32_t
+sys_arch_mbox_tryfetch(struct sys_mbox **mb, void **msg)
+{
+  LWIP_ASSERT("invalid mbox", (mb != NULL) && (*mb != NULL));
+  return mbox_pop(*mb, msg) ? 0 : SYS_MBOX_EMPTY;
+}
+
+u32_t
+sys_arch_mbox_fetch(struct sys_mbox **mb, void **msg, u32_t timeout)
+{
+  struct timespec start, deadline, now;
+  struct sys_mbox *mbox;
+  LWIP_ASSERT("invalid mbox", (mb != NULL) && (*mb != NULL));
+  mbox = *mb;
+
+  if (mbox_pop(mbox, msg)) {
+    return 0;
+  }
+  get_monotonic_time(&start);
+  if (timeout != 0) {
+    deadline.tv_sec = start.tv_sec + timeout / 1000L;
+    deadline.tv_nsec = start.tv_nsec + (timeout % 1000L) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+  }
+  while (!mbox_pop(mbox, msg)) {
+    if (mbox_sleep(mbox, &mbox->not_empty, &mbox->wait_fetch, 0,
+                   timeout != 0 ? &deadline : NULL) == SYS_ARCH_TIMEOUT) {
+      return SYS_ARCH_TIMEOUT;
+    }
+  }
+  get_monotonic_time(&now);
+  return (u32_t)((now.tv_sec - start.tv_sec) * 1000L + (now.tv_nsec - start.tv_nsec) / 1000000L);
+}
+#else /* LWIP_UNIX_MBOX_LOCKFREE */
 err_t
 sys_mbox_new(struct sys_mbox **mb, int size)
 {
@@ -375,6 +640,7 @@ sys_arch_mbox_fetch(struct sys_mbox **mb, void **msg, u32_t timeout)
 
   return time_needed;
 }
+#endif /* LWIP_UNIX_MBOX_LOCKFREE */
 
 /*-----------------------------------------------------------------------------------*/
 /* Semaphore */
@@ -469,11 +469,12 @@ netconn_accept(struct netconn *conn, struct netconn **new_conn)
  *
  * @param conn the netconn from which to receive data
  * @param new_buf pointer where a new pbuf/netbuf is stored when received data
+ * @param apiflags NETCONN_NOAUTORCVD to leave the TCP window update to the caller
  * @return ERR_OK if data has been received, an error code otherwise (timeout,
  *                memory error or another error)
  */
 static err_t
-netconn_recv_data(struct netconn *conn, void **new_buf)
+netconn_recv_data(struct netconn *conn, void **new_buf, u8_t apiflags)
 {
   void *buf = NULL;
   u16_t len;
@@ -537,18 +538,20 @@ netconn_recv_data(struct netconn *conn, void **new_buf)
   if (NETCONNTYPE_GROUP(conn->type) == NETCONN_TCP)
 #endif /* (LWIP_UDP || LWIP_RAW) */
   {
-    /* Let the stack know that we have taken the data. */
-    /* @todo: Speedup: Don't block and wait for the answer here
-       (to prevent multiple thread-switches). */
-    API_MSG_VAR_REF(msg).conn = conn;
-    if (buf != NULL) {
-      API_MSG_VAR_REF(msg).msg.r.len = ((struct pbuf *)buf)->tot_len;
-    } else {
-      API_MSG_VAR_REF(msg).msg.r.len = 1;
-    }
+    if ((buf == NULL) || !(apiflags & NETCONN_NOAUTORCVD)) {
+      /* Let the stack know that we have taken the data. */
+      /* @todo: Speedup: Don't block and wait for the answer here
+         (to prevent multiple thread-switches). */
+      API_MSG_VAR_REF(msg).conn = conn;
+      if (buf != NULL) {
+        API_MSG_VAR_REF(msg).msg.r.len = ((struct pbuf *)buf)->tot_len;
+      } else {
+        API_MSG_VAR_REF(msg).msg.r.len = 1;
+      }
 
-    /* don't care for the return value of lwip_netconn_do_recv */
-    netconn_apimsg(lwip_netconn_do_recv, &API_MSG_VAR_REF(msg));
+      /* don't care for the return value of lwip_netconn_do_recv */
+      netconn_apimsg(lwip_netconn_do_recv, &API_MSG_VAR_REF(msg));
+    }
     API_MSG_VAR_FREE(msg);
 
     /* If we are closed, we indicate that we no longer wish to use the socket */
@@ -601,11 +604,59 @@ netconn_recv_data(struct netconn *conn, void **new_buf)
  */
 err_t
 netconn_recv_tcp_pbuf(struct netconn *conn, struct pbuf **new_buf)
+{
+  return netconn_recv_tcp_pbuf_flags(conn, new_buf, 0);
+}
+
+/**
+ * @ingroup netconn_tcp
+ * Receive data (in form of a pbuf) from a TCP netconn
+ *
+ * @param conn the netconn from which to receive data
+ * @param new_buf pointer where a new pbuf is stored when received data
+ * @param apiflags NETCONN_NOAUTORCVD: don't update the receive window, the
+ *                 caller reports the data taken with netconn_tcp_recvd()
+ * @return ERR_OK if data has been received, an error code otherwise (timeout,
+ *                memory error or another error)
+ *         ERR_ARG if conn is not a TCP netconn
+ */
+err_t
+netconn_recv_tcp_pbuf_flags(struct netconn *conn, struct pbuf **new_buf, u8_t apiflags)
 {
   LWIP_ERROR("netconn_recv: invalid conn", (conn != NULL) &&
              NETCONNTYPE_GROUP(netconn_type(conn)) == NETCONN_TCP, return ERR_ARG;);
 
-  return netconn_recv_data(conn, (void **)new_buf);
+  return netconn_recv_data(conn, (void **)new_buf, apiflags);
+}
+
+/**
+ * @ingroup netconn_tcp
+ * Update the receive window of a TCP netconn for data received with
+ * NETCONN_NOAUTORCVD, so that several pbufs cost a single call into the
+ * TCPIP thread (or a single acquisition of the core lock).
+ *
+ * @param conn the netconn the data was received from
+ * @param len number of bytes taken from the netconn
+ * @return ERR_OK, or ERR_ARG if conn is not a TCP netconn
+ */
+err_t
+netconn_tcp_recvd(struct netconn *conn, size_t len)
+{
+  API_MSG_VAR_DECLARE(msg);
+
+  LWIP_ERROR("netconn_tcp_recvd: invalid conn", (conn != NULL) &&
+             NETCONNTYPE_GROUP(netconn_type(conn)) == NETCONN_TCP, return ERR_ARG;);
+  if (len == 0) {
+    return ERR_OK;
+  }
+
+  API_MSG_VAR_ALLOC(msg);
+  API_MSG_VAR_REF(msg).conn = conn;
+  API_MSG_VAR_REF(msg).msg.r.len = (u32_t)len;
+  /* don't care for the return value of lwip_netconn_do_recv */
+  netconn_apimsg(lwip_netconn_do_recv, &API_MSG_VAR_REF(msg));
+  API_MSG_VAR_FREE(msg);
+  return ERR_OK;
 }
 
 /**
@@ -642,7 +693,7 @@ netconn_recv(struct netconn *conn, struct netbuf **new_buf)
       return ERR_MEM;
     }
 
-    err = netconn_recv_data(conn, (void **)&p);
+    err = netconn_recv_data(conn, (void **)&p, 0);
     if (err != ERR_OK) {
       memp_free(MEMP_NETBUF, buf);
       return err;
@@ -663,7 +714,7 @@ netconn_recv(struct netconn *conn, struct netbuf **new_buf)
 #endif /* LWIP_TCP && (LWIP_UDP || LWIP_RAW) */
   {
 #if (LWIP_UDP || LWIP_RAW)
-    return netconn_recv_data(conn, (void **)new_buf);
+    return netconn_recv_data(conn, (void **)new_buf, 0);
 #endif /* (LWIP_UDP || LWIP_RAW) */
   }
 }
@@ -717,6 +768,41 @@ netconn_send(struct netconn *conn, struct netbuf *buf)
   return err;
 }
 
+/**
+ * @ingroup netconn_udp
+ * Send several netbufs over a UDP or RAW netconn with a single call into the
+ * TCPIP thread (or a single acquisition of the core lock).
+ *
+ * @param conn the UDP or RAW netconn over which to send data
+ * @param bufs the netbufs to send, each carrying its own destination (if any)
+ * @param count number of netbufs in bufs
+ * @param sent receives the number of netbufs sent; sending stops at the first error
+ * @return ERR_OK if all netbufs were sent, else the error of the first one that wasn't
+ */
+err_t
+netconn_send_batch(struct netconn *conn, struct netbuf **bufs, u16_t count, u16_t *sent)
+{
+  API_MSG_VAR_DECLARE(msg);
+  err_t err;
+
+  LWIP_ERROR("netconn_send_batch: invalid conn", (conn != NULL), return ERR_ARG;);
+  LWIP_ERROR("netconn_send_batch: invalid sent", (sent != NULL), return ERR_ARG;);
+  *sent = 0;
+
+  LWIP_DEBUGF(API_LIB_DEBUG, ("netconn_send_batch: sending %"U16_F" netbufs\n", count));
+
+  API_MSG_VAR_ALLOC(msg);
+  API_MSG_VAR_REF(msg).conn = conn;
+  API_MSG_VAR_REF(msg).msg.sb.bufs = bufs;
+  API_MSG_VAR_REF(msg).msg.sb.count = count;
+  API_MSG_VAR_REF(msg).msg.sb.sent = 0;
+  err = netconn_apimsg(lwip_netconn_do_send_batch, &API_MSG_VAR_REF(msg));
+  *sent = API_MSG_VAR_REF(msg).msg.sb.sent;
+  API_MSG_VAR_FREE(msg);
+
+  return err;
+}
+
 /**
  * @ingroup netconn_tcp
  * Send data over a TCP netconn.
@@ -735,15 +821,81 @@ err_t
 netconn_write_partly(struct netconn *conn, const void *dataptr, size_t size,
                      u8_t apiflags, size_t *bytes_written)
 {
+  struct netvector vector;
+  vector.ptr = dataptr;
+  vector.len = size;
+  return netconn_write_vectors_partly(conn, &vector, 1, apiflags, bytes_written);
+}
+
+/**
+ * @ingroup netconn_tcp
+ * Send the data of several vectors over a TCP netconn, as if they were one
+ * buffer: all of it is handed to the stack in one call into the TCPIP thread
+ * (or under one acquisition of the core lock) as long as it fits into the
+ * send buffer, without being gathered into a temporary buffer first.
+ *
+ * @param conn the TCP netconn over which to send data
+ * @param vectors array of vectors containing data to send
+ * @param vectorcnt number of vectors in the array
+ * @param apiflags combination of following flags :
+ * - NETCONN_COPY: data will be copied into memory belonging to the stack
+ * - NETCONN_MORE: for TCP connection, PSH flag will be set on last segment sent
+ * - NETCONN_DONTBLOCK: only write the data if all data can be written at once
+ * @param bytes_written pointer to a location that receives the number of written bytes
+ * @return ERR_OK if data was sent, any other err_t on error
+ */
+err_t
+netconn_write_vectors_partly(struct netconn *conn, struct netvector *vectors, u16_t vectorcnt,
+                             u8_t apiflags, size_t *bytes_written)
+{
+#if LWIP_PBUF_EXT
+  return netconn_write_vectors_ext(conn, vectors, vectorcnt, apiflags, NULL, bytes_written);
+}
+
+/**
+ * @ingroup netconn_tcp
+ * Send the data of several vectors over a TCP netconn like
+ * netconn_write_vectors_partly(), without copying it if NETCONN_COPY isn't
+ * set: the vectors point into memory lent with ext, which is told through
+ * ext->release() once the stack doesn't reference the data anymore.
+ *
+ * @param conn the TCP netconn over which to send data
+ * @param vectors array of vectors containing data to send
+ * @param vectorcnt number of vectors in the array
+ * @param apiflags see netconn_write_vectors_partly()
+ * @param ext the lent memory, or NULL
+ * @param bytes_written pointer to a location that receives the number of written bytes
+ * @return ERR_OK if data was sent, any other err_t on error
+ */
+err_t
+netconn_write_vectors_ext(struct netconn *conn, struct netvector *vectors, u16_t vectorcnt,
+                          u8_t apiflags, struct pbuf_ext *ext, size_t *bytes_written)
+{
+#endif /* LWIP_PBUF_EXT */
   API_MSG_VAR_DECLARE(msg);
   err_t err;
   u8_t dontblock;
+  size_t size;
+  int i;
 
   LWIP_ERROR("netconn_write: invalid conn",  (conn != NULL), return ERR_ARG;);
   LWIP_ERROR("netconn_write: invalid conn->type",  (NETCONNTYPE_GROUP(conn->type)== NETCONN_TCP), return ERR_VAL;);
+  size = 0;
+  for (i = 0; i < vectorcnt; i++) {
+    size += vectors[i].len;
+    if (size < vectors[i].len) {
+      /* overflow */
+      return ERR_VAL;
+    }
+  }
   if (size == 0) {
     return ERR_OK;
   }
+  /* lwip_netconn_do_writemore() expects the current vector to hold data */
+  while (vectors->len == 0) {
+    vectors++;
+    vectorcnt--;
+  }
   dontblock = netconn_is_nonblocking(conn) || (apiflags & NETCONN_DONTBLOCK);
 #if LWIP_SO_SNDTIMEO
   if (conn->send_timeout != 0) {
@@ -759,9 +911,14 @@ netconn_write_partly(struct netconn *conn, const void *dataptr, size_t size,
   API_MSG_VAR_ALLOC(msg);
   /* non-blocking write sends as much  */
   API_MSG_VAR_REF(msg).conn = conn;
-  API_MSG_VAR_REF(msg).msg.w.dataptr = dataptr;
+  API_MSG_VAR_REF(msg).msg.w.vector = vectors;
+  API_MSG_VAR_REF(msg).msg.w.vector_cnt = vectorcnt;
+  API_MSG_VAR_REF(msg).msg.w.vector_off = 0;
   API_MSG_VAR_REF(msg).msg.w.apiflags = apiflags;
   API_MSG_VAR_REF(msg).msg.w.len = size;
+#if LWIP_PBUF_EXT
+  API_MSG_VAR_REF(msg).msg.w.ext = ext;
+#endif /* LWIP_PBUF_EXT */
 #if LWIP_SO_SNDTIMEO
   if (conn->send_timeout != 0) {
     /* get the time we started, which is later compared to
@@ -287,6 +287,10 @@ recv_tcp(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
 #endif /* LWIP_SO_RCVBUF */
     /* Register event with callback */
     API_EVENT(conn, NETCONN_EVT_RCVPLUS, len);
+    if (p == NULL) {
+      /* FIN: the remote host won't send anything more */
+      API_EVENT(conn, NETCONN_EVT_HUP, 0);
+    }
   }
 
   return ERR_OK;
@@ -334,6 +338,14 @@ poll_tcp(void *arg, struct tcp_pcb *pcb)
     }
   }
 
+#if LWIP_TCP_TIMER_WHEEL
+  /* Nothing left to retry: stop polling until the next delayed write. */
+  if ((conn->pcb.tcp != NULL) && (conn->state != NETCONN_WRITE) &&
+      (conn->state != NETCONN_CLOSE) && !(conn->flags & NETCONN_FLAG_CHECK_WRITESPACE)) {
+    tcp_poll(conn->pcb.tcp, NULL, 0);
+  }
+#endif /* LWIP_TCP_TIMER_WHEEL */
+
   return ERR_OK;
 }
 
@@ -406,6 +418,7 @@ err_tcp(void *arg, err_t err)
 
   /* Notify the user layer about a connection error. Used to signal select. */
   API_EVENT(conn, NETCONN_EVT_ERROR, 0);
+  API_EVENT(conn, NETCONN_EVT_HUP, 0);
   /* Try to release selects pending on 'read' or 'write', too.
      They will get an error if they actually try to read or write. */
   API_EVENT(conn, NETCONN_EVT_RCVPLUS, 0);
@@ -461,7 +474,11 @@ setup_tcp(struct netconn *conn)
   tcp_arg(pcb, conn);
   tcp_recv(pcb, recv_tcp);
   tcp_sent(pcb, sent_tcp);
+#if !LWIP_TCP_TIMER_WHEEL
+  /* With the timer wheel, idle netconns are not polled: writes and close
+     arm the poll timer while they have something to retry. */
   tcp_poll(pcb, poll_tcp, NETCONN_TCP_POLL_INTERVAL);
+#endif /* !LWIP_TCP_TIMER_WHEEL */
   tcp_err(pcb, err_tcp);
 }
 
@@ -1381,6 +1398,56 @@ lwip_netconn_do_listen(void *m)
 }
 #endif /* LWIP_TCP */
 
+/**
+ * Send one netbuf on the RAW or UDP pcb contained in a netconn
+ *
+ * @param conn the netconn to send on
+ * @param buf the netbuf to send
+ * @return the result of raw_send()/udp_send() and friends
+ */
+static err_t
+lwip_netconn_send_netbuf(struct netconn *conn, struct netbuf *buf)
+{
+  err_t err = ERR_CONN;
+
+  if (conn->pcb.tcp != NULL) {
+    switch (NETCONNTYPE_GROUP(conn->type)) {
+#if LWIP_RAW
+    case NETCONN_RAW:
+      if (ip_addr_isany(&buf->addr) || IP_IS_ANY_TYPE_VAL(buf->addr)) {
+        err = raw_send(conn->pcb.raw, buf->p);
+      } else {
+        err = raw_sendto(conn->pcb.raw, buf->p, &buf->addr);
+      }
+      break;
+#endif
+#if LWIP_UDP
+    case NETCONN_UDP:
+#if LWIP_CHECKSUM_ON_COPY
+      if (ip_addr_isany(&buf->addr) || IP_IS_ANY_TYPE_VAL(buf->addr)) {
+        err = udp_send_chksum(conn->pcb.udp, buf->p,
+          buf->flags & NETBUF_FLAG_CHKSUM, buf->toport_chksum);
+      } else {
+        err = udp_sendto_chksum(conn->pcb.udp, buf->p,
+          &buf->addr, buf->port,
+          buf->flags & NETBUF_FLAG_CHKSUM, buf->toport_chksum);
+      }
+#else /* LWIP_CHECKSUM_ON_COPY */
+      if (ip_addr_isany_val(buf->addr) || IP_IS_ANY_TYPE_VAL(buf->addr)) {
+        err = udp_send(conn->pcb.udp, buf->p);
+      } else {
+        err = udp_sendto(conn->pcb.udp, buf->p, &buf->addr, buf->port);
+      }
+#endif /* LWIP_CHECKSUM_ON_COPY */
+      break;
+#endif /* LWIP_UDP */
+    default:
+      break;
+    }
+  }
+  return err;
+}
+
 /**
  * Send some data on a RAW or UDP pcb contained in a netconn
  * Called from netconn_send
@@ -1395,40 +1462,30 @@ lwip_netconn_do_send(void *m)
   if (ERR_IS_FATAL(msg->conn->last_err)) {
     msg->err = msg->conn->last_err;
   } else {
-    msg->err = ERR_CONN;
-    if (msg->conn->pcb.tcp != NULL) {
-      switch (NETCONNTYPE_GROUP(msg->conn->type)) {
-#if LWIP_RAW
-      case NETCONN_RAW:
-        if (ip_addr_isany(&msg->msg.b->addr) || IP_IS_ANY_TYPE_VAL(msg->msg.b->addr)) {
-          msg->err = raw_send(msg->conn->pcb.raw, msg->msg.b->p);
-        } else {
-          msg->err = raw_sendto(msg->conn->pcb.raw, msg->msg.b->p, &msg->msg.b->addr);
-        }
-        break;
-#endif
-#if LWIP_UDP
-      case NETCONN_UDP:
-#if LWIP_CHECKSUM_ON_COPY
-        if (ip_addr_isany(&msg->msg.b->addr) || IP_IS_ANY_TYPE_VAL(msg->msg.b->addr)) {
-          msg->err = udp_send_chksum(msg->conn->pcb.udp, msg->msg.b->p,
-            msg->msg.b->flags & NETBUF_FLAG_CHKSUM, msg->msg.b->toport_chksum);
-        } else {
-          msg->err = udp_sendto_chksum(msg->conn->pcb.udp, msg->msg.b->p,
-            &msg->msg.b->addr, msg->msg.b->port,
-            msg->msg.b->flags & NETBUF_FLAG_CHKSUM, msg->msg.b->toport_chksum);
-        }
-#else /* LWIP_CHECKSUM_ON_COPY */
-        if (ip_addr_isany_val(msg->msg.b->addr) || IP_IS_ANY_TYPE_VAL(msg->msg.b->addr)) {
-          msg->err = udp_send(msg->conn->pcb.udp, msg->msg.b->p);
-        } else {
-          msg->err = udp_sendto(msg->conn->pcb.udp, msg->msg.b->p, &msg->msg.b->addr, msg->msg.b->port);
-        }
-#endif /* LWIP_CHECKSUM_ON_COPY */
-        break;
-#endif /* LWIP_UDP */
-      default:
-        break;
+    msg->err = lwip_netconn_send_netbuf(msg->conn, msg->msg.b);
+  }
+  TCPIP_APIMSG_ACK(msg);
+}
+
+/**
+ * Send several netbufs on a RAW or UDP pcb contained in a netconn, stopping
+ * at the first one that fails. Called from netconn_send_batch
+ *
+ * @param m the api_msg_msg pointing to the connection
+ */
+void
+lwip_netconn_do_send_batch(void *m)
+{
+  struct api_msg *msg = (struct api_msg*)m;
+
+  if (ERR_IS_FATAL(msg->conn->last_err)) {
+    msg->err = msg->conn->last_err;
+  } else {
+    msg->err = ERR_OK;
+    while ((msg->msg.sb.sent < msg->msg.sb.count) && (msg->err == ERR_OK)) {
+      msg->err = lwip_netconn_send_netbuf(msg->conn, msg->msg.sb.bufs[msg->msg.sb.sent]);
+      if (msg->err == ERR_OK) {
+        msg->msg.sb.sent++;
       }
     }
   }
@@ -1531,33 +1588,62 @@ lwip_netconn_do_writemore(struct netconn *conn  WRITE_DELAYED_PARAM)
   } else
 #endif /* LWIP_SO_SNDTIMEO */
   {
-    dataptr = (const u8_t*)conn->current_msg->msg.w.dataptr + conn->write_offset;
-    diff = conn->current_msg->msg.w.len - conn->write_offset;
-    if (diff > 0xffffUL) { /* max_u16_t */
-      len = 0xffff;
-      apiflags |= TCP_WRITE_FLAG_MORE;
-    } else {
-      len = (u16_t)diff;
-    }
-    available = tcp_sndbuf(conn->pcb.tcp);
-    if (available < len) {
-      /* don't try to write more than sendbuf */
-      len = available;
-      if (dontblock) {
-        if (!len) {
-          err = ERR_WOULDBLOCK;
-          goto err_mem;
-        }
+    /* write as many vectors as fit into the send buffer in one go */
+    do {
+      apiflags = conn->current_msg->msg.w.apiflags;
+      dataptr = (const u8_t*)conn->current_msg->msg.w.vector->ptr + conn->current_msg->msg.w.vector_off;
+      diff = conn->current_msg->msg.w.vector->len - conn->current_msg->msg.w.vector_off;
+      if (diff > 0xffffUL) { /* max_u16_t */
+        len = 0xffff;
+        apiflags |= TCP_WRITE_FLAG_MORE;
       } else {
+        len = (u16_t)diff;
+      }
+      available = tcp_sndbuf(conn->pcb.tcp);
+      if (available < len) {
+        /* don't try to write more than sendbuf */
+        len = available;
+        if (dontblock) {
+          if (!len) {
+            /* return what the previous vectors wrote, if anything */
+            err = (conn->write_offset == 0) ? ERR_WOULDBLOCK : ERR_OK;
+            break;
+          }
+        } else {
+          apiflags |= TCP_WRITE_FLAG_MORE;
+        }
+      } else if (conn->write_offset + len < conn->current_msg->msg.w.len) {
+        /* more vectors follow, only the last segment gets the PSH flag */
         apiflags |= TCP_WRITE_FLAG_MORE;
       }
-    }
-    LWIP_ASSERT("lwip_netconn_do_writemore: invalid length!", ((conn->write_offset + len) <= conn->current_msg->msg.w.len));
-    err = tcp_write(conn->pcb.tcp, dataptr, len, apiflags);
+      LWIP_ASSERT("lwip_netconn_do_writemore: invalid length!", ((conn->write_offset + len) <= conn->current_msg->msg.w.len));
+#if LWIP_PBUF_EXT
+      err = tcp_write_ext(conn->pcb.tcp, dataptr, len, apiflags, conn->current_msg->msg.w.ext);
+#else /* LWIP_PBUF_EXT */
+      err = tcp_write(conn->pcb.tcp, dataptr, len, apiflags);
+#endif /* LWIP_PBUF_EXT */
+      if (err == ERR_OK) {
+        conn->write_offset += len;
+        conn->current_msg->msg.w.vector_off += len;
+        if (conn->current_msg->msg.w.vector_off == conn->current_msg->msg.w.vector->len) {
+          /* move on to the next vector that holds data */
+          do {
+            conn->current_msg->msg.w.vector_cnt--;
+            conn->current_msg->msg.w.vector++;
+          } while ((conn->current_msg->msg.w.vector_cnt > 0) && (conn->current_msg->msg.w.vector->len == 0));
+          conn->current_msg->msg.w.vector_off = 0;
+        }
+      } else if ((err == ERR_MEM) && dontblock && (conn->write_offset > 0)) {
+        /* the send queue is full, but the previous vectors made it */
+        err = ERR_OK;
+        break;
+      }
+    } while ((err == ERR_OK) && (conn->write_offset < conn->current_msg->msg.w.len) &&
+             (tcp_sndbuf(conn->pcb.tcp) > 0));
+
     /* if OK or memory error, check available space */
-    if ((err == ERR_OK) || (err == ERR_MEM)) {
-err_mem:
-      if (dontblock && (len < conn->current_msg->msg.w.len)) {
+    if ((err == ERR_OK) || (err == ERR_MEM) || (err == ERR_WOULDBLOCK)) {
+      if (dontblock && (conn->write_offset < conn->current_msg->msg.w.len)) {
         /* non-blocking write did not write everything: mark the pcb non-writable
            and let poll_tcp check writable space to mark the pcb writable again */
         API_EVENT(conn, NETCONN_EVT_SENDMINUS, len);
@@ -1572,7 +1658,6 @@ err_mem:
 
     if (err == ERR_OK) {
       err_t out_err;
-      conn->write_offset += len;
       if ((conn->write_offset == conn->current_msg->msg.w.len) || dontblock) {
         /* return sent length */
         conn->current_msg->msg.w.len = conn->write_offset;
@@ -1616,6 +1701,12 @@ err_mem:
       conn->current_msg->msg.w.len = 0;
     }
   }
+#if LWIP_TCP_TIMER_WHEEL
+  if (!write_finished || (conn->flags & NETCONN_FLAG_CHECK_WRITESPACE)) {
+    /* poll_tcp() continues the write or checks write-space */
+    tcp_poll(conn->pcb.tcp, poll_tcp, NETCONN_TCP_POLL_INTERVAL);
+  }
+#endif /* LWIP_TCP_TIMER_WHEEL */
   if (write_finished) {
     /* everything was written: set back connection state
        and back to application task */
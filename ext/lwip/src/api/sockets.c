@@ -187,7 +187,22 @@ static void sockaddr_to_ipaddr_port(const struct sockaddr* sockaddr, ip_addr_t*
 #define LWIP_SO_SNDRCVTIMEO_GET_MS(optval) ((((const struct timeval *)(optval))->tv_sec * 1000U) + (((const struct timeval *)(optval))->tv_usec / 1000U))
 #endif
 
-#define NUM_SOCKETS MEMP_NUM_NETCONN
+#define NUM_SOCKETS LWIP_SOCKET_MAX
+
+#if (LWIP_SOCKET_CHUNK & (LWIP_SOCKET_CHUNK - 1)) != 0
+#error "LWIP_SOCKET_CHUNK must be a power of two"
+#endif
+#if LWIP_SOCKET_GENERATION_BITS > 16
+#error "LWIP_SOCKET_GENERATION_BITS must not be larger than 16"
+#endif
+#if ((NUM_SOCKETS - 1) >> (30 - LWIP_SOCKET_GENERATION_BITS)) != 0
+#error "LWIP_SOCKET_MAX and LWIP_SOCKET_GENERATION_BITS make socket descriptors too large"
+#endif
+
+/** Generation bits of a socket descriptor */
+#define SOCKET_GEN_MASK ((1U << LWIP_SOCKET_GENERATION_BITS) - 1)
+/** Number of chunks the socket table can grow to */
+#define NUM_SOCKET_CHUNKS ((NUM_SOCKETS + LWIP_SOCKET_CHUNK - 1) / LWIP_SOCKET_CHUNK)
 
 /** This is overridable for the rare case where more than 255 threads
  * select on the same socket...
@@ -204,6 +219,12 @@ struct lwip_sock {
   void *lastdata;
   /** offset in the data that was left from the previous read */
   u16_t lastoffset;
+  /** receive window given back by released lwip_recv_zc() loans, not yet passed to TCP */
+  size_t zc_released;
+  /** lwip_recv_zc_release() calls using conn, lwip_close() waits for them before deleting it */
+  u16_t zc_releasing;
+  /** set by lwip_close() once no more lwip_recv_zc_release() calls may use conn */
+  u8_t closing;
   /** number of times data was received, set by event_callback(),
       tested by the receive and select functions */
   s16_t rcvevent;
@@ -212,10 +233,22 @@ struct lwip_sock {
   u16_t sendevent;
   /** error happened for this socket, set by event_callback(), tested by select */
   u16_t errevent;
+  /** remote host closed the connection, set by event_callback(), tested by epoll */
+  u8_t hupevent;
   /** last error that occurred on this socket (in fact, all our errnos fit into an u8_t) */
   u8_t err;
   /** counter of how many threads are waiting for this socket using select */
   SELWAIT_T select_waiting;
+  /** generation of this entry, bumped every time it is freed */
+  u16_t gen;
+  /** position of this entry in the socket table */
+  int index;
+  /** next entry on the free list (-1: end of list) */
+  int next_free;
+#if LWIP_SOCKET_EPOLL
+  /** registrations of this socket with epoll sets, walked by event_callback() */
+  struct lwip_epoll_item *epoll_items;
+#endif /* LWIP_SOCKET_EPOLL */
 };
 
 #if LWIP_NETCONN_SEM_PER_THREAD
@@ -238,12 +271,62 @@ struct lwip_select_cb {
   fd_set *writeset;
   /** unimplemented: exceptset passed to select */
   fd_set *exceptset;
+  /** maxfdp1 passed to select, the sets hold no descriptors from there on */
+  int maxfdp1;
   /** don't signal the same semaphore twice: set to 1 when signalled */
   int sem_signalled;
   /** semaphore to wake up a task waiting for select */
   SELECT_SEM_T sem;
 };
 
+#if LWIP_SOCKET_EPOLL
+/** One socket registered with an epoll set. An item is linked into its socket's
+ * list (so events only visit the sets interested in that socket) and, while it
+ * may be ready, into its set's ready list (so waits only visit ready sockets). */
+struct lwip_epoll_item {
+  /** the set this registration belongs to */
+  struct lwip_epoll *ep;
+  /** the registered socket */
+  int s;
+  /** requested events, including LWIP_EPOLLET and LWIP_EPOLLONESHOT */
+  u32_t events;
+  /** returned with every event for this socket */
+  lwip_epoll_data_t data;
+  /** cleared when a LWIP_EPOLLONESHOT event has been reported, until re-armed */
+  u8_t armed;
+  /** set while the item is on its set's ready list */
+  u8_t queued;
+  /** next registration of the same socket */
+  struct lwip_epoll_item *sock_next;
+  /** all registrations of the same set */
+  struct lwip_epoll_item *ep_next;
+  struct lwip_epoll_item *ep_prev;
+  /** the set's ready list */
+  struct lwip_epoll_item *ready_next;
+  struct lwip_epoll_item *ready_prev;
+};
+
+/** An epoll set */
+struct lwip_epoll {
+  /** all registrations */
+  struct lwip_epoll_item *items;
+  /** registrations that may be ready, in the order they became ready */
+  struct lwip_epoll_item *ready_head;
+  struct lwip_epoll_item *ready_tail;
+  /** number of tasks blocked in lwip_epoll_wait() */
+  int waiting;
+  /** set when the set has been closed while tasks were waiting, the last one frees it */
+  u8_t closed;
+  /** semaphore to wake up a task waiting for this set */
+  sys_sem_t sem;
+  /** optional callback told when the ready list becomes empty or non-empty */
+  lwip_epoll_hook_fn hook;
+  void *hook_arg;
+  /** readiness last passed to the hook */
+  u8_t hook_ready;
+};
+#endif /* LWIP_SOCKET_EPOLL */
+
 /** A struct sockaddr replacement that has the same alignment as sockaddr_in/
  *  sockaddr_in6 if instantiated.
  */
@@ -260,7 +343,7 @@ union sockaddr_aligned {
 #if LWIP_IGMP
 /* Define the number of IPv4 multicast memberships, default is one per socket */
 #ifndef LWIP_SOCKET_MAX_MEMBERSHIPS
-#define LWIP_SOCKET_MAX_MEMBERSHIPS NUM_SOCKETS
+#define LWIP_SOCKET_MAX_MEMBERSHIPS MEMP_NUM_NETCONN
 #endif
 
 /* This is to keep track of IP_ADD_MEMBERSHIP calls to drop the membership when
@@ -281,13 +364,30 @@ static void lwip_socket_unregister_membership(int s, const ip4_addr_t *if_addr,
 static void lwip_socket_drop_registered_memberships(int s);
 #endif /* LWIP_IGMP */
 
-/** The global array of available sockets */
-static struct lwip_sock sockets[NUM_SOCKETS];
+/** The socket table: chunks of LWIP_SOCKET_CHUNK entries, allocated as the table
+    grows and never freed so that lookups don't need to lock */
+static struct lwip_sock *sockets[NUM_SOCKET_CHUNKS];
+/** Number of entries in the socket table, protected by SYS_ARCH_PROTECT */
+static int socket_count;
+/** Head of the list of free entries (-1: none), protected by SYS_ARCH_PROTECT */
+static int socket_free = -1;
 /** The global list of tasks waiting for select */
 static struct lwip_select_cb *select_cb_list;
 /** This counter is increased from lwip_select when the list is changed
     and checked in event_callback to see if it has changed. */
 static volatile int select_cb_ctr;
+#if LWIP_SOCKET_EPOLL
+/** The global array of epoll sets, protected by SYS_ARCH_PROTECT */
+static struct lwip_epoll *epoll_sets[LWIP_EPOLL_MAX];
+
+/** Events reported whether they were requested or not */
+#define LWIP_EPOLL_ALWAYS (LWIP_EPOLLERR | LWIP_EPOLLHUP)
+
+static void lwip_epoll_notify(struct lwip_sock *sock, enum netconn_evt evt);
+static struct lwip_epoll_item *lwip_epoll_detach(struct lwip_sock *sock);
+static void lwip_epoll_free_items(struct lwip_epoll_item *items);
+static int lwip_epoll_close(int epfd);
+#endif /* LWIP_SOCKET_EPOLL */
 
 #if LWIP_SOCKET_SET_ERRNO
 #ifndef set_errno
@@ -341,33 +441,31 @@ lwip_socket_thread_cleanup(void)
 }
 
 /**
- * Map a externally used socket index to the internal socket representation.
+ * Map a externally used socket index to its socket table entry, without
+ * checking whether the entry is in use or still has the descriptor's generation.
  *
  * @param s externally used socket index
- * @return struct lwip_sock for the socket or NULL if not found
+ * @return struct lwip_sock of the table entry or NULL if it doesn't exist
  */
 static struct lwip_sock *
-get_socket(int s)
+get_socket_entry(int s)
 {
-  struct lwip_sock *sock;
+  struct lwip_sock *chunk;
+  u32_t idx;
 
   s -= LWIP_SOCKET_OFFSET;
-
-  if ((s < 0) || (s >= NUM_SOCKETS)) {
-    LWIP_DEBUGF(SOCKETS_DEBUG, ("get_socket(%d): invalid\n", s + LWIP_SOCKET_OFFSET));
-    set_errno(EBADF);
+  if (s < 0) {
     return NULL;
   }
-
-  sock = &sockets[s];
-
-  if (!sock->conn) {
-    LWIP_DEBUGF(SOCKETS_DEBUG, ("get_socket(%d): not active\n", s + LWIP_SOCKET_OFFSET));
-    set_errno(EBADF);
+  idx = (u32_t)s >> LWIP_SOCKET_GENERATION_BITS;
+  if (idx >= NUM_SOCKETS) {
     return NULL;
   }
-
-  return sock;
+  chunk = sockets[idx / LWIP_SOCKET_CHUNK];
+  if (chunk == NULL) {
+    return NULL;
+  }
+  return &chunk[idx & (LWIP_SOCKET_CHUNK - 1)];
 }
 
 /**
@@ -379,14 +477,95 @@ get_socket(int s)
 static struct lwip_sock *
 tryget_socket(int s)
 {
-  s -= LWIP_SOCKET_OFFSET;
-  if ((s < 0) || (s >= NUM_SOCKETS)) {
+  struct lwip_sock *sock = get_socket_entry(s);
+  if ((sock == NULL) || !sock->conn) {
+    return NULL;
+  }
+  /* a stale descriptor of an entry that has been reused since */
+  if (sock->gen != ((u32_t)(s - LWIP_SOCKET_OFFSET) & SOCKET_GEN_MASK)) {
     return NULL;
   }
-  if (!sockets[s].conn) {
+  return sock;
+}
+
+/**
+ * Map a externally used socket index to the internal socket representation.
+ *
+ * @param s externally used socket index
+ * @return struct lwip_sock for the socket or NULL if not found
+ */
+static struct lwip_sock *
+get_socket(int s)
+{
+  struct lwip_sock *sock = tryget_socket(s);
+
+  if (!sock) {
+    LWIP_DEBUGF(SOCKETS_DEBUG, ("get_socket(%d): invalid or not active\n", s));
+    set_errno(EBADF);
     return NULL;
   }
-  return &sockets[s];
+
+  return sock;
+}
+
+/**
+ * Add up to LWIP_SOCKET_CHUNK entries to the socket table and put them on the free list.
+ *
+ * @return 0 if the table has grown (possibly by another task); -1 if it is full or out of memory
+ */
+static int
+grow_sockets(void)
+{
+  struct lwip_sock *chunk;
+  int i, n, base;
+  SYS_ARCH_DECL_PROTECT(lev);
+
+  SYS_ARCH_PROTECT(lev);
+  base = socket_count;
+  SYS_ARCH_UNPROTECT(lev);
+  if (base >= NUM_SOCKETS) {
+    return -1;
+  }
+  chunk = (struct lwip_sock *)mem_calloc(LWIP_SOCKET_CHUNK, sizeof(struct lwip_sock));
+  if (chunk == NULL) {
+    return -1;
+  }
+  n = LWIP_MIN(LWIP_SOCKET_CHUNK, NUM_SOCKETS - base);
+  for (i = 0; i < n; i++) {
+    chunk[i].index = base + i;
+    chunk[i].next_free = base + i + 1;
+  }
+
+  SYS_ARCH_PROTECT(lev);
+  if (socket_count == base) {
+    chunk[n - 1].next_free = socket_free;
+    sockets[base / LWIP_SOCKET_CHUNK] = chunk;
+    socket_count = base + n;
+    socket_free = base;
+    chunk = NULL;
+  }
+  SYS_ARCH_UNPROTECT(lev);
+  if (chunk != NULL) {
+    /* another task grew the table in the meantime */
+    mem_free(chunk);
+  }
+  return 0;
+}
+
+/**
+ * Put a socket table entry back on the free list once nobody refers to it.
+ * Must be called with SYS_ARCH protected.
+ *
+ * @param sock the entry to release, its conn must have been cleared
+ */
+static void
+release_socket(struct lwip_sock *sock)
+{
+  if (sock->select_waiting == 0) {
+    sock->next_free = socket_free;
+    socket_free = sock->index;
+  }
+  /* else lwip_select() releases it when it stops waiting on it */
 }
 
 /**
@@ -400,31 +579,43 @@ tryget_socket(int s)
 static int
 alloc_socket(struct netconn *newconn, int accepted)
 {
+  struct lwip_sock *sock;
   int i;
   SYS_ARCH_DECL_PROTECT(lev);
 
-  /* allocate a new socket identifier */
-  for (i = 0; i < NUM_SOCKETS; ++i) {
-    /* Protect socket array */
-    SYS_ARCH_PROTECT(lev);
-    if (!sockets[i].conn && (sockets[i].select_waiting == 0)) {
-      sockets[i].conn       = newconn;
-      /* The socket is not yet known to anyone, so no need to protect
-         after having marked it as used. */
-      SYS_ARCH_UNPROTECT(lev);
-      sockets[i].lastdata   = NULL;
-      sockets[i].lastoffset = 0;
-      sockets[i].rcvevent   = 0;
-      /* TCP sendbuf is empty, but the socket is not yet writable until connected
-       * (unless it has been created by accept()). */
-      sockets[i].sendevent  = (NETCONNTYPE_GROUP(newconn->type) == NETCONN_TCP ? (accepted != 0) : 1);
-      sockets[i].errevent   = 0;
-      sockets[i].err        = 0;
-      return i + LWIP_SOCKET_OFFSET;
-    }
+  /* Protect socket table */
+  SYS_ARCH_PROTECT(lev);
+  while (socket_free < 0) {
     SYS_ARCH_UNPROTECT(lev);
+    if (grow_sockets() < 0) {
+      return -1;
+    }
+    SYS_ARCH_PROTECT(lev);
   }
-  return -1;
+  /* allocate a new socket identifier */
+  i = socket_free;
+  sock = &sockets[i / LWIP_SOCKET_CHUNK][i & (LWIP_SOCKET_CHUNK - 1)];
+  socket_free = sock->next_free;
+  sock->conn       = newconn;
+  /* The socket is not yet known to anyone, so no need to protect
+     after having marked it as used. */
+  SYS_ARCH_UNPROTECT(lev);
+  sock->lastdata   = NULL;
+  sock->lastoffset = 0;
+  sock->zc_released = 0;
+  sock->zc_releasing = 0;
+  sock->closing    = 0;
+  sock->rcvevent   = 0;
+  /* TCP sendbuf is empty, but the socket is not yet writable until connected
+   * (unless it has been created by accept()). */
+  sock->sendevent  = (NETCONNTYPE_GROUP(newconn->type) == NETCONN_TCP ? (accepted != 0) : 1);
+  sock->errevent   = 0;
+  sock->hupevent   = 0;
+  sock->err        = 0;
+#if LWIP_SOCKET_EPOLL
+  sock->epoll_items = NULL;
+#endif /* LWIP_SOCKET_EPOLL */
+  return (int)(((u32_t)i << LWIP_SOCKET_GENERATION_BITS) | sock->gen) + LWIP_SOCKET_OFFSET;
 }
 
 /** Free a socket. The socket's netconn must have been
@@ -437,14 +628,31 @@ static void
 free_socket(struct lwip_sock *sock, int is_tcp)
 {
   void *lastdata;
+#if LWIP_SOCKET_EPOLL
+  struct lwip_epoll_item *epoll_items;
+#endif /* LWIP_SOCKET_EPOLL */
+  SYS_ARCH_DECL_PROTECT(lev);
 
   lastdata         = sock->lastdata;
   sock->lastdata   = NULL;
   sock->lastoffset = 0;
   sock->err        = 0;
 
-  /* Protect socket array */
-  SYS_ARCH_SET(sock->conn, NULL);
+  /* Protect socket table */
+  SYS_ARCH_PROTECT(lev);
+#if LWIP_SOCKET_EPOLL
+  /* drop the socket from all epoll sets in the same step so that
+     lwip_epoll_ctl() can't add it to another one */
+  epoll_items = lwip_epoll_detach(sock);
+#endif /* LWIP_SOCKET_EPOLL */
+  sock->conn = NULL;
+  /* descriptors still referring to this entry are stale from now on */
+  sock->gen = (u16_t)((sock->gen + 1) & SOCKET_GEN_MASK);
+  release_socket(sock);
+  SYS_ARCH_UNPROTECT(lev);
+#if LWIP_SOCKET_EPOLL
+  lwip_epoll_free_items(epoll_items);
+#endif /* LWIP_SOCKET_EPOLL */
   /* don't use 'sock' after this line, as another task might have allocated it */
 
   if (lastdata != NULL) {
@@ -506,9 +714,9 @@ lwip_accept(int s, struct sockaddr *addr, socklen_t *addrlen)
     sock_set_errno(sock, ENFILE);
     return -1;
   }
-  LWIP_ASSERT("invalid socket index", (newsock >= LWIP_SOCKET_OFFSET) && (newsock < NUM_SOCKETS + LWIP_SOCKET_OFFSET));
   LWIP_ASSERT("newconn->callback == event_callback", newconn->callback == event_callback);
-  nsock = &sockets[newsock - LWIP_SOCKET_OFFSET];
+  nsock = tryget_socket(newsock);
+  LWIP_ASSERT("invalid socket index", nsock != NULL);
 
   /* See event_callback: If data comes in right away after an accept, even
    * though the server task might not have created a new socket yet.
@@ -610,9 +818,16 @@ lwip_close(int s)
   struct lwip_sock *sock;
   int is_tcp = 0;
   err_t err;
+  SYS_ARCH_DECL_PROTECT(lev);
 
   LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_close(%d)\n", s));
 
+#if LWIP_SOCKET_EPOLL
+  if (s >= LWIP_EPOLL_OFFSET) {
+    return lwip_epoll_close(s);
+  }
+#endif /* LWIP_SOCKET_EPOLL */
+
   sock = get_socket(s);
   if (!sock) {
     return -1;
@@ -629,8 +844,19 @@ lwip_close(int s)
   lwip_socket_drop_registered_memberships(s);
 #endif /* LWIP_IGMP */
 
+  /* wait for lwip_recv_zc_release() calls still giving back receive window */
+  SYS_ARCH_PROTECT(lev);
+  sock->closing = 1;
+  while (sock->zc_releasing > 0) {
+    SYS_ARCH_UNPROTECT(lev);
+    sys_msleep(1);
+    SYS_ARCH_PROTECT(lev);
+  }
+  SYS_ARCH_UNPROTECT(lev);
+
   err = netconn_delete(sock->conn);
   if (err != ERR_OK) {
+    sock->closing = 0;
     sock_set_errno(sock, err_to_errno(err));
     return -1;
   }
@@ -737,23 +963,54 @@ lwip_listen(int s, int backlog)
   return 0;
 }
 
-int
-lwip_recvfrom(int s, void *mem, size_t len, int flags,
-              struct sockaddr *from, socklen_t *fromlen)
+/** Copy len bytes starting at offset in p into the IO vectors, skipping the
+ * first iov_off bytes of the vectors (which have been filled before). */
+static void
+lwip_pbuf_copy_to_iov(struct pbuf *p, u16_t offset, u16_t len,
+                      const struct iovec *iov, int iovcnt, size_t iov_off)
+{
+  int i;
+
+  for (i = 0; (i < iovcnt) && (len > 0); i++) {
+    u16_t chunk;
+    if (iov_off >= iov[i].iov_len) {
+      iov_off -= iov[i].iov_len;
+      continue;
+    }
+    chunk = (u16_t)LWIP_MIN((size_t)len, iov[i].iov_len - iov_off);
+    pbuf_copy_partial(p, (u8_t*)iov[i].iov_base + iov_off, chunk, offset);
+    offset += chunk;
+    len -= chunk;
+    iov_off = 0;
+  }
+}
+
+/** Common receive path of lwip_recvfrom() and lwip_recvmsg(): fills the IO
+ * vectors from the pending netbuf/pbuf (or the next one received) and reports
+ * MSG_TRUNC in *msg_flags (if given) when a datagram did not fit. */
+static int
+lwip_recv_iov(int s, const struct iovec *iov, int iovcnt, int flags,
+              struct sockaddr *from, socklen_t *fromlen, int *msg_flags)
 {
   struct lwip_sock *sock;
   void             *buf = NULL;
   struct pbuf      *p;
   u16_t            buflen, copylen;
+  size_t           len = 0;
   int              off = 0;
+  int              i;
   u8_t             done = 0;
   err_t            err;
+  size_t           recvd = 0;
 
-  LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_recvfrom(%d, %p, %"SZT_F", 0x%x, ..)\n", s, mem, len, flags));
+  LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_recvfrom(%d, %p, %d, 0x%x, ..)\n", s, (const void*)iov, iovcnt, flags));
   sock = get_socket(s);
   if (!sock) {
     return -1;
   }
+  for (i = 0; i < iovcnt; i++) {
+    len += iov[i].iov_len;
+  }
 
   do {
     LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_recvfrom: top while sock->lastdata=%p\n", sock->lastdata));
@@ -766,8 +1023,7 @@ lwip_recvfrom(int s, void *mem, size_t len, int flags,
           (sock->rcvevent <= 0)) {
         if (off > 0) {
           /* already received data, return that */
-          sock_set_errno(sock, 0);
-          return off;
+          goto out;
         }
         LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_recvfrom(%d): returning EWOULDBLOCK\n", s));
         set_errno(EWOULDBLOCK);
@@ -777,7 +1033,11 @@ lwip_recvfrom(int s, void *mem, size_t len, int flags,
       /* No data was left from the previous operation, so we try to get
          some from the network. */
       if (NETCONNTYPE_GROUP(netconn_type(sock->conn)) == NETCONN_TCP) {
-        err = netconn_recv_tcp_pbuf(sock->conn, (struct pbuf **)&buf);
+        /* the receive window is updated once for all pbufs taken, see below */
+        err = netconn_recv_tcp_pbuf_flags(sock->conn, (struct pbuf **)&buf, NETCONN_NOAUTORCVD);
+        if (err == ERR_OK) {
+          recvd += ((struct pbuf *)buf)->tot_len;
+        }
       } else {
         err = netconn_recv(sock->conn, (struct netbuf **)&buf);
       }
@@ -791,8 +1051,7 @@ lwip_recvfrom(int s, void *mem, size_t len, int flags,
             event_callback(sock->conn, NETCONN_EVT_RCVPLUS, 0);
           }
           /* already received data, return that */
-          sock_set_errno(sock, 0);
-          return off;
+          goto out;
         }
         /* We should really do some error checking here. */
         LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_recvfrom(%d): buf == NULL, error is \"%s\"!\n",
@@ -823,11 +1082,16 @@ lwip_recvfrom(int s, void *mem, size_t len, int flags,
       copylen = buflen;
     } else {
       copylen = (u16_t)len;
+      if ((msg_flags != NULL) && (copylen < buflen) &&
+          (NETCONNTYPE_GROUP(netconn_type(sock->conn)) != NETCONN_TCP)) {
+        /* the rest of the datagram is discarded below */
+        *msg_flags |= MSG_TRUNC;
+      }
     }
 
     /* copy the contents of the received buffer into
-    the supplied memory pointer mem */
-    pbuf_copy_partial(p, (u8_t*)mem + off, copylen, sock->lastoffset);
+    the supplied IO vectors */
+    lwip_pbuf_copy_to_iov(p, sock->lastoffset, copylen, iov, iovcnt, (size_t)off);
 
     off += copylen;
 
@@ -909,205 +1173,584 @@ lwip_recvfrom(int s, void *mem, size_t len, int flags,
     }
   } while (!done);
 
+out:
+  if (recvd > 0) {
+    /* a single window update (and core lock acquisition) for all pbufs taken */
+    netconn_tcp_recvd(sock->conn, recvd);
+  }
   sock_set_errno(sock, 0);
   return off;
 }
 
 int
-lwip_read(int s, void *mem, size_t len)
+lwip_recvfrom(int s, void *mem, size_t len, int flags,
+              struct sockaddr *from, socklen_t *fromlen)
 {
-  return lwip_recvfrom(s, mem, len, 0, NULL, NULL);
+  struct iovec iov;
+
+  iov.iov_base = mem;
+  iov.iov_len = len;
+  return lwip_recv_iov(s, &iov, 1, flags, from, fromlen, NULL);
 }
 
 int
-lwip_recv(int s, void *mem, size_t len, int flags)
+lwip_recvmsg(int s, struct msghdr *message, int flags)
 {
-  return lwip_recvfrom(s, mem, len, flags, NULL, NULL);
+  int ret;
+
+  if ((message == NULL) || ((message->msg_iov == NULL) && (message->msg_iovlen != 0)) ||
+      ((int)message->msg_iovlen < 0)) {
+    set_errno(EINVAL);
+    return -1;
+  }
+  message->msg_flags = 0;
+  if (message->msg_control != NULL) {
+    /* no ancillary data is supported */
+    message->msg_controllen = 0;
+  }
+  ret = lwip_recv_iov(s, message->msg_iov, (int)message->msg_iovlen, flags,
+                      (struct sockaddr *)message->msg_name,
+                      message->msg_name ? &message->msg_namelen : NULL,
+                      &message->msg_flags);
+  if ((ret >= 0) && (message->msg_name == NULL)) {
+    message->msg_namelen = 0;
+  }
+  return ret;
 }
 
 int
-lwip_send(int s, const void *data, size_t size, int flags)
+lwip_recvmmsg(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags)
 {
   struct lwip_sock *sock;
-  err_t err;
-  u8_t write_flags;
-  size_t written;
-
-  LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_send(%d, data=%p, size=%"SZT_F", flags=0x%x)\n",
-                              s, data, size, flags));
+  unsigned int i;
+  int ret;
 
   sock = get_socket(s);
   if (!sock) {
     return -1;
   }
+  if ((msgvec == NULL) && (vlen != 0)) {
+    sock_set_errno(sock, EINVAL);
+    return -1;
+  }
+  for (i = 0; i < vlen; i++) {
+    ret = lwip_recvmsg(s, &msgvec[i].msg_hdr, flags & ~MSG_WAITFORONE);
+    if (ret < 0) {
+      if (i > 0) {
+        /* report the messages received so far, the error sticks for the next call */
+        break;
+      }
+      return -1;
+    }
+    msgvec[i].msg_len = (unsigned int)ret;
+    if ((ret == 0) && (NETCONNTYPE_GROUP(netconn_type(sock->conn)) == NETCONN_TCP)) {
+      /* end of stream */
+      i++;
+      break;
+    }
+    if (flags & MSG_WAITFORONE) {
+      flags |= MSG_DONTWAIT;
+    }
+  }
+  return (int)i;
+}
 
-  if (NETCONNTYPE_GROUP(netconn_type(sock->conn)) != NETCONN_TCP) {
-#if (LWIP_UDP || LWIP_RAW)
-    return lwip_sendto(s, data, size, flags, NULL, 0);
-#else /* (LWIP_UDP || LWIP_RAW) */
-    sock_set_errno(sock, err_to_errno(ERR_ARG));
+int
+lwip_read(int s, void *mem, size_t len)
+{
+  return lwip_recvfrom(s, mem, len, 0, NULL, NULL);
+}
+
+int
+lwip_readv(int s, const struct iovec *iov, int iovcnt)
+{
+  if ((iovcnt < 0) || ((iov == NULL) && (iovcnt != 0))) {
+    set_errno(EINVAL);
     return -1;
-#endif /* (LWIP_UDP || LWIP_RAW) */
   }
+  return lwip_recv_iov(s, iov, iovcnt, 0, NULL, NULL, NULL);
+}
 
-  write_flags = NETCONN_COPY |
-    ((flags & MSG_MORE)     ? NETCONN_MORE      : 0) |
-    ((flags & MSG_DONTWAIT) ? NETCONN_DONTBLOCK : 0);
-  written = 0;
-  err = netconn_write_partly(sock->conn, data, size, write_flags, &written);
+/** Received pbufs lent out by lwip_recv_zc(), until lwip_recv_zc_release() */
+struct lwip_zc_loan {
+  /** the pbufs lent out, tot_len is not kept up to date since they are only ever freed */
+  struct pbuf *p;
+  /** socket the data was received on */
+  int s;
+  /** bytes the loan keeps out of the receive window (TCP) or receive buffer (others) */
+  size_t held;
+};
 
-  LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_send(%d) err=%d written=%"SZT_F"\n", s, err, written));
-  sock_set_errno(sock, err_to_errno(err));
-  return (err == ERR_OK ? (int)written : -1);
+/**
+ * Give receive window back to a TCP socket for released loans. Like TCP's own
+ * window updates, this is only passed on once it reaches threshold, so that
+ * releasing many small loans doesn't cost a core lock acquisition each.
+ */
+static void
+lwip_recv_zc_window(struct lwip_sock *sock, size_t len, size_t threshold)
+{
+  size_t update = 0;
+  SYS_ARCH_DECL_PROTECT(lev);
+
+  SYS_ARCH_PROTECT(lev);
+  sock->zc_released += len;
+  if ((sock->zc_released > 0) && (sock->zc_released >= threshold)) {
+    update = sock->zc_released;
+    sock->zc_released = 0;
+  }
+  SYS_ARCH_UNPROTECT(lev);
+  if (update > 0) {
+    netconn_tcp_recvd(sock->conn, update);
+  }
 }
 
+/**
+ * Receive data without copying it: iov is filled in with read-only views of
+ * the received pbufs, which stay valid until lwip_recv_zc_release() is called
+ * with the returned loan. For TCP all data that is already queued is lent out
+ * at once (as far as the IO vectors go), and the receive window is only
+ * reopened for it once it is released.
+ *
+ * @param s socket to receive from
+ * @param iov IO vectors to fill in
+ * @param iovcnt number of IO vectors available, set to the number filled in
+ * @param loan set to the handle to pass to lwip_recv_zc_release(), or to NULL
+ *        if nothing was lent out (error, or a TCP connection that was closed)
+ * @param flags 0 or MSG_DONTWAIT
+ * @return number of bytes received (0 if a TCP connection was closed), or -1 on error
+ */
 int
-lwip_sendmsg(int s, const struct msghdr *msg, int flags)
+lwip_recv_zc(int s, struct iovec *iov, int *iovcnt, void **loan, int flags)
 {
   struct lwip_sock *sock;
-  int i;
-#if LWIP_TCP
-  u8_t write_flags;
-  size_t written;
-#endif
-  int size = 0;
-  err_t err = ERR_OK;
+  struct lwip_zc_loan *zc;
+  void *buf;
+  struct pbuf *p, *q, *last = NULL;
+  u16_t skip;
+  size_t fetched = 0;
+  int n = 0, len = 0;
+  u8_t is_tcp;
+  err_t err;
 
   sock = get_socket(s);
   if (!sock) {
     return -1;
   }
+  if ((iov == NULL) || (iovcnt == NULL) || (*iovcnt <= 0) || (loan == NULL) ||
+      ((flags & ~MSG_DONTWAIT) != 0)) {
+    sock_set_errno(sock, EINVAL);
+    return -1;
+  }
+  *loan = NULL;
+  is_tcp = (NETCONNTYPE_GROUP(netconn_type(sock->conn)) == NETCONN_TCP);
+  if (is_tcp) {
+    /* announce whatever released loans still hold back before (maybe) waiting */
+    lwip_recv_zc_window(sock, 0, 1);
+  }
+  zc = (struct lwip_zc_loan *)mem_malloc(sizeof(struct lwip_zc_loan));
+  if (zc == NULL) {
+    sock_set_errno(sock, ENOMEM);
+    return -1;
+  }
 
-  LWIP_ERROR("lwip_sendmsg: invalid msghdr", msg != NULL,
-             sock_set_errno(sock, err_to_errno(ERR_ARG)); return -1;);
-
-  LWIP_UNUSED_ARG(msg->msg_control);
-  LWIP_UNUSED_ARG(msg->msg_controllen);
-  LWIP_UNUSED_ARG(msg->msg_flags);
-  LWIP_ERROR("lwip_sendmsg: invalid msghdr iov", (msg->msg_iov != NULL && msg->msg_iovlen != 0),
-             sock_set_errno(sock, err_to_errno(ERR_ARG)); return -1;);
-
-  if (NETCONNTYPE_GROUP(netconn_type(sock->conn)) == NETCONN_TCP) {
-#if LWIP_TCP
-    write_flags = NETCONN_COPY |
-    ((flags & MSG_MORE)     ? NETCONN_MORE      : 0) |
-    ((flags & MSG_DONTWAIT) ? NETCONN_DONTBLOCK : 0);
-
-    for (i = 0; i < msg->msg_iovlen; i++) {
-      u8_t apiflags = write_flags;
-      if (i + 1 < msg->msg_iovlen) {
-        apiflags |= NETCONN_MORE;
-      }
-      written = 0;
-      err = netconn_write_partly(sock->conn, msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len, write_flags, &written);
+  /* data left over from an earlier call is lent out first */
+  buf = sock->lastdata;
+  skip = sock->lastoffset;
+  if (buf == NULL) {
+    if (((flags & MSG_DONTWAIT) || netconn_is_nonblocking(sock->conn)) &&
+        (sock->rcvevent <= 0)) {
+      mem_free(zc);
+      LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_recv_zc(%d): returning EWOULDBLOCK\n", s));
+      set_errno(EWOULDBLOCK);
+      return -1;
+    }
+    if (is_tcp) {
+      err = netconn_recv_tcp_pbuf_flags(sock->conn, (struct pbuf **)&buf, NETCONN_NOAUTORCVD);
       if (err == ERR_OK) {
-        size += written;
-        /* check that the entire IO vector was accepected, if not return a partial write */
-        if (written != msg->msg_iov[i].iov_len)
-          break;
-      }
-      /* none of this IO vector was accepted, but previous was, return partial write and conceal ERR_WOULDBLOCK */
-      else if (err == ERR_WOULDBLOCK && size > 0) {
-        err = ERR_OK;
-        /* let ERR_WOULDBLOCK persist on the netconn since we are returning ERR_OK */
-        break;
-      } else {
-        size = -1;
-        break;
+        fetched = ((struct pbuf *)buf)->tot_len;
       }
+    } else {
+      err = netconn_recv(sock->conn, (struct netbuf **)&buf);
+    }
+    if (err != ERR_OK) {
+      mem_free(zc);
+      sock_set_errno(sock, err_to_errno(err));
+      return (err == ERR_CLSD) ? 0 : -1;
     }
-    sock_set_errno(sock, err_to_errno(err));
-    return size;
-#else /* LWIP_TCP */
-    sock_set_errno(sock, err_to_errno(ERR_ARG));
-    return -1;
-#endif /* LWIP_TCP */
   }
-  /* else, UDP and RAW NETCONNs */
-#if LWIP_UDP || LWIP_RAW
-  {
-    struct netbuf *chain_buf;
+  sock->lastdata = NULL;
+  sock->lastoffset = 0;
 
-    LWIP_UNUSED_ARG(flags);
-    LWIP_ERROR("lwip_sendmsg: invalid msghdr name", (((msg->msg_name == NULL) && (msg->msg_namelen == 0)) ||
-               IS_SOCK_ADDR_LEN_VALID(msg->msg_namelen)) ,
-               sock_set_errno(sock, err_to_errno(ERR_ARG)); return -1;);
+  if (is_tcp) {
+    p = (struct pbuf *)buf;
+    /* drop pbufs that earlier calls have consumed completely */
+    while (skip >= p->len) {
+      q = p->next;
+      skip -= p->len;
+      p->next = NULL;
+      pbuf_free(p);
+      p = q;
+    }
+  } else {
+    p = ((struct netbuf *)buf)->p;
+    ((struct netbuf *)buf)->p = NULL;
+    netbuf_delete((struct netbuf *)buf);
+  }
 
-    /* initialize chain buffer with destination */
-    chain_buf = netbuf_new();
-    if (!chain_buf) {
-      sock_set_errno(sock, err_to_errno(ERR_MEM));
-      return -1;
+  q = p;
+  for (;;) {
+    for (; (q != NULL) && (n < *iovcnt); q = q->next) {
+      iov[n].iov_base = (u8_t *)q->payload + skip;
+      iov[n].iov_len = (size_t)(q->len - skip);
+      len += q->len - skip;
+      skip = 0;
+      last = q;
+      n++;
     }
-    if (msg->msg_name) {
-      u16_t remote_port;
-      SOCKADDR_TO_IPADDR_PORT((const struct sockaddr *)msg->msg_name, &chain_buf->addr, remote_port);
-      netbuf_fromport(chain_buf) = remote_port;
+    if ((q != NULL) || (n == *iovcnt) || !is_tcp || (sock->rcvevent <= 0)) {
+      break;
     }
-#if LWIP_NETIF_TX_SINGLE_PBUF
+    /* more segments are queued and there are IO vectors left: lend them out, too */
+    err = netconn_recv_tcp_pbuf_flags(sock->conn, &q, NETCONN_NOAUTORCVD);
+    if (err != ERR_OK) {
+      if (err == ERR_CLSD) {
+        /* ensure select gets the FIN, too */
+        event_callback(sock->conn, NETCONN_EVT_RCVPLUS, 0);
+      }
+      q = NULL;
+      break;
+    }
+    fetched += q->tot_len;
+    last->next = q;
+  }
+  if (q != NULL) {
+    /* more pbufs than IO vectors: split the chain after the last one lent out */
+    last->next = NULL;
+    if (is_tcp) {
+      /* kept for the next call, its share of the window is given back now
+         like that of any data not lent out */
+      sock->lastdata = q;
+      if (fetched > 0) {
+        netconn_tcp_recvd(sock->conn, q->tot_len);
+        fetched -= q->tot_len;
+      }
+    } else {
+      /* the rest of the datagram is discarded */
+      pbuf_free(q);
+    }
+  }
+
+  zc->p = p;
+  zc->s = s;
+  zc->held = fetched;
+#if LWIP_SO_RCVBUF
+  if (!is_tcp) {
+    /* the datagram still counts against SO_RCVBUF while it is on loan */
+    zc->held = (size_t)len;
+    SYS_ARCH_INC(sock->conn->recv_avail, len);
+  }
+#endif /* LWIP_SO_RCVBUF */
+  *loan = zc;
+  *iovcnt = n;
+  sock_set_errno(sock, 0);
+  return len;
+}
+
+/**
+ * Return data lent out by lwip_recv_zc(). The socket may have been closed in
+ * the meantime, the loan is released all the same.
+ *
+ * @param loan handle returned by lwip_recv_zc()
+ * @return 0 on success, -1 if loan is NULL
+ */
+int
+lwip_recv_zc_release(void *loan)
+{
+  struct lwip_zc_loan *zc = (struct lwip_zc_loan *)loan;
+  struct lwip_sock *sock;
+  struct netconn *conn = NULL;
+  SYS_ARCH_DECL_PROTECT(lev);
+
+  if (zc == NULL) {
+    set_errno(EINVAL);
+    return -1;
+  }
+  if (zc->held > 0) {
+    /* the socket may be closed concurrently: only use its netconn if lwip_close()
+       hasn't started deleting it, and keep it from doing so until we are done */
+    SYS_ARCH_PROTECT(lev);
+    sock = tryget_socket(zc->s);
+    if ((sock != NULL) && !sock->closing) {
+      conn = sock->conn;
+      sock->zc_releasing++;
+    }
+    SYS_ARCH_UNPROTECT(lev);
+    if (conn != NULL) {
+      if (NETCONNTYPE_GROUP(netconn_type(conn)) == NETCONN_TCP) {
+        lwip_recv_zc_window(sock, zc->held, TCP_WND_UPDATE_THRESHOLD);
+      }
+#if LWIP_SO_RCVBUF
+      else {
+        SYS_ARCH_DEC(conn->recv_avail, (int)zc->held);
+      }
+#endif /* LWIP_SO_RCVBUF */
+      SYS_ARCH_PROTECT(lev);
+      sock->zc_releasing--;
+      SYS_ARCH_UNPROTECT(lev);
+    }
+  }
+  pbuf_free(zc->p);
+  mem_free(zc);
+  return 0;
+}
+
+int
+lwip_recv(int s, void *mem, size_t len, int flags)
+{
+  return lwip_recvfrom(s, mem, len, flags, NULL, NULL);
+}
+
+int
+lwip_send(int s, const void *data, size_t size, int flags)
+{
+  struct lwip_sock *sock;
+  err_t err;
+  u8_t write_flags;
+  size_t written;
+
+  LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_send(%d, data=%p, size=%"SZT_F", flags=0x%x)\n",
+                              s, data, size, flags));
+
+  sock = get_socket(s);
+  if (!sock) {
+    return -1;
+  }
+
+  if (NETCONNTYPE_GROUP(netconn_type(sock->conn)) != NETCONN_TCP) {
+#if (LWIP_UDP || LWIP_RAW)
+    return lwip_sendto(s, data, size, flags, NULL, 0);
+#else /* (LWIP_UDP || LWIP_RAW) */
+    sock_set_errno(sock, err_to_errno(ERR_ARG));
+    return -1;
+#endif /* (LWIP_UDP || LWIP_RAW) */
+  }
+
+  write_flags = NETCONN_COPY |
+    ((flags & MSG_MORE)     ? NETCONN_MORE      : 0) |
+    ((flags & MSG_DONTWAIT) ? NETCONN_DONTBLOCK : 0);
+  written = 0;
+  err = netconn_write_partly(sock->conn, data, size, write_flags, &written);
+
+  LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_send(%d) err=%d written=%"SZT_F"\n", s, err, written));
+  sock_set_errno(sock, err_to_errno(err));
+  return (err == ERR_OK ? (int)written : -1);
+}
+
+#if LWIP_PBUF_EXT
+/**
+ * Send data without copying it: data lies in memory lent with ext, whose
+ * release() is called once the stack doesn't reference it anymore. For TCP
+ * that is once the data has been ACKed (or dropped with the connection),
+ * datagrams are passed on by reference before this returns anyway.
+ * The caller holds a reference to ext across the call and gives it up with
+ * pbuf_ext_free() afterwards, whatever the outcome.
+ *
+ * @param s socket to send on
+ * @param data the data to send, inside the lent memory
+ * @param size number of bytes to send
+ * @param flags MSG_MORE, MSG_DONTWAIT
+ * @param ext the lent memory
+ * @return number of bytes sent, or -1 on error
+ */
+int
+lwip_send_ext(int s, const void *data, size_t size, int flags, struct pbuf_ext *ext)
+{
+  struct lwip_sock *sock;
+  struct netvector vector;
+  err_t err;
+  u8_t write_flags;
+  size_t written;
+
+  LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_send_ext(%d, data=%p, size=%"SZT_F", flags=0x%x)\n",
+                              s, data, size, flags));
+
+  sock = get_socket(s);
+  if (!sock) {
+    return -1;
+  }
+
+  if (NETCONNTYPE_GROUP(netconn_type(sock->conn)) != NETCONN_TCP) {
+    return lwip_send(s, data, size, flags);
+  }
+
+  write_flags = ((flags & MSG_MORE)     ? NETCONN_MORE      : 0) |
+                ((flags & MSG_DONTWAIT) ? NETCONN_DONTBLOCK : 0);
+  vector.ptr = data;
+  vector.len = size;
+  written = 0;
+  err = netconn_write_vectors_ext(sock->conn, &vector, 1, write_flags, ext, &written);
+
+  LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_send_ext(%d) err=%d written=%"SZT_F"\n", s, err, written));
+  sock_set_errno(sock, err_to_errno(err));
+  return (err == ERR_OK ? (int)written : -1);
+}
+#endif /* LWIP_PBUF_EXT */
+
+#if LWIP_UDP || LWIP_RAW
+/** Initialize buf with the destination and the IO vectors of msg. The data is
+ * copied into a single pbuf (with room for the headers) if copy is set or
+ * LWIP_NETIF_TX_SINGLE_PBUF==1, else the pbufs reference the IO vectors.
+ * Release buf with netbuf_free(), also on error. */
+static err_t
+lwip_msghdr_to_netbuf(struct lwip_sock *sock, const struct msghdr *msg, struct netbuf *buf,
+                      u8_t copy, int *len)
+{
+  LWIP_MSGHDR_IOVLEN_TYPE i;
+  int size = 0;
+  err_t err = ERR_OK;
+  u16_t remote_port = 0;
+
+  buf->p = buf->ptr = NULL;
+#if LWIP_CHECKSUM_ON_COPY
+  buf->flags = 0;
+#endif /* LWIP_CHECKSUM_ON_COPY */
+  if (msg->msg_name) {
+    SOCKADDR_TO_IPADDR_PORT((const struct sockaddr *)msg->msg_name, &buf->addr, remote_port);
+  } else {
+    ip_addr_set_any(NETCONNTYPE_ISIPV6(netconn_type(sock->conn)), &buf->addr);
+  }
+  netbuf_fromport(buf) = remote_port;
+
+  if (LWIP_NETIF_TX_SINGLE_PBUF || copy) {
     for (i = 0; i < msg->msg_iovlen; i++) {
       size += msg->msg_iov[i].iov_len;
     }
     /* Allocate a new netbuf and copy the data into it. */
-    if (netbuf_alloc(chain_buf, (u16_t)size) == NULL) {
-       err = ERR_MEM;
+    if ((size > 0xFFFF) || (netbuf_alloc(buf, (u16_t)size) == NULL)) {
+      err = ERR_MEM;
     } else {
       /* flatten the IO vectors */
       size_t offset = 0;
       for (i = 0; i < msg->msg_iovlen; i++) {
-        MEMCPY(&((u8_t*)chain_buf->p->payload)[offset], msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len);
+        MEMCPY(&((u8_t*)buf->p->payload)[offset], msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len);
         offset += msg->msg_iov[i].iov_len;
       }
 #if LWIP_CHECKSUM_ON_COPY
       {
         /* This can be improved by using LWIP_CHKSUM_COPY() and aggregating the checksum for each IO vector */
-        u16_t chksum = ~inet_chksum_pbuf(chain_buf->p);
-        netbuf_set_chksum(chain_buf, chksum);
+        u16_t chksum = ~inet_chksum_pbuf(buf->p);
+        netbuf_set_chksum(buf, chksum);
       }
 #endif /* LWIP_CHECKSUM_ON_COPY */
-      err = ERR_OK;
     }
-#else /* LWIP_NETIF_TX_SINGLE_PBUF */
+  } else {
     /* create a chained netbuf from the IO vectors. NOTE: we assemble a pbuf chain
        manually to avoid having to allocate, chain, and delete a netbuf for each iov */
     for (i = 0; i < msg->msg_iovlen; i++) {
       struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, 0, PBUF_REF);
       if (p == NULL) {
-        err = ERR_MEM; /* let netbuf_delete() cleanup chain_buf */
+        err = ERR_MEM; /* let netbuf_free() cleanup buf */
         break;
       }
       p->payload = msg->msg_iov[i].iov_base;
       LWIP_ASSERT("iov_len < u16_t", msg->msg_iov[i].iov_len <= 0xFFFF);
       p->len = p->tot_len = (u16_t)msg->msg_iov[i].iov_len;
       /* netbuf empty, add new pbuf */
-      if (chain_buf->p == NULL) {
-        chain_buf->p = chain_buf->ptr = p;
+      if (buf->p == NULL) {
+        buf->p = buf->ptr = p;
         /* add pbuf to existing pbuf chain */
       } else {
-        pbuf_cat(chain_buf->p, p);
+        pbuf_cat(buf->p, p);
       }
     }
     /* save size of total chain */
     if (err == ERR_OK) {
-      size = netbuf_len(chain_buf);
+      size = netbuf_len(buf);
     }
-#endif /* LWIP_NETIF_TX_SINGLE_PBUF */
+  }
 
-    if (err == ERR_OK) {
+  if (err == ERR_OK) {
 #if LWIP_IPV4 && LWIP_IPV6
-      /* Dual-stack: Unmap IPv4 mapped IPv6 addresses */
-      if (IP_IS_V6_VAL(chain_buf->addr) && ip6_addr_isipv4mappedipv6(ip_2_ip6(&chain_buf->addr))) {
-        unmap_ipv4_mapped_ipv6(ip_2_ip4(&chain_buf->addr), ip_2_ip6(&chain_buf->addr));
-        IP_SET_TYPE_VAL(chain_buf->addr, IPADDR_TYPE_V4);
-      }
+    /* Dual-stack: Unmap IPv4 mapped IPv6 addresses */
+    if (IP_IS_V6_VAL(buf->addr) && ip6_addr_isipv4mappedipv6(ip_2_ip6(&buf->addr))) {
+      unmap_ipv4_mapped_ipv6(ip_2_ip4(&buf->addr), ip_2_ip6(&buf->addr));
+      IP_SET_TYPE_VAL(buf->addr, IPADDR_TYPE_V4);
+    }
 #endif /* LWIP_IPV4 && LWIP_IPV6 */
+    *len = size;
+  }
+  return err;
+}
+#endif /* LWIP_UDP || LWIP_RAW */
+
+int
+lwip_sendmsg(int s, const struct msghdr *msg, int flags)
+{
+  struct lwip_sock *sock;
+#if LWIP_TCP
+  u8_t write_flags;
+  size_t written;
+#endif
+  int size = 0;
+  err_t err = ERR_OK;
+
+  sock = get_socket(s);
+  if (!sock) {
+    return -1;
+  }
+
+  LWIP_ERROR("lwip_sendmsg: invalid msghdr", msg != NULL,
+             sock_set_errno(sock, err_to_errno(ERR_ARG)); return -1;);
+
+  LWIP_UNUSED_ARG(msg->msg_control);
+  LWIP_UNUSED_ARG(msg->msg_controllen);
+  LWIP_UNUSED_ARG(msg->msg_flags);
+  LWIP_ERROR("lwip_sendmsg: invalid msghdr iov", (msg->msg_iov != NULL && msg->msg_iovlen != 0),
+             sock_set_errno(sock, err_to_errno(ERR_ARG)); return -1;);
+
+  if (NETCONNTYPE_GROUP(netconn_type(sock->conn)) == NETCONN_TCP) {
+#if LWIP_TCP
+    write_flags = NETCONN_COPY |
+    ((flags & MSG_MORE)     ? NETCONN_MORE      : 0) |
+    ((flags & MSG_DONTWAIT) ? NETCONN_DONTBLOCK : 0);
+
+    if (msg->msg_iovlen > 0xFFFF) {
+      sock_set_errno(sock, EMSGSIZE);
+      return -1;
+    }
+    /* struct iovec and struct netvector are laid out alike, so all IO vectors are copied
+       into segments in one call, without gathering them into a temporary buffer first */
+    LWIP_ASSERT("struct iovec != struct netvector", (sizeof(struct iovec) == sizeof(struct netvector)) &&
+      (offsetof(struct iovec, iov_len) == offsetof(struct netvector, len)));
+    written = 0;
+    err = netconn_write_vectors_partly(sock->conn, (struct netvector *)msg->msg_iov,
+                                       (u16_t)msg->msg_iovlen, write_flags, &written);
+    sock_set_errno(sock, err_to_errno(err));
+    return (err == ERR_OK ? (int)written : -1);
+#else /* LWIP_TCP */
+    sock_set_errno(sock, err_to_errno(ERR_ARG));
+    return -1;
+#endif /* LWIP_TCP */
+  }
+  /* else, UDP and RAW NETCONNs */
+#if LWIP_UDP || LWIP_RAW
+  {
+    struct netbuf chain_buf;
+
+    LWIP_UNUSED_ARG(flags);
+    LWIP_ERROR("lwip_sendmsg: invalid msghdr name", (((msg->msg_name == NULL) && (msg->msg_namelen == 0)) ||
+               IS_SOCK_ADDR_LEN_VALID(msg->msg_namelen)) ,
+               sock_set_errno(sock, err_to_errno(ERR_ARG)); return -1;);
 
+    /* initialize chain buffer with destination and data */
+    err = lwip_msghdr_to_netbuf(sock, msg, &chain_buf, 0, &size);
+    if (err == ERR_OK) {
       /* send the data */
-      err = netconn_send(sock->conn, chain_buf);
+      err = netconn_send(sock->conn, &chain_buf);
     }
 
     /* deallocated the buffer */
-    netbuf_delete(chain_buf);
+    netbuf_free(&chain_buf);
 
     sock_set_errno(sock, err_to_errno(err));
     return (err == ERR_OK ? size : -1);
@@ -1118,6 +1761,91 @@ lwip_sendmsg(int s, const struct msghdr *msg, int flags)
 #endif /* LWIP_UDP || LWIP_RAW */
 }
 
+int
+lwip_sendmmsg(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags)
+{
+  struct lwip_sock *sock;
+  unsigned int done = 0;
+  err_t err = ERR_OK;
+
+  sock = get_socket(s);
+  if (!sock) {
+    return -1;
+  }
+
+  LWIP_ERROR("lwip_sendmmsg: invalid msgvec", (msgvec != NULL) || (vlen == 0),
+             sock_set_errno(sock, err_to_errno(ERR_ARG)); return -1;);
+
+  if (NETCONNTYPE_GROUP(netconn_type(sock->conn)) == NETCONN_TCP) {
+    /* a stream has no message boundaries to keep, send one after the other */
+    for (; done < vlen; done++) {
+      int ret = lwip_sendmsg(s, &msgvec[done].msg_hdr, flags);
+      if (ret < 0) {
+        break;
+      }
+      msgvec[done].msg_len = (unsigned int)ret;
+    }
+    return ((done > 0) || (vlen == 0)) ? (int)done : -1;
+  }
+#if LWIP_UDP || LWIP_RAW
+  LWIP_UNUSED_ARG(flags);
+  while ((done < vlen) && (err == ERR_OK)) {
+    struct netbuf batch[LWIP_SENDMMSG_BATCH];
+    struct netbuf *bufs[LWIP_SENDMMSG_BATCH];
+    int sizes[LWIP_SENDMMSG_BATCH];
+    u16_t count, sent, i;
+
+    /* prepare up to LWIP_SENDMMSG_BATCH datagrams, each copied into a single pbuf that
+       leaves room for the headers, so that every datagram costs just one allocation... */
+    for (count = 0; (count < LWIP_SENDMMSG_BATCH) && (done + count < vlen); count++) {
+      const struct msghdr *msg = &msgvec[done + count].msg_hdr;
+      if ((msg->msg_iov == NULL) || (msg->msg_iovlen == 0) ||
+          !(((msg->msg_name == NULL) && (msg->msg_namelen == 0)) ||
+            IS_SOCK_ADDR_LEN_VALID(msg->msg_namelen))) {
+        err = ERR_ARG;
+        break;
+      }
+      bufs[count] = &batch[count];
+      err = lwip_msghdr_to_netbuf(sock, msg, bufs[count], 1, &sizes[count]);
+      if (err != ERR_OK) {
+        netbuf_free(bufs[count]);
+        break;
+      }
+    }
+    /* ...and hand them to the stack in one go */
+    sent = 0;
+    if (count > 0) {
+      err_t send_err = netconn_send_batch(sock->conn, bufs, count, &sent);
+      if (err == ERR_OK) {
+        err = send_err;
+      }
+    }
+    for (i = 0; i < count; i++) {
+      if (i < sent) {
+        msgvec[done + i].msg_len = (unsigned int)sizes[i];
+      }
+      netbuf_free(bufs[i]);
+    }
+    done += sent;
+    if (sent < count) {
+      break;
+    }
+  }
+
+  LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_sendmmsg(%d) sent %u of %u err=%d\n", s, done, vlen, err));
+  if ((done > 0) || (vlen == 0)) {
+    /* report the datagrams sent so far, like Linux does */
+    sock_set_errno(sock, 0);
+    return (int)done;
+  }
+  sock_set_errno(sock, err_to_errno(err));
+  return -1;
+#else /* LWIP_UDP || LWIP_RAW */
+  sock_set_errno(sock, err_to_errno(ERR_ARG));
+  return -1;
+#endif /* LWIP_UDP || LWIP_RAW */
+}
+
 int
 lwip_sendto(int s, const void *data, size_t size, int flags,
        const struct sockaddr *to, socklen_t tolen)
@@ -1276,6 +2004,10 @@ lwip_writev(int s, const struct iovec *iov, int iovcnt)
 {
   struct msghdr msg;
 
+  if ((iovcnt < 0) || ((iov == NULL) && (iovcnt != 0))) {
+    set_errno(EINVAL);
+    return -1;
+  }
   msg.msg_name = NULL;
   msg.msg_namelen = 0;
   /* Hack: we have to cast via number to cast from 'const' pointer to non-const.
@@ -1388,180 +2120,728 @@ lwip_select(int maxfdp1, fd_set *readset, fd_set *writeset, fd_set *exceptset,
                   timeout ? (s32_t)timeout->tv_sec : (s32_t)-1,
                   timeout ? (s32_t)timeout->tv_usec : (s32_t)-1));
 
-  /* Go through each socket in each list to count number of sockets which
-     currently match */
-  nready = lwip_selscan(maxfdp1, readset, writeset, exceptset, &lreadset, &lwriteset, &lexceptset);
+  /* descriptors carry generation bits and may not fit in an fd_set, don't
+     index the caller's sets past their end */
+  if ((maxfdp1 < 0) || (maxfdp1 > FD_SETSIZE)) {
+    set_errno(EINVAL);
+    return -1;
+  }
+
+  /* Go through each socket in each list to count number of sockets which
+     currently match */
+  nready = lwip_selscan(maxfdp1, readset, writeset, exceptset, &lreadset, &lwriteset, &lexceptset);
+
+  /* If we don't have any current events, then suspend if we are supposed to */
+  if (!nready) {
+    if (timeout && timeout->tv_sec == 0 && timeout->tv_usec == 0) {
+      LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_select: no timeout, returning 0\n"));
+      /* This is OK as the local fdsets are empty and nready is zero,
+         or we would have returned earlier. */
+      goto return_copy_fdsets;
+    }
+
+    /* None ready: add our semaphore to list:
+       We don't actually need any dynamic memory. Our entry on the
+       list is only valid while we are in this function, so it's ok
+       to use local variables. */
+
+    select_cb.next = NULL;
+    select_cb.prev = NULL;
+    select_cb.readset = readset;
+    select_cb.writeset = writeset;
+    select_cb.exceptset = exceptset;
+    select_cb.maxfdp1 = maxfdp1;
+    select_cb.sem_signalled = 0;
+#if LWIP_NETCONN_SEM_PER_THREAD
+    select_cb.sem = LWIP_NETCONN_THREAD_SEM_GET();
+#else /* LWIP_NETCONN_SEM_PER_THREAD */
+    if (sys_sem_new(&select_cb.sem, 0) != ERR_OK) {
+      /* failed to create semaphore */
+      set_errno(ENOMEM);
+      return -1;
+    }
+#endif /* LWIP_NETCONN_SEM_PER_THREAD */
+
+    /* Protect the select_cb_list */
+    SYS_ARCH_PROTECT(lev);
+
+    /* Put this select_cb on top of list */
+    select_cb.next = select_cb_list;
+    if (select_cb_list != NULL) {
+      select_cb_list->prev = &select_cb;
+    }
+    select_cb_list = &select_cb;
+    /* Increasing this counter tells event_callback that the list has changed. */
+    select_cb_ctr++;
+
+    /* Now we can safely unprotect */
+    SYS_ARCH_UNPROTECT(lev);
+
+    /* Increase select_waiting for each socket we are interested in */
+    maxfdp2 = maxfdp1;
+    for (i = LWIP_SOCKET_OFFSET; i < maxfdp1; i++) {
+      if ((readset && FD_ISSET(i, readset)) ||
+          (writeset && FD_ISSET(i, writeset)) ||
+          (exceptset && FD_ISSET(i, exceptset))) {
+        struct lwip_sock *sock;
+        SYS_ARCH_PROTECT(lev);
+        sock = tryget_socket(i);
+        if (sock != NULL) {
+          sock->select_waiting++;
+          LWIP_ASSERT("sock->select_waiting > 0", sock->select_waiting > 0);
+        } else {
+          /* Not a valid socket */
+          nready = -1;
+          maxfdp2 = i;
+          SYS_ARCH_UNPROTECT(lev);
+          break;
+        }
+        SYS_ARCH_UNPROTECT(lev);
+      }
+    }
+
+    if (nready >= 0) {
+      /* Call lwip_selscan again: there could have been events between
+         the last scan (without us on the list) and putting us on the list! */
+      nready = lwip_selscan(maxfdp1, readset, writeset, exceptset, &lreadset, &lwriteset, &lexceptset);
+      if (!nready) {
+        /* Still none ready, just wait to be woken */
+        if (timeout == 0) {
+          /* Wait forever */
+          msectimeout = 0;
+        } else {
+          msectimeout =  ((timeout->tv_sec * 1000) + ((timeout->tv_usec + 500)/1000));
+          if (msectimeout == 0) {
+            /* Wait 1ms at least (0 means wait forever) */
+            msectimeout = 1;
+          }
+        }
+
+        waitres = sys_arch_sem_wait(SELECT_SEM_PTR(select_cb.sem), msectimeout);
+#if LWIP_NETCONN_SEM_PER_THREAD
+        waited = 1;
+#endif
+      }
+    }
+
+    /* Decrease select_waiting for each socket we are interested in */
+    for (i = LWIP_SOCKET_OFFSET; i < maxfdp2; i++) {
+      if ((readset && FD_ISSET(i, readset)) ||
+          (writeset && FD_ISSET(i, writeset)) ||
+          (exceptset && FD_ISSET(i, exceptset))) {
+        struct lwip_sock *sock;
+        SYS_ARCH_PROTECT(lev);
+        /* The entry can't have been reused while we were counted in its
+           select_waiting, even if the socket was closed in the meantime */
+        sock = get_socket_entry(i);
+        LWIP_ASSERT("socket entry exists", sock != NULL);
+        /* for now, handle select_waiting==0... */
+        LWIP_ASSERT("sock->select_waiting > 0", sock->select_waiting > 0);
+        if (sock->select_waiting > 0) {
+          sock->select_waiting--;
+          if (!sock->conn) {
+            /* closed while we were waiting */
+            release_socket(sock);
+          }
+        }
+        if (sock->conn == NULL) {
+          /* Not a valid socket */
+          nready = -1;
+        }
+        SYS_ARCH_UNPROTECT(lev);
+      }
+    }
+    /* Take us off the list */
+    SYS_ARCH_PROTECT(lev);
+    if (select_cb.next != NULL) {
+      select_cb.next->prev = select_cb.prev;
+    }
+    if (select_cb_list == &select_cb) {
+      LWIP_ASSERT("select_cb.prev == NULL", select_cb.prev == NULL);
+      select_cb_list = select_cb.next;
+    } else {
+      LWIP_ASSERT("select_cb.prev != NULL", select_cb.prev != NULL);
+      select_cb.prev->next = select_cb.next;
+    }
+    /* Increasing this counter tells event_callback that the list has changed. */
+    select_cb_ctr++;
+    SYS_ARCH_UNPROTECT(lev);
+
+#if LWIP_NETCONN_SEM_PER_THREAD
+    if (select_cb.sem_signalled && (!waited || (waitres == SYS_ARCH_TIMEOUT))) {
+      /* don't leave the thread-local semaphore signalled */
+      sys_arch_sem_wait(select_cb.sem, 1);
+    }
+#else /* LWIP_NETCONN_SEM_PER_THREAD */
+    sys_sem_free(&select_cb.sem);
+#endif /* LWIP_NETCONN_SEM_PER_THREAD */
+
+    if (nready < 0) {
+      /* This happens when a socket got closed while waiting */
+      set_errno(EBADF);
+      return -1;
+    }
+
+    if (waitres == SYS_ARCH_TIMEOUT) {
+      /* Timeout */
+      LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_select: timeout expired\n"));
+      /* This is OK as the local fdsets are empty and nready is zero,
+         or we would have returned earlier. */
+      goto return_copy_fdsets;
+    }
+
+    /* See what's set */
+    nready = lwip_selscan(maxfdp1, readset, writeset, exceptset, &lreadset, &lwriteset, &lexceptset);
+  }
+
+  LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_select: nready=%d\n", nready));
+return_copy_fdsets:
+  set_errno(0);
+  if (readset) {
+    *readset = lreadset;
+  }
+  if (writeset) {
+    *writeset = lwriteset;
+  }
+  if (exceptset) {
+    *exceptset = lexceptset;
+  }
+  return nready;
+}
+
+#if LWIP_SOCKET_EPOLL
+/**
+ * Map an epoll descriptor to its set. Call with SYS_ARCH protected.
+ */
+static struct lwip_epoll *
+get_epoll(int epfd)
+{
+  epfd -= LWIP_EPOLL_OFFSET;
+  if ((epfd < 0) || (epfd >= LWIP_EPOLL_MAX)) {
+    return NULL;
+  }
+  return epoll_sets[epfd];
+}
+
+/**
+ * Current readiness of a socket as LWIP_EPOLL* flags. Call with SYS_ARCH protected.
+ */
+static u32_t
+lwip_epoll_sock_events(struct lwip_sock *sock)
+{
+  u32_t events = 0;
+
+  if ((sock->lastdata != NULL) || (sock->rcvevent > 0)) {
+    events |= LWIP_EPOLLIN;
+  }
+  if (sock->sendevent != 0) {
+    events |= LWIP_EPOLLOUT;
+  }
+  if (sock->errevent != 0) {
+    events |= LWIP_EPOLLERR;
+  }
+  if (sock->hupevent != 0) {
+    events |= LWIP_EPOLLHUP;
+  }
+  return events;
+}
+
+/** Append an item to its set's ready list. Call with SYS_ARCH protected. */
+static void
+lwip_epoll_append(struct lwip_epoll_item *item)
+{
+  struct lwip_epoll *ep = item->ep;
+
+  item->queued = 1;
+  item->ready_next = NULL;
+  item->ready_prev = ep->ready_tail;
+  if (ep->ready_tail != NULL) {
+    ep->ready_tail->ready_next = item;
+  } else {
+    ep->ready_head = item;
+  }
+  ep->ready_tail = item;
+}
+
+/** Take an item off its set's ready list. Call with SYS_ARCH protected. */
+static void
+lwip_epoll_unqueue(struct lwip_epoll_item *item)
+{
+  struct lwip_epoll *ep = item->ep;
+
+  if (!item->queued) {
+    return;
+  }
+  if (item->ready_prev != NULL) {
+    item->ready_prev->ready_next = item->ready_next;
+  } else {
+    ep->ready_head = item->ready_next;
+  }
+  if (item->ready_next != NULL) {
+    item->ready_next->ready_prev = item->ready_prev;
+  } else {
+    ep->ready_tail = item->ready_prev;
+  }
+  item->queued = 0;
+}
+
+/** Tell the set's hook when its ready list has become empty or non-empty.
+ * Call with SYS_ARCH protected. */
+static void
+lwip_epoll_update_hook(struct lwip_epoll *ep)
+{
+  u8_t ready = (ep->ready_head != NULL);
+
+  if ((ep->hook != NULL) && (ready != ep->hook_ready)) {
+    ep->hook_ready = ready;
+    ep->hook(ep->hook_arg, ready);
+  }
+}
+
+/** Queue an item that has become ready and wake a task waiting on its set.
+ * Call with SYS_ARCH protected. */
+static void
+lwip_epoll_queue(struct lwip_epoll_item *item)
+{
+  if (item->queued) {
+    return;
+  }
+  lwip_epoll_append(item);
+  lwip_epoll_update_hook(item->ep);
+  if (item->ep->waiting > 0) {
+    /* Don't call SYS_ARCH_UNPROTECT() before signaling the semaphore, as the
+       last waiter might free the set after a concurrent lwip_epoll_close(). */
+    sys_sem_signal(&item->ep->sem);
+  }
+}
+
+/** Queue an item if its socket already has one of the requested events.
+ * Call with SYS_ARCH protected. */
+static void
+lwip_epoll_queue_if_ready(struct lwip_epoll_item *item, struct lwip_sock *sock)
+{
+  if (item->armed && (lwip_epoll_sock_events(sock) & (item->events | LWIP_EPOLL_ALWAYS))) {
+    lwip_epoll_queue(item);
+  }
+}
+
+/** Take an item off its set's list of registrations. Call with SYS_ARCH protected. */
+static void
+lwip_epoll_unlink_set(struct lwip_epoll_item *item)
+{
+  if (item->ep_prev != NULL) {
+    item->ep_prev->ep_next = item->ep_next;
+  } else {
+    item->ep->items = item->ep_next;
+  }
+  if (item->ep_next != NULL) {
+    item->ep_next->ep_prev = item->ep_prev;
+  }
+}
+
+/** Take an item off its socket's list of registrations. Call with SYS_ARCH protected. */
+static void
+lwip_epoll_unlink_sock(struct lwip_epoll_item *item)
+{
+  struct lwip_sock *sock = tryget_socket(item->s);
+  struct lwip_epoll_item **pitem;
+
+  LWIP_ASSERT("epoll item of a closed socket", sock != NULL);
+  for (pitem = &sock->epoll_items; *pitem != NULL; pitem = &(*pitem)->sock_next) {
+    if (*pitem == item) {
+      *pitem = item->sock_next;
+      break;
+    }
+  }
+}
+
+/**
+ * Remove a socket from all epoll sets it is registered with. Call with SYS_ARCH
+ * protected, then free the returned items (linked by sock_next) with
+ * lwip_epoll_free_items() once unprotected.
+ */
+static struct lwip_epoll_item *
+lwip_epoll_detach(struct lwip_sock *sock)
+{
+  struct lwip_epoll_item *items = sock->epoll_items;
+  struct lwip_epoll_item *item;
+
+  sock->epoll_items = NULL;
+  for (item = items; item != NULL; item = item->sock_next) {
+    lwip_epoll_unqueue(item);
+    lwip_epoll_unlink_set(item);
+    lwip_epoll_update_hook(item->ep);
+  }
+  return items;
+}
+
+static void
+lwip_epoll_free_items(struct lwip_epoll_item *items)
+{
+  struct lwip_epoll_item *next;
+
+  while (items != NULL) {
+    next = items->sock_next;
+    mem_free(items);
+    items = next;
+  }
+}
+
+/**
+ * Called from event_callback() with SYS_ARCH protected when a socket that is
+ * registered with at least one epoll set changes state.
+ */
+static void
+lwip_epoll_notify(struct lwip_sock *sock, enum netconn_evt evt)
+{
+  struct lwip_epoll_item *item;
+  u32_t event;
+
+  switch (evt) {
+    case NETCONN_EVT_RCVPLUS:
+      event = LWIP_EPOLLIN;
+      break;
+    case NETCONN_EVT_SENDPLUS:
+      event = LWIP_EPOLLOUT;
+      break;
+    case NETCONN_EVT_ERROR:
+      event = LWIP_EPOLLERR;
+      break;
+    case NETCONN_EVT_HUP:
+      event = LWIP_EPOLLHUP;
+      break;
+    default:
+      /* readiness dropped: queued items are re-checked when they are harvested */
+      return;
+  }
+  /* Each new event queues the item again, which is what edge-triggered waiters
+     rely on; level-triggered items stay queued for as long as they are ready. */
+  for (item = sock->epoll_items; item != NULL; item = item->sock_next) {
+    if (item->armed && ((item->events | LWIP_EPOLL_ALWAYS) & event)) {
+      lwip_epoll_queue(item);
+    }
+  }
+}
+
+int
+lwip_epoll_create(int size)
+{
+  struct lwip_epoll *ep;
+  int i;
+  SYS_ARCH_DECL_PROTECT(lev);
+
+  if (size <= 0) {
+    set_errno(EINVAL);
+    return -1;
+  }
+  ep = (struct lwip_epoll *)mem_malloc(sizeof(struct lwip_epoll));
+  if (ep == NULL) {
+    set_errno(ENOMEM);
+    return -1;
+  }
+  memset(ep, 0, sizeof(struct lwip_epoll));
+  if (sys_sem_new(&ep->sem, 0) != ERR_OK) {
+    mem_free(ep);
+    set_errno(ENOMEM);
+    return -1;
+  }
+
+  SYS_ARCH_PROTECT(lev);
+  for (i = 0; i < LWIP_EPOLL_MAX; ++i) {
+    if (epoll_sets[i] == NULL) {
+      epoll_sets[i] = ep;
+      SYS_ARCH_UNPROTECT(lev);
+      LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_epoll_create() = %d\n", i + LWIP_EPOLL_OFFSET));
+      return i + LWIP_EPOLL_OFFSET;
+    }
+  }
+  SYS_ARCH_UNPROTECT(lev);
+
+  sys_sem_free(&ep->sem);
+  mem_free(ep);
+  set_errno(EMFILE);
+  return -1;
+}
 
-  /* If we don't have any current events, then suspend if we are supposed to */
-  if (!nready) {
-    if (timeout && timeout->tv_sec == 0 && timeout->tv_usec == 0) {
-      LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_select: no timeout, returning 0\n"));
-      /* This is OK as the local fdsets are empty and nready is zero,
-         or we would have returned earlier. */
-      goto return_copy_fdsets;
-    }
+int
+lwip_epoll_ctl(int epfd, int op, int s, struct lwip_epoll_event *event)
+{
+  struct lwip_epoll *ep;
+  struct lwip_sock *sock;
+  struct lwip_epoll_item *item, *newitem = NULL;
+  int err = 0;
+  SYS_ARCH_DECL_PROTECT(lev);
 
-    /* None ready: add our semaphore to list:
-       We don't actually need any dynamic memory. Our entry on the
-       list is only valid while we are in this function, so it's ok
-       to use local variables. */
+  LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_epoll_ctl(%d, %d, %d)\n", epfd, op, s));
 
-    select_cb.next = NULL;
-    select_cb.prev = NULL;
-    select_cb.readset = readset;
-    select_cb.writeset = writeset;
-    select_cb.exceptset = exceptset;
-    select_cb.sem_signalled = 0;
-#if LWIP_NETCONN_SEM_PER_THREAD
-    select_cb.sem = LWIP_NETCONN_THREAD_SEM_GET();
-#else /* LWIP_NETCONN_SEM_PER_THREAD */
-    if (sys_sem_new(&select_cb.sem, 0) != ERR_OK) {
-      /* failed to create semaphore */
+  if ((op != LWIP_EPOLL_CTL_DEL) && (event == NULL)) {
+    set_errno(EFAULT);
+    return -1;
+  }
+  if (op == LWIP_EPOLL_CTL_ADD) {
+    newitem = (struct lwip_epoll_item *)mem_malloc(sizeof(struct lwip_epoll_item));
+    if (newitem == NULL) {
       set_errno(ENOMEM);
       return -1;
     }
-#endif /* LWIP_NETCONN_SEM_PER_THREAD */
-
-    /* Protect the select_cb_list */
-    SYS_ARCH_PROTECT(lev);
-
-    /* Put this select_cb on top of list */
-    select_cb.next = select_cb_list;
-    if (select_cb_list != NULL) {
-      select_cb_list->prev = &select_cb;
-    }
-    select_cb_list = &select_cb;
-    /* Increasing this counter tells event_callback that the list has changed. */
-    select_cb_ctr++;
+    memset(newitem, 0, sizeof(struct lwip_epoll_item));
+  }
 
-    /* Now we can safely unprotect */
+  SYS_ARCH_PROTECT(lev);
+  ep = get_epoll(epfd);
+  sock = tryget_socket(s);
+  if ((ep == NULL) || (sock == NULL)) {
     SYS_ARCH_UNPROTECT(lev);
+    if (newitem != NULL) {
+      mem_free(newitem);
+    }
+    set_errno(EBADF);
+    return -1;
+  }
+  /* a socket is registered with few sets, so this list is expected to be short */
+  for (item = sock->epoll_items; item != NULL; item = item->sock_next) {
+    if (item->ep == ep) {
+      break;
+    }
+  }
 
-    /* Increase select_waiting for each socket we are interested in */
-    maxfdp2 = maxfdp1;
-    for (i = LWIP_SOCKET_OFFSET; i < maxfdp1; i++) {
-      if ((readset && FD_ISSET(i, readset)) ||
-          (writeset && FD_ISSET(i, writeset)) ||
-          (exceptset && FD_ISSET(i, exceptset))) {
-        struct lwip_sock *sock;
-        SYS_ARCH_PROTECT(lev);
-        sock = tryget_socket(i);
-        if (sock != NULL) {
-          sock->select_waiting++;
-          LWIP_ASSERT("sock->select_waiting > 0", sock->select_waiting > 0);
-        } else {
-          /* Not a valid socket */
-          nready = -1;
-          maxfdp2 = i;
-          SYS_ARCH_UNPROTECT(lev);
-          break;
-        }
-        SYS_ARCH_UNPROTECT(lev);
+  switch (op) {
+    case LWIP_EPOLL_CTL_ADD:
+      if (item != NULL) {
+        err = EEXIST;
+        break;
       }
-    }
+      item = newitem;
+      newitem = NULL;
+      item->ep = ep;
+      item->s = s;
+      item->sock_next = sock->epoll_items;
+      sock->epoll_items = item;
+      item->ep_next = ep->items;
+      if (ep->items != NULL) {
+        ep->items->ep_prev = item;
+      }
+      ep->items = item;
+      item->events = event->events;
+      item->data = event->data;
+      item->armed = 1;
+      lwip_epoll_queue_if_ready(item, sock);
+      break;
+    case LWIP_EPOLL_CTL_MOD:
+      if (item == NULL) {
+        err = ENOENT;
+        break;
+      }
+      item->events = event->events;
+      item->data = event->data;
+      item->armed = 1;
+      lwip_epoll_queue_if_ready(item, sock);
+      break;
+    case LWIP_EPOLL_CTL_DEL:
+      if (item == NULL) {
+        err = ENOENT;
+        break;
+      }
+      lwip_epoll_unqueue(item);
+      lwip_epoll_unlink_set(item);
+      lwip_epoll_unlink_sock(item);
+      lwip_epoll_update_hook(ep);
+      /* free it below */
+      newitem = item;
+      break;
+    default:
+      err = EINVAL;
+      break;
+  }
+  SYS_ARCH_UNPROTECT(lev);
 
-    if (nready >= 0) {
-      /* Call lwip_selscan again: there could have been events between
-         the last scan (without us on the list) and putting us on the list! */
-      nready = lwip_selscan(maxfdp1, readset, writeset, exceptset, &lreadset, &lwriteset, &lexceptset);
-      if (!nready) {
-        /* Still none ready, just wait to be woken */
-        if (timeout == 0) {
-          /* Wait forever */
-          msectimeout = 0;
-        } else {
-          msectimeout =  ((timeout->tv_sec * 1000) + ((timeout->tv_usec + 500)/1000));
-          if (msectimeout == 0) {
-            /* Wait 1ms at least (0 means wait forever) */
-            msectimeout = 1;
-          }
-        }
+  if (newitem != NULL) {
+    mem_free(newitem);
+  }
+  if (err != 0) {
+    set_errno(err);
+    return -1;
+  }
+  return 0;
+}
 
-        waitres = sys_arch_sem_wait(SELECT_SEM_PTR(select_cb.sem), msectimeout);
-#if LWIP_NETCONN_SEM_PER_THREAD
-        waited = 1;
-#endif
-      }
-    }
+int
+lwip_epoll_wait(int epfd, struct lwip_epoll_event *events, int maxevents, int timeout)
+{
+  struct lwip_epoll *ep;
+  struct lwip_epoll_item *item, *last;
+  struct lwip_sock *sock;
+  u32_t start = 0, elapsed, msectimeout = 0, ready;
+  int n = 0, free_set;
+  SYS_ARCH_DECL_PROTECT(lev);
 
-    /* Decrease select_waiting for each socket we are interested in */
-    for (i = LWIP_SOCKET_OFFSET; i < maxfdp2; i++) {
-      if ((readset && FD_ISSET(i, readset)) ||
-          (writeset && FD_ISSET(i, writeset)) ||
-          (exceptset && FD_ISSET(i, exceptset))) {
-        struct lwip_sock *sock;
-        SYS_ARCH_PROTECT(lev);
-        sock = tryget_socket(i);
-        if (sock != NULL) {
-          /* for now, handle select_waiting==0... */
-          LWIP_ASSERT("sock->select_waiting > 0", sock->select_waiting > 0);
-          if (sock->select_waiting > 0) {
-            sock->select_waiting--;
-          }
-        } else {
-          /* Not a valid socket */
-          nready = -1;
+  if ((events == NULL) || (maxevents <= 0)) {
+    set_errno(EINVAL);
+    return -1;
+  }
+  if (timeout > 0) {
+    start = sys_now();
+  }
+
+  SYS_ARCH_PROTECT(lev);
+  ep = get_epoll(epfd);
+  if (ep == NULL) {
+    SYS_ARCH_UNPROTECT(lev);
+    set_errno(EBADF);
+    return -1;
+  }
+
+  for (;;) {
+    /* Visit each item that was queued before this pass at most once. Level-triggered
+       items that are still ready go back to the tail, to be reported again next time. */
+    last = ep->ready_tail;
+    while ((n < maxevents) && ((item = ep->ready_head) != NULL)) {
+      lwip_epoll_unqueue(item);
+      sock = tryget_socket(item->s);
+      ready = 0;
+      if ((sock != NULL) && item->armed) {
+        ready = lwip_epoll_sock_events(sock) & (item->events | LWIP_EPOLL_ALWAYS);
+      }
+      if (ready) {
+        events[n].events = ready;
+        events[n].data = item->data;
+        n++;
+        if (item->events & LWIP_EPOLLONESHOT) {
+          item->armed = 0;
+        } else if (!(item->events & LWIP_EPOLLET)) {
+          lwip_epoll_append(item);
         }
-        SYS_ARCH_UNPROTECT(lev);
+      }
+      if (item == last) {
+        break;
       }
     }
-    /* Take us off the list */
-    SYS_ARCH_PROTECT(lev);
-    if (select_cb.next != NULL) {
-      select_cb.next->prev = select_cb.prev;
+    if ((n > 0) || (timeout == 0)) {
+      break;
     }
-    if (select_cb_list == &select_cb) {
-      LWIP_ASSERT("select_cb.prev == NULL", select_cb.prev == NULL);
-      select_cb_list = select_cb.next;
-    } else {
-      LWIP_ASSERT("select_cb.prev != NULL", select_cb.prev != NULL);
-      select_cb.prev->next = select_cb.next;
+    if (timeout > 0) {
+      elapsed = sys_now() - start;
+      if (elapsed >= (u32_t)timeout) {
+        break;
+      }
+      msectimeout = (u32_t)timeout - elapsed;
     }
-    /* Increasing this counter tells event_callback that the list has changed. */
-    select_cb_ctr++;
-    SYS_ARCH_UNPROTECT(lev);
 
-#if LWIP_NETCONN_SEM_PER_THREAD
-    if (select_cb.sem_signalled && (!waited || (waitres == SYS_ARCH_TIMEOUT))) {
-      /* don't leave the thread-local semaphore signalled */
-      sys_arch_sem_wait(select_cb.sem, 1);
-    }
-#else /* LWIP_NETCONN_SEM_PER_THREAD */
-    sys_sem_free(&select_cb.sem);
-#endif /* LWIP_NETCONN_SEM_PER_THREAD */
+    ep->waiting++;
+    SYS_ARCH_UNPROTECT(lev);
+    sys_arch_sem_wait(&ep->sem, msectimeout);
+    SYS_ARCH_PROTECT(lev);
+    ep->waiting--;
 
-    if (nready < 0) {
-      /* This happens when a socket got closed while waiting */
+    if (ep->closed) {
+      /* closed while we were waiting, pass the wakeup on to the other waiters */
+      free_set = (ep->waiting == 0);
+      if (!free_set) {
+        sys_sem_signal(&ep->sem);
+      }
+      SYS_ARCH_UNPROTECT(lev);
+      if (free_set) {
+        sys_sem_free(&ep->sem);
+        mem_free(ep);
+      }
       set_errno(EBADF);
       return -1;
     }
+  }
 
-    if (waitres == SYS_ARCH_TIMEOUT) {
-      /* Timeout */
-      LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_select: timeout expired\n"));
-      /* This is OK as the local fdsets are empty and nready is zero,
-         or we would have returned earlier. */
-      goto return_copy_fdsets;
-    }
+  if ((ep->ready_head != NULL) && (ep->waiting > 0)) {
+    /* more is ready than this call could take, let another waiter have it */
+    sys_sem_signal(&ep->sem);
+  }
+  lwip_epoll_update_hook(ep);
+  SYS_ARCH_UNPROTECT(lev);
+  return n;
+}
 
-    /* See what's set */
-    nready = lwip_selscan(maxfdp1, readset, writeset, exceptset, &lreadset, &lwriteset, &lexceptset);
+/**
+ * Install a callback that is told whenever the set's ready list becomes non-empty
+ * or empty, e.g. to mirror the set's readiness onto a descriptor of the host OS.
+ * It is called right away if sockets are already ready. Only one hook can be
+ * installed per set.
+ */
+int
+lwip_epoll_set_hook(int epfd, lwip_epoll_hook_fn hook, void *arg)
+{
+  struct lwip_epoll *ep;
+  SYS_ARCH_DECL_PROTECT(lev);
+
+  SYS_ARCH_PROTECT(lev);
+  ep = get_epoll(epfd);
+  if (ep == NULL) {
+    SYS_ARCH_UNPROTECT(lev);
+    set_errno(EBADF);
+    return -1;
+  }
+  if (ep->hook != NULL) {
+    SYS_ARCH_UNPROTECT(lev);
+    set_errno(EBUSY);
+    return -1;
   }
+  ep->hook = hook;
+  ep->hook_arg = arg;
+  ep->hook_ready = 0;
+  lwip_epoll_update_hook(ep);
+  SYS_ARCH_UNPROTECT(lev);
+  return 0;
+}
 
-  LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_select: nready=%d\n", nready));
-return_copy_fdsets:
-  set_errno(0);
-  if (readset) {
-    *readset = lreadset;
+/**
+ * Close an epoll set, called from lwip_close() for epoll descriptors
+ */
+static int
+lwip_epoll_close(int epfd)
+{
+  struct lwip_epoll *ep;
+  struct lwip_epoll_item *items, *item, *next;
+  lwip_epoll_hook_fn hook;
+  void *hook_arg;
+  int free_set;
+  SYS_ARCH_DECL_PROTECT(lev);
+
+  SYS_ARCH_PROTECT(lev);
+  ep = get_epoll(epfd);
+  if (ep == NULL) {
+    SYS_ARCH_UNPROTECT(lev);
+    set_errno(EBADF);
+    return -1;
   }
-  if (writeset) {
-    *writeset = lwriteset;
+  epoll_sets[epfd - LWIP_EPOLL_OFFSET] = NULL;
+  items = ep->items;
+  for (item = items; item != NULL; item = item->ep_next) {
+    lwip_epoll_unlink_sock(item);
   }
-  if (exceptset) {
-    *exceptset = lexceptset;
+  ep->items = NULL;
+  ep->ready_head = NULL;
+  ep->ready_tail = NULL;
+  ep->closed = 1;
+  hook = ep->hook;
+  hook_arg = ep->hook_arg;
+  free_set = (ep->waiting == 0);
+  if (!free_set) {
+    sys_sem_signal(&ep->sem);
   }
-  return nready;
+  SYS_ARCH_UNPROTECT(lev);
+
+  for (item = items; item != NULL; item = next) {
+    next = item->ep_next;
+    mem_free(item);
+  }
+  if (free_set) {
+    sys_sem_free(&ep->sem);
+    mem_free(ep);
+  }
+  if (hook != NULL) {
+    hook(hook_arg, -1);
+  }
+  set_errno(0);
+  return 0;
 }
+#endif /* LWIP_SOCKET_EPOLL */
 
 /**
  * Callback registered in the netconn layer for each socket-netconn.
@@ -1625,11 +2905,20 @@ event_callback(struct netconn *conn, enum netconn_evt evt, u16_t len)
     case NETCONN_EVT_ERROR:
       sock->errevent = 1;
       break;
+    case NETCONN_EVT_HUP:
+      sock->hupevent = 1;
+      break;
     default:
       LWIP_ASSERT("unknown event", 0);
       break;
   }
 
+#if LWIP_SOCKET_EPOLL
+  if (sock->epoll_items != NULL) {
+    lwip_epoll_notify(sock, evt);
+  }
+#endif /* LWIP_SOCKET_EPOLL */
+
   if (sock->select_waiting == 0) {
     /* noone is waiting for this socket, no need to check select_cb_list */
     SYS_ARCH_UNPROTECT(lev);
@@ -1646,8 +2935,8 @@ again:
   for (scb = select_cb_list; scb != NULL; scb = scb->next) {
     /* remember the state of select_cb_list to detect changes */
     last_select_cb_ctr = select_cb_ctr;
-    if (scb->sem_signalled == 0) {
-      /* semaphore not signalled yet */
+    if ((scb->sem_signalled == 0) && (s < scb->maxfdp1)) {
+      /* semaphore not signalled yet and our socket fits in its sets */
       int do_signal = 0;
       /* Test this select call for our socket */
       if (sock->rcvevent > 0) {
@@ -2313,6 +3602,13 @@ lwip_setsockopt_impl(int s, int level, int optname, const void *optval, socklen_
       } else {
         ip_reset_option(sock->conn->pcb.ip, optname);
       }
+#if LWIP_TCP
+      if ((optname == SO_KEEPALIVE) &&
+          (NETCONNTYPE_GROUP(netconn_type(sock->conn)) == NETCONN_TCP)) {
+        /* the keepalive timer may be due earlier now */
+        tcp_timer_kick(sock->conn->pcb.tcp);
+      }
+#endif /* LWIP_TCP */
       LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_setsockopt(%d, SOL_SOCKET, optname=0x%x, ..) -> %s\n",
                   s, optname, (*(const int*)optval?"on":"off")));
       break;
@@ -2505,6 +3801,8 @@ lwip_setsockopt_impl(int s, int level, int optname, const void *optval, socklen_
       err = ENOPROTOOPT;
       break;
     }  /* switch (optname) */
+    /* the keepalive timer may be due earlier now */
+    tcp_timer_kick(sock->conn->pcb.tcp);
     break;
 #endif /* LWIP_TCP*/
 
@@ -2741,6 +4039,26 @@ lwip_fcntl(int s, int cmd, int val)
   return ret;
 }
 
+/**
+ * Returns the error SO_ERROR would report for a socket without clearing it,
+ * or EBADF if the socket does not exist.
+ */
+int
+lwip_socket_peek_error(int s)
+{
+  struct lwip_sock *sock = tryget_socket(s);
+  int err;
+
+  if (!sock) {
+    return EBADF;
+  }
+  err = sock->err;
+  if (((err == 0) || (err == EINPROGRESS)) && (sock->conn != NULL)) {
+    err = err_to_errno(netconn_err(sock->conn));
+  }
+  return (err == 0xFF ? -1 : err);
+}
+
 #if LWIP_IGMP
 /** Register a new IGMP membership. On socket close, the membership is dropped automatically.
  *
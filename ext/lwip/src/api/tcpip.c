@@ -63,6 +63,8 @@ static sys_mbox_t mbox;
 #if LWIP_TCPIP_CORE_LOCKING
 /** The global semaphore to lock the stack. */
 sys_mutex_t lock_tcpip_core;
+/** Driver hook run right before the core lock is released */
+void (*tcpip_core_unlock_hook)(void);
 #endif /* LWIP_TCPIP_CORE_LOCKING */
 
 #if LWIP_TIMERS
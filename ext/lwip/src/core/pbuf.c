@@ -473,6 +473,75 @@ pbuf_alloced_custom(pbuf_layer l, u16_t length, pbuf_type type, struct pbuf_cust
 }
 #endif /* LWIP_SUPPORT_CUSTOM_PBUF */
 
+#if LWIP_PBUF_EXT
+/** A PBUF_REF pbuf pointing into memory lent with a struct pbuf_ext */
+struct pbuf_ext_ref {
+  struct pbuf_custom pc;
+  struct pbuf_ext *ext;
+};
+
+static void
+pbuf_ext_ref_free(struct pbuf *p)
+{
+  struct pbuf_ext_ref *r = (struct pbuf_ext_ref *)p;
+  pbuf_ext_free(r->ext);
+  mem_free(r);
+}
+
+/**
+ * @ingroup pbuf
+ * Allocate a PBUF_RAW pbuf of type PBUF_REF that points into memory lent by
+ * the application. The pbuf holds a reference to ext until it is freed, so
+ * ext->release() is only called once no pbuf refers to the memory anymore.
+ *
+ * @param payload the lent data
+ * @param length size of the lent data
+ * @param ext the memory's struct pbuf_ext, its ref must be held by the caller
+ * @return the allocated pbuf, or NULL if out of memory
+ */
+struct pbuf *
+pbuf_alloc_ext(const void *payload, u16_t length, struct pbuf_ext *ext)
+{
+  struct pbuf_ext_ref *r;
+  SYS_ARCH_DECL_PROTECT(old_level);
+
+  LWIP_ASSERT("pbuf_alloc_ext: ext not held", ext->ref > 0);
+  r = (struct pbuf_ext_ref *)mem_malloc(sizeof(struct pbuf_ext_ref));
+  if (r == NULL) {
+    return NULL;
+  }
+  r->pc.custom_free_function = pbuf_ext_ref_free;
+  r->ext = ext;
+  SYS_ARCH_PROTECT(old_level);
+  ext->ref++;
+  SYS_ARCH_UNPROTECT(old_level);
+  return pbuf_alloced_custom(PBUF_RAW, length, PBUF_REF, &r->pc,
+                             LWIP_CONST_CAST(void *, payload), length);
+}
+
+/**
+ * @ingroup pbuf
+ * Give up a reference to lent memory, calling ext->release() if it was the
+ * last one. The lender calls this once it has handed the memory to the stack.
+ *
+ * @param ext the memory's struct pbuf_ext
+ */
+void
+pbuf_ext_free(struct pbuf_ext *ext)
+{
+  u32_t ref;
+  SYS_ARCH_DECL_PROTECT(old_level);
+
+  SYS_ARCH_PROTECT(old_level);
+  LWIP_ASSERT("pbuf_ext_free: ref > 0", ext->ref > 0);
+  ref = --ext->ref;
+  SYS_ARCH_UNPROTECT(old_level);
+  if (ref == 0) {
+    ext->release(ext);
+  }
+}
+#endif /* LWIP_PBUF_EXT */
+
 /**
  * @ingroup pbuf
  * Shrink a pbuf chain to a desired length.
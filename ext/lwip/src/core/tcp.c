@@ -131,12 +131,167 @@ struct tcp_pcb ** const tcp_pcb_lists[] = {&tcp_listen_pcbs.pcbs, &tcp_bound_pcb
 
 u8_t tcp_active_pcbs_changed;
 
+#if LWIP_TCP_PCB_HASH
+#if ((TCP_PCB_HASH_SIZE & (TCP_PCB_HASH_SIZE - 1)) != 0) || ((TCP_LISTEN_HASH_SIZE & (TCP_LISTEN_HASH_SIZE - 1)) != 0)
+#error "TCP_PCB_HASH_SIZE and TCP_LISTEN_HASH_SIZE must be powers of two"
+#endif
+/** PCBs of tcp_active_pcbs and tcp_tw_pcbs, chained through hash_next by 4-tuple */
+static struct tcp_pcb *tcp_pcb_hash[TCP_PCB_HASH_SIZE];
+/** PCBs of tcp_listen_pcbs, chained through hash_next by local port */
+static struct tcp_pcb_listen *tcp_listen_hash[TCP_LISTEN_HASH_SIZE];
+
+/** Bucket of a connection. The local address is left out: there are few of
+ * them and the full 4-tuple is compared when walking the bucket anyway. */
+static u32_t
+tcp_pcb_hash_bucket(u16_t local_port, const ip_addr_t *remote_ip, u16_t remote_port)
+{
+  u32_t h;
+#if LWIP_IPV6
+  if (IP_IS_V6(remote_ip)) {
+    const ip6_addr_t *ip6 = ip_2_ip6(remote_ip);
+    h = ip6->addr[0] ^ ip6->addr[1] ^ ip6->addr[2] ^ ip6->addr[3];
+  } else
+#endif /* LWIP_IPV6 */
+  {
+#if LWIP_IPV4
+    h = ip4_addr_get_u32(ip_2_ip4(remote_ip));
+#else /* LWIP_IPV4 */
+    h = 0;
+#endif /* LWIP_IPV4 */
+  }
+  h ^= ((u32_t)local_port << 16) | remote_port;
+  h *= 0x9E3779B1UL;
+  return (h ^ (h >> 16)) & (TCP_PCB_HASH_SIZE - 1);
+}
+
+/**
+ * Called by TCP_REG: adds a PCB that has just been put on tcp_active_pcbs,
+ * tcp_tw_pcbs or tcp_listen_pcbs to the matching hash table.
+ */
+void
+tcp_pcb_hash_add(struct tcp_pcb **pcbs, struct tcp_pcb *pcb)
+{
+  if ((pcbs == &tcp_active_pcbs) || (pcbs == &tcp_tw_pcbs)) {
+    u32_t b = tcp_pcb_hash_bucket(pcb->local_port, &pcb->remote_ip, pcb->remote_port);
+    pcb->hash_next = tcp_pcb_hash[b];
+    tcp_pcb_hash[b] = pcb;
+  } else if (pcbs == &tcp_listen_pcbs.pcbs) {
+    struct tcp_pcb_listen *lpcb = (struct tcp_pcb_listen *)pcb;
+    u32_t b = lpcb->local_port & (TCP_LISTEN_HASH_SIZE - 1);
+    lpcb->hash_next = tcp_listen_hash[b];
+    tcp_listen_hash[b] = lpcb;
+  }
+}
+
+/**
+ * Called by TCP_RMV: removes a PCB that has just been taken off
+ * tcp_active_pcbs, tcp_tw_pcbs or tcp_listen_pcbs from the matching hash table.
+ */
+void
+tcp_pcb_hash_remove(struct tcp_pcb **pcbs, struct tcp_pcb *pcb)
+{
+  if ((pcbs == &tcp_active_pcbs) || (pcbs == &tcp_tw_pcbs)) {
+    struct tcp_pcb **pp = &tcp_pcb_hash[tcp_pcb_hash_bucket(pcb->local_port, &pcb->remote_ip, pcb->remote_port)];
+    for (; *pp != NULL; pp = &(*pp)->hash_next) {
+      if (*pp == pcb) {
+        *pp = pcb->hash_next;
+        break;
+      }
+    }
+    pcb->hash_next = NULL;
+  } else if (pcbs == &tcp_listen_pcbs.pcbs) {
+    struct tcp_pcb_listen *lpcb = (struct tcp_pcb_listen *)pcb;
+    struct tcp_pcb_listen **pp = &tcp_listen_hash[lpcb->local_port & (TCP_LISTEN_HASH_SIZE - 1)];
+    for (; *pp != NULL; pp = &(*pp)->hash_next) {
+      if (*pp == lpcb) {
+        *pp = lpcb->hash_next;
+        break;
+      }
+    }
+    lpcb->hash_next = NULL;
+  }
+}
+
+/**
+ * Find the active or TIME-WAIT PCB of a connection.
+ *
+ * @return the PCB or NULL if there is no such connection
+ */
+struct tcp_pcb *
+tcp_pcb_hash_lookup(const ip_addr_t *local_ip, u16_t local_port,
+                    const ip_addr_t *remote_ip, u16_t remote_port)
+{
+  struct tcp_pcb *pcb = tcp_pcb_hash[tcp_pcb_hash_bucket(local_port, remote_ip, remote_port)];
+  for (; pcb != NULL; pcb = pcb->hash_next) {
+    LWIP_ASSERT("tcp_pcb_hash_lookup: pcb->state != CLOSED", pcb->state != CLOSED);
+    LWIP_ASSERT("tcp_pcb_hash_lookup: pcb->state != LISTEN", pcb->state != LISTEN);
+    if (pcb->remote_port == remote_port &&
+        pcb->local_port == local_port &&
+        ip_addr_cmp(&pcb->remote_ip, remote_ip) &&
+        ip_addr_cmp(&pcb->local_ip, local_ip)) {
+      return pcb;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Find the listening PCB for a connection request, preferring one bound to
+ * local_ip over one bound to any address (same rules as the list walk in
+ * tcp_input()).
+ *
+ * @return the PCB or NULL if nobody listens on local_port
+ */
+struct tcp_pcb_listen *
+tcp_listen_hash_lookup(const ip_addr_t *local_ip, u16_t local_port)
+{
+  struct tcp_pcb_listen *lpcb = tcp_listen_hash[local_port & (TCP_LISTEN_HASH_SIZE - 1)];
+#if SO_REUSE
+  struct tcp_pcb_listen *lpcb_any = NULL;
+#endif /* SO_REUSE */
+  for (; lpcb != NULL; lpcb = lpcb->hash_next) {
+    if (lpcb->local_port == local_port) {
+      if (IP_IS_ANY_TYPE_VAL(lpcb->local_ip)) {
+        /* found an ANY TYPE (IPv4/IPv6) match */
+#if SO_REUSE
+        lpcb_any = lpcb;
+#else /* SO_REUSE */
+        return lpcb;
+#endif /* SO_REUSE */
+      } else if (IP_ADDR_PCB_VERSION_MATCH_EXACT(lpcb, local_ip)) {
+        if (ip_addr_cmp(&lpcb->local_ip, local_ip)) {
+          /* found an exact match */
+          return lpcb;
+        } else if (ip_addr_isany(&lpcb->local_ip)) {
+          /* found an ANY-match */
+#if SO_REUSE
+          lpcb_any = lpcb;
+#else /* SO_REUSE */
+          return lpcb;
+#endif /* SO_REUSE */
+        }
+      }
+    }
+  }
+#if SO_REUSE
+  /* only pass to ANY if no specific local IP has been found */
+  return lpcb_any;
+#else /* SO_REUSE */
+  return NULL;
+#endif /* SO_REUSE */
+}
+#endif /* LWIP_TCP_PCB_HASH */
+
 /** Timer counter to handle calling slow-timer from tcp_tmr() */
 static u8_t tcp_timer;
 static u8_t tcp_timer_ctr;
 static u16_t tcp_new_port(void);
 
 static err_t tcp_close_shutdown_fin(struct tcp_pcb *pcb);
+static void tcp_slowtmr_tw(void);
+#if LWIP_TCP_TIMER_WHEEL
+static void tcp_timer_wheel_tick(void);
+#endif /* LWIP_TCP_TIMER_WHEEL */
 
 /**
  * Initialize this module.
@@ -155,6 +310,9 @@ tcp_init(void)
 void
 tcp_tmr(void)
 {
+#if LWIP_TCP_TIMER_WHEEL
+  tcp_timer_wheel_tick();
+#else /* LWIP_TCP_TIMER_WHEEL */
   /* Call tcp_fasttmr() every 250 ms */
   tcp_fasttmr();
 
@@ -163,6 +321,7 @@ tcp_tmr(void)
        tcp_tmr() is called. */
     tcp_slowtmr();
   }
+#endif /* LWIP_TCP_TIMER_WHEEL */
 }
 
 #if LWIP_CALLBACK_API || TCP_LISTEN_BACKLOG
@@ -370,6 +529,7 @@ tcp_close_shutdown_fin(struct tcp_pcb *pcb)
   } else if (err == ERR_MEM) {
     /* Mark this pcb for closing. Closing is retried from tcp_tmr. */
     pcb->flags |= TF_CLOSEPEND;
+    tcp_timer_kick(pcb);
     /* We have to return ERR_OK from here to indicate to the callers that this
        pcb should not be used any more as it will be freed soon via tcp_tmr.
        This is OK here since sending FIN does not guarantee a time frime for
@@ -975,6 +1135,199 @@ tcp_connect(struct tcp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port,
   return ret;
 }
 
+/**
+ * Per-PCB part of tcp_slowtmr(): runs the retransmission and persist timers
+ * of an active PCB and checks its keepalive and state timeouts.
+ *
+ * @param pcb the active PCB
+ * @param pcb_reset set to 1 if a RST should be sent when removing the PCB
+ * @return 1 if the PCB should be removed, 0 otherwise
+ */
+static u8_t
+tcp_slowtmr_pcb(struct tcp_pcb *pcb, u8_t *pcb_reset)
+{
+  tcpwnd_size_t eff_wnd;
+  u8_t pcb_remove = 0;
+  err_t err;
+
+  if (pcb->state == SYN_SENT && pcb->nrtx >= TCP_SYNMAXRTX) {
+    ++pcb_remove;
+    LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: max SYN retries reached\n"));
+  }
+  else if (pcb->nrtx >= TCP_MAXRTX) {
+    ++pcb_remove;
+    LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: max DATA retries reached\n"));
+  } else {
+    if (pcb->persist_backoff > 0) {
+      /* If snd_wnd is zero, use persist timer to send 1 byte probes
+       * instead of using the standard retransmission mechanism. */
+      u8_t backoff_cnt = tcp_persist_backoff[pcb->persist_backoff-1];
+      if (pcb->persist_cnt < backoff_cnt) {
+        pcb->persist_cnt++;
+      }
+      if (pcb->persist_cnt >= backoff_cnt) {
+        if (tcp_zero_window_probe(pcb) == ERR_OK) {
+          pcb->persist_cnt = 0;
+          if (pcb->persist_backoff < sizeof(tcp_persist_backoff)) {
+            pcb->persist_backoff++;
+          }
+        }
+      }
+    } else {
+      /* Increase the retransmission timer if it is running */
+      if (pcb->rtime >= 0) {
+        ++pcb->rtime;
+      }
+
+      if (pcb->unacked != NULL && pcb->rtime >= pcb->rto) {
+        /* Time for a retransmission. */
+        LWIP_DEBUGF(TCP_RTO_DEBUG, ("tcp_slowtmr: rtime %"S16_F
+                                    " pcb->rto %"S16_F"\n",
+                                    pcb->rtime, pcb->rto));
+
+        /* Double retransmission time-out unless we are trying to
+         * connect to somebody (i.e., we are in SYN_SENT). */
+        if (pcb->state != SYN_SENT) {
+          u8_t backoff_idx = LWIP_MIN(pcb->nrtx, sizeof(tcp_backoff)-1);
+          pcb->rto = ((pcb->sa >> 3) + pcb->sv) << tcp_backoff[backoff_idx];
+        }
+
+        /* Reset the retransmission timer. */
+        pcb->rtime = 0;
+
+        /* Reduce congestion window and ssthresh. */
+        eff_wnd = LWIP_MIN(pcb->cwnd, pcb->snd_wnd);
+        pcb->ssthresh = eff_wnd >> 1;
+        if (pcb->ssthresh < (tcpwnd_size_t)(pcb->mss << 1)) {
+          pcb->ssthresh = (pcb->mss << 1);
+        }
+        pcb->cwnd = pcb->mss;
+        LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_slowtmr: cwnd %"TCPWNDSIZE_F
+                                     " ssthresh %"TCPWNDSIZE_F"\n",
+                                     pcb->cwnd, pcb->ssthresh));
+
+        /* The following needs to be called AFTER cwnd is set to one
+           mss - STJ */
+        tcp_rexmit_rto(pcb);
+      }
+    }
+  }
+  /* Check if this PCB has stayed too long in FIN-WAIT-2 */
+  if (pcb->state == FIN_WAIT_2) {
+    /* If this PCB is in FIN_WAIT_2 because of SHUT_WR don't let it time out. */
+    if (pcb->flags & TF_RXCLOSED) {
+      /* PCB was fully closed (either through close() or SHUT_RDWR):
+         normal FIN-WAIT timeout handling. */
+      if ((u32_t)(tcp_ticks - pcb->tmr) >
+          TCP_FIN_WAIT_TIMEOUT / TCP_SLOW_INTERVAL) {
+        ++pcb_remove;
+        LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: removing pcb stuck in FIN-WAIT-2\n"));
+      }
+    }
+  }
+
+  /* Check if KEEPALIVE should be sent */
+  if (ip_get_option(pcb, SOF_KEEPALIVE) &&
+     ((pcb->state == ESTABLISHED) ||
+      (pcb->state == CLOSE_WAIT))) {
+    if ((u32_t)(tcp_ticks - pcb->tmr) >
+       (pcb->keep_idle + TCP_KEEP_DUR(pcb)) / TCP_SLOW_INTERVAL)
+    {
+      LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: KEEPALIVE timeout. Aborting connection to "));
+      ip_addr_debug_print(TCP_DEBUG, &pcb->remote_ip);
+      LWIP_DEBUGF(TCP_DEBUG, ("\n"));
+
+      ++pcb_remove;
+      *pcb_reset = 1;
+    } else if ((u32_t)(tcp_ticks - pcb->tmr) >
+              (pcb->keep_idle + pcb->keep_cnt_sent * TCP_KEEP_INTVL(pcb))
+              / TCP_SLOW_INTERVAL)
+    {
+      err = tcp_keepalive(pcb);
+      if (err == ERR_OK) {
+        pcb->keep_cnt_sent++;
+      }
+    }
+  }
+
+  /* If this PCB has queued out of sequence data, but has been
+     inactive for too long, will drop the data (it will eventually
+     be retransmitted). */
+#if TCP_QUEUE_OOSEQ
+  if (pcb->ooseq != NULL &&
+      (u32_t)tcp_ticks - pcb->tmr >= pcb->rto * TCP_OOSEQ_TIMEOUT) {
+    tcp_segs_free(pcb->ooseq);
+    pcb->ooseq = NULL;
+    LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_slowtmr: dropping OOSEQ queued data\n"));
+  }
+#endif /* TCP_QUEUE_OOSEQ */
+
+  /* Check if this PCB has stayed too long in SYN-RCVD */
+  if (pcb->state == SYN_RCVD) {
+    if ((u32_t)(tcp_ticks - pcb->tmr) >
+        TCP_SYN_RCVD_TIMEOUT / TCP_SLOW_INTERVAL) {
+      ++pcb_remove;
+      LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: removing pcb stuck in SYN-RCVD\n"));
+    }
+  }
+
+  /* Check if this PCB has stayed too long in LAST-ACK */
+  if (pcb->state == LAST_ACK) {
+    if ((u32_t)(tcp_ticks - pcb->tmr) > 2 * TCP_MSL / TCP_SLOW_INTERVAL) {
+      ++pcb_remove;
+      LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: removing pcb stuck in LAST-ACK\n"));
+    }
+  }
+  return pcb_remove;
+}
+
+/**
+ * Removes the PCBs that have been in TIME-WAIT for enough time.
+ * Part of tcp_slowtmr().
+ */
+static void
+tcp_slowtmr_tw(void)
+{
+  struct tcp_pcb *pcb, *prev;
+  u8_t pcb_remove;      /* flag if a PCB should be removed */
+
+  /* Steps through all of the TIME-WAIT PCBs. */
+  prev = NULL;
+  pcb = tcp_tw_pcbs;
+  while (pcb != NULL) {
+    LWIP_ASSERT("tcp_slowtmr: TIME-WAIT pcb->state == TIME-WAIT", pcb->state == TIME_WAIT);
+    pcb_remove = 0;
+
+    /* Check if this PCB has stayed long enough in TIME-WAIT */
+    if ((u32_t)(tcp_ticks - pcb->tmr) > 2 * TCP_MSL / TCP_SLOW_INTERVAL) {
+      ++pcb_remove;
+    }
+
+    /* If the PCB should be removed, do it. */
+    if (pcb_remove) {
+      struct tcp_pcb *pcb2;
+      tcp_pcb_purge(pcb);
+      /* Remove PCB from tcp_tw_pcbs list. */
+      if (prev != NULL) {
+        LWIP_ASSERT("tcp_slowtmr: middle tcp != tcp_tw_pcbs", pcb != tcp_tw_pcbs);
+        prev->next = pcb->next;
+      } else {
+        /* This PCB was the first. */
+        LWIP_ASSERT("tcp_slowtmr: first pcb == tcp_tw_pcbs", tcp_tw_pcbs == pcb);
+        tcp_tw_pcbs = pcb->next;
+      }
+      TCP_PCB_HASH_RMV(&tcp_tw_pcbs, pcb);
+      TCP_TIMER_RMV(&tcp_tw_pcbs, pcb);
+      pcb2 = pcb;
+      pcb = pcb->next;
+      memp_free(MEMP_TCP_PCB, pcb2);
+    } else {
+      prev = pcb;
+      pcb = pcb->next;
+    }
+  }
+}
+
 /**
  * Called every 500 ms and implements the retransmission timer and the timer that
  * removes PCBs that have been in TIME-WAIT for enough time. It also increments
@@ -986,7 +1339,6 @@ void
 tcp_slowtmr(void)
 {
   struct tcp_pcb *pcb, *prev;
-  tcpwnd_size_t eff_wnd;
   u8_t pcb_remove;      /* flag if a PCB should be removed */
   u8_t pcb_reset;       /* flag if a RST should be sent when removing */
   err_t err;
@@ -1015,137 +1367,8 @@ tcp_slowtmr_start:
     }
     pcb->last_timer = tcp_timer_ctr;
 
-    pcb_remove = 0;
     pcb_reset = 0;
-
-    if (pcb->state == SYN_SENT && pcb->nrtx >= TCP_SYNMAXRTX) {
-      ++pcb_remove;
-      LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: max SYN retries reached\n"));
-    }
-    else if (pcb->nrtx >= TCP_MAXRTX) {
-      ++pcb_remove;
-      LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: max DATA retries reached\n"));
-    } else {
-      if (pcb->persist_backoff > 0) {
-        /* If snd_wnd is zero, use persist timer to send 1 byte probes
-         * instead of using the standard retransmission mechanism. */
-        u8_t backoff_cnt = tcp_persist_backoff[pcb->persist_backoff-1];
-        if (pcb->persist_cnt < backoff_cnt) {
-          pcb->persist_cnt++;
-        }
-        if (pcb->persist_cnt >= backoff_cnt) {
-          if (tcp_zero_window_probe(pcb) == ERR_OK) {
-            pcb->persist_cnt = 0;
-            if (pcb->persist_backoff < sizeof(tcp_persist_backoff)) {
-              pcb->persist_backoff++;
-            }
-          }
-        }
-      } else {
-        /* Increase the retransmission timer if it is running */
-        if (pcb->rtime >= 0) {
-          ++pcb->rtime;
-        }
-
-        if (pcb->unacked != NULL && pcb->rtime >= pcb->rto) {
-          /* Time for a retransmission. */
-          LWIP_DEBUGF(TCP_RTO_DEBUG, ("tcp_slowtmr: rtime %"S16_F
-                                      " pcb->rto %"S16_F"\n",
-                                      pcb->rtime, pcb->rto));
-
-          /* Double retransmission time-out unless we are trying to
-           * connect to somebody (i.e., we are in SYN_SENT). */
-          if (pcb->state != SYN_SENT) {
-            u8_t backoff_idx = LWIP_MIN(pcb->nrtx, sizeof(tcp_backoff)-1);
-            pcb->rto = ((pcb->sa >> 3) + pcb->sv) << tcp_backoff[backoff_idx];
-          }
-
-          /* Reset the retransmission timer. */
-          pcb->rtime = 0;
-
-          /* Reduce congestion window and ssthresh. */
-          eff_wnd = LWIP_MIN(pcb->cwnd, pcb->snd_wnd);
-          pcb->ssthresh = eff_wnd >> 1;
-          if (pcb->ssthresh < (tcpwnd_size_t)(pcb->mss << 1)) {
-            pcb->ssthresh = (pcb->mss << 1);
-          }
-          pcb->cwnd = pcb->mss;
-          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_slowtmr: cwnd %"TCPWNDSIZE_F
-                                       " ssthresh %"TCPWNDSIZE_F"\n",
-                                       pcb->cwnd, pcb->ssthresh));
-
-          /* The following needs to be called AFTER cwnd is set to one
-             mss - STJ */
-          tcp_rexmit_rto(pcb);
-        }
-      }
-    }
-    /* Check if this PCB has stayed too long in FIN-WAIT-2 */
-    if (pcb->state == FIN_WAIT_2) {
-      /* If this PCB is in FIN_WAIT_2 because of SHUT_WR don't let it time out. */
-      if (pcb->flags & TF_RXCLOSED) {
-        /* PCB was fully closed (either through close() or SHUT_RDWR):
-           normal FIN-WAIT timeout handling. */
-        if ((u32_t)(tcp_ticks - pcb->tmr) >
-            TCP_FIN_WAIT_TIMEOUT / TCP_SLOW_INTERVAL) {
-          ++pcb_remove;
-          LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: removing pcb stuck in FIN-WAIT-2\n"));
-        }
-      }
-    }
-
-    /* Check if KEEPALIVE should be sent */
-    if (ip_get_option(pcb, SOF_KEEPALIVE) &&
-       ((pcb->state == ESTABLISHED) ||
-        (pcb->state == CLOSE_WAIT))) {
-      if ((u32_t)(tcp_ticks - pcb->tmr) >
-         (pcb->keep_idle + TCP_KEEP_DUR(pcb)) / TCP_SLOW_INTERVAL)
-      {
-        LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: KEEPALIVE timeout. Aborting connection to "));
-        ip_addr_debug_print(TCP_DEBUG, &pcb->remote_ip);
-        LWIP_DEBUGF(TCP_DEBUG, ("\n"));
-
-        ++pcb_remove;
-        ++pcb_reset;
-      } else if ((u32_t)(tcp_ticks - pcb->tmr) >
-                (pcb->keep_idle + pcb->keep_cnt_sent * TCP_KEEP_INTVL(pcb))
-                / TCP_SLOW_INTERVAL)
-      {
-        err = tcp_keepalive(pcb);
-        if (err == ERR_OK) {
-          pcb->keep_cnt_sent++;
-        }
-      }
-    }
-
-    /* If this PCB has queued out of sequence data, but has been
-       inactive for too long, will drop the data (it will eventually
-       be retransmitted). */
-#if TCP_QUEUE_OOSEQ
-    if (pcb->ooseq != NULL &&
-        (u32_t)tcp_ticks - pcb->tmr >= pcb->rto * TCP_OOSEQ_TIMEOUT) {
-      tcp_segs_free(pcb->ooseq);
-      pcb->ooseq = NULL;
-      LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_slowtmr: dropping OOSEQ queued data\n"));
-    }
-#endif /* TCP_QUEUE_OOSEQ */
-
-    /* Check if this PCB has stayed too long in SYN-RCVD */
-    if (pcb->state == SYN_RCVD) {
-      if ((u32_t)(tcp_ticks - pcb->tmr) >
-          TCP_SYN_RCVD_TIMEOUT / TCP_SLOW_INTERVAL) {
-        ++pcb_remove;
-        LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: removing pcb stuck in SYN-RCVD\n"));
-      }
-    }
-
-    /* Check if this PCB has stayed too long in LAST-ACK */
-    if (pcb->state == LAST_ACK) {
-      if ((u32_t)(tcp_ticks - pcb->tmr) > 2 * TCP_MSL / TCP_SLOW_INTERVAL) {
-        ++pcb_remove;
-        LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: removing pcb stuck in LAST-ACK\n"));
-      }
-    }
+    pcb_remove = tcp_slowtmr_pcb(pcb, &pcb_reset);
 
     /* If the PCB should be removed, do it. */
     if (pcb_remove) {
@@ -1165,6 +1388,8 @@ tcp_slowtmr_start:
         LWIP_ASSERT("tcp_slowtmr: first pcb == tcp_active_pcbs", tcp_active_pcbs == pcb);
         tcp_active_pcbs = pcb->next;
       }
+      TCP_PCB_HASH_RMV(&tcp_active_pcbs, pcb);
+      TCP_TIMER_RMV(&tcp_active_pcbs, pcb);
 
       if (pcb_reset) {
         tcp_rst(pcb->snd_nxt, pcb->rcv_nxt, &pcb->local_ip, &pcb->remote_ip,
@@ -1205,40 +1430,7 @@ tcp_slowtmr_start:
     }
   }
 
-
-  /* Steps through all of the TIME-WAIT PCBs. */
-  prev = NULL;
-  pcb = tcp_tw_pcbs;
-  while (pcb != NULL) {
-    LWIP_ASSERT("tcp_slowtmr: TIME-WAIT pcb->state == TIME-WAIT", pcb->state == TIME_WAIT);
-    pcb_remove = 0;
-
-    /* Check if this PCB has stayed long enough in TIME-WAIT */
-    if ((u32_t)(tcp_ticks - pcb->tmr) > 2 * TCP_MSL / TCP_SLOW_INTERVAL) {
-      ++pcb_remove;
-    }
-
-    /* If the PCB should be removed, do it. */
-    if (pcb_remove) {
-      struct tcp_pcb *pcb2;
-      tcp_pcb_purge(pcb);
-      /* Remove PCB from tcp_tw_pcbs list. */
-      if (prev != NULL) {
-        LWIP_ASSERT("tcp_slowtmr: middle tcp != tcp_tw_pcbs", pcb != tcp_tw_pcbs);
-        prev->next = pcb->next;
-      } else {
-        /* This PCB was the first. */
-        LWIP_ASSERT("tcp_slowtmr: first pcb == tcp_tw_pcbs", tcp_tw_pcbs == pcb);
-        tcp_tw_pcbs = pcb->next;
-      }
-      pcb2 = pcb;
-      pcb = pcb->next;
-      memp_free(MEMP_TCP_PCB, pcb2);
-    } else {
-      prev = pcb;
-      pcb = pcb->next;
-    }
-  }
+  tcp_slowtmr_tw();
 }
 
 /**
@@ -1293,6 +1485,284 @@ tcp_fasttmr_start:
   }
 }
 
+#if LWIP_TCP_TIMER_WHEEL
+#if (TCP_TIMER_WHEEL_SIZE & (TCP_TIMER_WHEEL_SIZE - 1)) != 0
+#error "TCP_TIMER_WHEEL_SIZE must be a power of two"
+#endif
+/** Active and TIME-WAIT PCBs with a timer running, chained through
+ * wheel_next in the slot of the tcp_tmr() tick they are due at */
+static struct tcp_pcb *tcp_timer_wheel[TCP_TIMER_WHEEL_SIZE];
+/** Incremented every time tcp_tmr() is called */
+static u32_t tcp_timer_wheel_now;
+
+static void
+tcp_timer_unlink(struct tcp_pcb *pcb)
+{
+  if (pcb->wheel_pprev != NULL) {
+    *pcb->wheel_pprev = pcb->wheel_next;
+    if (pcb->wheel_next != NULL) {
+      pcb->wheel_next->wheel_pprev = pcb->wheel_pprev;
+    }
+    pcb->wheel_next = NULL;
+    pcb->wheel_pprev = NULL;
+  }
+}
+
+static void
+tcp_timer_link(struct tcp_pcb *pcb, u32_t due)
+{
+  struct tcp_pcb **slot = &tcp_timer_wheel[due & (TCP_TIMER_WHEEL_SIZE - 1)];
+
+  tcp_timer_unlink(pcb);
+  pcb->wheel_due = due;
+  pcb->wheel_next = *slot;
+  if (*slot != NULL) {
+    (*slot)->wheel_pprev = &pcb->wheel_next;
+  }
+  *slot = pcb;
+  pcb->wheel_pprev = slot;
+}
+
+/** Lower 'ticks' to the number of slow timer ticks until tcp_ticks reaches 'due' */
+#define TCP_TIMER_DUE(ticks, due) do { \
+  s32_t left_ = (s32_t)((u32_t)(due) - tcp_ticks); \
+  if (left_ < 1) { \
+    left_ = 1; \
+  } \
+  if (((ticks) == 0) || ((u32_t)left_ < (ticks))) { \
+    (ticks) = (u32_t)left_; \
+  } } while (0)
+
+/**
+ * Number of slow timer ticks until tcp_slowtmr_pcb(), the poll timer or the
+ * TIME-WAIT timeout have something to do for a PCB. The deadlines mirror the
+ * checks in tcp_slowtmr_pcb(); waking a PCB too early is harmless, it is
+ * just scheduled again.
+ *
+ * @return 0 if none of the PCB's slow timers is running
+ */
+static u32_t
+tcp_timer_slow_ticks(struct tcp_pcb *pcb)
+{
+  u32_t ticks = 0;
+
+  if (pcb->state == TIME_WAIT) {
+    TCP_TIMER_DUE(ticks, pcb->tmr + 2 * TCP_MSL / TCP_SLOW_INTERVAL + 1);
+    return ticks;
+  }
+  /* the retransmission and persist timers count slow timer ticks; unsent
+     data is retried from the poll timer's tcp_output() like before */
+  if ((pcb->rtime >= 0) || (pcb->persist_backoff > 0) || (pcb->unsent != NULL)) {
+    return 1;
+  }
+  if ((pcb->state == FIN_WAIT_2) && (pcb->flags & TF_RXCLOSED)) {
+    TCP_TIMER_DUE(ticks, pcb->tmr + TCP_FIN_WAIT_TIMEOUT / TCP_SLOW_INTERVAL + 1);
+  }
+  if (ip_get_option(pcb, SOF_KEEPALIVE) &&
+     ((pcb->state == ESTABLISHED) ||
+      (pcb->state == CLOSE_WAIT))) {
+    TCP_TIMER_DUE(ticks, pcb->tmr + (pcb->keep_idle + pcb->keep_cnt_sent * TCP_KEEP_INTVL(pcb))
+                  / TCP_SLOW_INTERVAL + 1);
+    TCP_TIMER_DUE(ticks, pcb->tmr + (pcb->keep_idle + TCP_KEEP_DUR(pcb)) / TCP_SLOW_INTERVAL + 1);
+  }
+#if TCP_QUEUE_OOSEQ
+  if (pcb->ooseq != NULL) {
+    TCP_TIMER_DUE(ticks, pcb->tmr + pcb->rto * TCP_OOSEQ_TIMEOUT);
+  }
+#endif /* TCP_QUEUE_OOSEQ */
+  if (pcb->state == SYN_RCVD) {
+    TCP_TIMER_DUE(ticks, pcb->tmr + TCP_SYN_RCVD_TIMEOUT / TCP_SLOW_INTERVAL + 1);
+  }
+  if (pcb->state == LAST_ACK) {
+    TCP_TIMER_DUE(ticks, pcb->tmr + 2 * TCP_MSL / TCP_SLOW_INTERVAL + 1);
+  }
+#if LWIP_CALLBACK_API
+  /* without a poll callback there is nothing to poll */
+  if (pcb->poll != NULL)
+#endif /* LWIP_CALLBACK_API */
+  {
+    TCP_TIMER_DUE(ticks, pcb->wheel_ticks + pcb->pollinterval - pcb->polltmr);
+  }
+  return ticks;
+}
+
+/** (Re)schedule a PCB on the wheel for the earliest of its running timers */
+static void
+tcp_timer_arm(struct tcp_pcb *pcb)
+{
+  u32_t ticks;
+
+  if ((pcb->state != TIME_WAIT) &&
+      ((pcb->flags & (TF_ACK_DELAY | TF_CLOSEPEND)) || (pcb->refused_data != NULL))) {
+    /* the fast timer's work is done on the next tick */
+    tcp_timer_link(pcb, tcp_timer_wheel_now + 1);
+    return;
+  }
+  ticks = tcp_timer_slow_ticks(pcb);
+  if (ticks == 0) {
+    tcp_timer_unlink(pcb);
+  } else {
+    /* slow timer ticks fall on every other tcp_tmr() tick, the next one
+       being the first tick with (tcp_timer + 1) odd */
+    tcp_timer_link(pcb, tcp_timer_wheel_now + ((tcp_timer & 1) ? 2 : 1) + 2 * (ticks - 1));
+  }
+}
+
+/** Called from TCP_REG(): PCBs entering the active or TIME-WAIT list get on the wheel */
+void
+tcp_timer_reg(struct tcp_pcb **pcbs, struct tcp_pcb *pcb)
+{
+  if ((pcbs == &tcp_active_pcbs) || (pcbs == &tcp_tw_pcbs)) {
+    pcb->wheel_reg = 1;
+    pcb->wheel_ticks = tcp_ticks;
+    tcp_timer_arm(pcb);
+  }
+}
+
+/** Called from TCP_RMV(): PCBs leaving the active or TIME-WAIT list get off the wheel */
+void
+tcp_timer_rmv(struct tcp_pcb **pcbs, struct tcp_pcb *pcb)
+{
+  if ((pcbs == &tcp_active_pcbs) || (pcbs == &tcp_tw_pcbs)) {
+    pcb->wheel_reg = 0;
+    tcp_timer_unlink(pcb);
+  }
+}
+
+/**
+ * Have the wheel look at a PCB on the next tcp_tmr() tick. Must be called
+ * whenever one of the PCB's timers may have been started or brought forward
+ * outside of the timers themselves; tcp_output() does so for everything
+ * that happens during input processing and sending.
+ */
+void
+tcp_timer_kick(struct tcp_pcb *pcb)
+{
+  if ((pcb->state != LISTEN) && pcb->wheel_reg &&
+      ((pcb->wheel_pprev == NULL) || (pcb->wheel_due != tcp_timer_wheel_now + 1))) {
+    tcp_timer_link(pcb, tcp_timer_wheel_now + 1);
+  }
+}
+
+/** Runs the due timers of an active PCB, see tcp_fasttmr() and tcp_slowtmr() */
+static void
+tcp_timer_active(struct tcp_pcb *pcb, u8_t slow)
+{
+  err_t err = ERR_OK;
+
+  /* send delayed ACKs */
+  if (pcb->flags & TF_ACK_DELAY) {
+    LWIP_DEBUGF(TCP_DEBUG, ("tcp_fasttmr: delayed ACK\n"));
+    tcp_ack_now(pcb);
+    tcp_output(pcb);
+    pcb->flags &= ~(TF_ACK_DELAY | TF_ACK_NOW);
+  }
+  /* send pending FIN */
+  if (pcb->flags & TF_CLOSEPEND) {
+    LWIP_DEBUGF(TCP_DEBUG, ("tcp_fasttmr: pending FIN\n"));
+    pcb->flags &= ~(TF_CLOSEPEND);
+    tcp_close_shutdown_fin(pcb);
+  }
+
+  if (slow) {
+    u8_t pcb_reset = 0;
+
+    if (tcp_slowtmr_pcb(pcb, &pcb_reset)) {
+#if LWIP_CALLBACK_API
+      tcp_err_fn err_fn = pcb->errf;
+#endif /* LWIP_CALLBACK_API */
+      void *err_arg;
+      enum tcp_state last_state;
+      tcp_pcb_purge(pcb);
+      TCP_RMV_ACTIVE(pcb);
+
+      if (pcb_reset) {
+        tcp_rst(pcb->snd_nxt, pcb->rcv_nxt, &pcb->local_ip, &pcb->remote_ip,
+                 pcb->local_port, pcb->remote_port);
+      }
+
+      err_arg = pcb->callback_arg;
+      last_state = pcb->state;
+      memp_free(MEMP_TCP_PCB, pcb);
+      TCP_EVENT_ERR(last_state, err_fn, err_arg, ERR_ABRT);
+      return;
+    }
+
+    /* the poll timer also counts the slow ticks this PCB was not on the wheel */
+    pcb->polltmr = (u8_t)LWIP_MIN((u32_t)pcb->polltmr + (tcp_ticks - pcb->wheel_ticks), 0xff);
+    pcb->wheel_ticks = tcp_ticks;
+    if (pcb->polltmr >= pcb->pollinterval) {
+      pcb->polltmr = 0;
+      LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: polling application\n"));
+      /* schedule before the callback, which may call tcp_poll() or free the PCB */
+      tcp_timer_arm(pcb);
+      tcp_active_pcbs_changed = 0;
+      TCP_EVENT_POLL(pcb, err);
+      if (tcp_active_pcbs_changed) {
+        return;
+      }
+      if (err == ERR_OK) {
+        tcp_output(pcb);
+      }
+    }
+  }
+
+  tcp_timer_arm(pcb);
+  /* If there is data which was previously "refused" by upper layer */
+  if (pcb->refused_data != NULL) {
+    /* if it is still refused, tcp_process_refused_data() kicks the PCB again */
+    tcp_process_refused_data(pcb);
+  }
+}
+
+/**
+ * tcp_tmr() with LWIP_TCP_TIMER_WHEEL: advances the wheel by one slot and runs
+ * the timers of the PCBs found there, instead of having tcp_fasttmr() and
+ * tcp_slowtmr() walk all PCBs. tcp_ticks still advances every other tick.
+ */
+static void
+tcp_timer_wheel_tick(void)
+{
+  struct tcp_pcb *due, *pcb;
+  struct tcp_pcb **slot;
+  u8_t slow = (++tcp_timer & 1);
+  u8_t tw_expired = 0;
+
+  if (slow) {
+    ++tcp_ticks;
+  }
+  ++tcp_timer_wheel_now;
+
+  /* Take the slot's chain off the wheel: PCBs that are removed or scheduled
+     by the callbacks below unlink themselves from it through wheel_pprev. */
+  slot = &tcp_timer_wheel[tcp_timer_wheel_now & (TCP_TIMER_WHEEL_SIZE - 1)];
+  due = *slot;
+  *slot = NULL;
+  if (due != NULL) {
+    due->wheel_pprev = &due;
+  }
+  while ((pcb = due) != NULL) {
+    tcp_timer_unlink(pcb);
+    if ((s32_t)(pcb->wheel_due - tcp_timer_wheel_now) > 0) {
+      /* due in a later turn of the wheel */
+      tcp_timer_link(pcb, pcb->wheel_due);
+    } else if (pcb->state == TIME_WAIT) {
+      if (slow && ((u32_t)(tcp_ticks - pcb->tmr) > 2 * TCP_MSL / TCP_SLOW_INTERVAL)) {
+        tw_expired = 1;
+      } else {
+        tcp_timer_arm(pcb);
+      }
+    } else {
+      tcp_timer_active(pcb, slow);
+    }
+  }
+  if (tw_expired) {
+    /* one pass over the TIME-WAIT list frees all expired PCBs */
+    tcp_slowtmr_tw();
+  }
+}
+#endif /* LWIP_TCP_TIMER_WHEEL */
+
 /** Call tcp_output for all active pcbs that have TF_NAGLEMEMERR set */
 void
 tcp_txnow(void)
@@ -1360,6 +1830,7 @@ tcp_process_refused_data(struct tcp_pcb *pcb)
       }
 #endif /* TCP_QUEUE_OOSEQ && LWIP_WND_SCALE */
       pcb->refused_data = refused_data;
+      tcp_timer_kick(pcb);
       return ERR_INPROGRESS;
     }
   }
@@ -1799,6 +2270,7 @@ tcp_poll(struct tcp_pcb *pcb, tcp_poll_fn poll, u8_t interval)
   LWIP_UNUSED_ARG(poll);
 #endif /* LWIP_CALLBACK_API */
   pcb->pollinterval = interval;
+  tcp_timer_kick(pcb);
 }
 
 /**
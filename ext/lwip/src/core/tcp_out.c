@@ -367,6 +367,28 @@ tcp_write_checks(struct tcp_pcb *pcb, u16_t len)
 err_t
 tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
 {
+#if LWIP_PBUF_EXT
+  return tcp_write_ext(pcb, arg, len, apiflags, NULL);
+}
+
+/**
+ * @ingroup tcp_raw
+ * Write data for sending like tcp_write(), but if ext is not NULL and the data
+ * is not copied, it is referenced by pbufs from pbuf_alloc_ext(): ext->release()
+ * is called once the data has been ACKed (or the segments are dropped because
+ * the connection is gone), so the caller can tell when it may be reused.
+ *
+ * @param pcb Protocol control block for the TCP connection to enqueue data for.
+ * @param arg Pointer to the data to be enqueued for sending.
+ * @param len Data length in bytes
+ * @param apiflags see tcp_write()
+ * @param ext the lent memory holding the data, or NULL for plain PBUF_ROM references
+ * @return ERR_OK if enqueued, another err_t on error
+ */
+err_t
+tcp_write_ext(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags, struct pbuf_ext *ext)
+{
+#endif /* LWIP_PBUF_EXT */
   struct pbuf *concat_p = NULL;
   struct tcp_seg *last_unsent = NULL, *seg = NULL, *prev_seg = NULL, *queue = NULL;
   u16_t pos = 0; /* position in 'arg' data */
@@ -520,17 +542,29 @@ tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
         /* If the last unsent pbuf is of type PBUF_ROM, try to extend it. */
         struct pbuf *p;
         for (p = last_unsent->p; p->next != NULL; p = p->next);
-        if (p->type == PBUF_ROM && (const u8_t *)p->payload + p->len == (const u8_t *)arg) {
+        if (
+#if LWIP_PBUF_EXT
+            /* lent data needs pbufs of its own to be tracked */
+            (ext == NULL) &&
+#endif /* LWIP_PBUF_EXT */
+            p->type == PBUF_ROM && (const u8_t *)p->payload + p->len == (const u8_t *)arg) {
           LWIP_ASSERT("tcp_write: ROM pbufs cannot be oversized", pos == 0);
           extendlen = seglen;
         } else {
-          if ((concat_p = pbuf_alloc(PBUF_RAW, seglen, PBUF_ROM)) == NULL) {
+#if LWIP_PBUF_EXT
+          if (ext != NULL) {
+            concat_p = pbuf_alloc_ext((const u8_t*)arg + pos, seglen, ext);
+          } else
+#endif /* LWIP_PBUF_EXT */
+          if ((concat_p = pbuf_alloc(PBUF_RAW, seglen, PBUF_ROM)) != NULL) {
+            /* reference the non-volatile payload data */
+            ((struct pbuf_rom*)concat_p)->payload = (const u8_t*)arg + pos;
+          }
+          if (concat_p == NULL) {
             LWIP_DEBUGF(TCP_OUTPUT_DEBUG | LWIP_DBG_LEVEL_SERIOUS,
                         ("tcp_write: could not allocate memory for zero-copy pbuf\n"));
             goto memerr;
           }
-          /* reference the non-volatile payload data */
-          ((struct pbuf_rom*)concat_p)->payload = (const u8_t*)arg + pos;
           queuelen += pbuf_clen(concat_p);
         }
 #if TCP_CHECKSUM_ON_COPY
@@ -586,7 +620,16 @@ tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
 #if TCP_OVERSIZE
       LWIP_ASSERT("oversize == 0", oversize == 0);
 #endif /* TCP_OVERSIZE */
-      if ((p2 = pbuf_alloc(PBUF_TRANSPORT, seglen, PBUF_ROM)) == NULL) {
+#if LWIP_PBUF_EXT
+      if (ext != NULL) {
+        p2 = pbuf_alloc_ext((const u8_t*)arg + pos, seglen, ext);
+      } else
+#endif /* LWIP_PBUF_EXT */
+      if ((p2 = pbuf_alloc(PBUF_TRANSPORT, seglen, PBUF_ROM)) != NULL) {
+        /* reference the non-volatile payload data */
+        ((struct pbuf_rom*)p2)->payload = (const u8_t*)arg + pos;
+      }
+      if (p2 == NULL) {
         LWIP_DEBUGF(TCP_OUTPUT_DEBUG | LWIP_DBG_LEVEL_SERIOUS, ("tcp_write: could not allocate memory for zero-copy pbuf\n"));
         goto memerr;
       }
@@ -598,8 +641,6 @@ tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
         chksum = SWAP_BYTES_IN_WORD(chksum);
       }
 #endif /* TCP_CHECKSUM_ON_COPY */
-      /* reference the non-volatile payload data */
-      ((struct pbuf_rom*)p2)->payload = (const u8_t*)arg + pos;
 
       /* Second, allocate a pbuf for the headers. */
       if ((p = pbuf_alloc(PBUF_TRANSPORT, optlen, PBUF_RAM)) == NULL) {
@@ -1004,6 +1045,9 @@ tcp_output(struct tcp_pcb *pcb)
   LWIP_ASSERT("don't call tcp_output for listen-pcbs",
     pcb->state != LISTEN);
 
+  /* Whatever made us send may have started one of the pcb's timers */
+  tcp_timer_kick(pcb);
+
   /* First, check if we are invoked by the TCP input processing
      code. If so, we do not output anything. Instead, we rely on the
      input processing code to call us when input processing is done
@@ -80,6 +80,87 @@ static u16_t udp_port = UDP_LOCAL_PORT_RANGE_START;
 /* exported in udp.h (was static) */
 struct udp_pcb *udp_pcbs;
 
+#if LWIP_UDP_PCB_HASH
+#if (UDP_PCB_HASH_SIZE & (UDP_PCB_HASH_SIZE - 1)) != 0
+#error "UDP_PCB_HASH_SIZE must be a power of two"
+#endif
+/** PCBs of udp_pcbs, chained through hash_next: connected PCBs with a
+ * specific remote address by 4-tuple, all others by local port */
+static struct udp_pcb *udp_pcb_hash[UDP_PCB_HASH_SIZE];
+
+/** Bucket of a connected PCB. The local address is left out: there are few
+ * of them and it is compared when walking the bucket anyway. */
+static u32_t
+udp_pcb_hash_tuple(u16_t local_port, const ip_addr_t *remote_ip, u16_t remote_port)
+{
+  u32_t h;
+#if LWIP_IPV6
+  if (IP_IS_V6(remote_ip)) {
+    const ip6_addr_t *ip6 = ip_2_ip6(remote_ip);
+    h = ip6->addr[0] ^ ip6->addr[1] ^ ip6->addr[2] ^ ip6->addr[3];
+  } else
+#endif /* LWIP_IPV6 */
+  {
+#if LWIP_IPV4
+    h = ip4_addr_get_u32(ip_2_ip4(remote_ip));
+#else /* LWIP_IPV4 */
+    h = 0;
+#endif /* LWIP_IPV4 */
+  }
+  h ^= ((u32_t)local_port << 16) | remote_port;
+  h *= 0x9E3779B1UL;
+  return (h ^ (h >> 16)) & (UDP_PCB_HASH_SIZE - 1);
+}
+
+/** Bucket of a PCB that is not connected to a specific remote address */
+static u32_t
+udp_pcb_hash_port(u16_t local_port)
+{
+  u32_t h = local_port * 0x9E3779B1UL;
+  return (h ^ (h >> 16)) & (UDP_PCB_HASH_SIZE - 1);
+}
+
+static u32_t
+udp_pcb_hash_bucket(const struct udp_pcb *pcb)
+{
+  if ((pcb->flags & UDP_FLAGS_CONNECTED) && !ip_addr_isany(&pcb->remote_ip)) {
+    return udp_pcb_hash_tuple(pcb->local_port, &pcb->remote_ip, pcb->remote_port);
+  }
+  return udp_pcb_hash_port(pcb->local_port);
+}
+
+/**
+ * Add a PCB on udp_pcbs to the hash table. Must be called again (after
+ * udp_pcb_hash_remove()) whenever its local port or remote end change.
+ */
+static void
+udp_pcb_hash_add(struct udp_pcb *pcb)
+{
+  u32_t b = udp_pcb_hash_bucket(pcb);
+  pcb->hash_next = udp_pcb_hash[b];
+  udp_pcb_hash[b] = pcb;
+}
+
+/**
+ * Remove a PCB from the hash table.
+ *
+ * @return 1 if the PCB was hashed, 0 otherwise
+ */
+static u8_t
+udp_pcb_hash_remove(struct udp_pcb *pcb)
+{
+  struct udp_pcb **pp = &udp_pcb_hash[udp_pcb_hash_bucket(pcb)];
+  for (; *pp != NULL; pp = &(*pp)->hash_next) {
+    if (*pp == pcb) {
+      *pp = pcb->hash_next;
+      pcb->hash_next = NULL;
+      return 1;
+    }
+  }
+  return 0;
+}
+#endif /* LWIP_UDP_PCB_HASH */
+
 /**
  * Initialize this module.
  */
@@ -169,6 +250,58 @@ udp_input_local_match(struct udp_pcb *pcb, struct netif *inp, u8_t broadcast)
   return 0;
 }
 
+#if LWIP_UDP_PCB_HASH
+/**
+ * Find the PCB of the current input datagram (same rules as the list walk
+ * in udp_input()): a PCB connected to the source is looked up by 4-tuple
+ * first, then the PCBs bound to the destination port are searched.
+ *
+ * @return the PCB or NULL if nobody receives on port dest
+ */
+static struct udp_pcb *
+udp_pcb_hash_lookup(struct netif *inp, u8_t broadcast, u16_t src, u16_t dest)
+{
+  struct udp_pcb *pcb;
+  struct udp_pcb *uncon_pcb = NULL;
+
+  pcb = udp_pcb_hash[udp_pcb_hash_tuple(dest, ip_current_src_addr(), src)];
+  for (; pcb != NULL; pcb = pcb->hash_next) {
+    if ((pcb->flags & UDP_FLAGS_CONNECTED) &&
+        (pcb->local_port == dest) && (pcb->remote_port == src) &&
+        ip_addr_cmp(&pcb->remote_ip, ip_current_src_addr()) &&
+        (udp_input_local_match(pcb, inp, broadcast) != 0)) {
+      UDP_STATS_INC(udp.cachehit);
+      return pcb;
+    }
+  }
+
+  pcb = udp_pcb_hash[udp_pcb_hash_port(dest)];
+  for (; pcb != NULL; pcb = pcb->hash_next) {
+    if ((pcb->local_port == dest) &&
+        (udp_input_local_match(pcb, inp, broadcast) != 0)) {
+      if (((pcb->flags & UDP_FLAGS_CONNECTED) == 0) &&
+          ((uncon_pcb == NULL)
+#if SO_REUSE
+          /* prefer specific IPs over cath-all */
+          || !ip_addr_isany(&pcb->local_ip)
+#endif /* SO_REUSE */
+          )) {
+        /* the first unconnected matching PCB */
+        uncon_pcb = pcb;
+      }
+
+      /* the first fully matching PCB (connected to any remote address) */
+      if ((pcb->remote_port == src) &&
+          (ip_addr_isany_val(pcb->remote_ip) ||
+          ip_addr_cmp(&pcb->remote_ip, ip_current_src_addr()))) {
+        return pcb;
+      }
+    }
+  }
+  return uncon_pcb;
+}
+#endif /* LWIP_UDP_PCB_HASH */
+
 /**
  * Process an incoming UDP datagram.
  *
@@ -185,8 +318,11 @@ void
 udp_input(struct pbuf *p, struct netif *inp)
 {
   struct udp_hdr *udphdr;
-  struct udp_pcb *pcb, *prev;
+  struct udp_pcb *pcb;
+#if !LWIP_UDP_PCB_HASH
+  struct udp_pcb *prev;
   struct udp_pcb *uncon_pcb;
+#endif /* !LWIP_UDP_PCB_HASH */
   u16_t src, dest;
   u8_t broadcast;
   u8_t for_us = 0;
@@ -229,6 +365,9 @@ udp_input(struct pbuf *p, struct netif *inp)
   ip_addr_debug_print(UDP_DEBUG, ip_current_src_addr());
   LWIP_DEBUGF(UDP_DEBUG, (", %"U16_F")\n", lwip_ntohs(udphdr->src)));
 
+#if LWIP_UDP_PCB_HASH
+  pcb = udp_pcb_hash_lookup(inp, broadcast, src, dest);
+#else /* LWIP_UDP_PCB_HASH */
   pcb = NULL;
   prev = NULL;
   uncon_pcb = NULL;
@@ -282,6 +421,7 @@ udp_input(struct pbuf *p, struct netif *inp)
   if (pcb == NULL) {
     pcb = uncon_pcb;
   }
+#endif /* LWIP_UDP_PCB_HASH */
 
   /* Check checksum if this is a match or if it was directed at us. */
   if (pcb != NULL) {
@@ -302,7 +442,8 @@ udp_input(struct pbuf *p, struct netif *inp)
   if (for_us) {
     LWIP_DEBUGF(UDP_DEBUG | LWIP_DBG_TRACE, ("udp_input: calculating checksum\n"));
 #if CHECKSUM_CHECK_UDP
-    IF__NETIF_CHECKSUM_ENABLED(inp, CHECKSUM_CHECK_UDP) {
+    IF__NETIF_CHECKSUM_ENABLED(inp, CHECKSUM_CHECK_UDP)
+    IF__PBUF_CHECKSUM_UNVERIFIED(p) {
 #if LWIP_UDPLITE
       if (ip_current_header_proto() == IP_PROTO_UDPLITE) {
         /* Do the UDP Lite checksum */
@@ -943,6 +1084,11 @@ udp_bind(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port)
     }
   }
 
+#if LWIP_UDP_PCB_HASH
+  if (rebind) {
+    udp_pcb_hash_remove(pcb);
+  }
+#endif /* LWIP_UDP_PCB_HASH */
   ip_addr_set_ipaddr(&pcb->local_ip, ipaddr);
 
   pcb->local_port = port;
@@ -953,6 +1099,9 @@ udp_bind(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port)
     pcb->next = udp_pcbs;
     udp_pcbs = pcb;
   }
+#if LWIP_UDP_PCB_HASH
+  udp_pcb_hash_add(pcb);
+#endif /* LWIP_UDP_PCB_HASH */
   LWIP_DEBUGF(UDP_DEBUG | LWIP_DBG_TRACE | LWIP_DBG_STATE, ("udp_bind: bound to "));
   ip_addr_debug_print(UDP_DEBUG | LWIP_DBG_TRACE | LWIP_DBG_STATE, &pcb->local_ip);
   LWIP_DEBUGF(UDP_DEBUG | LWIP_DBG_TRACE | LWIP_DBG_STATE, (", port %"U16_F")\n", pcb->local_port));
@@ -993,6 +1142,9 @@ udp_connect(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port)
     }
   }
 
+#if LWIP_UDP_PCB_HASH
+  udp_pcb_hash_remove(pcb);
+#endif /* LWIP_UDP_PCB_HASH */
   ip_addr_set_ipaddr(&pcb->remote_ip, ipaddr);
   pcb->remote_port = port;
   pcb->flags |= UDP_FLAGS_CONNECTED;
@@ -1005,13 +1157,18 @@ udp_connect(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port)
   /* Insert UDP PCB into the list of active UDP PCBs. */
   for (ipcb = udp_pcbs; ipcb != NULL; ipcb = ipcb->next) {
     if (pcb == ipcb) {
-      /* already on the list, just return */
-      return ERR_OK;
+      /* already on the list */
+      break;
     }
   }
-  /* PCB not yet on the list, add PCB now */
-  pcb->next = udp_pcbs;
-  udp_pcbs = pcb;
+  if (ipcb == NULL) {
+    /* PCB not yet on the list, add PCB now */
+    pcb->next = udp_pcbs;
+    udp_pcbs = pcb;
+  }
+#if LWIP_UDP_PCB_HASH
+  udp_pcb_hash_add(pcb);
+#endif /* LWIP_UDP_PCB_HASH */
   return ERR_OK;
 }
 
@@ -1024,6 +1181,9 @@ udp_connect(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port)
 void
 udp_disconnect(struct udp_pcb *pcb)
 {
+#if LWIP_UDP_PCB_HASH
+  u8_t hashed = udp_pcb_hash_remove(pcb);
+#endif /* LWIP_UDP_PCB_HASH */
   /* reset remote address association */
 #if LWIP_IPV4 && LWIP_IPV6
   if (IP_IS_ANY_TYPE_VAL(pcb->local_ip)) {
@@ -1037,6 +1197,11 @@ udp_disconnect(struct udp_pcb *pcb)
   pcb->remote_port = 0;
   /* mark PCB as unconnected */
   pcb->flags &= ~UDP_FLAGS_CONNECTED;
+#if LWIP_UDP_PCB_HASH
+  if (hashed) {
+    udp_pcb_hash_add(pcb);
+  }
+#endif /* LWIP_UDP_PCB_HASH */
 }
 
 /**
@@ -1072,6 +1237,9 @@ udp_remove(struct udp_pcb *pcb)
   struct udp_pcb *pcb2;
 
   mib2_udp_unbind(pcb);
+#if LWIP_UDP_PCB_HASH
+  udp_pcb_hash_remove(pcb);
+#endif /* LWIP_UDP_PCB_HASH */
   /* pcb to be removed is first in list? */
   if (udp_pcbs == pcb) {
     /* make list start at 2nd pcb */
@@ -63,6 +63,8 @@ extern "C" {
 #define NETCONN_COPY      0x01
 #define NETCONN_MORE      0x02
 #define NETCONN_DONTBLOCK 0x04
+/* Flag for netconn_recv_tcp_pbuf_flags (u8_t) */
+#define NETCONN_NOAUTORCVD 0x08 /* don't update the receive window, call netconn_tcp_recvd() later */
 
 /* Flags for struct netconn.flags (u8_t) */
 /** Should this netconn avoid blocking? */
@@ -170,7 +172,9 @@ enum netconn_evt {
   NETCONN_EVT_RCVMINUS,
   NETCONN_EVT_SENDPLUS,
   NETCONN_EVT_SENDMINUS,
-  NETCONN_EVT_ERROR
+  NETCONN_EVT_ERROR,
+  /** the remote host closed the connection (or it was reset) */
+  NETCONN_EVT_HUP
 };
 
 #if LWIP_IGMP || (LWIP_IPV6 && LWIP_IPV6_MLD)
@@ -270,6 +274,14 @@ struct netconn {
   netconn_callback callback;
 };
 
+/** A piece of application data for netconn_write_vectors_partly() */
+struct netvector {
+  /** pointer to the application buffer that contains the data to send */
+  const void *ptr;
+  /** size of the application data to send */
+  size_t len;
+};
+
 /** Register an Network connection event */
 #define API_EVENT(c,e,l) if (c->callback) {         \
                            (*c->callback)(c, e, l); \
@@ -314,11 +326,20 @@ err_t   netconn_listen_with_backlog(struct netconn *conn, u8_t backlog);
 err_t   netconn_accept(struct netconn *conn, struct netconn **new_conn);
 err_t   netconn_recv(struct netconn *conn, struct netbuf **new_buf);
 err_t   netconn_recv_tcp_pbuf(struct netconn *conn, struct pbuf **new_buf);
+err_t   netconn_recv_tcp_pbuf_flags(struct netconn *conn, struct pbuf **new_buf, u8_t apiflags);
+err_t   netconn_tcp_recvd(struct netconn *conn, size_t len);
 err_t   netconn_sendto(struct netconn *conn, struct netbuf *buf,
                              const ip_addr_t *addr, u16_t port);
 err_t   netconn_send(struct netconn *conn, struct netbuf *buf);
+err_t   netconn_send_batch(struct netconn *conn, struct netbuf **bufs, u16_t count, u16_t *sent);
 err_t   netconn_write_partly(struct netconn *conn, const void *dataptr, size_t size,
                              u8_t apiflags, size_t *bytes_written);
+err_t   netconn_write_vectors_partly(struct netconn *conn, struct netvector *vectors, u16_t vectorcnt,
+                                     u8_t apiflags, size_t *bytes_written);
+#if LWIP_PBUF_EXT
+err_t   netconn_write_vectors_ext(struct netconn *conn, struct netvector *vectors, u16_t vectorcnt,
+                                  u8_t apiflags, struct pbuf_ext *ext, size_t *bytes_written);
+#endif /* LWIP_PBUF_EXT */
 /** @ingroup netconn_tcp */
 #define netconn_write(conn, dataptr, size, apiflags) \
           netconn_write_partly(conn, dataptr, size, apiflags, NULL)
@@ -1105,6 +1105,24 @@
 #define UDP_TTL                         (IP_DEFAULT_TTL)
 #endif
 
+/**
+ * LWIP_UDP_PCB_HASH==1: Find the PCB of an incoming datagram through a hash
+ * table instead of walking udp_pcbs: PCBs connected to a remote address are
+ * hashed by address/port 4-tuple, all others by local port. The list is
+ * still kept for everything else.
+ */
+#if !defined LWIP_UDP_PCB_HASH || defined __DOXYGEN__
+#define LWIP_UDP_PCB_HASH               0
+#endif
+
+/**
+ * UDP_PCB_HASH_SIZE: Number of buckets of the UDP PCB hash table.
+ * Must be a power of two.
+ */
+#if !defined UDP_PCB_HASH_SIZE || defined __DOXYGEN__
+#define UDP_PCB_HASH_SIZE               64
+#endif
+
 /**
  * LWIP_NETBUF_RECVINFO==1: append destination addr and port to every netbuf.
  */
@@ -1262,6 +1280,51 @@
 #define TCP_DEFAULT_LISTEN_BACKLOG      0xff
 #endif
 
+/**
+ * LWIP_TCP_PCB_HASH==1: Find the PCB of an incoming segment through hash
+ * tables instead of walking the PCB lists: active and TIME-WAIT PCBs are
+ * hashed by address/port 4-tuple, listening PCBs by local port. The lists
+ * are still kept for everything else.
+ */
+#if !defined LWIP_TCP_PCB_HASH || defined __DOXYGEN__
+#define LWIP_TCP_PCB_HASH               0
+#endif
+
+/**
+ * TCP_PCB_HASH_SIZE: Number of buckets of the active/TIME-WAIT PCB hash table.
+ * Must be a power of two.
+ */
+#if !defined TCP_PCB_HASH_SIZE || defined __DOXYGEN__
+#define TCP_PCB_HASH_SIZE               256
+#endif
+
+/**
+ * TCP_LISTEN_HASH_SIZE: Number of buckets of the listening PCB hash table.
+ * Must be a power of two.
+ */
+#if !defined TCP_LISTEN_HASH_SIZE || defined __DOXYGEN__
+#define TCP_LISTEN_HASH_SIZE            32
+#endif
+
+/**
+ * LWIP_TCP_TIMER_WHEEL==1: Run the per-connection TCP timers (retransmission,
+ * persist, delayed ACK, keepalive, poll and the state timeouts) from a timer
+ * wheel instead of sweeping all PCBs on every TCP timer tick: a PCB is only
+ * looked at when one of its timers is due, idle connections cost nothing.
+ */
+#if !defined LWIP_TCP_TIMER_WHEEL || defined __DOXYGEN__
+#define LWIP_TCP_TIMER_WHEEL            0
+#endif
+
+/**
+ * TCP_TIMER_WHEEL_SIZE: Number of slots (of TCP_TMR_INTERVAL each) of the TCP
+ * timer wheel. Timers further out than one turn wait in their slot for the
+ * later turns. Must be a power of two.
+ */
+#if !defined TCP_TIMER_WHEEL_SIZE || defined __DOXYGEN__
+#define TCP_TIMER_WHEEL_SIZE            256
+#endif
+
 /**
  * TCP_OVERSIZE: The maximum number of bytes that tcp_write may
  * allocate ahead of time in an attempt to create shorter pbuf chains
@@ -1372,6 +1435,16 @@
 #if !defined PBUF_POOL_BUFSIZE || defined __DOXYGEN__
 #define PBUF_POOL_BUFSIZE               LWIP_MEM_ALIGN_SIZE(TCP_MSS+40+PBUF_LINK_ENCAPSULATION_HLEN+PBUF_LINK_HLEN)
 #endif
+
+/**
+ * LWIP_PBUF_EXT==1: Enable pbuf_alloc_ext(), pbufs referencing memory lent by
+ * the application that tell it once the stack no longer references the memory.
+ * This is what tcp_write_ext(), netconn_write_vectors_ext() and lwip_send_ext()
+ * send from without copying.
+ */
+#if !defined LWIP_PBUF_EXT || defined __DOXYGEN__
+#define LWIP_PBUF_EXT                   0
+#endif
 /**
  * @}
  */
@@ -1770,6 +1843,80 @@
 #define LWIP_SOCKET_OFFSET              0
 #endif
 
+/**
+ * LWIP_SOCKET_MAX: The maximum number of sockets that can be open at the same time.
+ * The socket table starts out empty and grows by LWIP_SOCKET_CHUNK entries as
+ * sockets are opened, so memory follows the highest number of sockets actually
+ * used rather than this limit.
+ */
+#if !defined LWIP_SOCKET_MAX || defined __DOXYGEN__
+#define LWIP_SOCKET_MAX                 MEMP_NUM_NETCONN
+#endif
+
+/**
+ * LWIP_SOCKET_CHUNK: The number of socket table entries allocated at once when
+ * the table grows. Must be a power of two.
+ */
+#if !defined LWIP_SOCKET_CHUNK || defined __DOXYGEN__
+#define LWIP_SOCKET_CHUNK               32
+#endif
+
+/**
+ * LWIP_SOCKET_GENERATION_BITS==n: Tag each socket descriptor with an n bit
+ * count of how often its table entry has been reused, so a descriptor that was
+ * closed fails with EBADF instead of reaching the socket that took its place.
+ * Descriptors are (index << n | generation) + LWIP_SOCKET_OFFSET, 0 leaves them
+ * equal to the table index.
+ */
+#if !defined LWIP_SOCKET_GENERATION_BITS || defined __DOXYGEN__
+#define LWIP_SOCKET_GENERATION_BITS     0
+#endif
+
+/**
+ * LWIP_SOCKET_EPOLL==1: Enable lwip_epoll_create()/lwip_epoll_ctl()/lwip_epoll_wait().
+ * Each socket keeps a list of the epoll sets it is registered with, so an event only
+ * touches the sets interested in that socket and a wait only visits ready sockets.
+ */
+#if !defined LWIP_SOCKET_EPOLL || defined __DOXYGEN__
+#define LWIP_SOCKET_EPOLL               0
+#endif
+
+/**
+ * LWIP_EPOLL_MAX: The maximum number of epoll sets that can exist at the same time.
+ */
+#if !defined LWIP_EPOLL_MAX || defined __DOXYGEN__
+#define LWIP_EPOLL_MAX                  64
+#endif
+
+/**
+ * LWIP_EPOLL_OFFSET: Descriptor of the first epoll set. Epoll descriptors are handed out
+ * from LWIP_EPOLL_OFFSET upwards and must not overlap socket descriptors.
+ */
+#if !defined LWIP_EPOLL_OFFSET || defined __DOXYGEN__
+#define LWIP_EPOLL_OFFSET               0x40000000
+#endif
+
+/**
+ * LWIP_MSGHDR_IOVLEN_TYPE, LWIP_MSGHDR_CONTROLLEN_TYPE: Types of the msg_iovlen and
+ * msg_controllen fields of struct msghdr. Set both to size_t to give struct msghdr
+ * (and struct mmsghdr) the layout glibc uses, so that structs filled in by code built
+ * against the host's socket headers can be passed to lwip_sendmsg()/lwip_recvmsg().
+ */
+#if !defined LWIP_MSGHDR_IOVLEN_TYPE || defined __DOXYGEN__
+#define LWIP_MSGHDR_IOVLEN_TYPE         int
+#endif
+#if !defined LWIP_MSGHDR_CONTROLLEN_TYPE || defined __DOXYGEN__
+#define LWIP_MSGHDR_CONTROLLEN_TYPE     socklen_t
+#endif
+
+/**
+ * LWIP_SENDMMSG_BATCH: The maximum number of datagrams lwip_sendmmsg() hands to
+ * the stack in one call into the TCPIP thread (or under one core lock).
+ */
+#if !defined LWIP_SENDMMSG_BATCH || defined __DOXYGEN__
+#define LWIP_SENDMMSG_BATCH             32
+#endif
+
 /**
  * LWIP_TCP_KEEPALIVE==1: Enable TCP_KEEPIDLE, TCP_KEEPINTVL and TCP_KEEPCNT
  * options processing. Note that TCP_KEEPIDLE and TCP_KEEPINTVL have to be set
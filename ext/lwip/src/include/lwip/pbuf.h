@@ -52,7 +52,7 @@ extern "C" {
  * Currently, the pbuf_custom code is only needed for one specific configuration
  * of IP_FRAG, unless required by external driver/application code. */
 #ifndef LWIP_SUPPORT_CUSTOM_PBUF
-#define LWIP_SUPPORT_CUSTOM_PBUF ((IP_FRAG && !LWIP_NETIF_TX_SINGLE_PBUF) || (LWIP_IPV6 && LWIP_IPV6_FRAG))
+#define LWIP_SUPPORT_CUSTOM_PBUF ((IP_FRAG && !LWIP_NETIF_TX_SINGLE_PBUF) || (LWIP_IPV6 && LWIP_IPV6_FRAG) || LWIP_PBUF_EXT)
 #endif
 
 /* @todo: We need a mechanism to prevent wasting memory in every pbuf
@@ -137,6 +137,11 @@ typedef enum {
 #define PBUF_FLAG_LLMCAST   0x10U
 /** indicates this pbuf includes a TCP FIN flag */
 #define PBUF_FLAG_TCP_FIN   0x20U
+/** indicates the netif driver has already verified this packet's TCP/UDP checksum */
+#define PBUF_FLAG_CHKSUM_VERIFIED 0x40U
+
+/** Opens a block that is skipped for packets marked with PBUF_FLAG_CHKSUM_VERIFIED */
+#define IF__PBUF_CHECKSUM_UNVERIFIED(p) if (((p)->flags & PBUF_FLAG_CHKSUM_VERIFIED) == 0)
 
 /** Main packet buffer struct */
 struct pbuf {
@@ -198,6 +203,18 @@ struct pbuf_custom {
 };
 #endif /* LWIP_SUPPORT_CUSTOM_PBUF */
 
+#if LWIP_PBUF_EXT
+/** Memory lent to the stack by the application: every pbuf created for it by
+ * pbuf_alloc_ext() holds a reference, release() is called once the last one
+ * is gone (possibly from the TCPIP thread, so it must not call into the stack). */
+struct pbuf_ext {
+  /** number of references, set to 1 by the lender, who gives it up with pbuf_ext_free() */
+  u32_t ref;
+  /** called once the memory isn't referenced anymore */
+  void (*release)(struct pbuf_ext *ext);
+};
+#endif /* LWIP_PBUF_EXT */
+
 /** Define this to 0 to prevent freeing ooseq pbufs when the PBUF_POOL is empty */
 #ifndef PBUF_POOL_FREE_OOSEQ
 #define PBUF_POOL_FREE_OOSEQ 1
@@ -226,6 +243,10 @@ struct pbuf *pbuf_alloced_custom(pbuf_layer l, u16_t length, pbuf_type type,
                                  struct pbuf_custom *p, void *payload_mem,
                                  u16_t payload_mem_len);
 #endif /* LWIP_SUPPORT_CUSTOM_PBUF */
+#if LWIP_PBUF_EXT
+struct pbuf *pbuf_alloc_ext(const void *payload, u16_t length, struct pbuf_ext *ext);
+void pbuf_ext_free(struct pbuf_ext *ext);
+#endif /* LWIP_PBUF_EXT */
 void pbuf_realloc(struct pbuf *p, u16_t size);
 u8_t pbuf_header(struct pbuf *p, s16_t header_size);
 u8_t pbuf_header_force(struct pbuf *p, s16_t header_size);
@@ -86,6 +86,12 @@ struct api_msg {
   union {
     /** used for lwip_netconn_do_send */
     struct netbuf *b;
+    /** used for lwip_netconn_do_send_batch */
+    struct {
+      struct netbuf **bufs;
+      u16_t count;
+      u16_t sent;
+    } sb;
     /** used for lwip_netconn_do_newconn */
     struct {
       u8_t proto;
@@ -103,9 +109,19 @@ struct api_msg {
     } ad;
     /** used for lwip_netconn_do_write */
     struct {
-      const void *dataptr;
+      /** current vector to write */
+      const struct netvector *vector;
+      /** number of unwritten vectors, including the current one */
+      u16_t vector_cnt;
+      /** offset into the current vector */
+      size_t vector_off;
+      /** total length of all vectors, bytes written when done */
       size_t len;
       u8_t apiflags;
+#if LWIP_PBUF_EXT
+      /** lent memory the vectors point into, NULL if not lent */
+      struct pbuf_ext *ext;
+#endif /* LWIP_PBUF_EXT */
 #if LWIP_SO_SNDTIMEO
       u32_t time_started;
 #endif /* LWIP_SO_SNDTIMEO */
@@ -188,6 +204,7 @@ void lwip_netconn_do_connect         (void *m);
 void lwip_netconn_do_disconnect      (void *m);
 void lwip_netconn_do_listen          (void *m);
 void lwip_netconn_do_send            (void *m);
+void lwip_netconn_do_send_batch      (void *m);
 void lwip_netconn_do_recv            (void *m);
 #if TCP_LISTEN_BACKLOG
 void lwip_netconn_do_accepted        (void *m);
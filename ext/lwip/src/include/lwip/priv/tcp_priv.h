@@ -334,6 +334,33 @@ extern struct tcp_pcb ** const tcp_pcb_lists[NUM_TCP_PCB_LISTS];
    3) All PCBs in the tcp_listen_pcbs list is in LISTEN state.
    4) All PCBs in the tcp_tw_pcbs list is in TIME-WAIT state.
 */
+#if LWIP_TCP_PCB_HASH
+/* Hash tables mirroring tcp_active_pcbs + tcp_tw_pcbs and tcp_listen_pcbs,
+   updated by TCP_REG and TCP_RMV (no-ops for other lists) */
+void tcp_pcb_hash_add(struct tcp_pcb **pcbs, struct tcp_pcb *pcb);
+void tcp_pcb_hash_remove(struct tcp_pcb **pcbs, struct tcp_pcb *pcb);
+struct tcp_pcb *tcp_pcb_hash_lookup(const ip_addr_t *local_ip, u16_t local_port,
+                                    const ip_addr_t *remote_ip, u16_t remote_port);
+struct tcp_pcb_listen *tcp_listen_hash_lookup(const ip_addr_t *local_ip, u16_t local_port);
+#define TCP_PCB_HASH_ADD(pcbs, npcb) tcp_pcb_hash_add(pcbs, npcb)
+#define TCP_PCB_HASH_RMV(pcbs, npcb) tcp_pcb_hash_remove(pcbs, npcb)
+#else /* LWIP_TCP_PCB_HASH */
+#define TCP_PCB_HASH_ADD(pcbs, npcb)
+#define TCP_PCB_HASH_RMV(pcbs, npcb)
+#endif /* LWIP_TCP_PCB_HASH */
+
+#if LWIP_TCP_TIMER_WHEEL
+/* Timer wheel holding the PCBs of tcp_active_pcbs and tcp_tw_pcbs that have a
+   timer running, updated by TCP_REG and TCP_RMV (no-ops for other lists) */
+void tcp_timer_reg(struct tcp_pcb **pcbs, struct tcp_pcb *pcb);
+void tcp_timer_rmv(struct tcp_pcb **pcbs, struct tcp_pcb *pcb);
+#define TCP_TIMER_REG(pcbs, npcb) tcp_timer_reg(pcbs, npcb)
+#define TCP_TIMER_RMV(pcbs, npcb) tcp_timer_rmv(pcbs, npcb)
+#else /* LWIP_TCP_TIMER_WHEEL */
+#define TCP_TIMER_REG(pcbs, npcb)
+#define TCP_TIMER_RMV(pcbs, npcb)
+#endif /* LWIP_TCP_TIMER_WHEEL */
+
 /* Define two macros, TCP_REG and TCP_RMV that registers a TCP PCB
    with a PCB list or removes a PCB from a list, respectively. */
 #ifndef TCP_DEBUG_PCB_LISTS
@@ -352,6 +379,8 @@ extern struct tcp_pcb ** const tcp_pcb_lists[NUM_TCP_PCB_LISTS];
                             (npcb)->next = *(pcbs); \
                             LWIP_ASSERT("TCP_REG: npcb->next != npcb", (npcb)->next != (npcb)); \
                             *(pcbs) = (npcb); \
+                            TCP_PCB_HASH_ADD(pcbs, npcb); \
+                            TCP_TIMER_REG(pcbs, npcb); \
                             LWIP_ASSERT("TCP_RMV: tcp_pcbs sane", tcp_pcbs_sane()); \
               tcp_timer_needed(); \
                             } while(0)
@@ -368,6 +397,8 @@ extern struct tcp_pcb ** const tcp_pcb_lists[NUM_TCP_PCB_LISTS];
                                } \
                             } \
                             (npcb)->next = NULL; \
+                            TCP_PCB_HASH_RMV(pcbs, npcb); \
+                            TCP_TIMER_RMV(pcbs, npcb); \
                             LWIP_ASSERT("TCP_RMV: tcp_pcbs sane", tcp_pcbs_sane()); \
                             LWIP_DEBUGF(TCP_DEBUG, ("TCP_RMV: removed %p from %p\n", (npcb), *(pcbs))); \
                             } while(0)
@@ -378,6 +409,8 @@ extern struct tcp_pcb ** const tcp_pcb_lists[NUM_TCP_PCB_LISTS];
   do {                                             \
     (npcb)->next = *pcbs;                          \
     *(pcbs) = (npcb);                              \
+    TCP_PCB_HASH_ADD(pcbs, npcb);                  \
+    TCP_TIMER_REG(pcbs, npcb);                     \
     tcp_timer_needed();                            \
   } while (0)
 
@@ -398,6 +431,8 @@ extern struct tcp_pcb ** const tcp_pcb_lists[NUM_TCP_PCB_LISTS];
       }                                            \
     }                                              \
     (npcb)->next = NULL;                           \
+    TCP_PCB_HASH_RMV(pcbs, npcb);                  \
+    TCP_TIMER_RMV(pcbs, npcb);                     \
   } while(0)
 
 #endif /* LWIP_DEBUG */
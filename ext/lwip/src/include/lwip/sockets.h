@@ -155,12 +155,18 @@ struct msghdr {
   void         *msg_name;
   socklen_t     msg_namelen;
   struct iovec *msg_iov;
-  int           msg_iovlen;
+  LWIP_MSGHDR_IOVLEN_TYPE msg_iovlen;
   void         *msg_control;
-  socklen_t     msg_controllen;
+  LWIP_MSGHDR_CONTROLLEN_TYPE msg_controllen;
   int           msg_flags;
 };
 
+/** One message of lwip_sendmmsg()/lwip_recvmmsg() */
+struct mmsghdr {
+  struct msghdr msg_hdr;
+  unsigned int  msg_len;   /* bytes sent or received for this message */
+};
+
 /* Socket protocol types (TCP/UDP/RAW) */
 #define SOCK_STREAM     1
 #define SOCK_DGRAM      2
@@ -239,6 +245,11 @@ struct linger {
 #define MSG_OOB        0x04    /* Unimplemented: Requests out-of-band data. The significance and semantics of out-of-band data are protocol-specific */
 #define MSG_DONTWAIT   0x08    /* Nonblocking i/o for this operation only */
 #define MSG_MORE       0x10    /* Sender will send more */
+#define MSG_WAITFORONE 0x20    /* lwip_recvmmsg(): only wait for the first message, then take what is queued */
+
+/* Flags returned in msghdr.msg_flags by lwip_recvmsg() */
+#define MSG_TRUNC      0x40    /* The datagram was larger than the buffers and has been truncated */
+#define MSG_CTRUNC     0x80    /* Control data was discarded (always, no control data is supported) */
 
 
 /*
@@ -463,8 +474,11 @@ void lwip_socket_thread_cleanup(void); /* LWIP_NETCONN_SEM_PER_THREAD==1: destro
 #define lwip_listen       listen
 #define lwip_recv         recv
 #define lwip_recvfrom     recvfrom
+#define lwip_recvmsg      recvmsg
+#define lwip_recvmmsg     recvmmsg
 #define lwip_send         send
 #define lwip_sendmsg      sendmsg
+#define lwip_sendmmsg     sendmmsg
 #define lwip_sendto       sendto
 #define lwip_socket       socket
 #define lwip_select       select
@@ -472,6 +486,7 @@ void lwip_socket_thread_cleanup(void); /* LWIP_NETCONN_SEM_PER_THREAD==1: destro
 
 #if LWIP_POSIX_SOCKETS_IO_NAMES
 #define lwip_read         read
+#define lwip_readv        readv
 #define lwip_write        write
 #define lwip_writev       writev
 #undef lwip_close
@@ -494,10 +509,20 @@ int lwip_connect(int s, const struct sockaddr *name, socklen_t namelen);
 int lwip_listen(int s, int backlog);
 int lwip_recv(int s, void *mem, size_t len, int flags);
 int lwip_read(int s, void *mem, size_t len);
+int lwip_readv(int s, const struct iovec *iov, int iovcnt);
+int lwip_recv_zc(int s, struct iovec *iov, int *iovcnt, void **loan, int flags);
+int lwip_recv_zc_release(void *loan);
 int lwip_recvfrom(int s, void *mem, size_t len, int flags,
       struct sockaddr *from, socklen_t *fromlen);
+int lwip_recvmsg(int s, struct msghdr *message, int flags);
+int lwip_recvmmsg(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags);
 int lwip_send(int s, const void *dataptr, size_t size, int flags);
+#if LWIP_PBUF_EXT
+struct pbuf_ext;
+int lwip_send_ext(int s, const void *dataptr, size_t size, int flags, struct pbuf_ext *ext);
+#endif /* LWIP_PBUF_EXT */
 int lwip_sendmsg(int s, const struct msghdr *message, int flags);
+int lwip_sendmmsg(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags);
 int lwip_sendto(int s, const void *dataptr, size_t size, int flags,
     const struct sockaddr *to, socklen_t tolen);
 int lwip_socket(int domain, int type, int protocol);
@@ -507,6 +532,43 @@ int lwip_select(int maxfdp1, fd_set *readset, fd_set *writeset, fd_set *exceptse
                 struct timeval *timeout);
 int lwip_ioctl(int s, long cmd, void *argp);
 int lwip_fcntl(int s, int cmd, int val);
+int lwip_socket_peek_error(int s);
+
+#if LWIP_SOCKET_EPOLL
+/* Event flags for lwip_epoll_ctl()/lwip_epoll_wait(), values match Linux <sys/epoll.h> */
+#define LWIP_EPOLLIN       0x001U
+#define LWIP_EPOLLOUT      0x004U
+#define LWIP_EPOLLERR      0x008U
+#define LWIP_EPOLLHUP      0x010U
+#define LWIP_EPOLLONESHOT  (1U << 30)
+#define LWIP_EPOLLET       (1U << 31)
+
+/* Operations for lwip_epoll_ctl() */
+#define LWIP_EPOLL_CTL_ADD 1
+#define LWIP_EPOLL_CTL_DEL 2
+#define LWIP_EPOLL_CTL_MOD 3
+
+typedef union lwip_epoll_data {
+  void *ptr;
+  int fd;
+  u32_t u32;
+  uint64_t u64;
+} lwip_epoll_data_t;
+
+struct lwip_epoll_event {
+  u32_t events;
+  lwip_epoll_data_t data;
+};
+
+int lwip_epoll_create(int size);
+int lwip_epoll_ctl(int epfd, int op, int s, struct lwip_epoll_event *event);
+int lwip_epoll_wait(int epfd, struct lwip_epoll_event *events, int maxevents, int timeout);
+
+/** Told whether an epoll set has become ready (1) or idle (0), called with SYS_ARCH
+ * protected. Called once more with -1 (not protected) after the set has been closed. */
+typedef void (*lwip_epoll_hook_fn)(void *arg, int ready);
+int lwip_epoll_set_hook(int epfd, lwip_epoll_hook_fn hook, void *arg);
+#endif /* LWIP_SOCKET_EPOLL */
 
 #if LWIP_COMPAT_SOCKETS
 #if LWIP_COMPAT_SOCKETS != 2
@@ -515,6 +577,8 @@ int lwip_fcntl(int s, int cmd, int val);
 /** @ingroup socket */
 #define read(s,mem,len)                           lwip_read(s,mem,len)
 /** @ingroup socket */
+#define readv(s,iov,iovcnt)                       lwip_readv(s,iov,iovcnt)
+/** @ingroup socket */
 #define write(s,dataptr,len)                      lwip_write(s,dataptr,len)
 /** @ingroup socket */
 #define writev(s,iov,iovcnt)                      lwip_writev(s,iov,iovcnt)
@@ -168,8 +168,15 @@ enum tcp_state {
 /**
  * members common to struct tcp_pcb and struct tcp_listen_pcb
  */
+#if LWIP_TCP_PCB_HASH
+#define TCP_PCB_HASH_NEXT(type) type *hash_next; /* for the hash table bucket */
+#else /* LWIP_TCP_PCB_HASH */
+#define TCP_PCB_HASH_NEXT(type)
+#endif /* LWIP_TCP_PCB_HASH */
+
 #define TCP_PCB_COMMON(type) \
   type *next; /* for the linked list */ \
+  TCP_PCB_HASH_NEXT(type) \
   void *callback_arg; \
   enum tcp_state state; /* TCP state */ \
   u8_t prio; \
@@ -232,6 +239,13 @@ struct tcp_pcb {
   u8_t polltmr, pollinterval;
   u8_t last_timer;
   u32_t tmr;
+#if LWIP_TCP_TIMER_WHEEL
+  /* timer wheel slot chain, only linked while a timer is running */
+  struct tcp_pcb *wheel_next, **wheel_pprev;
+  u32_t wheel_due;   /* wheel tick at which the PCB is looked at next */
+  u32_t wheel_ticks; /* tcp_ticks when polltmr was last advanced */
+  u8_t wheel_reg;    /* on tcp_active_pcbs or tcp_tw_pcbs */
+#endif /* LWIP_TCP_TIMER_WHEEL */
 
   /* receiver variables */
   u32_t rcv_nxt;   /* next seqno expected */
@@ -360,6 +374,13 @@ void             tcp_err     (struct tcp_pcb *pcb, tcp_err_fn err);
 void             tcp_accept  (struct tcp_pcb *pcb, tcp_accept_fn accept);
 #endif /* LWIP_CALLBACK_API */
 void             tcp_poll    (struct tcp_pcb *pcb, tcp_poll_fn poll, u8_t interval);
+#if LWIP_TCP_TIMER_WHEEL
+/* Have the timer wheel look at a PCB on the next tick, for code outside TCP
+   that changes its timer settings (e.g. keepalive) */
+void             tcp_timer_kick(struct tcp_pcb *pcb);
+#else /* LWIP_TCP_TIMER_WHEEL */
+#define          tcp_timer_kick(pcb)
+#endif /* LWIP_TCP_TIMER_WHEEL */
 
 #if LWIP_TCP_TIMESTAMPS
 #define          tcp_mss(pcb)             (((pcb)->flags & TF_TIMESTAMP) ? ((pcb)->mss - 12)  : (pcb)->mss)
@@ -409,6 +430,10 @@ err_t            tcp_shutdown(struct tcp_pcb *pcb, int shut_rx, int shut_tx);
 
 err_t            tcp_write   (struct tcp_pcb *pcb, const void *dataptr, u16_t len,
                               u8_t apiflags);
+#if LWIP_PBUF_EXT
+err_t            tcp_write_ext(struct tcp_pcb *pcb, const void *dataptr, u16_t len,
+                              u8_t apiflags, struct pbuf_ext *ext);
+#endif /* LWIP_PBUF_EXT */
 
 void             tcp_setprio (struct tcp_pcb *pcb, u8_t prio);
 
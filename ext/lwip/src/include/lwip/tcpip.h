@@ -52,10 +52,14 @@ extern "C" {
 #if LWIP_TCPIP_CORE_LOCKING
 /** The global semaphore to lock the stack. */
 extern sys_mutex_t lock_tcpip_core;
+/** Called with the core still locked right before each UNLOCK_TCPIP_CORE(), i.e. at the
+    end of every unit of stack work (may be NULL). Used by drivers to flush deferred output. */
+extern void (*tcpip_core_unlock_hook)(void);
 /** Lock lwIP core mutex (needs @ref LWIP_TCPIP_CORE_LOCKING 1) */
 #define LOCK_TCPIP_CORE()     sys_mutex_lock(&lock_tcpip_core)
 /** Unlock lwIP core mutex (needs @ref LWIP_TCPIP_CORE_LOCKING 1) */
-#define UNLOCK_TCPIP_CORE()   sys_mutex_unlock(&lock_tcpip_core)
+#define UNLOCK_TCPIP_CORE()   do { if (tcpip_core_unlock_hook != NULL) { tcpip_core_unlock_hook(); } \
+                                   sys_mutex_unlock(&lock_tcpip_core); } while(0)
 #else /* LWIP_TCPIP_CORE_LOCKING */
 #define LOCK_TCPIP_CORE()
 #define UNLOCK_TCPIP_CORE()
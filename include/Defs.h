@@ -154,6 +154,46 @@ typedef signed char err_t;
  */
 #define LWIP_STATUS_TMR_INTERVAL           500
 
+/**
+ * Number of bytes that should be reserved in front of a frame handed to VirtualTap::putLoaned()
+ * so that the Ethernet header can be written in place (must be at least 14)
+ */
+#define ZT_RX_LOAN_HEADROOM                16
+
+/**
+ * Maximum number of loaned (zero-copy) RX frame buffers the stack may hold at once
+ */
+#define ZT_RX_LOAN_POOL_SIZE               1024
+
+/**
+ * Maximum number of pbufs in an outgoing frame that will be passed to the scatter-gather
+ * virtual wire handler, longer chains are flattened into a single buffer
+ */
+#define ZT_TX_MAX_IOV                      16
+
+/**
+ * Whether incoming frames are fed into the stack by the thread calling VirtualTap::put() instead
+ * of being queued for the tcpip thread (see zts_set_rx_inline())
+ */
+#define ZT_RX_INLINE                       false
+
+/**
+ * Default number of RX shard threads. Incoming frames are steered to a shard by a hash of their
+ * flow (addresses, protocol and ports), the shard verifies their TCP/UDP checksums and feeds them
+ * into the (single) stack in batches. 0 disables sharding (see zts_set_rx_shards())
+ */
+#define ZT_RX_SHARDS                       0
+
+/**
+ * Upper bound on the number of RX shard threads
+ */
+#define ZT_RX_SHARDS_MAX                   64
+
+/**
+ * Maximum number of frames waiting in a single RX shard, further frames are dropped
+ */
+#define ZT_RX_SHARD_QUEUE_LEN              4096
+
 // #define LWIP_CHKSUM <your_checksum_routine>, See: RFC1071 for inspiration
 #endif
 
@@ -169,7 +209,8 @@ typedef signed char err_t;
 /****************************************************************************/
 
 /**
- * Maximum number of sockets that libzt can administer
+ * Maximum number of sockets that libzt keeps per-socket counters for. The socket table
+ * itself grows on demand up to LWIP_SOCKET_MAX (see lwipopts.h)
  */
 #define ZT_MAX_SOCKETS                     1024
 
@@ -198,6 +239,32 @@ typedef signed char err_t;
  */
 #define ZT_PHY_POLL_INTERVAL               5
 
+/**
+ * Maximum number of frames handed to the tcpip thread in a single message by VirtualTap::putBatch()
+ */
+#define ZT_RX_BATCH_MAX                    64
+
+/**
+ * Number of power-of-two buckets in the RX batch size histogram (enough to cover ZT_RX_BATCH_MAX)
+ */
+#define ZT_RX_BATCH_HIST_LEN               7
+
+/**
+ * Default maximum time (in microseconds) an outgoing frame may wait in a VirtualTap's TX staging
+ * queue before it is flushed onto the virtual wire, 0 disables TX staging
+ */
+#define ZT_TX_STAGE_LATENCY_CAP            200
+
+/**
+ * Number of frames after which a VirtualTap's TX staging queue is flushed
+ */
+#define ZT_TX_STAGE_MAX_FRAMES             64
+
+/**
+ * Number of bytes after which a VirtualTap's TX staging queue is flushed
+ */
+#define ZT_TX_STAGE_MAX_BYTES              131072
+
 /**
  * State check interval (in ms) for VirtualSocket state
  */
@@ -213,6 +280,11 @@ typedef signed char err_t;
  */
 #define ZT_API_CHECK_INTERVAL              50
 
+/**
+ * Longest wait (in ms) on libzt sockets before zts_poll() checks the host descriptors of a mixed set again
+ */
+#define ZT_POLL_HOST_INTERVAL              10
+
 /**
  * Maximum size of guarded RX buffer (for picoTCP raw driver only)
  */
@@ -310,6 +382,78 @@ typedef signed char err_t;
  */
 #define ZT_HOUSEKEEPING_INTERVAL           3
 
+/**
+ * Number of reader slots used by getTapByAddr() to announce lock-free reads of the routing cache,
+ * readers hash onto a slot so that concurrent lookups rarely share a cache line
+ */
+#define ZT_TAP_ROUTES_READER_SLOTS         16
+
+/**
+ * Trace levels for zts_set_trace_level()
+ */
+#define ZT_TRACE_OFF                       0 // record nothing
+#define ZT_TRACE_DROPS                     1 // record dropped frames
+#define ZT_TRACE_FRAMES                    2 // record dropped frames and every frame sent or received
+
+/**
+ * Default trace level
+ */
+#define ZT_TRACE_LEVEL                     ZT_TRACE_OFF
+
+/**
+ * Number of events kept in each thread's trace ring (must be a power of two), older events are
+ * overwritten
+ */
+#define ZT_TRACE_RING_LEN                  4096
+
+/**
+ * Version of struct zts_stats filled by zts_get_stats(), incremented whenever its layout changes
+ */
+#define ZT_STATS_VERSION                   2
+
+/**
+ * Maximum number of network stack memory pools, VirtualTaps and sockets reported by zts_get_stats()
+ */
+#define ZT_STATS_MAX_POOLS                 32
+#define ZT_STATS_MAX_TAPS                  16
+#define ZT_STATS_MAX_SOCKETS               ZT_MAX_SOCKETS
+
+/**
+ * Events for zts_epoll_ctl() and zts_epoll_wait(), same values as Linux <sys/epoll.h>
+ */
+#define ZTS_EPOLLIN                        0x001
+#define ZTS_EPOLLOUT                       0x004
+#define ZTS_EPOLLERR                       0x008 // always reported, need not be requested
+#define ZTS_EPOLLHUP                       0x010 // remote host closed the connection, always reported
+#define ZTS_EPOLLONESHOT                   (1U << 30)
+#define ZTS_EPOLLET                        (1U << 31)
+
+/**
+ * Operations for zts_epoll_ctl()
+ */
+#define ZTS_EPOLL_CTL_ADD                  1
+#define ZTS_EPOLL_CTL_DEL                  2
+#define ZTS_EPOLL_CTL_MOD                  3
+
+/**
+ * Flags for zts_recvmmsg(), and flags returned in msg_flags by zts_recvmsg() and zts_recvmmsg().
+ * These are the network stack's values, not the host's
+ */
+#define ZTS_MSG_DONTWAIT                   0x08
+#define ZTS_MSG_WAITFORONE                 0x20 // block for the first message only
+#define ZTS_MSG_TRUNC                      0x40 // datagram didn't fit into the buffers
+#define ZTS_MSG_CTRUNC                     0x80 // ancillary data is not supported
+
+/**
+ * Operations for zts_ring_submit()
+ */
+#define ZTS_RING_NOP                       0 // completes right away with 0
+#define ZTS_RING_CONNECT                   1
+#define ZTS_RING_ACCEPT                    2
+#define ZTS_RING_SEND                      3
+#define ZTS_RING_RECV                      4
+#define ZTS_RING_CLOSE                     5
+
 /**
  * Whether or not we want libzt to exit on internal failure
  */
@@ -327,9 +471,17 @@ typedef signed char err_t;
 #define ZT_RECV_SIG int fd, void *buf, size_t len, int flags
 #define ZT_RECVFROM_SIG int fd, void *buf, size_t len, int flags, struct sockaddr *addr, socklen_t *addrlen
 #define ZT_RECVMSG_SIG int fd, struct msghdr *msg,int flags
+#define ZT_SENDMMSG_SIG int fd, struct zts_mmsghdr *msgvec, unsigned int vlen, int flags
+#define ZT_RECVMMSG_SIG int fd, struct zts_mmsghdr *msgvec, unsigned int vlen, int flags
 #define ZT_SEND_SIG int fd, const void *buf, size_t len, int flags
+#define ZT_SEND_ZC_SIG int fd, const void *buf, size_t len, int flags, void *cookie
+#define ZT_SEND_ZC_REAP_SIG struct zts_zc_completion *completions, int max, int timeout_ms
 #define ZT_READ_SIG int fd, void *buf, size_t len
 #define ZT_WRITE_SIG int fd, const void *buf, size_t len
+#define ZT_READV_SIG int fd, const struct iovec *iov, int iovcnt
+#define ZT_RECV_ZC_SIG int fd, struct iovec *iov, int *iovcnt, void **handle, int flags
+#define ZT_BUF_RELEASE_SIG void *handle
+#define ZT_WRITEV_SIG int fd, const struct iovec *iov, int iovcnt
 #define ZT_SHUTDOWN_SIG int fd, int how
 #define ZT_SOCKET_SIG int socket_family, int socket_type, int protocol
 #define ZT_CONNECT_SIG int fd, const struct sockaddr *addr, socklen_t addrlen
@@ -340,6 +492,10 @@ typedef signed char err_t;
 #define ZT_CLOSE_SIG int fd
 #define ZT_POLL_SIG struct pollfd *fds, nfds_t nfds, int timeout
 #define ZT_SELECT_SIG int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout
+#define ZT_RING_CREATE_SIG unsigned int entries
+#define ZT_RING_SUBMIT_SIG struct zts_ring *ring, const struct zts_ring_sqe *sqes, int n
+#define ZT_RING_WAIT_SIG struct zts_ring *ring, struct zts_ring_cqe *cqes, int max, int timeout_ms
+#define ZT_RING_CLOSE_SIG struct zts_ring *ring
 #define ZT_GETSOCKNAME_SIG int fd, struct sockaddr *addr, socklen_t *addrlen
 #define ZT_GETPEERNAME_SIG int fd, struct sockaddr *addr, socklen_t *addrlen
 #define ZT_GETHOSTNAME_SIG char *name, size_t len
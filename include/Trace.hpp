@@ -0,0 +1,117 @@
+/*
+ * ZeroTier SDK - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+/**
+ * @file
+ *
+ * Binary event tracing for the data path. Events are fixed-size records appended to a
+ * per-thread ring and only turned into text when the rings are dumped with zts_dump_trace()
+ */
+
+#ifndef LIBZT_TRACE_HPP
+#define LIBZT_TRACE_HPP
+
+#include <stdint.h>
+#include <atomic>
+
+#include "Defs.h"
+
+/**
+ * Trace event types
+ */
+#define ZT_TRACE_ETH_TX                    1 // frame sent onto the virtual wire
+#define ZT_TRACE_ETH_RX                    2 // frame received from the virtual wire (copied)
+#define ZT_TRACE_ETH_RX_LOANED             3 // frame received from the virtual wire (loaned buffer)
+#define ZT_TRACE_DROP                      4 // frame(s) dropped, arg holds one of ZT_TRACE_DROP_*
+
+/**
+ * Reasons recorded with ZT_TRACE_DROP events
+ */
+#define ZT_TRACE_DROP_NO_PBUF              1 // no pbufs available
+#define ZT_TRACE_DROP_SHORT_PBUF           2 // first pbuf smaller than ethernet header
+#define ZT_TRACE_DROP_TX_TOO_LARGE         3 // frame larger than TX buffer
+#define ZT_TRACE_DROP_BAD_CHECKSUM         4 // bad TCP/UDP checksum (RX shards)
+#define ZT_TRACE_DROP_SHARD_FULL           5 // RX shard queue full
+#define ZT_TRACE_DROP_MBOX_FULL            6 // tcpip mbox full
+#define ZT_TRACE_DROP_NO_MEM               7 // unable to allocate batch
+#define ZT_TRACE_DROP_INPUT                8 // stack interface rejected the frame
+
+/**
+ * One trace event. For frame events len is the frame length and arg the ethertype, for drops
+ * len is the number of frames dropped and arg the reason
+ */
+struct zt_trace_record
+{
+	uint64_t ts; // monotonic time (in us)
+	uint64_t nwid;
+	uint32_t len;
+	uint16_t event;
+	uint16_t arg;
+	uint8_t src[6];
+	uint8_t dst[6];
+};
+
+/**
+ * Current trace level (ZT_TRACE_OFF, ZT_TRACE_DROPS or ZT_TRACE_FRAMES), read with a relaxed load
+ * on the data path so that a disabled trace point costs one predictable branch
+ */
+extern std::atomic<int> zt_trace_level;
+
+/**
+ * Appends a record to the calling thread's trace ring. Don't call directly, use the macros below
+ */
+void zt_trace_event(uint16_t event, uint16_t arg, uint64_t nwid, const void *src, const void *dst, uint32_t len);
+
+#if defined(__GNUC__)
+	#define ZT_TRACE_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+	#define ZT_TRACE_UNLIKELY(x) (x)
+#endif
+
+#define ZT_TRACE_ENABLED(level) \
+	ZT_TRACE_UNLIKELY(zt_trace_level.load(std::memory_order_relaxed) >= (level))
+
+/**
+ * Records a frame crossing the virtual wire. src and dst point at 6-byte MAC addresses
+ */
+#define ZT_TRACE_FRAME(event, nwid, src, dst, proto, len) \
+	do { \
+		if (ZT_TRACE_ENABLED(ZT_TRACE_FRAMES)) { \
+			zt_trace_event(event, proto, nwid, src, dst, len); \
+		} \
+	} while (0)
+
+/**
+ * Records count dropped frames. src and dst may be NULL when the addresses are not known
+ */
+#define ZT_TRACE_DROPPED(reason, nwid, src, dst, count) \
+	do { \
+		if (ZT_TRACE_ENABLED(ZT_TRACE_DROPS)) { \
+			zt_trace_event(ZT_TRACE_DROP, reason, nwid, src, dst, count); \
+		} \
+	} while (0)
+
+#endif // _H
@@ -85,6 +85,41 @@ int zts_get_device_id_from_file(const char *filepath, char *devID);
  */
 void *zts_start_service(void *thread_id);
 
+/**
+ * @brief Returns the VirtualTap whose assigned subnets or managed routes best match an address
+ *
+ * @usage For internal use only. Lock-free and allocation-free, safe to call per connection
+ * @param addr Destination address
+ * @return The VirtualTap with the longest matching prefix, or NULL if none matches
+ */
+ZeroTier::VirtualTap *getTapByAddr(ZeroTier::InetAddress *addr);
+
+/**
+ * @brief Rebuilds the routing cache used by getTapByAddr()
+ *
+ * @usage For internal use only. Call whenever a tap's addresses or managed routes change
+ * @return
+ */
+void rebuildTapRoutes();
+
+/**
+ * @brief Removes a VirtualTap from the list of taps and from the routing cache
+ *
+ * @usage For internal use only. Called when a VirtualTap is destroyed
+ * @param tap
+ * @return
+ */
+void removeTap(ZeroTier::VirtualTap *tap);
+
+/**
+ * @brief Copies every VirtualTap's frame, byte and drop counters into a stats snapshot
+ *
+ * @usage For internal use only. Called by zts_get_stats()
+ * @param stats Snapshot to fill in
+ * @return
+ */
+void getTapStats(struct zts_stats *stats);
+
 /**
  * @brief Stops all VirtualTap interfaces and associated I/O loops
  *
@@ -0,0 +1,514 @@
+/*
+ * ZeroTier SDK - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+/**
+ * @file
+ *
+ * Header-only C++20 coroutine layer over the zts_ring_* API. A Reactor owns one ring and drives
+ * any number of Task coroutines from the thread that calls Reactor::run(): socket operations are
+ * submitted to the ring in batches when every runnable task has suspended, and each completion
+ * resumes the task that was waiting for it. The library itself doesn't need C++20, only code that
+ * includes this header does
+ */
+
+#ifndef LIBZT_ZTCOROUTINE_HPP
+#define LIBZT_ZTCOROUTINE_HPP
+
+#if __cplusplus < 202002L
+#error "ZTCoroutine.hpp requires C++20"
+#endif
+
+#include <errno.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include <chrono>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <list>
+#include <optional>
+#include <queue>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "libzt.h"
+
+namespace ZeroTier {
+namespace Coro {
+
+class Reactor;
+
+template <typename T> class Task;
+
+namespace detail {
+
+/**
+ * State shared by every Task promise: who to resume when the task finishes, and for tasks handed
+ * to Reactor::spawn(), where the reactor keeps track of them
+ */
+struct PromiseBase
+{
+	std::coroutine_handle<> continuation;
+	std::exception_ptr exception;
+	Reactor *owner = nullptr;
+	std::list<std::coroutine_handle<>>::iterator root;
+
+	struct FinalAwaiter
+	{
+		bool await_ready() noexcept { return false; }
+		template <typename P>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept;
+		void await_resume() noexcept {}
+	};
+
+	std::suspend_always initial_suspend() noexcept { return {}; }
+	FinalAwaiter final_suspend() noexcept { return {}; }
+	void unhandled_exception() noexcept { exception = std::current_exception(); }
+};
+
+template <typename T>
+struct Promise : PromiseBase
+{
+	std::optional<T> value;
+	Task<T> get_return_object() noexcept;
+	template <typename U>
+	void return_value(U &&v) { value.emplace(std::forward<U>(v)); }
+	T result()
+	{
+		if (exception) {
+			std::rethrow_exception(exception);
+		}
+		return std::move(*value);
+	}
+};
+
+template <>
+struct Promise<void> : PromiseBase
+{
+	Task<void> get_return_object() noexcept;
+	void return_void() noexcept {}
+	void result()
+	{
+		if (exception) {
+			std::rethrow_exception(exception);
+		}
+	}
+};
+
+} // namespace detail
+
+/**
+ * A lazily started coroutine. It runs when it is awaited by another task (which resumes once it
+ * finishes, with its result) or when it is handed to Reactor::spawn(). A Task owns its frame,
+ * destroying a Task that hasn't finished destroys the suspended coroutine with it. Awaiting an empty
+ * (default-constructed or moved-from) Task throws std::logic_error
+ */
+template <typename T = void>
+class Task
+{
+public:
+	typedef detail::Promise<T> promise_type;
+
+	Task() noexcept {}
+	explicit Task(std::coroutine_handle<promise_type> h) noexcept : _h(h) {}
+	Task(Task &&o) noexcept : _h(std::exchange(o._h, nullptr)) {}
+	Task &operator=(Task &&o) noexcept
+	{
+		if (this != &o) {
+			if (_h) {
+				_h.destroy();
+			}
+			_h = std::exchange(o._h, nullptr);
+		}
+		return *this;
+	}
+	Task(const Task &) = delete;
+	Task &operator=(const Task &) = delete;
+	~Task()
+	{
+		if (_h) {
+			_h.destroy();
+		}
+	}
+
+	bool await_ready() const noexcept { return !_h || _h.done(); }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+	{
+		_h.promise().continuation = awaiting;
+		return _h;
+	}
+	T await_resume()
+	{
+		if (!_h) {
+			throw std::logic_error("awaited an empty Task");
+		}
+		return _h.promise().result();
+	}
+
+private:
+	friend class Reactor;
+	std::coroutine_handle<promise_type> _h;
+};
+
+namespace detail {
+
+template <typename T>
+inline Task<T> Promise<T>::get_return_object() noexcept
+{
+	return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() noexcept
+{
+	return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+} // namespace detail
+
+/**
+ * Drives coroutines over one zts_ring. A reactor and its tasks belong to the thread that calls
+ * run(): awaitables may only be used from tasks running on that reactor. Socket operations
+ * complete with what the equivalent zts_* call would have returned, or -errno on failure
+ */
+class Reactor
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	/**
+	 * @param entries Maximum number of socket operations in flight at once, operations beyond that
+	 * wait in the reactor until earlier ones complete
+	 */
+	explicit Reactor(unsigned int entries = 256) : _ring(zts_ring_create(entries)) {}
+	Reactor(const Reactor &) = delete;
+	Reactor &operator=(const Reactor &) = delete;
+
+	/**
+	 * Closes the ring first so nothing can still write into a task's buffers, then destroys the
+	 * tasks that haven't finished
+	 */
+	~Reactor()
+	{
+		if (_ring) {
+			zts_ring_close(_ring);
+		}
+		while (!_roots.empty()) {
+			std::coroutine_handle<> h = _roots.front();
+			_roots.pop_front();
+			h.destroy();
+		}
+	}
+
+	/**
+	 * @return Whether the underlying ring was created, call this after zts_start() has succeeded
+	 */
+	bool valid() const { return _ring != nullptr; }
+
+	/**
+	 * Hands a task to the reactor, it starts on the next pass of run() and its frame is freed when
+	 * it finishes. An exception escaping a spawned task terminates the program
+	 */
+	void spawn(Task<void> task)
+	{
+		std::coroutine_handle<detail::Promise<void>> h = std::exchange(task._h, nullptr);
+		if (!h) {
+			return;
+		}
+		h.promise().owner = this;
+		h.promise().root = _roots.insert(_roots.end(), h);
+		_ready.push_back(h);
+	}
+
+	/**
+	 * Runs spawned tasks until all of them have finished
+	 * @return 0 once no tasks are left, -1 if the ring failed
+	 */
+	int run()
+	{
+		zts_ring_cqe cqes[64];
+		while (!_roots.empty()) {
+			while (!_ready.empty()) {
+				std::coroutine_handle<> h = _ready.front();
+				_ready.pop_front();
+				h.resume();
+			}
+			fire_timers();
+			flush();
+			if (!_ready.empty()) {
+				continue;
+			}
+			if (_roots.empty()) {
+				break;
+			}
+			int timeout = next_timeout();
+			if (!_inflight) {
+				// every task is sleeping, the ring would return right away
+				if (_timers.empty()) {
+					return -1;
+				}
+				std::this_thread::sleep_until(_timers.top().deadline);
+				continue;
+			}
+			int n = zts_ring_wait(_ring, cqes, 64, timeout);
+			if (n < 0) {
+				return -1;
+			}
+			_inflight -= n;
+			for (int i=0; i<n; i++) {
+				Op *op = static_cast<Op *>(cqes[i].user_data);
+				op->res = cqes[i].res;
+				op->awaiting.resume();
+			}
+		}
+		return 0;
+	}
+
+	/**
+	 * Awaitable socket operation, co_await yields the result as a ssize_t
+	 */
+	struct Op
+	{
+		Reactor *reactor;
+		zts_ring_sqe sqe;
+		ssize_t res = 0;
+		std::coroutine_handle<> awaiting;
+
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> h)
+		{
+			awaiting = h;
+			sqe.user_data = this;
+			reactor->_pending.push_back(sqe);
+		}
+		ssize_t await_resume() const noexcept { return res; }
+	};
+
+	/**
+	 * Awaitable delay, resumes the task no earlier than its deadline
+	 */
+	struct Sleep
+	{
+		Reactor *reactor;
+		Clock::time_point deadline;
+
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> h)
+		{
+			if (deadline <= Clock::now()) {
+				reactor->_ready.push_back(h);
+			} else {
+				reactor->_timers.push(Timer{deadline, reactor->_timer_seq++, h});
+			}
+		}
+		void await_resume() const noexcept {}
+	};
+
+	/**
+	 * Accepts a connection, yields the new socket
+	 */
+	Op accept(int fd, struct sockaddr *addr = nullptr, socklen_t addrlen = 0)
+	{
+		return make_op(ZTS_RING_ACCEPT, fd, 0, nullptr, 0, addr, addrlen);
+	}
+
+	/**
+	 * Connects a socket, yields 0 once the connection is established. addr must stay valid
+	 * until the operation completes
+	 */
+	Op connect(int fd, const struct sockaddr *addr, socklen_t addrlen)
+	{
+		return make_op(ZTS_RING_CONNECT, fd, 0, nullptr, 0, const_cast<struct sockaddr *>(addr), addrlen);
+	}
+
+	/**
+	 * Reads whatever is available once the socket is readable, yields 0 at end of stream
+	 */
+	Op read(int fd, void *buf, size_t len, int flags = 0)
+	{
+		return make_op(ZTS_RING_RECV, fd, flags, buf, len, nullptr, 0);
+	}
+
+	/**
+	 * Sends as much as the socket takes once it is writable, yields the number of bytes sent
+	 */
+	Op write(int fd, const void *buf, size_t len, int flags = 0)
+	{
+		return make_op(ZTS_RING_SEND, fd, flags, const_cast<void *>(buf), len, nullptr, 0);
+	}
+
+	/**
+	 * Closes a socket once the operations already submitted on it have completed
+	 */
+	Op close(int fd)
+	{
+		return make_op(ZTS_RING_CLOSE, fd, 0, nullptr, 0, nullptr, 0);
+	}
+
+	/**
+	 * Sends all of buf, yields len, or the error that stopped it
+	 */
+	Task<ssize_t> write_all(int fd, const void *buf, size_t len, int flags = 0)
+	{
+		size_t done = 0;
+		while (done < len) {
+			ssize_t n = co_await write(fd, static_cast<const char *>(buf) + done, len - done, flags);
+			if (n < 0) {
+				co_return n;
+			}
+			done += n;
+		}
+		co_return (ssize_t)done;
+	}
+
+	/**
+	 * Suspends the task for at least ms milliseconds, 0 lets the other runnable tasks go first
+	 */
+	Sleep sleep(unsigned int ms)
+	{
+		return Sleep{this, Clock::now() + std::chrono::milliseconds(ms)};
+	}
+
+private:
+	friend struct detail::PromiseBase;
+
+	struct Timer
+	{
+		Clock::time_point deadline;
+		unsigned long long seq; // keeps timers with the same deadline in order
+		std::coroutine_handle<> awaiting;
+		bool operator>(const Timer &o) const
+		{
+			return deadline != o.deadline ? deadline > o.deadline : seq > o.seq;
+		}
+	};
+
+	Op make_op(int op, int fd, int flags, void *buf, size_t len, struct sockaddr *addr, socklen_t addrlen)
+	{
+		Op o;
+		o.reactor = this;
+		o.sqe.op = op;
+		o.sqe.fd = fd;
+		o.sqe.flags = flags;
+		o.sqe.buf = buf;
+		o.sqe.len = len;
+		o.sqe.addr = addr;
+		o.sqe.addrlen = addrlen;
+		o.sqe.user_data = nullptr;
+		return o;
+	}
+
+	/**
+	 * Submits the operations queued since the last pass, in one call. What the ring has no room
+	 * for stays queued until completions free entries
+	 */
+	void flush()
+	{
+		if (_pending.empty()) {
+			return;
+		}
+		int n = _ring ? zts_ring_submit(_ring, _pending.data(), (int)_pending.size()) : -1;
+		if (n < 0) {
+			for (size_t i=0; i<_pending.size(); i++) {
+				Op *op = static_cast<Op *>(_pending[i].user_data);
+				op->res = -EBADF;
+				_ready.push_back(op->awaiting);
+			}
+			_pending.clear();
+			return;
+		}
+		_inflight += n;
+		_pending.erase(_pending.begin(), _pending.begin() + n);
+	}
+
+	void fire_timers()
+	{
+		if (_timers.empty()) {
+			return;
+		}
+		Clock::time_point now = Clock::now();
+		while (!_timers.empty() && _timers.top().deadline <= now) {
+			_ready.push_back(_timers.top().awaiting);
+			_timers.pop();
+		}
+	}
+
+	/**
+	 * @return Milliseconds until the earliest timer (rounded up), or -1 if there is none
+	 */
+	int next_timeout() const
+	{
+		if (_timers.empty()) {
+			return -1;
+		}
+		Clock::duration d = _timers.top().deadline - Clock::now();
+		if (d <= Clock::duration::zero()) {
+			return 0;
+		}
+		return (int)std::chrono::ceil<std::chrono::milliseconds>(d).count();
+	}
+
+	struct zts_ring *_ring;
+	int _inflight = 0; // submitted and not yet reaped
+	unsigned long long _timer_seq = 0;
+	std::vector<zts_ring_sqe> _pending;
+	std::deque<std::coroutine_handle<>> _ready;
+	std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> _timers;
+	std::list<std::coroutine_handle<>> _roots;
+};
+
+namespace detail {
+
+/**
+ * Finishing a task resumes whoever awaited it. A spawned task has nobody waiting, its frame is
+ * freed here instead (it is suspended at this point, so destroying it is safe)
+ */
+template <typename P>
+inline std::coroutine_handle<> PromiseBase::FinalAwaiter::await_suspend(std::coroutine_handle<P> h) noexcept
+{
+	PromiseBase &p = h.promise();
+	if (p.continuation) {
+		return p.continuation;
+	}
+	if (p.owner) {
+		if (p.exception) {
+			std::terminate();
+		}
+		p.owner->_roots.erase(p.root);
+		h.destroy();
+	}
+	return std::noop_coroutine();
+}
+
+} // namespace detail
+
+} // namespace Coro
+} // namespace ZeroTier
+
+#endif // LIBZT_ZTCOROUTINE_HPP
@@ -34,9 +34,14 @@
 #define LIBZT_H
 
 #include <poll.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <vector>
+#if !defined(LWIP_HDR_SOCKETS_H)
+// struct zts_mmsghdr needs a complete struct msghdr (libzt itself gets lwIP's)
+#include <sys/socket.h>
+#endif
 
 #include "Debug.hpp"
 #include "Defs.h"
@@ -278,7 +283,9 @@ void zts_disable_http_control_plane();
  * This function will return an integer which can be used in much the same way as a
  * typical file descriptor, however it is only valid for use with libzt library calls
  * as this is merely a facade which is associated with the internal socket representation
- * of both the network stacks and drivers.
+ * of both the network stacks and drivers. Descriptors are not reused densely like
+ * host ones: each carries a count of how often its slot has been reused, so calls on a
+ * descriptor whose socket was closed fail instead of reaching a newer socket.
  *
  * @usage Call this after zts_start() has succeeded
  * @param socket_family Address family (AF_INET, AF_INET6)
@@ -434,7 +441,10 @@ int zts_close(int fd);
 /**
  * @brief Waits for one of a set of file descriptors to become ready to perform I/O.
  *
- * @usage Call this after zts_start() has succeeded
+ * @usage Call this after zts_start() has succeeded. Registers the descriptors with a temporary
+ * epoll set on every call, use zts_epoll_create() for long-lived sets of sockets. Descriptors that
+ * aren't libzt sockets are passed to the host's poll(). POLLHUP is reported once the remote host
+ * has closed the connection
  * @param fds
  * @param nfds
  * @param timeout
@@ -445,7 +455,8 @@ int zts_poll(struct pollfd *fds, nfds_t nfds, int timeout);
 /**
  * @brief Monitor multiple file descriptors, waiting until one or more of the file descriptors become "ready"
  *
- * @usage Call this after zts_start() has succeeded
+ * @usage Call this after zts_start() has succeeded. Only descriptors below FD_SETSIZE fit in an
+ * fd_set, nfds larger than FD_SETSIZE fails with EINVAL (use zts_poll() or zts_epoll_*() instead)
  * @param nfds
  * @param readfds
  * @param writefds
@@ -455,6 +466,153 @@ int zts_poll(struct pollfd *fds, nfds_t nfds, int timeout);
  */
 int zts_select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout);
 
+typedef union zts_epoll_data
+{
+	void *ptr;
+	int fd;
+	uint32_t u32;
+	uint64_t u64;
+} zts_epoll_data_t;
+
+/**
+ * An event registered with zts_epoll_ctl() or returned by zts_epoll_wait()
+ */
+struct zts_epoll_event
+{
+	uint32_t events; // ZTS_EPOLL* flags
+	zts_epoll_data_t data; // returned unchanged with every event for the socket
+};
+
+/**
+ * @brief Creates an epoll set
+ *
+ * @usage Unlike zts_select(), each socket keeps a list of the sets it belongs to, so an event only
+ * touches the sets interested in that socket and zts_epoll_wait() only visits sockets that are ready.
+ * Close the set with zts_close().
+ * @param size Ignored, but must be greater than zero
+ * @return Descriptor of the new set, or -1 on error
+ */
+int zts_epoll_create(int size);
+
+/**
+ * @brief Adds, modifies or removes a socket in an epoll set
+ *
+ * @usage Level-triggered by default: a socket is reported by every zts_epoll_wait() for as long as it
+ * is ready. With ZTS_EPOLLET it is reported once per new event, with ZTS_EPOLLONESHOT only once until
+ * it is re-armed with ZTS_EPOLL_CTL_MOD. Closing a socket removes it from all sets.
+ * @param epfd Descriptor returned by zts_epoll_create()
+ * @param op ZTS_EPOLL_CTL_ADD, ZTS_EPOLL_CTL_MOD or ZTS_EPOLL_CTL_DEL
+ * @param fd Socket file descriptor (only valid for use with libzt calls)
+ * @param event Requested events and user data (ignored for ZTS_EPOLL_CTL_DEL)
+ * @return 0 on success, -1 on error
+ */
+int zts_epoll_ctl(int epfd, int op, int fd, struct zts_epoll_event *event);
+
+/**
+ * @brief Waits for sockets in an epoll set to become ready
+ *
+ * @usage Call this after zts_start() has succeeded
+ * @param epfd Descriptor returned by zts_epoll_create()
+ * @param events Where to store the ready sockets' events
+ * @param maxevents Maximum number of events to return
+ * @param timeout Milliseconds to wait, 0 to return immediately, -1 to wait indefinitely
+ * @return Number of events stored, 0 on timeout, -1 on error
+ */
+int zts_epoll_wait(int epfd, struct zts_epoll_event *events, int maxevents, int timeout);
+
+/**
+ * @brief Returns a host descriptor that is readable while sockets in an epoll set are ready
+ *
+ * @usage Lets a single host event loop (select, poll, epoll, kqueue) drive both kernel sockets and
+ * libzt sockets: wait on this descriptor alongside the host's own, and whenever it is readable call
+ * zts_epoll_wait() with a timeout of 0. It stays readable until a zts_epoll_wait() call leaves nothing
+ * ready in the set. The descriptor belongs to the set (an eventfd on Linux, a pipe elsewhere), don't
+ * read from or close it, zts_close(epfd) closes it.
+ * @param epfd Descriptor returned by zts_epoll_create()
+ * @return Host descriptor (the same one on every call for a given set), or -1 on error
+ */
+int zts_epoll_host_fd(int epfd);
+
+/**
+ * An operation for zts_ring_submit(), fields the operation doesn't use are ignored
+ */
+struct zts_ring_sqe
+{
+	int op;                // ZTS_RING_* operation
+	int fd;                // socket the operation applies to
+	int flags;             // ZTS_RING_SEND, ZTS_RING_RECV: flags as for zts_send() and zts_recv()
+	void *buf;             // ZTS_RING_SEND, ZTS_RING_RECV: data buffer
+	size_t len;            // ZTS_RING_SEND, ZTS_RING_RECV: length of buf
+	struct sockaddr *addr; // ZTS_RING_CONNECT: remote address, ZTS_RING_ACCEPT: receives the peer's address (may be NULL)
+	socklen_t addrlen;     // ZTS_RING_CONNECT: length of addr, ZTS_RING_ACCEPT: room in addr
+	void *user_data;       // returned unchanged in the completion
+};
+
+/**
+ * Completion of an operation submitted with zts_ring_submit(), see zts_ring_wait()
+ */
+struct zts_ring_cqe
+{
+	void *user_data; // as submitted
+	ssize_t res;     // what the equivalent zts_* call would have returned, -errno on failure
+	int op;          // as submitted
+	int fd;          // as submitted
+};
+
+struct zts_ring;
+
+/**
+ * @brief Creates a submission/completion ring for asynchronous socket operations
+ *
+ * @usage Call this after zts_start() has succeeded. Operations are queued in bulk with zts_ring_submit()
+ * and never block: whatever can finish right away does, the rest waits on its socket, and
+ * zts_ring_wait() carries it out once the network stack reports the socket ready. Operations on
+ * the same socket and in the same direction (connect and send, or accept and recv) complete in
+ * submission order, a close waits until all earlier operations on its socket have completed.
+ * A ring can be used from several threads. Sockets must not be used with blocking zts_* calls
+ * while the ring has connect or accept operations outstanding on them.
+ * @param entries Maximum number of operations submitted and not yet reaped with zts_ring_wait()
+ * @return The new ring, or NULL on error
+ */
+struct zts_ring *zts_ring_create(unsigned int entries);
+
+/**
+ * @brief Queues operations on a ring
+ *
+ * @usage Call this after zts_start() has succeeded. Operations that can finish without waiting
+ * have completed by the time this returns, every accepted operation produces exactly one completion.
+ * @param ring Ring returned by zts_ring_create()
+ * @param sqes Operations, in submission order
+ * @param n Number of operations
+ * @return Number of operations accepted (fewer than n once the ring holds entries operations that
+ * haven't been reaped), or -1 on error
+ */
+int zts_ring_submit(struct zts_ring *ring, const struct zts_ring_sqe *sqes, int n);
+
+/**
+ * @brief Waits for operations on a ring to complete
+ *
+ * @usage Call this after zts_start() has succeeded. Waiting is also what carries out the
+ * operations whose sockets have become ready, so operations that had to wait only make progress
+ * while some thread is in zts_ring_wait().
+ * @param ring Ring returned by zts_ring_create()
+ * @param cqes Array receiving the completions, oldest first
+ * @param max Size of the array
+ * @param timeout_ms How long to wait for the first completion, 0 to return immediately, -1 to wait indefinitely
+ * @return Number of completions returned, 0 on timeout or if no operations are outstanding, -1 on error
+ */
+int zts_ring_wait(struct zts_ring *ring, struct zts_ring_cqe *cqes, int max, int timeout_ms);
+
+/**
+ * @brief Destroys a ring
+ *
+ * @usage Operations still outstanding are dropped without completions, their sockets stay open.
+ * No other thread may be using the ring.
+ * @param ring Ring returned by zts_ring_create()
+ * @return 0 on success, -1 on error
+ */
+int zts_ring_close(struct zts_ring *ring);
+
 /**
  * @brief Issue file control commands on a socket
  *
@@ -489,6 +647,43 @@ int zts_ioctl(int fd, unsigned long request, void *argp);
  */
 ssize_t zts_send(int fd, const void *buf, size_t len, int flags);
 
+/**
+ * Completion of a zts_send_zc() call, see zts_send_zc_reap()
+ */
+struct zts_zc_completion
+{
+	int fd;       // descriptor the data was sent on
+	void *cookie; // as passed to zts_send_zc()
+};
+
+/**
+ * @brief Send data to remote host without copying it
+ *
+ * @usage Call this after zts_start() has succeeded. For stream sockets the network stack
+ * refers to buf until the data has been acknowledged by the remote host (or dropped with the
+ * connection), so buf must not be changed or freed until then. Every call, whatever its
+ * outcome, produces exactly one completion carrying cookie, which zts_send_zc_reap() returns
+ * once buf may be reused. Best suited to large, long-lived buffers.
+ * @param fd File descriptor (only valid for use with libzt calls)
+ * @param buf Pointer to data buffer
+ * @param len Length of data to write
+ * @param flags
+ * @param cookie Passed back in the completion for this call
+ * @return Number of bytes sent, or -1 on error
+ */
+ssize_t zts_send_zc(int fd, const void *buf, size_t len, int flags, void *cookie);
+
+/**
+ * @brief Collect completions of zts_send_zc() calls, from all sockets
+ *
+ * @usage Call this after zts_start() has succeeded
+ * @param completions Array receiving the completions, oldest first
+ * @param max Size of the array
+ * @param timeout_ms How long to wait for the first completion, -1 to wait indefinitely
+ * @return Number of completions returned (0 if the timeout expired), or -1 on error
+ */
+int zts_send_zc_reap(struct zts_zc_completion *completions, int max, int timeout_ms);
+
 /**
  * @brief Send data to remote host
  *
@@ -514,6 +709,29 @@ ssize_t zts_sendto(int fd, const void *buf, size_t len, int flags, const struct
  */
 ssize_t zts_sendmsg(int fd, const struct msghdr *msg, int flags);
 
+/**
+ * One message of zts_sendmmsg() or zts_recvmmsg(), same layout as Linux's struct mmsghdr
+ */
+struct zts_mmsghdr
+{
+	struct msghdr msg_hdr;
+	unsigned int msg_len; // bytes sent or received for this message
+};
+
+/**
+ * @brief Send several messages to remote hosts
+ *
+ * @usage Call this after zts_start() has succeeded. On a datagram socket the messages are handed to
+ * the network stack in batches under a single lock acquisition, which is much cheaper than one
+ * zts_sendto() per datagram. Sending stops at the first message that fails.
+ * @param fd File descriptor (only valid for use with libzt calls)
+ * @param msgvec Messages to send, each with its own destination (msg_name) and IO vectors
+ * @param vlen Number of messages in msgvec
+ * @param flags
+ * @return Number of messages sent (msg_len of each is set), or -1 on error if none was sent
+ */
+int zts_sendmmsg(int fd, struct zts_mmsghdr *msgvec, unsigned int vlen, int flags);
+
 /**
  * @brief Receive data from remote host
  *
@@ -543,14 +761,30 @@ ssize_t zts_recvfrom(int fd, void *buf, size_t len, int flags, struct sockaddr *
 /**
  * @brief Receive a message from remote host
  *
- * @usage Call this after zts_start() has succeeded
+ * @usage Call this after zts_start() has succeeded. Data is scattered over the IO vectors in msg_iov,
+ * msg_name (if set) receives the sender's address. A datagram that doesn't fit is truncated and
+ * ZTS_MSG_TRUNC is set in msg_flags. Ancillary data is not supported, msg_controllen is set to zero.
  * @param fd File descriptor (only valid for use with libzt calls)
  * @param msg
  * @param flags
- * @return
+ * @return Number of bytes received, or -1 on error
  */
 ssize_t zts_recvmsg(int fd, struct msghdr *msg,int flags);
 
+/**
+ * @brief Receive several messages from remote hosts
+ *
+ * @usage Call this after zts_start() has succeeded. Each message is filled in as by zts_recvmsg().
+ * With ZTS_MSG_WAITFORONE only the first message is waited for, after that only what is already
+ * queued is taken. Datagrams are received without taking the network stack's lock.
+ * @param fd File descriptor (only valid for use with libzt calls)
+ * @param msgvec Messages to fill in
+ * @param vlen Number of messages in msgvec
+ * @param flags
+ * @return Number of messages received (msg_len of each is set), or -1 on error if none was received
+ */
+int zts_recvmmsg(int fd, struct zts_mmsghdr *msgvec, unsigned int vlen, int flags);
+
 /**
  * @brief Read bytes from socket onto buffer
  *
@@ -573,6 +807,59 @@ int zts_read(int fd, void *buf, size_t len);
  */
 int zts_write(int fd, const void *buf, size_t len);
 
+/**
+ * @brief Read bytes from socket into several buffers
+ *
+ * @usage Call this after zts_start() has succeeded. The buffers are filled in order, for stream
+ * sockets all data that is already queued is copied in one pass and the receive window is
+ * reopened once for the whole call.
+ * @param fd File descriptor (only valid for use with libzt calls)
+ * @param iov IO vectors describing the buffers
+ * @param iovcnt Number of IO vectors
+ * @return Number of bytes read, or -1 on error
+ */
+ssize_t zts_readv(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Receive data without copying it out of the network stack's buffers
+ *
+ * @usage Call this after zts_start() has succeeded. The IO vectors are filled in with read-only
+ * views of the received buffers, which stay valid until zts_buf_release() is called with the
+ * returned handle. Every handle that isn't NULL must be released. Stream sockets keep the
+ * lent data in the receive window until it is released, so the peer is held back once the
+ * window is out on loan. A datagram that needs more IO vectors than given is truncated.
+ * @param fd File descriptor (only valid for use with libzt calls)
+ * @param iov IO vectors to fill in
+ * @param iovcnt Number of IO vectors available, set to the number filled in
+ * @param handle Set to the handle of the lent buffers, or to NULL if nothing was lent out
+ * @param flags 0 or ZTS_MSG_DONTWAIT
+ * @return Number of bytes received (0 if the connection was closed), or -1 on error
+ */
+ssize_t zts_recv_zc(int fd, struct iovec *iov, int *iovcnt, void **handle, int flags);
+
+/**
+ * @brief Release buffers lent out by zts_recv_zc()
+ *
+ * @usage Call this once the data returned by zts_recv_zc() is no longer needed. This may also be
+ * done after the socket has been closed.
+ * @param handle Handle returned by zts_recv_zc()
+ * @return 0 if successful, -1 if the handle is NULL
+ */
+int zts_buf_release(void *handle);
+
+/**
+ * @brief Write bytes from several buffers to socket
+ *
+ * @usage Call this after zts_start() has succeeded. For stream sockets the buffers are copied
+ * into as few segments as possible, so a small header and its payload are sent together
+ * without first being gathered into a temporary buffer.
+ * @param fd File descriptor (only valid for use with libzt calls)
+ * @param iov IO vectors describing the buffers
+ * @param iovcnt Number of IO vectors
+ * @return Number of bytes written, or -1 on error
+ */
+ssize_t zts_writev(int fd, const struct iovec *iov, int iovcnt);
+
 /**
  * @brief Shut down some aspect of a socket (read, write, or both)
  *
@@ -601,6 +888,175 @@ int zts_add_dns_nameserver(struct sockaddr *addr);
  */
 int zts_del_dns_nameserver(struct sockaddr *addr);
 
+/****************************************************************************/
+/* Stack driver tuning                                                      */
+/****************************************************************************/
+
+/**
+ * @brief Sets the maximum time an outgoing frame may be held back for coalescing with others
+ *
+ * @usage Frames produced by one unit of network stack work are sent to the ZeroTier virtual wire as a
+ * burst once that work is done. This bounds how long a frame can wait during a long unit of work. Use 0
+ * to send every frame immediately. Defaults to ZT_TX_STAGE_LATENCY_CAP.
+ * @param usec Latency cap in microseconds
+ * @return
+ */
+int zts_set_tx_latency_cap(unsigned int usec);
+
+/**
+ * @brief Selects whether incoming frames are processed inline or queued for the network stack thread
+ *
+ * @usage When enabled, the ZeroTier thread delivering a frame runs it through the network stack directly
+ * instead of handing it to the stack's own thread. This removes a thread hop from every received frame,
+ * which lowers request/response latency. Defaults to ZT_RX_INLINE.
+ * @param enabled 1 to process frames inline, 0 to queue them
+ * @return 0 on success, -1 if not supported
+ */
+int zts_set_rx_inline(int enabled);
+
+/**
+ * @brief Sets the number of RX shard threads which verify TCP/UDP checksums in parallel
+ *
+ * @usage Incoming frames are steered to a shard by a hash of their addresses, protocol and ports, so
+ * every flow stays on one shard and keeps its order. Each shard verifies TCP/UDP checksums on its own
+ * core and feeds its frames into the network stack in batches. Only the checksum work is spread out:
+ * there is still a single network stack, and protocol processing runs under its lock one frame at a
+ * time. Must be called before the service is started. Defaults to ZT_RX_SHARDS (0, no sharding).
+ * @param n Number of shards, at most ZT_RX_SHARDS_MAX
+ * @return 0 on success, -1 if the stack is already running or n is out of range
+ */
+int zts_set_rx_shards(unsigned int n);
+
+/****************************************************************************/
+/* Tracing                                                                  */
+/****************************************************************************/
+
+/**
+ * @brief Sets which data path events are recorded into the trace rings
+ *
+ * @usage Events are stored as fixed-size binary records in a ring owned by the thread that produced
+ * them and are only formatted by zts_dump_trace(), so tracing adds no formatting work to the packet
+ * path. When off, each trace point costs a single branch. Defaults to ZT_TRACE_LEVEL.
+ * @param level ZT_TRACE_OFF, ZT_TRACE_DROPS or ZT_TRACE_FRAMES
+ * @return 0 on success, -1 if level is out of range
+ */
+int zts_set_trace_level(int level);
+
+/**
+ * @brief Formats all events recorded since the previous dump, in time order
+ *
+ * @usage Each thread keeps its last ZT_TRACE_RING_LEN events, older ones are overwritten and do not
+ * appear in the dump.
+ * @param out Stream to write the formatted events to
+ * @return Number of events written
+ */
+int zts_dump_trace(FILE *out);
+
+/****************************************************************************/
+/* Statistics                                                               */
+/****************************************************************************/
+
+/**
+ * Counters kept by the network stack for one protocol layer
+ */
+struct zts_proto_stats
+{
+	uint32_t xmit;    // transmitted packets
+	uint32_t recv;    // received packets
+	uint32_t fw;      // forwarded packets
+	uint32_t drop;    // dropped packets
+	uint32_t chkerr;  // checksum errors
+	uint32_t lenerr;  // invalid length errors
+	uint32_t memerr;  // out of memory errors
+	uint32_t rterr;   // routing errors
+	uint32_t proterr; // protocol errors
+	uint32_t opterr;  // errors in options
+	uint32_t err;     // misc errors
+};
+
+/**
+ * Usage of the network stack's heap or of one of its memory pools
+ */
+struct zts_pool_stats
+{
+	char name[24];
+	uint32_t avail;
+	uint32_t used;
+	uint32_t max;     // high-water mark of used
+	uint32_t err;     // failed allocations
+};
+
+/**
+ * Frames exchanged between one VirtualTap and the ZeroTier virtual wire
+ */
+struct zts_tap_stats
+{
+	uint64_t nwid;
+	uint64_t rx_frames;
+	uint64_t rx_bytes;
+	uint64_t rx_drops;  // received frames the network stack never saw (no pbufs, queues full, bad checksum)
+	uint64_t tx_frames;
+	uint64_t tx_bytes;
+	uint64_t tx_drops;
+};
+
+/**
+ * Batches of frames one VirtualTap handed to the network stack in a single wakeup
+ */
+struct zts_tap_batch_stats
+{
+	uint64_t rx_batches;
+	uint64_t rx_batch_frames; // frames delivered in those batches
+	uint64_t rx_batch_hist[ZT_RX_BATCH_HIST_LEN]; // batch sizes in power-of-two buckets (1, 2-3, 4-7, ...)
+};
+
+/**
+ * Payload bytes moved through one open socket
+ */
+struct zts_socket_stats
+{
+	int fd;
+	uint64_t rx_bytes;
+	uint64_t tx_bytes;
+};
+
+/**
+ * Snapshot of every counter libzt keeps, see zts_get_stats()
+ */
+struct zts_stats
+{
+	uint32_t version;   // ZT_STATS_VERSION of the library that filled this snapshot
+	uint32_t size;      // number of bytes of this structure that were filled
+	uint64_t timestamp; // when the snapshot was taken (monotonic, in ms)
+	struct zts_proto_stats link; // frames exchanged with the virtual wire, summed over all taps
+	struct zts_proto_stats etharp;
+	struct zts_proto_stats ip;
+	struct zts_proto_stats icmp;
+	struct zts_proto_stats tcp;
+	struct zts_proto_stats udp;
+	struct zts_pool_stats heap;
+	uint32_t pool_count;
+	struct zts_pool_stats pools[ZT_STATS_MAX_POOLS];
+	uint32_t tap_count;
+	struct zts_tap_stats taps[ZT_STATS_MAX_TAPS];
+	uint32_t socket_count;
+	struct zts_socket_stats sockets[ZT_STATS_MAX_SOCKETS];
+	struct zts_tap_batch_stats tap_batches[ZT_STATS_MAX_TAPS]; // same order as taps, added in ZT_STATS_VERSION 2
+};
+
+/**
+ * @brief Takes a snapshot of the network stack, VirtualTap and socket counters
+ *
+ * @usage Counters are kept with relaxed atomics (or under the stack's own lock) so collecting them
+ * doesn't slow down the data path. Comparing tap drops, pool errors and stack drops over time shows
+ * whether an application is limited by CPU, by buffers, or by the virtual wire. Callers built against
+ * an older, smaller struct zts_stats pass its size and receive only the fields it knows about.
+ * @param stats Where to write the snapshot
+ * @param len Size of the caller's struct zts_stats (normally sizeof(struct zts_stats))
+ * @return 0 on success, -1 if stats is NULL or len is too small to hold the header
+ */
+int zts_get_stats(struct zts_stats *stats, size_t len);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -62,15 +62,12 @@ void lwip_dns_init();
  */
 void lwip_start_dhcp(struct netif *interface);
 
-void general_lwip_init_interface(void *tapref, struct netif *interface, const char *name, const ZeroTier::MAC &mac,
-	const ZeroTier::InetAddress &addr, const ZeroTier::InetAddress &nm, const ZeroTier::InetAddress &gw);
-
-void general_turn_on_interface(struct netif *interface);
-
 /**
  * @brief Set up an interface in the network stack for the VirtualTap.
  *
- * @param
+ * @usage Each VirtualTap owns its own netif (with the VirtualTap's MTU), created when its first IPv4
+ * address is assigned. The first netif brought up becomes the stack's default route, traffic for other
+ * subnets leaves through whichever netif's address and netmask match the destination.
  * @param tapref Reference to VirtualTap that will be responsible for sending and receiving data
  * @param mac Virtual hardware address for this ZeroTier VirtualTap interface
  * @param ip Virtual IP address for this ZeroTier VirtualTap interface
@@ -78,16 +75,91 @@ void general_turn_on_interface(struct netif *interface);
  */
 void lwip_init_interface(void *tapref, const ZeroTier::MAC &mac, const ZeroTier::InetAddress &ip);
 
+/**
+ * @brief Removes the VirtualTap's interface from the network stack
+ *
+ * @usage Called when a VirtualTap is being destroyed. The netif is freed once the stack has drained any
+ * frames still queued for it.
+ * @param tapref Reference to VirtualTap whose interface should be removed
+ * @return
+ */
+void lwip_remove_interface(void *tapref);
+
+/**
+ * @brief Updates the MTU of the VirtualTap's interface
+ *
+ * @usage Called when the MTU of the VirtualTap's network changes
+ * @param tapref Reference to VirtualTap whose interface should be updated
+ * @param mtu New MTU (clamped to ZT_MAX_MTU)
+ * @return
+ */
+void lwip_set_interface_mtu(void *tapref, unsigned int mtu);
+
 /**
  * @brief Called from the stack, outbound ethernet frames from the network stack enter the ZeroTier virtual wire here.
  *
- * @usage This shall only be called from the stack or the stack driver. Not the application thread.
+ * @usage This shall only be called from the stack or the stack driver. Not the application thread. Frames are
+ * held in the VirtualTap's TX staging queue and flushed as a burst when the core lock is released, when the
+ * queue fills up, or when the oldest frame exceeds the latency cap (see lwip_set_tx_latency_cap()). Single-pbuf
+ * frames are passed to the virtual wire in place, chained frames are passed as an iovec list if the VirtualTap
+ * has a scatter-gather handler and are otherwise flattened into a single buffer.
  * @param netif Transmits an outgoing Ethernet fram from the network stack onto the ZeroTier virtual wire
  * @param p A pointer to the beginning of a chain pf struct pbufs
  * @return
  */
 err_t lwip_eth_tx(struct netif *netif, struct pbuf *p);
 
+/**
+ * @brief Discards any frames still waiting in a VirtualTap's TX staging queue
+ *
+ * @usage Called when a VirtualTap is being destroyed
+ * @param tap VirtualTap whose staged frames should be dropped
+ * @return
+ */
+void lwip_eth_tx_discard(ZeroTier::VirtualTap *tap);
+
+/**
+ * @brief Sets the maximum time an outgoing frame may wait in a TX staging queue before being flushed
+ *
+ * @usage Frames staged during a unit of stack work are always flushed when the core lock is released,
+ * this bounds how long they can wait inside a long-running unit of work. 0 disables staging entirely.
+ * @param usec Latency cap in microseconds
+ * @return
+ */
+void lwip_set_tx_latency_cap(unsigned int usec);
+
+/**
+ * @brief Selects whether incoming frames are processed inline or queued for the tcpip thread
+ *
+ * @usage In inline mode the thread calling VirtualTap::put() takes the core lock and runs the frame
+ * through the stack itself, saving a context switch per frame at the cost of that thread contending
+ * with application threads for the core lock. Requires LWIP_TCPIP_CORE_LOCKING.
+ * @param enabled Whether inline mode should be used
+ * @return 0 on success, -1 if inline mode isn't supported by this stack configuration
+ */
+int lwip_set_rx_inline(bool enabled);
+
+/**
+ * @brief Sets the number of RX shard threads started with the stack
+ *
+ * @usage Frames are steered to a shard by flow hash (RSS-style), so each flow is handled by a single
+ * shard in order. Shards verify TCP/UDP checksums outside of the core lock (marking the frames they
+ * verified so the stack skips its own check) and feed their frames into the stack in batches under the
+ * core lock. lwIP itself stays a single instance, so protocol processing isn't parallelised. Only allowed before lwip_driver_init(). Requires LWIP_TCPIP_CORE_LOCKING.
+ * @param n Number of shards, 0 disables sharding
+ * @return 0 on success, -1 if the stack is already running or n is out of range
+ */
+int lwip_set_rx_shards(unsigned int n);
+
+/**
+ * @brief Copies the stack's protocol, heap and memory pool counters into a stats snapshot
+ *
+ * @usage Called by zts_get_stats(). Holds the core lock only while copying
+ * @param stats Snapshot to fill in
+ * @return
+ */
+void lwip_get_stats(struct zts_stats *stats);
+
 /**
  * @brief Receives incoming Ethernet frames from the ZeroTier virtual wire
  *
@@ -103,4 +175,39 @@ err_t lwip_eth_tx(struct netif *netif, struct pbuf *p);
 void lwip_eth_rx(ZeroTier::VirtualTap *tap, const ZeroTier::MAC &from, const ZeroTier::MAC &to, unsigned int etherType,
 	const void *data, unsigned int len);
 
+/**
+ * @brief Receives a batch of incoming Ethernet frames from the ZeroTier virtual wire
+ *
+ * @usage This shall be called from the VirtualTap's I/O thread (via VirtualTap::putBatch()). Frames are
+ * copied into pbufs up front and handed to the tcpip thread in groups of up to ZT_RX_BATCH_MAX with a
+ * single message (and thus a single wakeup) per group.
+ * @param tap Pointer to VirtualTap from which this data comes
+ * @param frames Array of frames
+ * @param count Number of frames in the array
+ * @return
+ */
+void lwip_eth_rx_batch(ZeroTier::VirtualTap *tap, const ZeroTier::VirtualTapFrame *frames, unsigned int count);
+
+/**
+ * @brief Receives an incoming Ethernet frame from a loaned buffer without copying it
+ *
+ * @usage This shall be called from the VirtualTap's I/O thread (via VirtualTap::putLoaned()). The buffer is
+ * wrapped in a PBUF_REF pbuf and the Ethernet header is written into the headroom in front of data. release
+ * is called (possibly from the stack thread) once the stack is done with the frame. If the buffer can't be
+ * loaned (not enough headroom, too large, or no loan descriptors left) the frame is copied and release is
+ * called before this function returns.
+ * @param tap Pointer to VirtualTap from which this data comes
+ * @param from Origin address (virtual ZeroTier hardware address)
+ * @param to Intended destination address (virtual ZeroTier hardware address)
+ * @param etherType Protocol type
+ * @param data Pointer to Ethernet payload, must be writable
+ * @param len Length of Ethernet payload
+ * @param headroom Number of writable bytes in front of data (see ZT_RX_LOAN_HEADROOM)
+ * @param release Called with (arg, data) to return the buffer to its owner
+ * @param arg Argument passed to release
+ * @return
+ */
+void lwip_eth_rx_loaned(ZeroTier::VirtualTap *tap, const ZeroTier::MAC &from, const ZeroTier::MAC &to, unsigned int etherType,
+	void *data, unsigned int len, unsigned int headroom, void (*release)(void *, void *), void *arg);
+
 #endif
@@ -185,6 +185,21 @@ remote peer.
 //#define LWIP_NOASSERT 1
 #define TCP_LISTEN_BACKLOG   0
 
+/**
+ * LWIP_TCP_PCB_HASH==1: Find the PCB of each incoming segment through hash tables (by 4-tuple for
+ * connections, by port for listeners) instead of walking the PCB lists, sized for thousands of connections
+ */
+#define LWIP_TCP_PCB_HASH               1
+#define TCP_PCB_HASH_SIZE               8192
+#define TCP_LISTEN_HASH_SIZE            64
+
+/**
+ * LWIP_TCP_TIMER_WHEEL==1: Run the per-connection TCP timers from a timer wheel so that each TCP
+ * timer tick only touches the connections whose timers are due, instead of all of them
+ */
+#define LWIP_TCP_TIMER_WHEEL            1
+#define TCP_TIMER_WHEEL_SIZE            1024
+
 /*------------------------------------------------------------------------------
 ---------------------------------- Timers --------------------------------------
 ------------------------------------------------------------------------------*/
@@ -284,6 +299,12 @@ happening sooner than they should.
  */
 #define PBUF_POOL_BUFSIZE               LWIP_MEM_ALIGN_SIZE(TCP_MSS+40+PBUF_LINK_HLEN)
 
+/**
+ * LWIP_PBUF_EXT==1: pbufs referencing application memory that report when it's
+ * no longer referenced, used by zts_send_zc()
+ */
+#define LWIP_PBUF_EXT                   1
+
 
 /*------------------------------------------------------------------------------
 -------------------------- Internal Memory Pool Sizes --------------------------
@@ -531,6 +552,12 @@ happening sooner than they should.
  */
 #define LWIP_UDP                        1
 
+/**
+ * LWIP_UDP_PCB_HASH==1: Find the PCB of each incoming datagram through a hash table (by 4-tuple for
+ * connected PCBs, by port for the rest) instead of walking udp_pcbs, sized for hundreds of bound ports
+ */
+#define LWIP_UDP_PCB_HASH               1
+#define UDP_PCB_HASH_SIZE               1024
 
 /*------------------------------------------------------------------------------
 -------------------------------- TCP Options -----------------------------------
@@ -573,6 +600,40 @@ happening sooner than they should.
 
 #define LWIP_SOCKET                     1//(NO_SYS==0)
 
+/**
+ * LWIP_SOCKET_EPOLL==1: Enable the epoll-style readiness API behind zts_epoll_*()
+ */
+#define LWIP_SOCKET_EPOLL               1
+
+/**
+ * LWIP_SOCKET_MAX: Upper bound on simultaneously open sockets. The socket table grows
+ * LWIP_SOCKET_CHUNK entries at a time, so only the sockets actually used take memory.
+ * (netconns and PCBs come from the heap since MEMP_MEM_MALLOC==1, so they don't cap this)
+ */
+#define LWIP_SOCKET_MAX                 65536
+#define LWIP_SOCKET_CHUNK               256
+
+/**
+ * LWIP_SOCKET_GENERATION_BITS: Descriptors carry a 4 bit reuse count so stale ones fail
+ * with EBADF. Descriptors of the first 64 table entries stay below FD_SETSIZE (1024) and
+ * remain usable with zts_select(), which fails with EINVAL for nfds above FD_SETSIZE
+ */
+#define LWIP_SOCKET_GENERATION_BITS     4
+
+/**
+ * LWIP_MSGHDR_IOVLEN_TYPE, LWIP_MSGHDR_CONTROLLEN_TYPE: Applications fill in struct msghdr
+ * from the host's headers, so lwIP's copy has to match glibc's layout on Linux
+ */
+#if defined(__linux__)
+#define LWIP_MSGHDR_IOVLEN_TYPE         size_t
+#define LWIP_MSGHDR_CONTROLLEN_TYPE     size_t
+#endif
+
+/**
+ * LWIP_SENDMMSG_BATCH: Datagrams zts_sendmmsg() sends per core lock acquisition
+ */
+#define LWIP_SENDMMSG_BATCH             64
+
 
 /*------------------------------------------------------------------------------
 ------------------------------ Statistics Options ------------------------------
@@ -583,6 +644,18 @@ happening sooner than they should.
  */
 #define LWIP_STATS                      1
 
+/**
+ * LWIP_STATS_LARGE==1: Use 32-bit counters so that long-running instances don't wrap them
+ * between two zts_get_stats() snapshots.
+ */
+#define LWIP_STATS_LARGE                1
+
+/**
+ * MEMP_STATS==1: Track per-pool usage even though pools are backed by the heap (MEMP_MEM_MALLOC),
+ * allocation failures show up as pool errors in zts_get_stats().
+ */
+#define MEMP_STATS                      1
+
 /*------------------------------------------------------------------------------
 --------------------------------- PPP Options ----------------------------------
 ------------------------------------------------------------------------------*/
@@ -48,6 +48,9 @@ endif
 LWIPINCLUDES:=-I$(LWIPDIR)/include -I$(LWIPARCH) -I$(LWIPDIR) -I. -Iext -Iinclude
 CFLAGS=-Wno-format -Wno-deprecated -O3 -g -Wall -fPIC
 CFLAGS+=-DLWIP_IPV4 -DLWIP_IPV6=0 -DIPv4 -DLWIP_DEBUG=1 $(LWIPINCLUDES)
+ifeq ($(LWIP_UNIX_MBOX_LOCKFREE),1)
+CFLAGS+=-DLWIP_UNIX_MBOX_LOCKFREE=1
+endif
 
 UNIXLIB=liblwip.a
 
@@ -0,0 +1,214 @@
+/*
+ * ZeroTier SDK - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+/**
+ * @file
+ *
+ * Path-compressed binary trie for longest-prefix-match lookups
+ */
+
+#ifndef ZT_PREFIXTRIE_HPP
+#define ZT_PREFIXTRIE_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+namespace ZeroTier {
+
+	/**
+	 * A path-compressed (PATRICIA-style) binary trie keyed by bit strings of up to
+	 * 128 bits. Nodes live in one contiguous vector and refer to each other by index,
+	 * so a built trie is a single allocation that can be shared read-only between
+	 * threads. Lookups walk at most one node per distinct prefix length and never
+	 * allocate.
+	 */
+	template<typename T> class PrefixTrie {
+
+	private:
+		struct Node {
+			uint8_t key[16]; // prefix, bits past 'bits' are zero
+			unsigned int bits;
+			int child[2];
+			int value; // index into values, or -1
+		};
+
+		std::vector<Node> nodes;
+		std::vector<T> values;
+		int root;
+
+		static inline unsigned int bitAt(const uint8_t *key, unsigned int i)
+		{
+			return (key[i >> 3] >> (7 - (i & 7))) & 1;
+		}
+
+		/**
+		 * Number of leading bits shared by a and b, not looking past max
+		 */
+		static unsigned int commonBits(const uint8_t *a, const uint8_t *b, unsigned int max)
+		{
+			unsigned int i = 0;
+			while (i < max) {
+				uint8_t d = a[i >> 3] ^ b[i >> 3];
+				if (d == 0) {
+					i = (i & ~7u) + 8;
+					continue;
+				}
+				while (!(d & (0x80 >> (i & 7)))) {
+					i++;
+				}
+				break;
+			}
+			return (i < max) ? i : max;
+		}
+
+		/**
+		 * Whether a and b agree on bits [from, to)
+		 */
+		static inline bool bitsEqual(const uint8_t *a, const uint8_t *b, unsigned int from, unsigned int to)
+		{
+			for (unsigned int i = from; i < to; ) {
+				if (!(i & 7) && (to - i) >= 8) {
+					if (a[i >> 3] != b[i >> 3]) {
+						return false;
+					}
+					i += 8;
+					continue;
+				}
+				if (bitAt(a, i) != bitAt(b, i)) {
+					return false;
+				}
+				i++;
+			}
+			return true;
+		}
+
+		int newNode(const uint8_t *key, unsigned int bits, int value)
+		{
+			Node n;
+			memset(&n, 0, sizeof(n));
+			memcpy(n.key, key, (bits + 7) / 8);
+			if (bits & 7) {
+				n.key[bits >> 3] &= (uint8_t)(0xff << (8 - (bits & 7)));
+			}
+			n.bits = bits;
+			n.child[0] = n.child[1] = -1;
+			n.value = value;
+			nodes.push_back(n);
+			return (int)nodes.size() - 1;
+		}
+
+	public:
+		PrefixTrie() : root(-1) {}
+
+		/**
+		 * Insert a prefix. Inserting a prefix that is already present replaces its value.
+		 *
+		 * @param key Big-endian key bytes (only the first (bits+7)/8 are read)
+		 * @param bits Prefix length in bits (0-128)
+		 * @param value Value returned for addresses covered by this prefix
+		 */
+		void insert(const uint8_t *key, unsigned int bits, const T &value)
+		{
+			if (bits > 128) {
+				return;
+			}
+			values.push_back(value);
+			const int v = (int)values.size() - 1;
+			int parent = -1, side = 0;
+			int cur = root;
+			for (;;) {
+				if (cur < 0) {
+					int n = newNode(key, bits, v);
+					if (parent < 0) { root = n; } else { nodes[parent].child[side] = n; }
+					return;
+				}
+				const unsigned int nbits = nodes[cur].bits;
+				const unsigned int common = commonBits(nodes[cur].key, key, (nbits < bits) ? nbits : bits);
+				if (common == nbits && common == bits) {
+					nodes[cur].value = v;
+					return;
+				}
+				if (common == nbits) {
+					// existing node is a prefix of the new key, descend
+					parent = cur;
+					side = bitAt(key, nbits);
+					cur = nodes[cur].child[side];
+					continue;
+				}
+				int n;
+				if (common == bits) {
+					// new key is a prefix of the existing node, insert above it
+					n = newNode(key, bits, v);
+					nodes[n].child[bitAt(nodes[cur].key, bits)] = cur;
+				}
+				else {
+					// keys diverge at 'common', insert a branch node with both below it
+					n = newNode(key, common, -1);
+					int leaf = newNode(key, bits, v);
+					nodes[n].child[bitAt(key, common)] = leaf;
+					nodes[n].child[bitAt(nodes[cur].key, common)] = cur;
+				}
+				if (parent < 0) { root = n; } else { nodes[parent].child[side] = n; }
+				return;
+			}
+		}
+
+		/**
+		 * Longest-prefix-match lookup
+		 *
+		 * @param addr Big-endian address bytes
+		 * @param bits Address length in bits (32 or 128)
+		 * @return Value of the longest matching prefix, or NULL if none matches
+		 */
+		const T *lookup(const uint8_t *addr, unsigned int bits) const
+		{
+			const T *best = NULL;
+			unsigned int checked = 0;
+			int cur = root;
+			while (cur >= 0) {
+				const Node &n = nodes[cur];
+				if (n.bits > bits || !bitsEqual(n.key, addr, checked, n.bits)) {
+					break;
+				}
+				checked = n.bits;
+				if (n.value >= 0) {
+					best = &values[n.value];
+				}
+				if (n.bits == bits) {
+					break;
+				}
+				cur = n.child[bitAt(addr, n.bits)];
+			}
+			return best;
+		}
+
+		size_t size() const { return values.size(); }
+	};
+
+} // namespace ZeroTier
+
+#endif // ZT_PREFIXTRIE_HPP
@@ -0,0 +1,233 @@
+/*
+ * ZeroTier SDK - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+/**
+ * @file
+ *
+ * Per-thread binary trace rings
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+
+#include "Trace.hpp"
+#include "libzt.h"
+#include "Utilities.h"
+
+#include "MAC.hpp"
+#include "Mutex.hpp"
+
+std::atomic<int> zt_trace_level(ZT_TRACE_LEVEL);
+
+/*
+ * Events written by one thread. Only the owning thread writes records and advances head, the
+ * dumper copies records out and discards any that may have been overwritten while it did so
+ */
+struct zt_trace_ring
+{
+	std::atomic<uint64_t> head; // number of records ever written
+	uint64_t dumped; // records already dumped, guarded by zt_trace_rings_m
+	std::atomic<bool> owned; // whether a live thread writes to this ring
+	long tid;
+	struct zt_trace_record records[ZT_TRACE_RING_LEN];
+};
+
+static ZeroTier::Mutex zt_trace_rings_m;
+static std::vector<struct zt_trace_ring *> zt_trace_rings;
+
+/*
+ * Hands the calling thread's ring back for reuse by another thread once this one exits
+ */
+struct zt_trace_ring_owner
+{
+	struct zt_trace_ring *ring = NULL;
+	~zt_trace_ring_owner()
+	{
+		if (ring) {
+			ring->owned.store(false, std::memory_order_release);
+		}
+	}
+};
+
+static thread_local zt_trace_ring_owner zt_trace_this_thread;
+
+static struct zt_trace_ring *zt_trace_ring_acquire()
+{
+	ZeroTier::Mutex::Lock _l(zt_trace_rings_m);
+	struct zt_trace_ring *ring = NULL;
+	for (size_t i=0; i<zt_trace_rings.size(); i++) {
+		bool expected = false;
+		if (zt_trace_rings[i]->owned.compare_exchange_strong(expected, true)) {
+			ring = zt_trace_rings[i];
+			break;
+		}
+	}
+	if (ring == NULL) {
+		ring = new zt_trace_ring();
+		ring->head.store(0);
+		ring->dumped = 0;
+		ring->owned.store(true);
+		zt_trace_rings.push_back(ring);
+	}
+	ring->tid = (long)ZT_THREAD_ID;
+	return ring;
+}
+
+void zt_trace_event(uint16_t event, uint16_t arg, uint64_t nwid, const void *src, const void *dst, uint32_t len)
+{
+	struct zt_trace_ring *ring = zt_trace_this_thread.ring;
+	if (ring == NULL) {
+		ring = zt_trace_this_thread.ring = zt_trace_ring_acquire();
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	const uint64_t h = ring->head.load(std::memory_order_relaxed);
+	struct zt_trace_record *r = &(ring->records[h & (ZT_TRACE_RING_LEN - 1)]);
+	r->ts = (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+	r->nwid = nwid;
+	r->len = len;
+	r->event = event;
+	r->arg = arg;
+	if (src) {
+		memcpy(r->src, src, 6);
+	}
+	else {
+		memset(r->src, 0, 6);
+	}
+	if (dst) {
+		memcpy(r->dst, dst, 6);
+	}
+	else {
+		memset(r->dst, 0, 6);
+	}
+	ring->head.store(h + 1, std::memory_order_release);
+}
+
+static const char *zt_trace_drop_reason(int reason)
+{
+	switch (reason) {
+		case ZT_TRACE_DROP_NO_PBUF:
+			return "no pbufs available";
+		case ZT_TRACE_DROP_SHORT_PBUF:
+			return "first pbuf smaller than ethernet header";
+		case ZT_TRACE_DROP_TX_TOO_LARGE:
+			return "frame larger than TX buffer";
+		case ZT_TRACE_DROP_BAD_CHECKSUM:
+			return "bad checksum";
+		case ZT_TRACE_DROP_SHARD_FULL:
+			return "RX shard queue full";
+		case ZT_TRACE_DROP_MBOX_FULL:
+			return "tcpip mbox full";
+		case ZT_TRACE_DROP_NO_MEM:
+			return "unable to allocate batch";
+		case ZT_TRACE_DROP_INPUT:
+			return "rejected by stack interface";
+		default:
+			return "unknown";
+	}
+}
+
+static bool zt_trace_before(const std::pair<long, struct zt_trace_record> &a,
+	const std::pair<long, struct zt_trace_record> &b)
+{
+	return a.second.ts < b.second.ts;
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int zts_set_trace_level(int level)
+{
+	if (level < ZT_TRACE_OFF || level > ZT_TRACE_FRAMES) {
+		return -1;
+	}
+	zt_trace_level.store(level, std::memory_order_relaxed);
+	return 0;
+}
+
+int zts_dump_trace(FILE *out)
+{
+	// copy out everything recorded since the last dump, per ring, then format in time order
+	std::vector<std::pair<long, struct zt_trace_record> > events;
+	{
+		ZeroTier::Mutex::Lock _l(zt_trace_rings_m);
+		for (size_t i=0; i<zt_trace_rings.size(); i++) {
+			struct zt_trace_ring *ring = zt_trace_rings[i];
+			const uint64_t head = ring->head.load(std::memory_order_acquire);
+			uint64_t first = std::max(ring->dumped, head > ZT_TRACE_RING_LEN ? head - ZT_TRACE_RING_LEN : 0);
+			size_t start = events.size();
+			for (uint64_t j=first; j<head; j++) {
+				events.push_back(std::make_pair(ring->tid, ring->records[j & (ZT_TRACE_RING_LEN - 1)]));
+			}
+			// the writer may have lapped us while copying, drop whatever it could have overwritten
+			std::atomic_thread_fence(std::memory_order_acquire);
+			const uint64_t now = ring->head.load(std::memory_order_relaxed);
+			if (now >= ZT_TRACE_RING_LEN && now - ZT_TRACE_RING_LEN + 1 > first) {
+				uint64_t lost = std::min(now - ZT_TRACE_RING_LEN + 1 - first, head - first);
+				events.erase(events.begin() + start, events.begin() + start + lost);
+			}
+			ring->dumped = head;
+		}
+	}
+	std::stable_sort(events.begin(), events.end(), zt_trace_before);
+	char srcBuf[ZT_MAC_ADDRSTRLEN], dstBuf[ZT_MAC_ADDRSTRLEN], srcNode[ZTO_ID_LEN], dstNode[ZTO_ID_LEN];
+	for (size_t i=0; i<events.size(); i++) {
+		const struct zt_trace_record &r = events[i].second;
+		mac2str(srcBuf, ZT_MAC_ADDRSTRLEN, (unsigned char *)r.src);
+		mac2str(dstBuf, ZT_MAC_ADDRSTRLEN, (unsigned char *)r.dst);
+		ZeroTier::MAC(r.src, 6).toAddress(r.nwid).toString(srcNode);
+		ZeroTier::MAC(r.dst, 6).toAddress(r.nwid).toString(dstNode);
+		fprintf(out, "%llu.%06llu [%ld] %016llx ", (unsigned long long)(r.ts / 1000000),
+			(unsigned long long)(r.ts % 1000000), events[i].first, (unsigned long long)r.nwid);
+		switch (r.event) {
+			case ZT_TRACE_ETH_TX:
+				fprintf(out, "len=%5d dst=%s [%s TX <-- %s] proto=0x%04x %s\n", r.len, dstBuf, dstNode, srcNode,
+					r.arg, beautify_eth_proto_nums(r.arg));
+				break;
+			case ZT_TRACE_ETH_RX:
+			case ZT_TRACE_ETH_RX_LOANED:
+				fprintf(out, "len=%5d dst=%s [%s RX --> %s] proto=0x%04x %s%s\n", r.len, dstBuf, srcNode, dstNode,
+					r.arg, beautify_eth_proto_nums(r.arg), r.event == ZT_TRACE_ETH_RX_LOANED ? " (loaned)" : "");
+				break;
+			case ZT_TRACE_DROP:
+				fprintf(out, "dropped %d packet(s): %s src=%s dst=%s\n", r.len, zt_trace_drop_reason(r.arg), srcBuf, dstBuf);
+				break;
+			default:
+				fprintf(out, "unknown event %d\n", r.event);
+				break;
+		}
+	}
+	fflush(out);
+	return (int)events.size();
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -31,12 +31,25 @@
  */
 
 #include <errno.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <time.h>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#endif
 
 #include "Phy.hpp"
 
 #include "VirtualTap.hpp"
 
 #include <utility>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
 #include <stdint.h>
 #include <cstring>
 
@@ -65,6 +78,176 @@ namespace ZeroTier {
 
 	int VirtualTap::devno = 0;
 
+	/****************************************************************************/
+	/* Shared reactor                                                           */
+	/* - A single thread serves every VirtualTap. It sleeps until some tap's    */
+	/*   housekeeping is due or until it is woken because the set of taps       */
+	/*   changed, instead of each tap polling on its own thread                 */
+	/****************************************************************************/
+
+	static uint64_t reactor_now()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+	}
+
+	class VirtualTapReactor
+	{
+	public:
+		VirtualTapReactor() : _run(false), _wakefd(-1), _wakefd_w(-1), _timerfd(-1) {}
+
+		void add(VirtualTap *tap)
+		{
+			std::lock_guard<std::mutex> l(_m);
+			tap->_housekeepingDue = reactor_now();
+			tap->_housekeepingBusy = false;
+			_taps.push_back(tap);
+			// started with the first VirtualTap, then sleeps indefinitely whenever there are none
+			if (!_run) {
+				if (!open()) {
+					return;
+				}
+				_run = true;
+				_thread = Thread::start(this);
+			}
+			wake();
+		}
+
+		void remove(VirtualTap *tap)
+		{
+			// waits for the tap's housekeeping if it is running, as the per-tap thread's join did
+			std::unique_lock<std::mutex> l(_m);
+			_taps.erase(std::remove(_taps.begin(), _taps.end(), tap), _taps.end());
+			_idle.wait(l, [tap]{ return !tap->_housekeepingBusy; });
+			wake();
+		}
+
+		void threadMain()
+			throw()
+		{
+			std::vector<VirtualTap*> due;
+			for (;;) {
+				uint64_t next = 0;
+				{
+					std::lock_guard<std::mutex> l(_m);
+					uint64_t now = reactor_now();
+					for (size_t i=0; i<_taps.size(); i++) {
+						if (_taps[i]->_housekeepingDue <= now) {
+							_taps[i]->_housekeepingBusy = true;
+							_taps[i]->_housekeepingDue = now + ZT_HOUSEKEEPING_INTERVAL * 1000;
+							due.push_back(_taps[i]);
+						}
+						if (next == 0 || _taps[i]->_housekeepingDue < next) {
+							next = _taps[i]->_housekeepingDue;
+						}
+					}
+				}
+				// without the lock: housekeeping takes the service's locks, which are held while
+				// taps are added and removed, and a slow tap mustn't hold up the others' removal
+				for (size_t i=0; i<due.size(); i++) {
+					due[i]->Housekeeping();
+					std::lock_guard<std::mutex> l(_m);
+					due[i]->_housekeepingBusy = false;
+					_idle.notify_all();
+				}
+				due.clear();
+				sleepUntil(next);
+			}
+		}
+
+	private:
+		bool open()
+		{
+#if defined(__linux__)
+			_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			_wakefd_w = _wakefd;
+			_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+			if (_wakefd < 0 || _timerfd < 0) {
+				DEBUG_ERROR("unable to create reactor descriptors, errno=%d", errno);
+				close();
+				return false;
+			}
+#else
+			int fds[2];
+			if (pipe(fds) < 0) {
+				DEBUG_ERROR("unable to create reactor pipe, errno=%d", errno);
+				return false;
+			}
+			fcntl(fds[0], F_SETFL, O_NONBLOCK);
+			fcntl(fds[1], F_SETFL, O_NONBLOCK);
+			_wakefd = fds[0];
+			_wakefd_w = fds[1];
+#endif
+			return true;
+		}
+
+		void close()
+		{
+			if (_wakefd_w >= 0 && _wakefd_w != _wakefd) {
+				::close(_wakefd_w);
+			}
+			if (_wakefd >= 0) {
+				::close(_wakefd);
+			}
+			if (_timerfd >= 0) {
+				::close(_timerfd);
+			}
+			_wakefd = _wakefd_w = _timerfd = -1;
+		}
+
+		void wake()
+		{
+			if (_wakefd_w >= 0) {
+				uint64_t one = 1;
+				if (write(_wakefd_w, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+					DEBUG_ERROR("unable to wake reactor, errno=%d", errno);
+				}
+			}
+		}
+
+		// blocks until the given monotonic time (in ms, 0 for none) or until woken
+		void sleepUntil(uint64_t due)
+		{
+			struct pollfd fds[2];
+			int nfds = 0, timeout = -1;
+			fds[nfds].fd = _wakefd;
+			fds[nfds++].events = POLLIN;
+#if defined(__linux__)
+			struct itimerspec its;
+			memset(&its, 0, sizeof(its));
+			its.it_value.tv_sec = due / 1000;
+			its.it_value.tv_nsec = (due % 1000) * 1000000;
+			// an all-zero value disarms the timer
+			timerfd_settime(_timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+			fds[nfds].fd = _timerfd;
+			fds[nfds++].events = POLLIN;
+#else
+			if (due) {
+				uint64_t now = reactor_now();
+				timeout = due > now ? (int)(due - now) : 0;
+			}
+#endif
+			if (poll(fds, nfds, timeout) > 0) {
+				uint64_t buf[8];
+				for (int i=0; i<nfds; i++) {
+					if (fds[i].revents & POLLIN) {
+						while (read(fds[i].fd, buf, sizeof(buf)) > 0) {}
+					}
+				}
+			}
+		}
+
+		std::mutex _m;
+		std::condition_variable _idle; // signalled whenever a tap's housekeeping finishes
+		std::vector<VirtualTap*> _taps;
+		bool _run;
+		int _wakefd, _wakefd_w, _timerfd;
+		Thread _thread;
+	};
+
+	static VirtualTapReactor reactor;
+
 	/****************************************************************************/
 	/* VirtualTap Service                                                        */
 	/* - For each joined network a VirtualTap will be created to administer I/O  */
@@ -82,6 +265,7 @@ namespace ZeroTier {
 			unsigned int,unsigned int,const void *,unsigned int),
 		void *arg) :
 			_handler(handler),
+			_sgHandler(NULL),
 			_homePath(homePath),
 			_arg(arg),
 			_enabled(true),
@@ -92,6 +276,21 @@ namespace ZeroTier {
 			_unixListenSocket((PhySocket *)0),
 			_phy(this,false,true)
 	{
+		_txStageLen = 0;
+		_txStageBytes = 0;
+		_txStageSince = 0;
+		_txStagePending = false;
+		_rxBatches = 0;
+		_rxBatchFrames = 0;
+		for (int i=0; i<ZT_RX_BATCH_HIST_LEN; i++) {
+			_rxBatchHist[i] = 0;
+		}
+		_rxFrames = 0;
+		_rxBytes = 0;
+		_rxDrops = 0;
+		_txFrames = 0;
+		_txBytes = 0;
+		_txDrops = 0;
 		ZeroTier::vtaps.push_back((void*)this);
 
 		// set virtual tap interface name (full)
@@ -107,16 +306,20 @@ namespace ZeroTier {
 		// initialize network stacks
 		lwip_driver_init();
 #endif
-		// start vtap thread and stack I/O loops
-		_thread = Thread::start(this);
+		// serviced by the shared reactor
+		reactor.add(this);
 	}
 
 	VirtualTap::~VirtualTap()
 	{
 		_run = false;
-		_phy.whack();
-		Thread::join(_thread);
+		removeTap(this);
+		reactor.remove(this);
 		_phy.close(_unixListenSocket,false);
+#if defined(STACK_LWIP)
+		lwip_remove_interface(this);
+		lwip_eth_tx_discard(this);
+#endif
 	}
 
 	void VirtualTap::setEnabled(bool en)
@@ -129,6 +332,12 @@ namespace ZeroTier {
 		return _enabled;
 	}
 
+	void VirtualTap::setScatterGatherHandler(void (*handler)(void *, void *, uint64_t, const MAC &, const MAC &,
+		unsigned int, unsigned int, const struct iovec *, int, unsigned int))
+	{
+		_sgHandler = handler;
+	}
+
 	bool VirtualTap::registerIpWithStack(const InetAddress &ip)
 	{
 #if defined(STACK_LWIP)
@@ -141,32 +350,38 @@ namespace ZeroTier {
 	{
 		char ipbuf[INET6_ADDRSTRLEN];
 		DEBUG_EXTRA("addr=%s", ip.toString(ipbuf));
-		Mutex::Lock _l(_ips_m);
-		if (registerIpWithStack(ip)) {
+		{
+			Mutex::Lock _l(_ips_m);
+			if (registerIpWithStack(ip) == false) {
+				return false;
+			}
 			if (std::find(_ips.begin(),_ips.end(),ip) == _ips.end()) {
 				_ips.push_back(ip);
 				std::sort(_ips.begin(),_ips.end());
 			}
-			return true;
 		}
-		return false;
+		rebuildTapRoutes();
+		return true;
 	}
 
 	bool VirtualTap::removeIp(const InetAddress &ip)
 	{
 		DEBUG_EXTRA();
-		Mutex::Lock _l(_ips_m);
-		std::vector<InetAddress>::iterator i(std::find(_ips.begin(),_ips.end(),ip));
-		//if (i == _ips.end()) {
-		//	return false;
-		//}
-		_ips.erase(i);
-		if (ip.isV4()) {
-			// FIXME: De-register from network stacks
-		}
-		if (ip.isV6()) {
-			// FIXME: De-register from network stacks
+		{
+			Mutex::Lock _l(_ips_m);
+			std::vector<InetAddress>::iterator i(std::find(_ips.begin(),_ips.end(),ip));
+			//if (i == _ips.end()) {
+			//	return false;
+			//}
+			_ips.erase(i);
+			if (ip.isV4()) {
+				// FIXME: De-register from network stacks
+			}
+			if (ip.isV6()) {
+				// FIXME: De-register from network stacks
+			}
 		}
+		rebuildTapRoutes();
 		return true;
 	}
 
@@ -179,11 +394,54 @@ namespace ZeroTier {
 	void VirtualTap::put(const MAC &from,const MAC &to,unsigned int etherType,
 		const void *data,unsigned int len)
 	{
+		_rxFrames.fetch_add(1, std::memory_order_relaxed);
+		_rxBytes.fetch_add(len, std::memory_order_relaxed);
 #if defined(STACK_LWIP)
 		lwip_eth_rx(this, from, to, etherType, data, len);
 #endif
 	}
 
+	void VirtualTap::putBatch(const VirtualTapFrame *frames,unsigned int count)
+	{
+#if defined(STACK_LWIP)
+		uint64_t bytes = 0;
+		for (unsigned int i=0; i<count; i++) {
+			bytes += frames[i].len;
+		}
+		_rxFrames.fetch_add(count, std::memory_order_relaxed);
+		_rxBytes.fetch_add(bytes, std::memory_order_relaxed);
+		lwip_eth_rx_batch(this, frames, count);
+#else
+		for (unsigned int i=0; i<count; i++) {
+			put(frames[i].from, frames[i].to, frames[i].etherType, frames[i].data, frames[i].len);
+		}
+#endif
+	}
+
+	void VirtualTap::recordRxBatch(unsigned int count)
+	{
+		int bucket = 0;
+		while ((count >> (bucket + 1)) && bucket < (ZT_RX_BATCH_HIST_LEN - 1)) {
+			bucket++;
+		}
+		_rxBatches.fetch_add(1, std::memory_order_relaxed);
+		_rxBatchFrames.fetch_add(count, std::memory_order_relaxed);
+		_rxBatchHist[bucket].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void VirtualTap::putLoaned(const MAC &from,const MAC &to,unsigned int etherType,
+		void *data,unsigned int len,unsigned int headroom,void (*release)(void *,void *),void *arg)
+	{
+#if defined(STACK_LWIP)
+		_rxFrames.fetch_add(1, std::memory_order_relaxed);
+		_rxBytes.fetch_add(len, std::memory_order_relaxed);
+		lwip_eth_rx_loaned(this, from, to, etherType, data, len, headroom, release, arg);
+#else
+		put(from, to, etherType, data, len);
+		release(arg, data);
+#endif
+	}
+
 	std::string VirtualTap::deviceName() const
 	{
 		return _dev;
@@ -234,15 +492,9 @@ namespace ZeroTier {
 	void VirtualTap::setMtu(unsigned int mtu)
 	{
 		_mtu = mtu;
-	}
-
-	void VirtualTap::threadMain()
-		throw()
-	{
-		while (true) {
-			_phy.poll(ZT_PHY_POLL_INTERVAL);
-			Housekeeping();
-		}
+#if defined(STACK_LWIP)
+		lwip_set_interface_mtu(this, mtu);
+#endif
 	}
 
 	void VirtualTap::phyOnUnixClose(PhySocket *sock, void **uptr)
@@ -399,68 +651,111 @@ namespace ZeroTier {
 
 	void VirtualTap::Housekeeping()
 	{
+		// update managed routes (add/del from network stacks), this is a no-op unless the service
+		// pushed a different set since the last interval
+		ZeroTier::OneService *service = ((ZeroTier::OneService *)zt1ServiceRef);
+		if (service) {
+			std::unique_ptr<std::vector<ZT_VirtualNetworkRoute>> managed_routes(service->getRoutes(this->_nwid));
+			if (managed_routes) {
+				setManagedRoutes(*managed_routes);
+			}
+		}
 		Mutex::Lock _l(_tcpconns_m);
-		std::time_t current_ts = std::time(nullptr);
-		if (current_ts > last_housekeeping_ts + ZT_HOUSEKEEPING_INTERVAL) {
+		{
 			// DEBUG_EXTRA();
-			// update managed routes (add/del from network stacks)
-			ZeroTier::OneService *service = ((ZeroTier::OneService *)zt1ServiceRef);
-			if (service) {
-				std::unique_ptr<std::vector<ZT_VirtualNetworkRoute>> managed_routes(service->getRoutes(this->_nwid));
-				ZeroTier::InetAddress target_addr;
-				ZeroTier::InetAddress via_addr;
-				ZeroTier::InetAddress null_addr;
-				ZeroTier::InetAddress nm;
-				null_addr.fromString("");
-				bool found;
-				char ipbuf[INET6_ADDRSTRLEN], ipbuf2[INET6_ADDRSTRLEN], ipbuf3[INET6_ADDRSTRLEN];
-				// TODO: Rework this when we have time
-				// check if pushed route exists in tap (add)
-				for (int i=0; i<ZT_MAX_NETWORK_ROUTES; i++) {
-					found = false;
-					target_addr = managed_routes->at(i).target;
-					via_addr = managed_routes->at(i).via;
-					nm = target_addr.netmask();
-					for (int j=0; j<routes.size(); j++) {
-						if (via_addr.ipsEqual(null_addr) || target_addr.ipsEqual(null_addr)) {
-							found=true;
-							continue;
-						}
-						if (routes[j].first.ipsEqual(target_addr) && routes[j].second.ipsEqual(nm)) {
-							found=true;
-						}
-					}
-					if (found == false) {
-						if (via_addr.ipsEqual(null_addr) == false) {
-							DEBUG_INFO("adding route <target=%s, nm=%s, via=%s>", target_addr.toString(ipbuf), nm.toString(ipbuf2), via_addr.toString(ipbuf3));
-							routes.push_back(std::pair<ZeroTier::InetAddress,ZeroTier::InetAddress>(target_addr, nm));
-							routeAdd(target_addr, nm, via_addr);
-						}
-					}
-				}
-				// check if route exists in tap but not in pushed routes (remove)
-				for (int i=0; i<routes.size(); i++) {
-					found = false;
-					for (int j=0; j<ZT_MAX_NETWORK_ROUTES; j++) {
-						target_addr = managed_routes->at(j).target;
-						via_addr = managed_routes->at(j).via;
-						nm = target_addr.netmask();
-						if (routes[i].first.ipsEqual(target_addr) && routes[i].second.ipsEqual(nm)) {
-							found=true;
-						}
-					}
-					if (found == false) {
-						DEBUG_INFO("removing route to <target=%s>", routes[i].first.toString(ipbuf), routes[i].second.toString(ipbuf2));
-						routes.erase(routes.begin() + i);
-						routeDelete(routes[i].first, routes[i].second);
-					}
-				}
-			}
 			// TODO: Clean up VirtualSocket objects
-			last_housekeeping_ts = std::time(nullptr);
 		}
 	}
 
+	void VirtualTap::setManagedRoutes(const std::vector<ZT_VirtualNetworkRoute> &managedRoutes)
+	{
+		{
+			Mutex::Lock _l(_ips_m);
+			if (managedRoutes.size() == _managedRoutes.size()
+				&& memcmp(managedRoutes.data(), _managedRoutes.data(),
+					managedRoutes.size() * sizeof(ZT_VirtualNetworkRoute)) == 0) {
+				return;
+			}
+			_managedRoutes = managedRoutes;
+			_routesGeneration++;
+		}
+		rebuildTapRoutes();
+		reconcileRoutes();
+	}
+
+	/*
+	 * Hash key identifying a route by its target address and prefix length
+	 */
+	static std::string routeKey(const InetAddress &target, const InetAddress &nm)
+	{
+		std::string key((const char *)target.rawIpData(), target.rawIpLen());
+		key.push_back((char)target.ss_family);
+		key.append((const char *)nm.rawIpData(), nm.rawIpLen());
+		return key;
+	}
+
+	void VirtualTap::reconcileRoutes()
+	{
+		Mutex::Lock _l(_routes_m);
+		std::vector<ZT_VirtualNetworkRoute> managed_routes;
+		uint64_t generation;
+		{
+			Mutex::Lock _l2(_ips_m);
+			if (_routesGeneration == _routesAppliedGeneration) {
+				return;
+			}
+			managed_routes = _managedRoutes;
+			generation = _routesGeneration;
+		}
+		ZeroTier::InetAddress target_addr;
+		ZeroTier::InetAddress via_addr;
+		ZeroTier::InetAddress null_addr;
+		ZeroTier::InetAddress nm;
+		null_addr.fromString("");
+		char ipbuf[INET6_ADDRSTRLEN], ipbuf2[INET6_ADDRSTRLEN], ipbuf3[INET6_ADDRSTRLEN];
+		// routes we want installed, only those with both a target and a gateway are installed
+		std::unordered_map<std::string, size_t> wanted;
+		for (size_t i=0; i<managed_routes.size(); i++) {
+			target_addr = managed_routes[i].target;
+			via_addr = managed_routes[i].via;
+			if ((target_addr.isV4() == false && target_addr.isV6() == false)
+				|| (via_addr.isV4() == false && via_addr.isV6() == false)
+				|| target_addr.ipsEqual(null_addr) || via_addr.ipsEqual(null_addr)) {
+				continue;
+			}
+			wanted[routeKey(target_addr, target_addr.netmask())] = i;
+		}
+		// routes currently installed that are still wanted
+		std::unordered_set<std::string> kept;
+		std::vector<std::pair<ZeroTier::InetAddress,ZeroTier::InetAddress>> removed, installed;
+		for (size_t i=0; i<routes.size(); i++) {
+			std::string key = routeKey(routes[i].first, routes[i].second);
+			if (wanted.count(key) && kept.insert(key).second) {
+				installed.push_back(routes[i]);
+			}
+			else {
+				removed.push_back(routes[i]);
+			}
+		}
+		for (size_t i=0; i<removed.size(); i++) {
+			DEBUG_INFO("removing route to <target=%s, nm=%s>", removed[i].first.toString(ipbuf), removed[i].second.toString(ipbuf2));
+			routeDelete(removed[i].first, removed[i].second);
+		}
+		for (std::unordered_map<std::string, size_t>::iterator it=wanted.begin(); it!=wanted.end(); ++it) {
+			if (kept.count(it->first)) {
+				continue;
+			}
+			target_addr = managed_routes[it->second].target;
+			via_addr = managed_routes[it->second].via;
+			nm = target_addr.netmask();
+			DEBUG_INFO("adding route <target=%s, nm=%s, via=%s>", target_addr.toString(ipbuf), nm.toString(ipbuf2), via_addr.toString(ipbuf3));
+			installed.push_back(std::pair<ZeroTier::InetAddress,ZeroTier::InetAddress>(target_addr, nm));
+			routeAdd(target_addr, nm, via_addr);
+		}
+		routes.swap(installed);
+		_routesAppliedGeneration = generation;
+	}
+
 	/****************************************************************************/
 	/* Not used in this implementation                                          */
 	/****************************************************************************/
@@ -34,7 +34,11 @@
 #define ZT_VIRTUALTAP_HPP
 
 #include <ctime>
+#include <atomic>
+#include <sys/uio.h>
 
+#include "ZeroTierOne.h"
+#include "Defs.h"
 #include "Mutex.hpp"
 #include "MulticastGroup.hpp"
 #include "InetAddress.hpp"
@@ -43,6 +47,18 @@
 
 namespace ZeroTier {
 
+	/**
+	 * A single frame as presented to VirtualTap::putBatch()
+	 */
+	struct VirtualTapFrame
+	{
+		MAC from;
+		MAC to;
+		unsigned int etherType;
+		const void *data;
+		unsigned int len;
+	};
+
 	/**
 	 * emulates an Ethernet tap device
 	 */
@@ -88,6 +104,26 @@ namespace ZeroTier {
 		void put(const MAC &from,const MAC &to,unsigned int etherType,const void *data,
 			unsigned int len);
 
+		/**
+		 * Presents a batch of frames to the userspace stack, waking the stack once per batch. The
+		 * ZeroTier core delivers frames one at a time through put(), so this is only used by
+		 * drivers which can collect frames themselves
+		 */
+		void putBatch(const VirtualTapFrame *frames,unsigned int count);
+
+		/**
+		 * Records the size of a batch of frames delivered to the stack in a single wakeup
+		 */
+		void recordRxBatch(unsigned int count);
+
+		/**
+		 * Presents data to the userspace stack without copying it. The caller loans the buffer
+		 * (with at least ZT_RX_LOAN_HEADROOM writable bytes in front of data) until release(arg, data)
+		 * is called. Frames which can't be loaned are copied and released immediately.
+		 */
+		void putLoaned(const MAC &from,const MAC &to,unsigned int etherType,void *data,
+			unsigned int len,unsigned int headroom,void (*release)(void *,void *),void *arg);
+
 		/**
 		 * Get VirtualTap device name (e.g. 'libzt4-17d72843bc2c5760')
 		 */
@@ -113,18 +149,28 @@ namespace ZeroTier {
 		 */
 		void setMtu(unsigned int mtu);
 
-		/**
-		 * Calls main network stack loops
-		 */
-		void threadMain()
-			throw();
-
 		/**
 		 * For moving data onto the ZeroTier virtual wire
 		 */
 		void (*_handler)(void *, void *, uint64_t, const MAC &, const MAC &, unsigned int, unsigned int,
 			const void *, unsigned int);
 
+		/**
+		 * For moving a scatter-gather frame (iovec list and total length) onto the ZeroTier virtual wire
+		 */
+		void (*_sgHandler)(void *, void *, uint64_t, const MAC &, const MAC &, unsigned int, unsigned int,
+			const struct iovec *, int, unsigned int);
+
+		/**
+		 * Registers a scatter-gather variant of the virtual wire handler. Chained outgoing frames are
+		 * passed through it without being flattened; _handler is still used for everything else.
+		 * Nothing installs one by default: the ZeroTier core only takes contiguous frames
+		 * (Node::processVirtualNetworkFrame()), so taps created by the service keep flattening
+		 * chained frames. This is a hook for virtual wires which accept an iovec list.
+		 */
+		void setScatterGatherHandler(void (*handler)(void *, void *, uint64_t, const MAC &, const MAC &,
+			unsigned int, unsigned int, const struct iovec *, int, unsigned int));
+
 		/**
 		 * Signals us to close the TcpVirtualSocket associated with this PhySocket
 		 */
@@ -150,6 +196,19 @@ namespace ZeroTier {
 		 */
 		bool routeDelete(const InetAddress &ip, const InetAddress &nm);
 
+		/**
+		 * Replaces the set of managed routes pushed for this network. Does nothing unless the set
+		 * differs from the last one, otherwise bumps the route generation, refreshes the routing
+		 * cache and reconciles the routes installed in the network stack
+		 */
+		void setManagedRoutes(const std::vector<ZT_VirtualNetworkRoute> &managedRoutes);
+
+		/**
+		 * Brings the routes installed in the network stack in line with the current generation of
+		 * managed routes, applying all removals and then all additions in one pass
+		 */
+		void reconcileRoutes();
+
 		/**
 		 * Assign a VirtualSocket to the VirtualTap
 		 */
@@ -178,6 +237,9 @@ namespace ZeroTier {
 		/* Vars                                                                     */
 		/****************************************************************************/
 
+		/*
+		 * Managed routes (target, netmask) currently installed in the network stack, guarded by _routes_m
+		 */
 		std::vector<std::pair<ZeroTier::InetAddress, ZeroTier::InetAddress>> routes;
 		void *zt1ServiceRef = NULL;
 
@@ -190,6 +252,19 @@ namespace ZeroTier {
 		std::vector<InetAddress> ips() const;
 		std::vector<InetAddress> _ips;
 
+		/*
+		 * Managed routes last pushed by the service for this network, guarded by _ips_m.
+		 * Kept so that the routing cache is only rebuilt when they actually change
+		 */
+		std::vector<ZT_VirtualNetworkRoute> _managedRoutes;
+
+		/*
+		 * Incremented (under _ips_m) whenever _managedRoutes changes, and the generation that was
+		 * last applied to the network stack (under _routes_m)
+		 */
+		uint64_t _routesGeneration = 0;
+		uint64_t _routesAppliedGeneration = 0;
+
 		std::string _homePath;
 		void *_arg;
 		volatile bool _enabled;
@@ -200,20 +275,62 @@ namespace ZeroTier {
 		PhySocket *_unixListenSocket;
 		Phy<VirtualTap *> _phy;
 
+		/*
+		 * Network stack interface owned by this VirtualTap (struct netif for lwIP), NULL until
+		 * an address has been assigned
+		 */
+		void *_netif = NULL;
+
 		//std::vector<VirtualSocket*> _VirtualSockets;
 
-		Thread _thread;
 		std::string _dev; // path to Unix domain socket
 
 		std::vector<MulticastGroup> _multicastGroups;
 		Mutex _multicastGroups_m;
-		Mutex _ips_m, _tcpconns_m, _rx_buf_m, _close_m;
+		Mutex _ips_m, _tcpconns_m, _rx_buf_m, _close_m, _routes_m;
+
+		/*
+		 * Outgoing frames (stack buffers) waiting to be flushed onto the virtual wire as a burst,
+		 * along with their total size and when the oldest was staged. Guarded by the stack's core lock.
+		 */
+		void *_txStage[ZT_TX_STAGE_MAX_FRAMES];
+		unsigned int _txStageLen;
+		unsigned int _txStageBytes;
+		uint64_t _txStageSince;
+		bool _txStagePending;
+
+		/*
+		 * Number of RX batches handed to the stack, frames delivered in them, and a histogram
+		 * of batch sizes in power-of-two buckets (1, 2-3, 4-7, ... ZT_RX_BATCH_MAX). Read by
+		 * zts_get_stats()
+		 */
+		std::atomic<uint64_t> _rxBatches;
+		std::atomic<uint64_t> _rxBatchFrames;
+		std::atomic<uint64_t> _rxBatchHist[ZT_RX_BATCH_HIST_LEN];
+
+		/*
+		 * Frames and bytes received from and sent onto the virtual wire, and frames dropped on
+		 * the way in and out. Relaxed atomics, read by zts_get_stats()
+		 */
+		std::atomic<uint64_t> _rxFrames;
+		std::atomic<uint64_t> _rxBytes;
+		std::atomic<uint64_t> _rxDrops;
+		std::atomic<uint64_t> _txFrames;
+		std::atomic<uint64_t> _txBytes;
+		std::atomic<uint64_t> _txDrops;
+
+		/*
+		 * Monotonic time (in ms) at which the shared reactor next runs Housekeeping(), guarded by
+		 * the reactor's lock
+		 * SEE: ZT_HOUSEKEEPING_INTERVAL in Defs.h
+		 */
+		uint64_t _housekeepingDue = 0;
 
 		/*
-		 * Timestamp of last run of housekeeping
-		 * SEE: ZT_HOUSEKEEPING_INTERVAL in libzt.h
+		 * Set by the shared reactor while it runs Housekeeping() outside of its lock, so that
+		 * removing the tap can wait for it. Guarded by the reactor's lock
 		 */
-		std::time_t last_housekeeping_ts = 0;
+		bool _housekeepingBusy = false;
 
 		/****************************************************************************/
 		/* In these, we will call the stack's corresponding functions, this is      */
@@ -38,6 +38,12 @@
 #include "OneService.hpp"
 #include "Utilities.h"
 #include "OSUtils.hpp"
+#include "libzt.h"
+#include "PrefixTrie.hpp"
+
+#include <atomic>
+#include <thread>
+#include <algorithm>
 
 #ifdef __cplusplus
 extern "C" {
@@ -53,6 +59,27 @@ namespace ZeroTier {
 
 	ZeroTier::Mutex _vtaps_lock;
 	ZeroTier::Mutex _multiplexer_lock;
+
+	/*
+	 * Longest-prefix-match view of every tap's assigned addresses and managed routes. Rebuilt
+	 * by rebuildTapRoutes() whenever either changes and read without locks by getTapByAddr()
+	 */
+	struct TapRoutes {
+		PrefixTrie<VirtualTap*> v4;
+		PrefixTrie<VirtualTap*> v6;
+	};
+	static std::atomic<TapRoutes*> _tapRoutes(NULL);
+
+	/*
+	 * Readers count themselves in the half of their slot that matches the epoch parity, a
+	 * writer bumps the epoch and waits for the old half to drain before freeing the old table
+	 */
+	struct TapRoutesReaders {
+		std::atomic<int> n[2];
+		char pad[64 - 2 * sizeof(std::atomic<int>)];
+	};
+	static std::atomic<unsigned int> _tapRoutesEpoch(0);
+	static TapRoutesReaders _tapRoutesReaders[ZT_TAP_ROUTES_READER_SLOTS];
 }
 
 /****************************************************************************/
@@ -79,45 +106,120 @@ ZeroTier::VirtualTap *getTapByNWID(uint64_t nwid)
 
 ZeroTier::VirtualTap *getTapByAddr(ZeroTier::InetAddress *addr)
 {
+	unsigned int bits;
+	if (addr->isV4()) {
+		bits = 32;
+	}
+	else if (addr->isV6()) {
+		bits = 128;
+	}
+	else {
+		return NULL;
+	}
+	ZeroTier::TapRoutesReaders &slot = ZeroTier::_tapRoutesReaders[
+		std::hash<std::thread::id>()(std::this_thread::get_id()) % ZT_TAP_ROUTES_READER_SLOTS];
+	// announce this reader under the current epoch, retrying if a writer advanced it meanwhile
+	unsigned int epoch;
+	for (;;) {
+		epoch = ZeroTier::_tapRoutesEpoch.load();
+		slot.n[epoch & 1].fetch_add(1);
+		if (ZeroTier::_tapRoutesEpoch.load() == epoch) {
+			break;
+		}
+		slot.n[epoch & 1].fetch_sub(1);
+	}
+	ZeroTier::VirtualTap *tap = NULL;
+	const ZeroTier::TapRoutes *t = ZeroTier::_tapRoutes.load();
+	if (t) {
+		ZeroTier::VirtualTap * const *s = (bits == 32 ? t->v4 : t->v6).lookup(
+			(const uint8_t *)addr->rawIpData(), bits);
+		if (s) {
+			tap = *s;
+		}
+	}
+	slot.n[epoch & 1].fetch_sub(1);
+	return tap;
+}
+
+static void insertTapRoute(ZeroTier::TapRoutes *t, const ZeroTier::InetAddress &prefix, unsigned int bits,
+	ZeroTier::VirtualTap *tap)
+{
+	if (prefix.isV4()) {
+		t->v4.insert((const uint8_t *)prefix.rawIpData(), bits > 32 ? 32 : bits, tap);
+	}
+	if (prefix.isV6()) {
+		t->v6.insert((const uint8_t *)prefix.rawIpData(), bits > 128 ? 128 : bits, tap);
+	}
+}
+
+void rebuildTapRoutes()
+{
+	ZeroTier::TapRoutes *t = new ZeroTier::TapRoutes();
 	ZeroTier::_vtaps_lock.lock();
-	ZeroTier::VirtualTap *s, *tap = nullptr;
-	//char ipbuf[64], ipbuf2[64], ipbuf3[64];
-	for (int i=0; i<ZeroTier::vtaps.size(); i++) {
-		s = (ZeroTier::VirtualTap*)ZeroTier::vtaps[i];
-		// check address schemes
-		for (int j=0; j<s->_ips.size(); j++) {
-			if ((s->_ips[j].isV4() && addr->isV4()) || (s->_ips[j].isV6() && addr->isV6())) {
-				//DEBUG_EXTRA("looking at tap %s, <addr=%s> --- for <%s>", s->_dev.c_str(), s->_ips[j].toString(ipbuf), addr->toIpString(ipbuf2));
-				if (s->_ips[j].isEqualPrefix(addr)
-					|| s->_ips[j].ipsEqual(addr)
-					|| s->_ips[j].containsAddress(addr)
-					|| (addr->isV6() && ipv6_in_subnet(&s->_ips[j], addr))
-					)
-				{
-					//DEBUG_EXTRA("selected tap %s, <addr=%s>", s->_dev.c_str(), s->_ips[j].toString(ipbuf));
-					ZeroTier::_vtaps_lock.unlock();
-					return s;
+	// Equal prefixes are replaced by whatever is inserted last. Managed routes go in before
+	// assigned addresses so that a tap's own subnet wins over an identical pushed route, and
+	// taps are walked last-to-first so that the earliest tap wins ties between taps
+	for (int pass=0; pass<2; pass++) {
+		for (int i=(int)ZeroTier::vtaps.size()-1; i>=0; i--) {
+			ZeroTier::VirtualTap *s = (ZeroTier::VirtualTap*)ZeroTier::vtaps[i];
+			ZeroTier::Mutex::Lock _l(s->_ips_m);
+			if (pass == 0) {
+				for (int j=0; j<s->_managedRoutes.size(); j++) {
+					ZeroTier::InetAddress target = s->_managedRoutes[j].target;
+					insertTapRoute(t, target, target.netmaskBits(), s);
 				}
 			}
-		}
-		// check managed routes
-		if (tap == NULL) {
-			std::vector<ZT_VirtualNetworkRoute> *managed_routes = ZeroTier::zt1Service->getRoutes(s->_nwid);
-			ZeroTier::InetAddress target, nm, via;
-			for (int i=0; i<managed_routes->size(); i++) {
-				target = managed_routes->at(i).target;
-				nm = target.netmask();
-				via = managed_routes->at(i).via;
-				if (target.containsAddress(addr)) {
-					//DEBUG_EXTRA("chose tap with route <target=%s, nm=%s, via=%s>", target.toString(ipbuf), nm.toString(ipbuf2), via.toString(ipbuf3));
-					ZeroTier::_vtaps_lock.unlock();
-					return s;
+			else {
+				for (int j=0; j<s->_ips.size(); j++) {
+					insertTapRoute(t, s->_ips[j], s->_ips[j].netmaskBits(), s);
+					insertTapRoute(t, s->_ips[j], 128, s); // the address itself
 				}
 			}
 		}
 	}
+	ZeroTier::TapRoutes *old = ZeroTier::_tapRoutes.exchange(t);
+	// advance the epoch and wait for readers that may still be looking at the old table
+	unsigned int epoch = ZeroTier::_tapRoutesEpoch.fetch_add(1);
+	for (int i=0; i<ZT_TAP_ROUTES_READER_SLOTS; i++) {
+		while (ZeroTier::_tapRoutesReaders[i].n[epoch & 1].load() != 0) {
+			std::this_thread::yield();
+		}
+	}
+	ZeroTier::_vtaps_lock.unlock();
+	delete old;
+}
+
+void removeTap(ZeroTier::VirtualTap *tap)
+{
+	ZeroTier::_vtaps_lock.lock();
+	ZeroTier::vtaps.erase(std::remove(ZeroTier::vtaps.begin(), ZeroTier::vtaps.end(), (void*)tap),
+		ZeroTier::vtaps.end());
+	ZeroTier::_vtaps_lock.unlock();
+	rebuildTapRoutes();
+}
+
+void getTapStats(struct zts_stats *stats)
+{
+	ZeroTier::_vtaps_lock.lock();
+	stats->tap_count = 0;
+	for (int i=0; i<ZeroTier::vtaps.size() && i<ZT_STATS_MAX_TAPS; i++) {
+		ZeroTier::VirtualTap *s = (ZeroTier::VirtualTap*)ZeroTier::vtaps[i];
+		struct zts_tap_stats *t = &(stats->taps[stats->tap_count++]);
+		t->nwid = s->_nwid;
+		t->rx_frames = s->_rxFrames.load(std::memory_order_relaxed);
+		t->rx_bytes = s->_rxBytes.load(std::memory_order_relaxed);
+		t->rx_drops = s->_rxDrops.load(std::memory_order_relaxed);
+		t->tx_frames = s->_txFrames.load(std::memory_order_relaxed);
+		t->tx_bytes = s->_txBytes.load(std::memory_order_relaxed);
+		t->tx_drops = s->_txDrops.load(std::memory_order_relaxed);
+		struct zts_tap_batch_stats *b = &(stats->tap_batches[stats->tap_count - 1]);
+		b->rx_batches = s->_rxBatches.load(std::memory_order_relaxed);
+		b->rx_batch_frames = s->_rxBatchFrames.load(std::memory_order_relaxed);
+		for (int j=0; j<ZT_RX_BATCH_HIST_LEN; j++) {
+			b->rx_batch_hist[j] = s->_rxBatchHist[j].load(std::memory_order_relaxed);
+		}
+	}
 	ZeroTier::_vtaps_lock.unlock();
-	return tap;
 }
 
 ZeroTier::VirtualTap *getTapByName(char *ifname)
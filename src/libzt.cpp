@@ -30,10 +30,26 @@
  * Application-facing, partially-POSIX-compliant socket API
  */
 
+#include <algorithm>
+#include <cstddef>
 #include <cstring>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <time.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#else
+#include <fcntl.h>
+#endif
 
 #if defined(STACK_LWIP)
 #include "lwip/sockets.h"
+#include "lwip/pbuf.h"
 #include "lwip/sys.h"
 #include "lwip/ip_addr.h"
 #include "lwip/netdb.h"
@@ -44,6 +60,158 @@
 #endif
 
 #include "libzt.h"
+#include "Mutex.hpp"
+
+#if defined(STACK_LWIP)
+// Stack driver tuning (see lwIP.hpp, which can't be included alongside lwIP's socket headers)
+void lwip_set_tx_latency_cap(unsigned int usec);
+int lwip_set_rx_inline(bool enabled);
+int lwip_set_rx_shards(unsigned int n);
+void lwip_get_stats(struct zts_stats *stats);
+
+// zts_epoll_* hand their arguments straight to lwIP
+static_assert(sizeof(struct zts_epoll_event) == sizeof(struct lwip_epoll_event)
+	&& offsetof(struct zts_epoll_event, data) == offsetof(struct lwip_epoll_event, data),
+	"struct zts_epoll_event must match struct lwip_epoll_event");
+static_assert(ZTS_EPOLLIN == LWIP_EPOLLIN && ZTS_EPOLLOUT == LWIP_EPOLLOUT && ZTS_EPOLLERR == LWIP_EPOLLERR
+	&& ZTS_EPOLLHUP == LWIP_EPOLLHUP && ZTS_EPOLLONESHOT == LWIP_EPOLLONESHOT && ZTS_EPOLLET == LWIP_EPOLLET
+	&& ZTS_EPOLL_CTL_ADD == LWIP_EPOLL_CTL_ADD && ZTS_EPOLL_CTL_DEL == LWIP_EPOLL_CTL_DEL
+	&& ZTS_EPOLL_CTL_MOD == LWIP_EPOLL_CTL_MOD, "ZTS_EPOLL* must match LWIP_EPOLL*");
+
+// zts_sendmmsg()/zts_recvmmsg() hand their vectors straight to lwIP as well
+static_assert(sizeof(struct zts_mmsghdr) == sizeof(struct mmsghdr)
+	&& offsetof(struct zts_mmsghdr, msg_len) == offsetof(struct mmsghdr, msg_len),
+	"struct zts_mmsghdr must match struct mmsghdr");
+static_assert(ZTS_MSG_DONTWAIT == MSG_DONTWAIT && ZTS_MSG_WAITFORONE == MSG_WAITFORONE
+	&& ZTS_MSG_TRUNC == MSG_TRUNC && ZTS_MSG_CTRUNC == MSG_CTRUNC, "ZTS_MSG_* must match lwIP's MSG_*");
+
+/*
+ * Host descriptor that mirrors whether an epoll set has ready sockets, see zts_epoll_host_fd()
+ */
+struct zts_host_notifier
+{
+	int epfd;
+	int rfd; // readable while the set is ready, handed to the application
+	int wfd; // same as rfd for an eventfd, write end of a pipe otherwise
+};
+
+static ZeroTier::Mutex zts_host_notifiers_m;
+static std::map<int, struct zts_host_notifier *> zts_host_notifiers;
+
+/*
+ * A zts_send_zc() call whose buffer lwIP may still refer to. Once it doesn't, the completion
+ * is queued for zts_send_zc_reap(), which may be waiting on the condition variable
+ */
+struct zts_zc_send
+{
+	struct pbuf_ext ext; // lwIP hands this back, so it comes first
+	struct zts_zc_completion completion;
+};
+
+static std::mutex zts_zc_done_m;
+static std::condition_variable zts_zc_done_cv;
+static std::deque<struct zts_zc_completion> zts_zc_done;
+
+/*
+ * Ring operations waiting on one socket, in submission order, until lwIP reports it ready
+ */
+struct zts_ring_fd
+{
+	std::deque<struct zts_ring_sqe> rx;    // ZTS_RING_ACCEPT, ZTS_RING_RECV
+	std::deque<struct zts_ring_sqe> tx;    // ZTS_RING_CONNECT, ZTS_RING_SEND
+	std::deque<struct zts_ring_sqe> close; // ZTS_RING_CLOSE and whatever follows it, held back until rx and tx drain
+	bool connecting = false;               // the connect at the head of tx is in progress
+	bool registered = false;               // in the ring's epoll set
+	uint32_t armed = 0;                    // events the one-shot registration waits for, 0 once reported
+};
+
+/*
+ * Submission/completion ring, see zts_ring_create(). Parked operations sit in a private epoll set
+ * whose hook wakes zts_ring_wait() from lwIP's thread, once per batch of ready sockets
+ */
+struct zts_ring
+{
+	int epfd;
+	std::mutex run_m; // fds and the epoll set's registrations, held while operations run
+	std::map<int, struct zts_ring_fd> fds;
+	// everything below is guarded by cq_m, which is always taken last: the hook takes it with
+	// lwIP's SYS_ARCH protection held
+	std::mutex cq_m;
+	std::condition_variable cq_cv;
+	std::vector<struct zts_ring_cqe> cq; // circular, one slot per entry, so it can't overflow
+	unsigned int cq_head = 0;
+	unsigned int cq_count = 0;
+	unsigned int inflight = 0; // submitted and not yet reaped
+	bool ready = false; // the epoll set has sockets ready
+};
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+// see ZT1Service.h
+void getTapStats(struct zts_stats *stats);
+#ifdef __cplusplus
+}
+#endif
+
+/*
+ * Payload bytes moved through each open socket, indexed by socket table slot. Relaxed atomics
+ * on separate cache lines, so the I/O calls only pay for an uncontended add
+ */
+struct alignas(64) zts_socket_counters
+{
+	std::atomic<bool> open;
+	std::atomic<int> fd;
+	std::atomic<uint64_t> rx_bytes;
+	std::atomic<uint64_t> tx_bytes;
+};
+static struct zts_socket_counters zts_socket_bytes[ZT_STATS_MAX_SOCKETS];
+
+// Descriptors carry a generation tag above the socket table index, the counters go by the index
+static inline int zts_socket_slot(int fd)
+{
+#if defined(STACK_LWIP)
+	return fd < LWIP_SOCKET_OFFSET ? -1 : (fd - LWIP_SOCKET_OFFSET) >> LWIP_SOCKET_GENERATION_BITS;
+#else
+	return fd;
+#endif
+}
+
+static void zts_socket_opened(int fd)
+{
+	int slot = zts_socket_slot(fd);
+	if (slot >= 0 && slot < ZT_STATS_MAX_SOCKETS) {
+		zts_socket_bytes[slot].fd.store(fd, std::memory_order_relaxed);
+		zts_socket_bytes[slot].rx_bytes.store(0, std::memory_order_relaxed);
+		zts_socket_bytes[slot].tx_bytes.store(0, std::memory_order_relaxed);
+		zts_socket_bytes[slot].open.store(true, std::memory_order_release);
+	}
+}
+
+static void zts_socket_closed(int fd)
+{
+	int slot = zts_socket_slot(fd);
+	if (slot >= 0 && slot < ZT_STATS_MAX_SOCKETS) {
+		zts_socket_bytes[slot].open.store(false, std::memory_order_release);
+	}
+}
+
+static inline void zts_socket_rx(int fd, ssize_t n)
+{
+	int slot = zts_socket_slot(fd);
+	if (n > 0 && slot >= 0 && slot < ZT_STATS_MAX_SOCKETS) {
+		zts_socket_bytes[slot].rx_bytes.fetch_add(n, std::memory_order_relaxed);
+	}
+}
+
+static inline void zts_socket_tx(int fd, ssize_t n)
+{
+	int slot = zts_socket_slot(fd);
+	if (n > 0 && slot >= 0 && slot < ZT_STATS_MAX_SOCKETS) {
+		zts_socket_bytes[slot].tx_bytes.fetch_add(n, std::memory_order_relaxed);
+	}
+}
 
 #ifdef __cplusplus
 extern "C" {
@@ -101,6 +269,7 @@ int zts_socket(int socket_family, int socket_type, int protocol)
 	DEBUG_EXTRA("family=%d, type=%d, proto=%d", socket_family, socket_type, protocol);
 #if defined(STACK_LWIP)
 	err = lwip_socket(socket_family, socket_type, protocol);
+	zts_socket_opened(err);
 #endif
 #if defined(STCK_PICO)
 #endif
@@ -161,6 +330,7 @@ int zts_accept(int fd, struct sockaddr *addr, socklen_t *addrlen)
 	DEBUG_EXTRA("fd=%d", fd);
 #if defined(STACK_LWIP)
 	err = lwip_accept(fd, addr, addrlen);
+	zts_socket_opened(err);
 #endif
 #if defined(STCK_PICO)
 #endif
@@ -303,6 +473,9 @@ int zts_close(int fd)
 	DEBUG_EXTRA("fd=%d", fd);
 #if defined(STACK_LWIP)
 	err = lwip_close(fd);
+	if (err == 0) {
+		zts_socket_closed(fd);
+	}
 #endif
 #if defined(STCK_PICO)
 #endif
@@ -315,8 +488,99 @@ int zts_poll(struct pollfd *fds, nfds_t nfds, int timeout)
 {
 	int err = -1;
 #if defined(STACK_LWIP)
-	DEBUG_ERROR("warning, this is not implemented");
-	return poll(fds, nfds, timeout);
+	// lwIP has no poll(), so register the descriptors with a short-lived epoll set
+	int epfd = lwip_epoll_create(1);
+	if (epfd < 0) {
+		return -1;
+	}
+	// entries listing a descriptor that is already in the set take their events from that entry
+	// (and add theirs to it), only the requested events are registered so that e.g. an always writable
+	// datagram socket doesn't end the wait early when only POLLIN is of interest. Descriptors lwIP
+	// doesn't know are left to the host's poll()
+	std::vector<nfds_t> first(nfds ? nfds : 1);
+	std::vector<uint32_t> wanted(nfds ? nfds : 1, 0);
+	std::vector<bool> on_host(nfds ? nfds : 1, false);
+	std::vector<struct pollfd> host;
+	std::vector<nfds_t> host_index;
+	nfds_t active = 0;
+	for (nfds_t i=0; i<nfds; i++) {
+		fds[i].revents = 0;
+		first[i] = i;
+		if (fds[i].fd < 0) {
+			continue;
+		}
+		active++;
+		struct lwip_epoll_event ev;
+		ev.events = wanted[i] = ((fds[i].events & POLLIN) ? LWIP_EPOLLIN : 0)
+			| ((fds[i].events & POLLOUT) ? LWIP_EPOLLOUT : 0);
+		ev.data.u64 = i;
+		if (lwip_epoll_ctl(epfd, LWIP_EPOLL_CTL_ADD, fds[i].fd, &ev) < 0) {
+			for (nfds_t j=0; j<i; j++) {
+				if (fds[j].fd == fds[i].fd && first[j] == j && !on_host[j]) {
+					first[i] = j;
+					ev.events = wanted[j] |= wanted[i];
+					ev.data.u64 = j;
+					lwip_epoll_ctl(epfd, LWIP_EPOLL_CTL_MOD, fds[i].fd, &ev);
+					break;
+				}
+			}
+			if (first[i] == i) {
+				on_host[i] = true;
+				host.push_back(fds[i]);
+				host_index.push_back(i);
+			}
+		}
+	}
+	if (host.size() == active) {
+		// nothing for lwIP to wait on
+		lwip_close(epfd);
+		return poll(fds, nfds, timeout);
+	}
+	std::vector<struct lwip_epoll_event> events(nfds);
+	std::vector<short> ready(nfds, 0);
+	int n, hn = 0;
+	if (host.empty()) {
+		n = lwip_epoll_wait(epfd, &events[0], (int)events.size(), timeout);
+	}
+	else {
+		// lwIP can't wake the host's poll(), so take turns: the host descriptors are checked
+		// between waits of at most ZT_POLL_HOST_INTERVAL on the lwIP descriptors
+		u32_t start = sys_now();
+		for (;;) {
+			if ((hn = poll(&host[0], host.size(), 0)) < 0) {
+				n = -1;
+				break;
+			}
+			int wait = (hn || timeout == 0) ? 0 : ZT_POLL_HOST_INTERVAL;
+			if (timeout > 0) {
+				u32_t elapsed = sys_now() - start;
+				wait = elapsed >= (u32_t)timeout ? 0 : std::min(wait, (int)((u32_t)timeout - elapsed));
+			}
+			n = lwip_epoll_wait(epfd, &events[0], (int)events.size(), wait);
+			if (n != 0 || hn || wait == 0) {
+				break;
+			}
+		}
+	}
+	if (n >= 0) {
+		for (int i=0; i<n; i++) {
+			ready[events[i].data.u64] = ((events[i].events & LWIP_EPOLLIN) ? POLLIN : 0)
+				| ((events[i].events & LWIP_EPOLLOUT) ? POLLOUT : 0)
+				| ((events[i].events & LWIP_EPOLLERR) ? POLLERR : 0)
+				| ((events[i].events & LWIP_EPOLLHUP) ? POLLHUP : 0);
+		}
+		for (size_t h=0; h<host.size(); h++) {
+			ready[host_index[h]] = host[h].revents;
+		}
+		err = 0;
+		for (nfds_t i=0; i<nfds; i++) {
+			if (fds[i].fd >= 0) {
+				fds[i].revents = ready[first[i]] & (fds[i].events | POLLERR | POLLHUP | POLLNVAL);
+				err += fds[i].revents ? 1 : 0;
+			}
+		}
+	}
+	lwip_close(epfd);
 #endif
 #if defined(STCK_PICO)
 #endif
@@ -340,6 +604,436 @@ int zts_select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
 	return err;
 }
 
+int zts_epoll_create(int size)
+{
+	int err = -1;
+	DEBUG_EXTRA("size=%d", size);
+#if defined(STACK_LWIP)
+	err = lwip_epoll_create(size);
+#endif
+#if defined(STCK_PICO)
+#endif
+#if defined(NO_STACK)
+#endif
+	return err;
+}
+
+int zts_epoll_ctl(int epfd, int op, int fd, struct zts_epoll_event *event)
+{
+	int err = -1;
+	DEBUG_EXTRA("epfd=%d, op=%d, fd=%d", epfd, op, fd);
+#if defined(STACK_LWIP)
+	err = lwip_epoll_ctl(epfd, op, fd, (struct lwip_epoll_event *)event);
+#endif
+#if defined(STCK_PICO)
+#endif
+#if defined(NO_STACK)
+#endif
+	return err;
+}
+
+int zts_epoll_wait(int epfd, struct zts_epoll_event *events, int maxevents, int timeout)
+{
+	int err = -1;
+#if defined(STACK_LWIP)
+	err = lwip_epoll_wait(epfd, (struct lwip_epoll_event *)events, maxevents, timeout);
+#endif
+#if defined(STCK_PICO)
+#endif
+#if defined(NO_STACK)
+#endif
+	return err;
+}
+
+#if defined(STACK_LWIP)
+// called by lwIP when the set becomes ready or idle, and once after it has been closed
+static void zts_host_notifier_hook(void *arg, int ready)
+{
+	struct zts_host_notifier *hn = (struct zts_host_notifier *)arg;
+	uint64_t n = 1;
+	if (ready > 0) {
+		if (write(hn->wfd, &n, sizeof(n)) < 0) {
+			DEBUG_ERROR("unable to signal host descriptor %d", hn->rfd);
+		}
+	}
+	else if (ready == 0) {
+		while (read(hn->rfd, &n, sizeof(n)) > 0) {}
+	}
+	else {
+		{
+			ZeroTier::Mutex::Lock _l(zts_host_notifiers_m);
+			std::map<int, struct zts_host_notifier *>::iterator it = zts_host_notifiers.find(hn->epfd);
+			if (it != zts_host_notifiers.end() && it->second == hn) {
+				zts_host_notifiers.erase(it);
+			}
+		}
+		close(hn->rfd);
+		if (hn->wfd != hn->rfd) {
+			close(hn->wfd);
+		}
+		delete hn;
+	}
+}
+#endif
+
+int zts_epoll_host_fd(int epfd)
+{
+	int err = -1;
+	DEBUG_EXTRA("epfd=%d", epfd);
+#if defined(STACK_LWIP) && !defined(_WIN32)
+	ZeroTier::Mutex::Lock _l(zts_host_notifiers_m);
+	struct zts_host_notifier *hn = new zts_host_notifier();
+	hn->epfd = epfd;
+#if defined(__linux__)
+	hn->rfd = hn->wfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (hn->rfd < 0) {
+		delete hn;
+		return -1;
+	}
+#else
+	int p[2];
+	if (pipe(p) < 0) {
+		delete hn;
+		return -1;
+	}
+	fcntl(p[0], F_SETFL, O_NONBLOCK);
+	fcntl(p[1], F_SETFL, O_NONBLOCK);
+	hn->rfd = p[0];
+	hn->wfd = p[1];
+#endif
+	// lwIP only accepts the hook if this is an open set that doesn't have one yet
+	if (lwip_epoll_set_hook(epfd, zts_host_notifier_hook, hn) == 0) {
+		zts_host_notifiers[epfd] = hn;
+		return hn->rfd;
+	}
+	close(hn->rfd);
+	if (hn->wfd != hn->rfd) {
+		close(hn->wfd);
+	}
+	delete hn;
+	std::map<int, struct zts_host_notifier *>::iterator it = zts_host_notifiers.find(epfd);
+	if (it != zts_host_notifiers.end()) {
+		err = it->second->rfd;
+	}
+#endif
+	return err;
+}
+
+#if defined(STACK_LWIP)
+// lwIP's own O_NONBLOCK, see zts_fcntl()
+#define ZTS_LWIP_O_NONBLOCK 1
+
+// called by lwIP when the ring's set becomes ready or idle, and once after it has been closed
+static void zts_ring_hook(void *arg, int ready)
+{
+	struct zts_ring *ring = (struct zts_ring *)arg;
+	if (ready < 0) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> l(ring->cq_m);
+		ring->ready = ready > 0;
+	}
+	if (ready > 0) {
+		ring->cq_cv.notify_all();
+	}
+}
+
+static void zts_ring_complete(struct zts_ring *ring, const struct zts_ring_sqe &sqe, ssize_t res)
+{
+	{
+		std::lock_guard<std::mutex> l(ring->cq_m);
+		struct zts_ring_cqe &cqe = ring->cq[(ring->cq_head + ring->cq_count++) % ring->cq.size()];
+		cqe.user_data = sqe.user_data;
+		cqe.res = res;
+		cqe.op = sqe.op;
+		cqe.fd = sqe.fd;
+	}
+	ring->cq_cv.notify_all();
+}
+
+// lwIP's errno.h shadows the host's here, so errors are read back from the socket instead. Peeked
+// rather than read through SO_ERROR, which would clear them before the application sees them
+static int zts_ring_error(int fd)
+{
+	return lwip_socket_peek_error(fd);
+}
+
+// Carries out sqe without blocking, returns false without completing it if it has to wait
+static bool zts_ring_try(struct zts_ring *ring, struct zts_ring_fd &st, const struct zts_ring_sqe &sqe)
+{
+	ssize_t res = -1;
+	int err = 0;
+	if (sqe.op == ZTS_RING_RECV) {
+		res = lwip_recv(sqe.fd, sqe.buf, sqe.len, sqe.flags | MSG_DONTWAIT);
+		zts_socket_rx(sqe.fd, res);
+	}
+	else if (sqe.op == ZTS_RING_SEND) {
+		res = lwip_send(sqe.fd, sqe.buf, sqe.len, sqe.flags | MSG_DONTWAIT);
+		zts_socket_tx(sqe.fd, res);
+	}
+	else if (st.connecting) {
+		// retried once the socket has become writable or failed
+		if ((err = zts_ring_error(sqe.fd)) == EINPROGRESS) {
+			return false;
+		}
+		st.connecting = false;
+		res = err ? -1 : 0;
+	}
+	else {
+		// lwIP has no per-call flag for these, so the socket is non-blocking for the duration of the call
+		int fl = lwip_fcntl(sqe.fd, F_GETFL, 0);
+		if (fl < 0) {
+			err = EBADF;
+		}
+		else {
+			lwip_fcntl(sqe.fd, F_SETFL, fl | ZTS_LWIP_O_NONBLOCK);
+			if (sqe.op == ZTS_RING_ACCEPT) {
+				socklen_t addrlen = sqe.addrlen;
+				res = lwip_accept(sqe.fd, sqe.addr, sqe.addr ? &addrlen : NULL);
+				zts_socket_opened(res);
+			}
+			else {
+				struct sockaddr_storage ss;
+				sys2lwip(sqe.fd, sqe.addr, (struct sockaddr*)&ss);
+				res = lwip_connect(sqe.fd, (struct sockaddr*)&ss, sqe.addrlen);
+			}
+			// before lwip_fcntl() clears it
+			err = res < 0 ? zts_ring_error(sqe.fd) : 0;
+			lwip_fcntl(sqe.fd, F_SETFL, fl);
+			if (sqe.op == ZTS_RING_CONNECT && err == EINPROGRESS) {
+				st.connecting = true;
+				return false;
+			}
+		}
+	}
+	if (res < 0 && !err) {
+		// lwIP records failures on the socket, having to wait is the one outcome it doesn't
+		err = zts_ring_error(sqe.fd);
+		err = err ? err : EWOULDBLOCK;
+	}
+	if (res < 0 && (err == EWOULDBLOCK || err == EAGAIN)) {
+		return false;
+	}
+	zts_ring_complete(ring, sqe, res < 0 ? -err : res);
+	return true;
+}
+
+/*
+ * Runs the operations parked on a socket as far as the reported events allow, then re-arms its
+ * registration for whatever still has to wait. Call with run_m held, it may be erased
+ */
+static void zts_ring_run(struct zts_ring *ring, std::map<int, struct zts_ring_fd>::iterator it, uint32_t events)
+{
+	int fd = it->first;
+	struct zts_ring_fd &st = it->second;
+	if (events & (LWIP_EPOLLIN | LWIP_EPOLLERR)) {
+		while (!st.rx.empty() && zts_ring_try(ring, st, st.rx.front())) {
+			st.rx.pop_front();
+		}
+	}
+	if (events & (LWIP_EPOLLOUT | LWIP_EPOLLERR)) {
+		while (!st.tx.empty() && zts_ring_try(ring, st, st.tx.front())) {
+			st.tx.pop_front();
+		}
+	}
+	if (st.rx.empty() && st.tx.empty() && !st.close.empty()) {
+		// closing removes the socket from the epoll set, anything submitted after the close is too late
+		int res = lwip_close(fd) < 0 ? -zts_ring_error(fd) : 0;
+		if (res == 0) {
+			zts_socket_closed(fd);
+		}
+		zts_ring_complete(ring, st.close.front(), res);
+		for (size_t i=1; i<st.close.size(); i++) {
+			zts_ring_complete(ring, st.close[i], -EBADF);
+		}
+		ring->fds.erase(it);
+		return;
+	}
+	uint32_t want = (st.rx.empty() ? 0 : LWIP_EPOLLIN) | (st.tx.empty() ? 0 : LWIP_EPOLLOUT);
+	if (want && want != st.armed) {
+		struct lwip_epoll_event ev;
+		ev.events = want | LWIP_EPOLLONESHOT;
+		ev.data.fd = fd;
+		if (lwip_epoll_ctl(ring->epfd, st.registered ? LWIP_EPOLL_CTL_MOD : LWIP_EPOLL_CTL_ADD, fd, &ev) < 0) {
+			// not a socket (any more), nothing parked on it will ever become ready
+			int res = -EBADF;
+			for (size_t i=0; i<st.rx.size(); i++) {
+				zts_ring_complete(ring, st.rx[i], res);
+			}
+			for (size_t i=0; i<st.tx.size(); i++) {
+				zts_ring_complete(ring, st.tx[i], res);
+			}
+			ring->fds.erase(it);
+			return;
+		}
+		st.registered = true;
+		st.armed = want;
+	}
+	else if (!want && st.armed) {
+		lwip_epoll_ctl(ring->epfd, LWIP_EPOLL_CTL_DEL, fd, NULL);
+		st.registered = false;
+		st.armed = 0;
+	}
+	if (!st.registered && st.rx.empty() && st.tx.empty()) {
+		ring->fds.erase(it);
+	}
+}
+
+// Runs the operations parked on the sockets lwIP reports ready
+static void zts_ring_poll(struct zts_ring *ring)
+{
+	struct lwip_epoll_event events[64];
+	std::lock_guard<std::mutex> l(ring->run_m);
+	int n = lwip_epoll_wait(ring->epfd, events, 64, 0);
+	for (int i=0; i<n; i++) {
+		std::map<int, struct zts_ring_fd>::iterator it = ring->fds.find(events[i].data.fd);
+		if (it != ring->fds.end()) {
+			it->second.armed = 0;
+			zts_ring_run(ring, it, events[i].events);
+		}
+	}
+}
+#endif
+
+struct zts_ring *zts_ring_create(unsigned int entries)
+{
+	struct zts_ring *ring = NULL;
+	DEBUG_EXTRA("entries=%u", entries);
+#if defined(STACK_LWIP)
+	if (entries == 0) {
+		return NULL;
+	}
+	ring = new zts_ring();
+	ring->cq.resize(entries);
+	ring->epfd = lwip_epoll_create(1);
+	if (ring->epfd < 0 || lwip_epoll_set_hook(ring->epfd, zts_ring_hook, ring) < 0) {
+		if (ring->epfd >= 0) {
+			lwip_close(ring->epfd);
+		}
+		delete ring;
+		ring = NULL;
+	}
+#endif
+#if defined(STCK_PICO)
+#endif
+#if defined(NO_STACK)
+#endif
+	return ring;
+}
+
+int zts_ring_submit(struct zts_ring *ring, const struct zts_ring_sqe *sqes, int n)
+{
+	int err = -1;
+#if defined(STACK_LWIP)
+	if (!ring || n < 0 || (n > 0 && !sqes)) {
+		return -1;
+	}
+	int accepted;
+	{
+		std::lock_guard<std::mutex> l(ring->cq_m);
+		accepted = (int)std::min((size_t)n, ring->cq.size() - ring->inflight);
+		ring->inflight += accepted;
+	}
+	std::lock_guard<std::mutex> l(ring->run_m);
+	for (int i=0; i<accepted; i++) {
+		const struct zts_ring_sqe &sqe = sqes[i];
+		if (sqe.op == ZTS_RING_NOP) {
+			zts_ring_complete(ring, sqe, 0);
+			continue;
+		}
+		if (sqe.op < ZTS_RING_NOP || sqe.op > ZTS_RING_CLOSE || (sqe.op == ZTS_RING_CONNECT && !sqe.addr)
+			|| ((sqe.op == ZTS_RING_SEND || sqe.op == ZTS_RING_RECV) && !sqe.buf && sqe.len)) {
+			zts_ring_complete(ring, sqe, -EINVAL);
+			continue;
+		}
+		std::map<int, struct zts_ring_fd>::iterator it = ring->fds.insert(std::make_pair(sqe.fd, zts_ring_fd())).first;
+		struct zts_ring_fd &st = it->second;
+		if (!st.close.empty() || sqe.op == ZTS_RING_CLOSE) {
+			st.close.push_back(sqe);
+		}
+		else {
+			// only the first operation in each direction gets to run, the others wait their turn
+			std::deque<struct zts_ring_sqe> &q = (sqe.op == ZTS_RING_ACCEPT || sqe.op == ZTS_RING_RECV) ? st.rx : st.tx;
+			if (!q.empty() || !zts_ring_try(ring, st, sqe)) {
+				q.push_back(sqe);
+			}
+		}
+		zts_ring_run(ring, it, 0);
+	}
+	err = accepted;
+#endif
+#if defined(STCK_PICO)
+#endif
+#if defined(NO_STACK)
+#endif
+	return err;
+}
+
+int zts_ring_wait(struct zts_ring *ring, struct zts_ring_cqe *cqes, int max, int timeout_ms)
+{
+	int n = -1;
+#if defined(STACK_LWIP)
+	if (!ring || !cqes || max <= 0) {
+		return -1;
+	}
+	std::chrono::steady_clock::time_point deadline =
+		std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms > 0 ? timeout_ms : 0);
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> l(ring->cq_m);
+			if (!ring->cq_count && ring->inflight) {
+				if (timeout_ms < 0) {
+					ring->cq_cv.wait(l, [ring]{ return ring->cq_count || ring->ready; });
+				}
+				else {
+					ring->cq_cv.wait_until(l, deadline, [ring]{ return ring->cq_count || ring->ready; });
+				}
+			}
+			if (ring->cq_count) {
+				n = (int)std::min((unsigned int)max, ring->cq_count);
+				for (int i=0; i<n; i++) {
+					cqes[i] = ring->cq[ring->cq_head];
+					ring->cq_head = (ring->cq_head + 1) % ring->cq.size();
+				}
+				ring->cq_count -= n;
+				ring->inflight -= n;
+				return n;
+			}
+			if (!ring->ready || !ring->inflight) {
+				return 0;
+			}
+		}
+		// lwIP has woken us, carry out what has become possible and look again
+		zts_ring_poll(ring);
+	}
+#endif
+#if defined(STCK_PICO)
+#endif
+#if defined(NO_STACK)
+#endif
+	return n;
+}
+
+int zts_ring_close(struct zts_ring *ring)
+{
+	int err = -1;
+	DEBUG_EXTRA("ring=%p", ring);
+#if defined(STACK_LWIP)
+	if (!ring) {
+		return -1;
+	}
+	// also removes the parked sockets from the set and unhooks it
+	err = lwip_close(ring->epfd);
+	delete ring;
+#endif
+#if defined(STCK_PICO)
+#endif
+#if defined(NO_STACK)
+#endif
+	return err;
+}
+
 int zts_fcntl(int fd, int cmd, int flags)
 {
 	int err = -1;
@@ -382,6 +1076,7 @@ ssize_t zts_sendto(int fd, const void *buf, size_t len, int flags,
 	struct sockaddr_storage ss;
 	sys2lwip(fd, addr, (struct sockaddr*)&ss);
 	err = lwip_sendto(fd, buf, len, flags, (struct sockaddr*)&ss, addrlen);
+	zts_socket_tx(fd, err);
 #endif
 #if defined(STCK_PICO)
 #endif
@@ -390,12 +1085,74 @@ ssize_t zts_sendto(int fd, const void *buf, size_t len, int flags,
 	return err;
 }
 
+#if defined(STACK_LWIP)
+// Called by lwIP, possibly from its own thread, once it lets go of a zts_send_zc() buffer
+static void zts_zc_release(struct pbuf_ext *ext)
+{
+	struct zts_zc_send *zs = (struct zts_zc_send *)ext;
+	{
+		std::lock_guard<std::mutex> l(zts_zc_done_m);
+		zts_zc_done.push_back(zs->completion);
+	}
+	zts_zc_done_cv.notify_all();
+	delete zs;
+}
+#endif
+
+ssize_t zts_send_zc(int fd, const void *buf, size_t len, int flags, void *cookie)
+{
+	int err = -1;
+	DEBUG_TRANS("fd=%d, len=%d", fd, len);
+#if defined(STACK_LWIP)
+	struct zts_zc_send *zs = new zts_zc_send();
+	zs->ext.ref = 1;
+	zs->ext.release = zts_zc_release;
+	zs->completion.fd = fd;
+	zs->completion.cookie = cookie;
+	err = lwip_send_ext(fd, buf, len, flags, &zs->ext);
+	zts_socket_tx(fd, err);
+	// lwIP's pbufs hold their own references, the completion is queued when the last one goes
+	pbuf_ext_free(&zs->ext);
+#endif
+#if defined(STCK_PICO)
+#endif
+#if defined(NO_STACK)
+#endif
+	return err;
+}
+
+int zts_send_zc_reap(struct zts_zc_completion *completions, int max, int timeout_ms)
+{
+	int n = -1;
+#if defined(STACK_LWIP)
+	if (!completions || max <= 0) {
+		return -1;
+	}
+	std::unique_lock<std::mutex> l(zts_zc_done_m);
+	if (timeout_ms < 0) {
+		zts_zc_done_cv.wait(l, []{ return !zts_zc_done.empty(); });
+	}
+	else {
+		zts_zc_done_cv.wait_for(l, std::chrono::milliseconds(timeout_ms), []{ return !zts_zc_done.empty(); });
+	}
+	n = (int)std::min((size_t)max, zts_zc_done.size());
+	std::copy(zts_zc_done.begin(), zts_zc_done.begin() + n, completions);
+	zts_zc_done.erase(zts_zc_done.begin(), zts_zc_done.begin() + n);
+#endif
+#if defined(STCK_PICO)
+#endif
+#if defined(NO_STACK)
+#endif
+	return n;
+}
+
 ssize_t zts_send(int fd, const void *buf, size_t len, int flags)
 {
 	int err = -1;
 	DEBUG_TRANS("fd=%d, len=%d", fd, len);
 #if defined(STACK_LWIP)
 	err = lwip_send(fd, buf, len, flags);
+	zts_socket_tx(fd, err);
 #endif
 #if defined(STCK_PICO)
 #endif
@@ -410,6 +1167,26 @@ ssize_t zts_sendmsg(int fd, const struct msghdr *msg, int flags)
 	DEBUG_TRANS("fd=%d", fd);
 #if defined(STACK_LWIP)
 	err = lwip_sendmsg(fd, msg, flags);
+	zts_socket_tx(fd, err);
+#endif
+#if defined(STCK_PICO)
+#endif
+#if defined(NO_STACK)
+#endif
+	return err;
+}
+
+int zts_sendmmsg(int fd, struct zts_mmsghdr *msgvec, unsigned int vlen, int flags)
+{
+	int err = -1;
+	DEBUG_TRANS("fd=%d, vlen=%d", fd, vlen);
+#if defined(STACK_LWIP)
+	err = lwip_sendmmsg(fd, (struct mmsghdr *)msgvec, vlen, flags);
+	ssize_t bytes = 0;
+	for (int i = 0; i < err; i++) {
+		bytes += msgvec[i].msg_len;
+	}
+	zts_socket_tx(fd, bytes);
 #endif
 #if defined(STCK_PICO)
 #endif
@@ -424,6 +1201,7 @@ ssize_t zts_recv(int fd, void *buf, size_t len, int flags)
 	DEBUG_TRANS("fd=%d", fd);
 #if defined(STACK_LWIP)
 	err = lwip_recv(fd, buf, len, flags);
+	zts_socket_rx(fd, err);
 #endif
 #if defined(STCK_PICO)
 #endif
@@ -439,6 +1217,7 @@ ssize_t zts_recvfrom(int fd, void *buf, size_t len, int flags,
 	DEBUG_TRANS("fd=%d", fd);
 #if defined(STACK_LWIP)
 	err = lwip_recvfrom(fd, buf, len, flags, addr, addrlen);
+	zts_socket_rx(fd, err);
 #endif
 #if defined(STCK_PICO)
 #endif
@@ -452,6 +1231,27 @@ ssize_t zts_recvmsg(int fd, struct msghdr *msg,int flags)
 	DEBUG_TRANS("fd=%d", fd);
 	int err = -1;
 #if defined(STACK_LWIP)
+	err = lwip_recvmsg(fd, msg, flags);
+	zts_socket_rx(fd, err);
+#endif
+#if defined(STCK_PICO)
+#endif
+#if defined(NO_STACK)
+#endif
+	return err;
+}
+
+int zts_recvmmsg(int fd, struct zts_mmsghdr *msgvec, unsigned int vlen, int flags)
+{
+	int err = -1;
+	DEBUG_TRANS("fd=%d, vlen=%d", fd, vlen);
+#if defined(STACK_LWIP)
+	err = lwip_recvmmsg(fd, (struct mmsghdr *)msgvec, vlen, flags);
+	ssize_t bytes = 0;
+	for (int i = 0; i < err; i++) {
+		bytes += msgvec[i].msg_len;
+	}
+	zts_socket_rx(fd, bytes);
 #endif
 #if defined(STCK_PICO)
 #endif
@@ -466,6 +1266,7 @@ int zts_read(int fd, void *buf, size_t len)
 	//DEBUG_TRANS("fd=%d, len=%d", fd, len);
 #if defined(STACK_LWIP)
 	err = lwip_read(fd, buf, len);
+	zts_socket_rx(fd, err);
 #endif
 #if defined(STCK_PICO)
 #endif
@@ -480,6 +1281,65 @@ int zts_write(int fd, const void *buf, size_t len)
 	int err = -1;
 #if defined(STACK_LWIP)
 	err = lwip_write(fd, buf, len);
+	zts_socket_tx(fd, err);
+#endif
+#if defined(STCK_PICO)
+#endif
+#if defined(NO_STACK)
+#endif
+	return err;
+}
+
+ssize_t zts_readv(int fd, const struct iovec *iov, int iovcnt)
+{
+	int err = -1;
+	DEBUG_TRANS("fd=%d, iovcnt=%d", fd, iovcnt);
+#if defined(STACK_LWIP)
+	err = lwip_readv(fd, iov, iovcnt);
+	zts_socket_rx(fd, err);
+#endif
+#if defined(STCK_PICO)
+#endif
+#if defined(NO_STACK)
+#endif
+	return err;
+}
+
+ssize_t zts_recv_zc(int fd, struct iovec *iov, int *iovcnt, void **handle, int flags)
+{
+	int err = -1;
+	DEBUG_TRANS("fd=%d", fd);
+#if defined(STACK_LWIP)
+	err = lwip_recv_zc(fd, iov, iovcnt, handle, flags);
+	zts_socket_rx(fd, err);
+#endif
+#if defined(STCK_PICO)
+#endif
+#if defined(NO_STACK)
+#endif
+	return err;
+}
+
+int zts_buf_release(void *handle)
+{
+	int err = -1;
+#if defined(STACK_LWIP)
+	err = lwip_recv_zc_release(handle);
+#endif
+#if defined(STCK_PICO)
+#endif
+#if defined(NO_STACK)
+#endif
+	return err;
+}
+
+ssize_t zts_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+	int err = -1;
+	DEBUG_TRANS("fd=%d, iovcnt=%d", fd, iovcnt);
+#if defined(STACK_LWIP)
+	err = lwip_writev(fd, iov, iovcnt);
+	zts_socket_tx(fd, err);
 #endif
 #if defined(STCK_PICO)
 #endif
@@ -534,6 +1394,95 @@ int zts_del_dns_nameserver(struct sockaddr *addr)
 	return err;
 }
 
+/****************************************************************************/
+/* Stack driver tuning                                                      */
+/****************************************************************************/
+
+int zts_set_tx_latency_cap(unsigned int usec)
+{
+	DEBUG_EXTRA("usec=%d", usec);
+	int err = -1;
+#if defined(STACK_LWIP)
+	lwip_set_tx_latency_cap(usec);
+	err = 0;
+#endif
+#if defined(STCK_PICO)
+#endif
+#if defined(NO_STACK)
+#endif
+	return err;
+}
+
+int zts_set_rx_inline(int enabled)
+{
+	DEBUG_EXTRA("enabled=%d", enabled);
+	int err = -1;
+#if defined(STACK_LWIP)
+	err = lwip_set_rx_inline(enabled != 0);
+#endif
+#if defined(STCK_PICO)
+#endif
+#if defined(NO_STACK)
+#endif
+	return err;
+}
+
+int zts_set_rx_shards(unsigned int n)
+{
+	DEBUG_EXTRA("n=%d", n);
+	int err = -1;
+#if defined(STACK_LWIP)
+	err = lwip_set_rx_shards(n);
+#endif
+#if defined(STCK_PICO)
+#endif
+#if defined(NO_STACK)
+#endif
+	return err;
+}
+
+/****************************************************************************/
+/* Statistics                                                               */
+/****************************************************************************/
+
+int zts_get_stats(struct zts_stats *stats, size_t len)
+{
+	if (stats == NULL || len < 2 * sizeof(uint32_t)) {
+		return -1;
+	}
+	struct zts_stats *snapshot = new struct zts_stats;
+	memset(snapshot, 0, sizeof(struct zts_stats));
+	snapshot->version = ZT_STATS_VERSION;
+	snapshot->size = len < sizeof(struct zts_stats) ? len : sizeof(struct zts_stats);
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	snapshot->timestamp = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+#if defined(STACK_LWIP)
+	lwip_get_stats(snapshot);
+#endif
+#if defined(STCK_PICO)
+#endif
+#if defined(NO_STACK)
+#endif
+	getTapStats(snapshot);
+	// the link layer is the sum of all VirtualTaps
+	for (unsigned int i=0; i<snapshot->tap_count; i++) {
+		snapshot->link.recv += snapshot->taps[i].rx_frames;
+		snapshot->link.xmit += snapshot->taps[i].tx_frames;
+		snapshot->link.drop += snapshot->taps[i].rx_drops + snapshot->taps[i].tx_drops;
+	}
+	for (int slot=0; slot<ZT_STATS_MAX_SOCKETS; slot++) {
+		if (zts_socket_bytes[slot].open.load(std::memory_order_acquire)) {
+			struct zts_socket_stats *s = &(snapshot->sockets[snapshot->socket_count++]);
+			s->fd = zts_socket_bytes[slot].fd.load(std::memory_order_relaxed);
+			s->rx_bytes = zts_socket_bytes[slot].rx_bytes.load(std::memory_order_relaxed);
+			s->tx_bytes = zts_socket_bytes[slot].tx_bytes.load(std::memory_order_relaxed);
+		}
+	}
+	memcpy(stats, snapshot, snapshot->size);
+	delete snapshot;
+	return 0;
+}
 
 /****************************************************************************/
 /* SDK Socket API (Java Native Interface JNI)                               */
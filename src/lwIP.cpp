@@ -30,6 +30,10 @@
  * lwIP network stack driver
  */
 
+#include <time.h>
+#include <vector>
+#include <algorithm>
+
 #include "VirtualTap.hpp"
 
 #include "ZeroTierOne.h"
@@ -38,6 +42,7 @@
 #include "libzt.h"
 #include "Utilities.h"
 #include "Debug.hpp"
+#include "Trace.hpp"
 
 #include "netif/ethernet.h"
 #include "lwip/netif.h"
@@ -50,22 +55,111 @@
 #include "lwip/priv/tcp_priv.h" /* for tcp_debug_print_pcbs() */
 #include "lwip/timeouts.h"
 #include "lwip/stats.h"
+#include "lwip/inet_chksum.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/ip6.h"
 
 #include "dns.h"
 #include "netifapi.h"
 
 #include "lwIP.hpp"
 
-netif lwipdev, lwipdev6, n1;
-
-struct netif netifs[10];
-
 bool lwip_driver_initialized = false;
 ZeroTier::Mutex driver_m;
 
+/**
+ * A pbuf which references a frame buffer loaned to us by the caller of VirtualTap::putLoaned()
+ */
+struct zt_loaned_pbuf
+{
+	struct pbuf_custom pc;
+	void (*release)(void *, void *);
+	void *arg;
+	void *buf;
+};
+
+LWIP_MEMPOOL_DECLARE(ZT_LOANED_PBUF, ZT_RX_LOAN_POOL_SIZE, sizeof(struct zt_loaned_pbuf), "ZT_LOANED_PBUF")
+
+/**
+ * Maximum time (in microseconds) a frame may sit in a VirtualTap's TX staging queue, 0 disables staging
+ */
+volatile unsigned int lwip_tx_latency_cap = ZT_TX_STAGE_LATENCY_CAP;
+
+/**
+ * VirtualTaps which staged TX frames during the current stack work cycle (guarded by the core lock)
+ */
+static std::vector<ZeroTier::VirtualTap*> tx_pending_taps;
+
+static void lwip_core_unlock_hook();
+
+/**
+ * Whether frames from the virtual wire are fed into the stack by the calling thread (under the core
+ * lock) instead of being queued for the tcpip thread
+ */
+volatile bool lwip_rx_inline = ZT_RX_INLINE;
+
+/**
+ * Set while the current thread is handing frames to the virtual wire (with the core lock held)
+ */
+static thread_local bool lwip_tx_in_progress = false;
+
+/**
+ * Released once every RX shard has processed the frames queued ahead of a removed netif
+ */
+struct lwip_netif_release
+{
+	struct netif *interface;
+	std::atomic<unsigned int> remaining;
+};
+
+/**
+ * A frame waiting in an RX shard (or, when p is NULL, a netif release marker)
+ */
+struct lwip_rx_shard_entry
+{
+	struct netif *interface;
+	struct pbuf *p;
+	struct lwip_netif_release *release;
+};
+
+/**
+ * A worker thread owning the flows hashed to it: it verifies their checksums in parallel with the
+ * other shards and feeds them into the stack in batches, preserving per-flow order. The stack itself
+ * still processes them one at a time under the core lock
+ */
+struct lwip_rx_shard
+{
+	ZeroTier::Mutex m;
+	sys_sem_t ready;
+	std::vector<lwip_rx_shard_entry> pending;
+};
+
+/**
+ * Number of RX shards to start with the stack, and those running (fixed once the stack is up)
+ */
+static unsigned int lwip_rx_shards_requested = ZT_RX_SHARDS;
+static unsigned int lwip_rx_shard_count = 0;
+static struct lwip_rx_shard *lwip_rx_shards = NULL;
+
+static void lwip_rx_shards_start();
+static void lwip_free_interface(void *arg);
+
+// called by netif_add(), configures the netif for the VirtualTap stored in netif->state
 err_t tapif_init(struct netif *netif)
 {
-	// we do the actual initialization in elsewhere
+	ZeroTier::VirtualTap *tap = (ZeroTier::VirtualTap*)netif->state;
+	netif->output = etharp_output;
+	netif->linkoutput = lwip_eth_tx;
+	netif->mtu = (tap->_mtu > 0 && tap->_mtu < ZT_MAX_MTU) ? tap->_mtu : ZT_MAX_MTU;
+	netif->name[0] = 'l';
+	netif->name[1] = '4';
+	netif->hwaddr_len = 6;
+	tap->_mac.copyTo(netif->hwaddr, netif->hwaddr_len);
+	netif->flags = NETIF_FLAG_BROADCAST
+		| NETIF_FLAG_ETHARP
+		| NETIF_FLAG_IGMP
+		| NETIF_FLAG_LINK_UP
+		| NETIF_FLAG_UP;
 	return ERR_OK;
 }
 
@@ -86,7 +180,7 @@ static void tcpip_init_done(void *arg)
 {
 	sys_sem_t *sem;
 	sem = (sys_sem_t *)arg;
-	netif_set_up(&lwipdev);
+	lwip_rx_shards_start();
 	DEBUG_EXTRA("lwIP stack driver initialized");
 	lwip_driver_initialized = true;
 	driver_m.unlock();
@@ -113,92 +207,208 @@ void lwip_driver_init()
 {
 	driver_m.lock(); // unlocked from callback indicating completion of driver init
 	if (lwip_driver_initialized == true) {
+		driver_m.unlock();
 		return;
 	}
+	LWIP_MEMPOOL_INIT(ZT_LOANED_PBUF);
+	tcpip_core_unlock_hook = lwip_core_unlock_hook;
 	sys_thread_new("main_network_stack_thread", main_network_stack_thread,
 		NULL, DEFAULT_THREAD_STACKSIZE, DEFAULT_THREAD_PRIO);
 }
 
-err_t lwip_eth_tx(struct netif *netif, struct pbuf *p)
+// moves a single frame onto the virtual wire
+static err_t lwip_eth_tx_frame(ZeroTier::VirtualTap *tap, struct pbuf *p)
 {
 	struct pbuf *q;
 	char buf[ZT_MAX_MTU+32];
 	char *bufptr;
-	int totalLength = 0;
-
-	ZeroTier::VirtualTap *tap = (ZeroTier::VirtualTap*)netif->state;
-	bufptr = buf;
-	for (q = p; q != NULL; q = q->next) {
-		memcpy(bufptr, q->payload, q->len);
-		bufptr += q->len;
-		totalLength += q->len;
-	}
 	struct eth_hdr *ethhdr;
-	ethhdr = (struct eth_hdr *)buf;
 
+	if (p->len < sizeof(struct eth_hdr)) {
+		DEBUG_ERROR("dropped packet: first pbuf smaller than ethernet header");
+		tap->_txDrops.fetch_add(1, std::memory_order_relaxed);
+		ZT_TRACE_DROPPED(ZT_TRACE_DROP_SHORT_PBUF, tap->_nwid, NULL, NULL, 1);
+		return ERR_IF;
+	}
+	ethhdr = (struct eth_hdr *)p->payload;
 	ZeroTier::MAC src_mac;
 	ZeroTier::MAC dest_mac;
 	src_mac.setTo(ethhdr->src.addr, 6);
 	dest_mac.setTo(ethhdr->dest.addr, 6);
-
-	char *data = buf + sizeof(struct eth_hdr);
-	int len = totalLength - sizeof(struct eth_hdr);
 	int proto = ZeroTier::Utils::ntoh((uint16_t)ethhdr->type);
-	tap->_handler(tap->_arg, NULL, tap->_nwid, src_mac, dest_mac, proto, 0, data, len);
-
-	if (ZT_MSG_TRANSFER == true) {
-		char flagbuf[32];
-		memset(&flagbuf, 0, 32);
-		char macBuf[ZT_MAC_ADDRSTRLEN], nodeBuf[ZTO_ID_LEN];
-		mac2str(macBuf, ZT_MAC_ADDRSTRLEN, ethhdr->dest.addr);
-		ZeroTier::MAC mac;
-		mac.setTo(ethhdr->dest.addr, 6);
-		mac.toAddress(tap->_nwid).toString(nodeBuf);
-		DEBUG_TRANS("len=%5d dst=%s [%s TX <-- %s] proto=0x%04x %s %s", totalLength, macBuf, nodeBuf, tap->nodeId().c_str(),
-			ZeroTier::Utils::ntoh(ethhdr->type), beautify_eth_proto_nums(ZeroTier::Utils::ntoh(ethhdr->type)), flagbuf);
+	int len = p->tot_len - sizeof(struct eth_hdr);
+
+	lwip_tx_in_progress = true;
+	if (p->next == NULL) {
+		// contiguous frame, no need to flatten
+		tap->_handler(tap->_arg, NULL, tap->_nwid, src_mac, dest_mac, proto, 0,
+			(char*)p->payload + sizeof(struct eth_hdr), len);
+	}
+	else if (tap->_sgHandler && pbuf_clen(p) <= ZT_TX_MAX_IOV) {
+		// hand the pbuf chain to the virtual wire as-is
+		struct iovec iov[ZT_TX_MAX_IOV];
+		int iovcnt = 0;
+		if (p->len > sizeof(struct eth_hdr)) {
+			iov[iovcnt].iov_base = (char*)p->payload + sizeof(struct eth_hdr);
+			iov[iovcnt].iov_len = p->len - sizeof(struct eth_hdr);
+			iovcnt++;
+		}
+		for (q = p->next; q != NULL; q = q->next) {
+			if (q->len) {
+				iov[iovcnt].iov_base = q->payload;
+				iov[iovcnt].iov_len = q->len;
+				iovcnt++;
+			}
+		}
+		tap->_sgHandler(tap->_arg, NULL, tap->_nwid, src_mac, dest_mac, proto, 0, iov, iovcnt, len);
 	}
+	else {
+		if (p->tot_len > sizeof(buf)) {
+			DEBUG_ERROR("dropped packet: frame larger than TX buffer");
+			tap->_txDrops.fetch_add(1, std::memory_order_relaxed);
+			ZT_TRACE_DROPPED(ZT_TRACE_DROP_TX_TOO_LARGE, tap->_nwid, ethhdr->src.addr, ethhdr->dest.addr, 1);
+			lwip_tx_in_progress = false;
+			return ERR_IF;
+		}
+		bufptr = buf;
+		for (q = p; q != NULL; q = q->next) {
+			memcpy(bufptr, q->payload, q->len);
+			bufptr += q->len;
+		}
+		tap->_handler(tap->_arg, NULL, tap->_nwid, src_mac, dest_mac, proto, 0, buf + sizeof(struct eth_hdr), len);
+	}
+	lwip_tx_in_progress = false;
+
+	tap->_txFrames.fetch_add(1, std::memory_order_relaxed);
+	tap->_txBytes.fetch_add(len, std::memory_order_relaxed);
+	ZT_TRACE_FRAME(ZT_TRACE_ETH_TX, tap->_nwid, ethhdr->src.addr, ethhdr->dest.addr, proto, p->tot_len);
 	return ERR_OK;
 }
 
-void general_lwip_init_interface(void *tapref, struct netif *interface, const char *name, const ZeroTier::MAC &mac, const ZeroTier::InetAddress &addr, const ZeroTier::InetAddress &nm, const ZeroTier::InetAddress &gw)
+static uint64_t lwip_now_us()
 {
-#if defined(LIBZT_IPV4)
-	char ipbuf[INET6_ADDRSTRLEN], nmbuf[INET6_ADDRSTRLEN], gwbuf[INET6_ADDRSTRLEN];
-	static ip_addr_t _addr, _nm, _gw;
-	IP4_ADDR(&_gw,127,0,0,1);
-	IP4_ADDR(&_addr,10,6,6,86);
-	//_addr.addr = *((u32_t *)addr.rawIpData());
-	_nm.addr = *((u32_t *)addr.netmask().rawIpData());
-	netif_add(&(n1),&_addr, &_nm, &_gw, NULL, tapif_init, tcpip_input);
-	n1.state = tapref;
-	n1.output = etharp_output;
-	n1.mtu = ZT_MAX_MTU;
-	n1.name[0] = name[0];
-	n1.name[1] = name[1];
-	n1.linkoutput = lwip_eth_tx;
-	n1.hwaddr_len = 6;
-	mac.copyTo(n1.hwaddr, n1.hwaddr_len);
-	n1.flags = NETIF_FLAG_BROADCAST
-		| NETIF_FLAG_ETHARP
-		| NETIF_FLAG_IGMP
-		| NETIF_FLAG_LINK_UP
-		| NETIF_FLAG_UP;
-	netif_set_link_up(&n1);
-	char macbuf[ZT_MAC_ADDRSTRLEN];
-	mac2str(macbuf, ZT_MAC_ADDRSTRLEN, n1.hwaddr);
-	DEBUG_INFO("initialized netif as [mac=%s, addr=%s, nm=%s, gw=%s]", macbuf, addr.toString(ipbuf), addr.netmask().toString(nmbuf), gw.toString(gwbuf));
-#endif
-#if defined(LIBZT_IPV6)
-#endif
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
-void general_turn_on_interface(struct netif *interface)
+// accounts for a received frame dropped before the stack took it, taking its addresses from its ethernet header
+static inline void lwip_rx_drop(int reason, struct netif *interface, struct pbuf *p)
 {
-	//netif_set_up(&n1);
-	//netif_set_default(&n1);
-	//lwipdev.linkoutput = NULL;
-	//netif_set_down(&lwipdev);
-	//netif_set_link_down(&lwipdev);
+	ZeroTier::VirtualTap *tap = (ZeroTier::VirtualTap *)interface->state;
+	if (tap) {
+		tap->_rxDrops.fetch_add(1, std::memory_order_relaxed);
+	}
+	if (ZT_TRACE_ENABLED(ZT_TRACE_DROPS)) {
+		struct eth_hdr *ethhdr = p->len >= sizeof(struct eth_hdr) ? (struct eth_hdr *)p->payload : NULL;
+		zt_trace_event(ZT_TRACE_DROP, reason, tap ? tap->_nwid : 0, ethhdr ? ethhdr->src.addr : NULL,
+			ethhdr ? ethhdr->dest.addr : NULL, 1);
+	}
+}
+
+// sends everything in the tap's TX staging queue as one burst, core lock must be held
+static void lwip_eth_tx_flush(ZeroTier::VirtualTap *tap)
+{
+	for (unsigned int i=0; i<tap->_txStageLen; i++) {
+		struct pbuf *p = (struct pbuf *)tap->_txStage[i];
+		lwip_eth_tx_frame(tap, p);
+		pbuf_free(p);
+	}
+	tap->_txStageLen = 0;
+	tap->_txStageBytes = 0;
+}
+
+// runs at the end of every unit of stack work (tcpip message, timer, or locked API call)
+static void lwip_core_unlock_hook()
+{
+	if (tx_pending_taps.empty()) {
+		return;
+	}
+	for (size_t i=0; i<tx_pending_taps.size(); i++) {
+		lwip_eth_tx_flush(tx_pending_taps[i]);
+		tx_pending_taps[i]->_txStagePending = false;
+	}
+	tx_pending_taps.clear();
+}
+
+err_t lwip_eth_tx(struct netif *netif, struct pbuf *p)
+{
+	struct pbuf *q;
+	ZeroTier::VirtualTap *tap = (ZeroTier::VirtualTap*)netif->state;
+	if (tap == NULL) {
+		return ERR_IF; // VirtualTap is being torn down
+	}
+	unsigned int latency_cap = lwip_tx_latency_cap;
+	if (latency_cap == 0) {
+		return lwip_eth_tx_frame(tap, p);
+	}
+	// frames which reference memory we don't own (e.g. application buffers) must be copied
+	for (q = p; q != NULL; q = q->next) {
+		if (q->type == PBUF_REF || q->type == PBUF_ROM) {
+			break;
+		}
+	}
+	if (q == NULL) {
+		pbuf_ref(p);
+	}
+	else {
+		q = pbuf_alloc(PBUF_RAW, p->tot_len, PBUF_RAM);
+		if (q == NULL) {
+			lwip_eth_tx_flush(tap);
+			return lwip_eth_tx_frame(tap, p);
+		}
+		pbuf_copy(q, p);
+		p = q;
+	}
+	uint64_t now = lwip_now_us();
+	if (tap->_txStageLen == 0) {
+		tap->_txStageSince = now;
+	}
+	if (!tap->_txStagePending) {
+		tap->_txStagePending = true;
+		tx_pending_taps.push_back(tap);
+	}
+	tap->_txStage[tap->_txStageLen++] = p;
+	tap->_txStageBytes += p->tot_len;
+	if (tap->_txStageLen == ZT_TX_STAGE_MAX_FRAMES
+		|| tap->_txStageBytes >= ZT_TX_STAGE_MAX_BYTES
+		|| (now - tap->_txStageSince) >= latency_cap) {
+		lwip_eth_tx_flush(tap);
+	}
+	return ERR_OK;
+}
+
+void lwip_eth_tx_discard(ZeroTier::VirtualTap *tap)
+{
+	if (lwip_driver_initialized == false) {
+		return;
+	}
+	LOCK_TCPIP_CORE();
+	for (unsigned int i=0; i<tap->_txStageLen; i++) {
+		pbuf_free((struct pbuf *)tap->_txStage[i]);
+	}
+	tap->_txStageLen = 0;
+	tap->_txStageBytes = 0;
+	if (tap->_txStagePending) {
+		tx_pending_taps.erase(std::find(tx_pending_taps.begin(), tx_pending_taps.end(), tap));
+		tap->_txStagePending = false;
+	}
+	UNLOCK_TCPIP_CORE();
+}
+
+void lwip_set_tx_latency_cap(unsigned int usec)
+{
+	lwip_tx_latency_cap = usec;
+}
+
+int lwip_set_rx_inline(bool enabled)
+{
+#if LWIP_TCPIP_CORE_LOCKING
+	lwip_rx_inline = enabled;
+	return 0;
+#else
+	return enabled ? -1 : 0;
+#endif
 }
 
 void lwip_dns_init()
@@ -214,40 +424,428 @@ void lwip_start_dhcp(struct netif *interface)
 void lwip_init_interface(void *tapref, const ZeroTier::MAC &mac, const ZeroTier::InetAddress &ip)
 {
 	char ipbuf[INET6_ADDRSTRLEN], nmbuf[INET6_ADDRSTRLEN];
+	ZeroTier::VirtualTap *tap = (ZeroTier::VirtualTap*)tapref;
 #if defined(LIBZT_IPV4)
 	if (ip.isV4()) {
-		static ip_addr_t ipaddr, netmask, gw;
+		if (tap->_netif) {
+			// lwIP keeps a single IPv4 address per netif
+			DEBUG_INFO("%s already has an IPv4 address, ignoring %s", tap->_dev.c_str(), ip.toString(ipbuf));
+			return;
+		}
+		ip4_addr_t ipaddr, netmask, gw;
 		IP4_ADDR(&gw,127,0,0,1);
 		ipaddr.addr = *((u32_t *)ip.rawIpData());
 		netmask.addr = *((u32_t *)ip.netmask().rawIpData());
-		netif_add(&(lwipdev),&ipaddr, &netmask, &gw, NULL, tapif_init, tcpip_input);
-		lwipdev.state = tapref;
-		lwipdev.output = etharp_output;
-		lwipdev.mtu = ZT_MAX_MTU;
-		lwipdev.name[0] = 'l';
-		lwipdev.name[1] = '4';
-		lwipdev.linkoutput = lwip_eth_tx;
-		lwipdev.hwaddr_len = 6;
-		mac.copyTo(lwipdev.hwaddr, lwipdev.hwaddr_len);
-		lwipdev.flags = NETIF_FLAG_BROADCAST
-			| NETIF_FLAG_ETHARP
-			| NETIF_FLAG_IGMP
-			| NETIF_FLAG_LINK_UP
-			| NETIF_FLAG_UP;
-		netif_set_default(&(lwipdev));
-		netif_set_link_up(&(lwipdev));
-		netif_set_up(&(lwipdev));
+		struct netif *interface = new struct netif();
+		if (netifapi_netif_add(interface, &ipaddr, &netmask, &gw, tapref, tapif_init, tcpip_input) != ERR_OK) {
+			DEBUG_ERROR("unable to add netif for %s", tap->_dev.c_str());
+			delete interface;
+			return;
+		}
+		tap->_netif = interface;
+		// the first VirtualTap brought up carries traffic that matches no other netif's subnet
+		if (netif_default == NULL) {
+			netifapi_netif_set_default(interface);
+		}
+		netifapi_netif_set_link_up(interface);
+		netifapi_netif_set_up(interface);
 		char macbuf[ZT_MAC_ADDRSTRLEN];
-		mac2str(macbuf, ZT_MAC_ADDRSTRLEN, lwipdev.hwaddr);
-		DEBUG_INFO("initialized netif as [mac=%s, addr=%s, nm=%s]", macbuf, ip.toString(ipbuf), ip.netmask().toString(nmbuf));
+		mac2str(macbuf, ZT_MAC_ADDRSTRLEN, interface->hwaddr);
+		DEBUG_INFO("initialized netif %c%c%d as [mac=%s, addr=%s, nm=%s, mtu=%d]", interface->name[0], interface->name[1],
+			interface->num, macbuf, ip.toString(ipbuf), ip.netmask().toString(nmbuf), interface->mtu);
 	}
 #endif
 #if defined(LIBZT_IPV6)
 #endif
 }
 
-void lwip_eth_rx(ZeroTier::VirtualTap *tap, const ZeroTier::MAC &from, const ZeroTier::MAC &to, unsigned int etherType,
-	const void *data, unsigned int len)
+// runs in the tcpip thread after everything queued ahead of it, so no queued frame still refers to the netif
+static void lwip_free_interface(void *arg)
+{
+	delete (struct netif *)arg;
+}
+
+void lwip_remove_interface(void *tapref)
+{
+	ZeroTier::VirtualTap *tap = (ZeroTier::VirtualTap*)tapref;
+	struct netif *interface = (struct netif *)tap->_netif;
+	if (interface == NULL) {
+		return;
+	}
+	netifapi_netif_remove(interface);
+	LOCK_TCPIP_CORE();
+	interface->state = NULL;
+	tap->_netif = NULL;
+	if (netif_default == NULL && netif_list != NULL) {
+		netif_set_default(netif_list);
+	}
+	UNLOCK_TCPIP_CORE();
+	if (lwip_rx_shard_count) {
+		// the shards may still hold frames for this netif, the last one to reach the marker frees it
+		struct lwip_netif_release *release = new struct lwip_netif_release;
+		release->interface = interface;
+		release->remaining = lwip_rx_shard_count;
+		for (unsigned int i=0; i<lwip_rx_shard_count; i++) {
+			struct lwip_rx_shard *shard = &lwip_rx_shards[i];
+			shard->m.lock();
+			shard->pending.push_back({ NULL, NULL, release });
+			shard->m.unlock();
+			sys_sem_signal(&shard->ready);
+		}
+		return;
+	}
+	if (tcpip_callback(lwip_free_interface, interface) != ERR_OK) {
+		DEBUG_ERROR("unable to free netif");
+	}
+}
+
+void lwip_set_interface_mtu(void *tapref, unsigned int mtu)
+{
+	ZeroTier::VirtualTap *tap = (ZeroTier::VirtualTap*)tapref;
+	LOCK_TCPIP_CORE();
+	if (tap->_netif) {
+		((struct netif *)tap->_netif)->mtu = (mtu > 0 && mtu < ZT_MAX_MTU) ? mtu : ZT_MAX_MTU;
+	}
+	UNLOCK_TCPIP_CORE();
+}
+
+// whether the calling thread should feed frames into the stack itself
+static inline bool lwip_eth_input_inline()
+{
+#if LWIP_TCPIP_CORE_LOCKING
+	// a frame looped back from inside our own TX handler already holds the (non-recursive) core lock
+	return lwip_rx_inline && !lwip_tx_in_progress;
+#else
+	return false;
+#endif
+}
+
+static inline uint32_t lwip_flow_hash_mix(uint32_t h, uint32_t k)
+{
+	k *= 0xcc9e2d51;
+	k = (k << 15) | (k >> 17);
+	k *= 0x1b873593;
+	h ^= k;
+	h = (h << 13) | (h >> 19);
+	return h * 5 + 0xe6546b64;
+}
+
+// RSS-style hash of a frame's flow: addresses, protocol and (for unfragmented TCP/UDP) ports
+static uint32_t lwip_flow_hash(struct pbuf *p)
+{
+	const uint8_t *f = (const uint8_t *)p->payload;
+	const uint8_t *ip = f + SIZEOF_ETH_HDR;
+	uint32_t h = 0, w;
+	uint8_t proto = 0;
+	const uint8_t *ports = NULL;
+	if (p->len < SIZEOF_ETH_HDR) {
+		return 0;
+	}
+	uint16_t type = (f[12] << 8) | f[13];
+	if (type == ETHTYPE_IP && p->len >= SIZEOF_ETH_HDR + IP_HLEN) {
+		unsigned int hlen = (ip[0] & 0x0f) * 4;
+		for (int i=12; i<20; i+=4) {
+			memcpy(&w, ip + i, 4);
+			h = lwip_flow_hash_mix(h, w);
+		}
+		proto = ip[9];
+		bool fragment = ((ip[6] & 0x3f) | ip[7]) != 0;
+		if (!fragment && p->len >= SIZEOF_ETH_HDR + hlen + 4) {
+			ports = ip + hlen;
+		}
+	}
+	else if (type == ETHTYPE_IPV6 && p->len >= SIZEOF_ETH_HDR + IP6_HLEN) {
+		for (int i=8; i<40; i+=4) {
+			memcpy(&w, ip + i, 4);
+			h = lwip_flow_hash_mix(h, w);
+		}
+		proto = ip[6];
+		if (p->len >= SIZEOF_ETH_HDR + IP6_HLEN + 4) {
+			ports = ip + IP6_HLEN;
+		}
+	}
+	else {
+		return 0; // ARP etc. all go to the first shard
+	}
+	if (ports && (proto == IP_PROTO_TCP || proto == IP_PROTO_UDP)) {
+		memcpy(&w, ports, 4);
+		h = lwip_flow_hash_mix(h, w);
+	}
+	h = lwip_flow_hash_mix(h, proto);
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	return h;
+}
+
+// verifies the TCP/UDP checksum of an unfragmented datagram and marks it PBUF_FLAG_CHKSUM_VERIFIED
+// so that the stack doesn't check it again, anything else is left unmarked for the stack to check
+static bool lwip_rx_verify(struct pbuf *p)
+{
+	if (p->len < SIZEOF_ETH_HDR + IP_HLEN) {
+		return true;
+	}
+	const uint8_t *f = (const uint8_t *)p->payload;
+	const uint8_t *ip = f + SIZEOF_ETH_HDR;
+	uint16_t type = (f[12] << 8) | f[13];
+	u16_t hlen, plen, chksum;
+	u8_t proto;
+#if LWIP_IPV4
+	if (type == ETHTYPE_IP) {
+		const struct ip_hdr *iphdr = (const struct ip_hdr *)ip;
+		hlen = IPH_HL(iphdr) * 4;
+		u16_t tot_len = lwip_ntohs(IPH_LEN(iphdr));
+		proto = IPH_PROTO(iphdr);
+		if ((IPH_OFFSET(iphdr) & PP_HTONS(IP_OFFMASK | IP_MF)) || hlen < IP_HLEN || tot_len < hlen
+			|| tot_len > p->tot_len - SIZEOF_ETH_HDR || p->len < SIZEOF_ETH_HDR + hlen) {
+			return true; // fragments and malformed headers are handled by the stack
+		}
+		if (proto != IP_PROTO_TCP && proto != IP_PROTO_UDP) {
+			return true;
+		}
+		plen = tot_len - hlen;
+		if (proto == IP_PROTO_UDP && plen >= 8 && ip[hlen + 6] == 0 && ip[hlen + 7] == 0) {
+			return true; // no UDP checksum
+		}
+		ip4_addr_t src, dest;
+		memcpy(&src, &iphdr->src, sizeof(src));
+		memcpy(&dest, &iphdr->dest, sizeof(dest));
+		// trim ethernet padding, the stack would do the same
+		pbuf_realloc(p, SIZEOF_ETH_HDR + tot_len);
+		pbuf_header(p, -(s16_t)(SIZEOF_ETH_HDR + hlen));
+		chksum = inet_chksum_pseudo(p, proto, plen, &src, &dest);
+		// forced since a loaned frame (PBUF_REF) can't otherwise take its headers back
+		pbuf_header_force(p, (s16_t)(SIZEOF_ETH_HDR + hlen));
+		if (chksum != 0) {
+			return false;
+		}
+		p->flags |= PBUF_FLAG_CHKSUM_VERIFIED;
+		return true;
+	}
+#endif
+#if LWIP_IPV6
+	if (type == ETHTYPE_IPV6 && p->len >= SIZEOF_ETH_HDR + IP6_HLEN) {
+		const struct ip6_hdr *ip6hdr = (const struct ip6_hdr *)ip;
+		hlen = IP6_HLEN;
+		plen = lwip_ntohs(IP6H_PLEN(ip6hdr));
+		proto = IP6H_NEXTH(ip6hdr);
+		if ((proto != IP6_NEXTH_TCP && proto != IP6_NEXTH_UDP) || plen > p->tot_len - SIZEOF_ETH_HDR - hlen) {
+			return true; // extension headers are handled by the stack
+		}
+		ip6_addr_t src, dest;
+		ip6_addr_copy(src, ip6hdr->src);
+		ip6_addr_copy(dest, ip6hdr->dest);
+		pbuf_realloc(p, SIZEOF_ETH_HDR + hlen + plen);
+		pbuf_header(p, -(s16_t)(SIZEOF_ETH_HDR + hlen));
+		chksum = ip6_chksum_pseudo(p, proto, plen, &src, &dest);
+		pbuf_header_force(p, (s16_t)(SIZEOF_ETH_HDR + hlen));
+		if (chksum != 0) {
+			return false;
+		}
+		p->flags |= PBUF_FLAG_CHKSUM_VERIFIED;
+		return true;
+	}
+#endif
+	return true;
+}
+
+static void lwip_rx_shard_thread(void *arg)
+{
+	struct lwip_rx_shard *shard = (struct lwip_rx_shard *)arg;
+	std::vector<lwip_rx_shard_entry> work;
+	for (;;) {
+		sys_arch_sem_wait(&shard->ready, 0);
+		shard->m.lock();
+		work.swap(shard->pending);
+		shard->m.unlock();
+		if (work.empty()) {
+			continue;
+		}
+		// checksums are verified here, outside of the core lock and in parallel with the other shards
+		for (size_t i=0; i<work.size(); i++) {
+			if (work[i].p && !lwip_rx_verify(work[i].p)) {
+				DEBUG_ERROR("dropped packet: bad checksum");
+				lwip_rx_drop(ZT_TRACE_DROP_BAD_CHECKSUM, work[i].interface, work[i].p);
+				pbuf_free(work[i].p);
+				work[i].p = NULL;
+			}
+		}
+		LOCK_TCPIP_CORE();
+		for (size_t i=0; i<work.size(); i++) {
+			if (work[i].p && ethernet_input(work[i].p, work[i].interface) != ERR_OK) {
+				DEBUG_ERROR("error while feeding frame into stack interface");
+				lwip_rx_drop(ZT_TRACE_DROP_INPUT, work[i].interface, work[i].p);
+				pbuf_free(work[i].p);
+			}
+		}
+		UNLOCK_TCPIP_CORE();
+		for (size_t i=0; i<work.size(); i++) {
+			struct lwip_netif_release *release = work[i].release;
+			if (release && --(release->remaining) == 0) {
+				tcpip_callback(lwip_free_interface, release->interface);
+				delete release;
+			}
+		}
+		work.clear();
+	}
+}
+
+// runs in the tcpip thread during initialization, before any netif exists
+static void lwip_rx_shards_start()
+{
+	unsigned int n = lwip_rx_shards_requested;
+	if (n == 0) {
+		return;
+	}
+#if LWIP_TCPIP_CORE_LOCKING
+	lwip_rx_shards = new struct lwip_rx_shard[n];
+	for (unsigned int i=0; i<n; i++) {
+		if (sys_sem_new(&(lwip_rx_shards[i].ready), 0) != ERR_OK) {
+			DEBUG_ERROR("failed to create semaphore for RX shard %d", i);
+			return;
+		}
+		lwip_rx_shards[i].pending.reserve(ZT_RX_BATCH_MAX);
+		sys_thread_new("lwip_rx_shard", lwip_rx_shard_thread, &lwip_rx_shards[i],
+			DEFAULT_THREAD_STACKSIZE, DEFAULT_THREAD_PRIO);
+		lwip_rx_shard_count++;
+	}
+	DEBUG_INFO("started %d RX shards", lwip_rx_shard_count);
+#else
+	DEBUG_ERROR("RX shards require LWIP_TCPIP_CORE_LOCKING");
+#endif
+}
+
+// queues a frame on the shard which owns its flow
+static void lwip_rx_shard_input(struct netif *interface, struct pbuf *p)
+{
+	struct lwip_rx_shard *shard = &lwip_rx_shards[lwip_flow_hash(p) % lwip_rx_shard_count];
+	shard->m.lock();
+	if (shard->pending.size() >= ZT_RX_SHARD_QUEUE_LEN) {
+		shard->m.unlock();
+		DEBUG_ERROR("dropped packet: RX shard queue full");
+		lwip_rx_drop(ZT_TRACE_DROP_SHARD_FULL, interface, p);
+		pbuf_free(p);
+		return;
+	}
+	bool wake = shard->pending.empty();
+	shard->pending.push_back({ interface, p, NULL });
+	shard->m.unlock();
+	if (wake) {
+		sys_sem_signal(&shard->ready);
+	}
+}
+
+int lwip_set_rx_shards(unsigned int n)
+{
+	if (lwip_driver_initialized || n > ZT_RX_SHARDS_MAX) {
+		return -1;
+	}
+#if LWIP_TCPIP_CORE_LOCKING
+	lwip_rx_shards_requested = n;
+	return 0;
+#else
+	return n ? -1 : 0;
+#endif
+}
+
+static void lwip_copy_proto_stats(struct zts_proto_stats *dst, const struct stats_proto *src)
+{
+	dst->xmit = src->xmit;
+	dst->recv = src->recv;
+	dst->fw = src->fw;
+	dst->drop = src->drop;
+	dst->chkerr = src->chkerr;
+	dst->lenerr = src->lenerr;
+	dst->memerr = src->memerr;
+	dst->rterr = src->rterr;
+	dst->proterr = src->proterr;
+	dst->opterr = src->opterr;
+	dst->err = src->err;
+}
+
+void lwip_get_stats(struct zts_stats *stats)
+{
+	if (lwip_driver_initialized == false) {
+		return;
+	}
+	// the stack only updates its counters with the core lock held, take it just long enough to copy them
+	// link-level counters are kept per VirtualTap by this driver, lwIP only maintains lwip_stats.link
+	// in its sample drivers
+	LOCK_TCPIP_CORE();
+#if ETHARP_STATS
+	lwip_copy_proto_stats(&(stats->etharp), &(lwip_stats.etharp));
+#endif
+#if IP_STATS
+	lwip_copy_proto_stats(&(stats->ip), &(lwip_stats.ip));
+#endif
+#if ICMP_STATS
+	lwip_copy_proto_stats(&(stats->icmp), &(lwip_stats.icmp));
+#endif
+#if TCP_STATS
+	lwip_copy_proto_stats(&(stats->tcp), &(lwip_stats.tcp));
+#endif
+#if UDP_STATS
+	lwip_copy_proto_stats(&(stats->udp), &(lwip_stats.udp));
+#endif
+#if MEM_STATS
+	strncpy(stats->heap.name, "heap", sizeof(stats->heap.name) - 1);
+	stats->heap.avail = lwip_stats.mem.avail;
+	stats->heap.used = lwip_stats.mem.used;
+	stats->heap.max = lwip_stats.mem.max;
+	stats->heap.err = lwip_stats.mem.err;
+#endif
+#if MEMP_STATS
+	stats->pool_count = 0;
+	for (int i=0; i<MEMP_MAX && i<ZT_STATS_MAX_POOLS; i++) {
+		const struct stats_mem *pool = lwip_stats.memp[i];
+		struct zts_pool_stats *dst = &(stats->pools[stats->pool_count++]);
+#if defined(LWIP_DEBUG) || MEMP_OVERFLOW_CHECK || LWIP_STATS_DISPLAY
+		strncpy(dst->name, memp_pools[i]->desc, sizeof(dst->name) - 1);
+#else
+		snprintf(dst->name, sizeof(dst->name), "pool%d", i);
+#endif
+		dst->avail = pool->avail;
+		dst->used = pool->used;
+		dst->max = pool->max;
+		dst->err = pool->err;
+	}
+#endif
+	UNLOCK_TCPIP_CORE();
+}
+
+// hands a complete Ethernet frame to the stack, the pbuf is consumed either way
+static void lwip_eth_input(ZeroTier::VirtualTap *tap, struct pbuf *p)
+{
+	struct netif *interface = (struct netif *)tap->_netif;
+	if (interface == NULL) {
+		// no address has been assigned to this VirtualTap yet
+		pbuf_free(p);
+		return;
+	}
+	if (lwip_rx_shard_count) {
+		lwip_rx_shard_input(interface, p);
+		return;
+	}
+	if (lwip_eth_input_inline()) {
+		LOCK_TCPIP_CORE();
+		if (ethernet_input(p, interface) != ERR_OK) {
+			DEBUG_ERROR("error while feeding frame into stack interface");
+			lwip_rx_drop(ZT_TRACE_DROP_INPUT, interface, p);
+			pbuf_free(p);
+		}
+		UNLOCK_TCPIP_CORE();
+		return;
+	}
+	if (interface->input(p, interface) != ERR_OK) {
+		DEBUG_ERROR("error while feeding frame into stack interface");
+		lwip_rx_drop(ZT_TRACE_DROP_MBOX_FULL, interface, p);
+		pbuf_free(p);
+	}
+}
+
+// copies a frame from the virtual wire into pool pbufs with the ethernet header prepended
+static struct pbuf *lwip_eth_frame_alloc(ZeroTier::VirtualTap *tap, const ZeroTier::MAC &from, const ZeroTier::MAC &to,
+	unsigned int etherType, const void *data, unsigned int len)
 {
 	struct pbuf *p,*q;
 	struct eth_hdr ethhdr;
@@ -262,7 +860,10 @@ void lwip_eth_rx(ZeroTier::VirtualTap *tap, const ZeroTier::MAC &from, const Zer
 		q = p;
 		if (q->len < sizeof(ethhdr)) {
 			DEBUG_ERROR("dropped packet: first pbuf smaller than ethernet header");
-			return;
+			tap->_rxDrops.fetch_add(1, std::memory_order_relaxed);
+			ZT_TRACE_DROPPED(ZT_TRACE_DROP_SHORT_PBUF, tap->_nwid, ethhdr.src.addr, ethhdr.dest.addr, 1);
+			pbuf_free(p);
+			return NULL;
 		}
 		memcpy(q->payload,&ethhdr,sizeof(ethhdr));
 		memcpy((char*)q->payload + sizeof(ethhdr),dataptr,q->len - sizeof(ethhdr));
@@ -275,27 +876,140 @@ void lwip_eth_rx(ZeroTier::VirtualTap *tap, const ZeroTier::MAC &from, const Zer
 	}
 	else {
 		DEBUG_ERROR("dropped packet: no pbufs available");
-		return;
+		tap->_rxDrops.fetch_add(1, std::memory_order_relaxed);
+		ZT_TRACE_DROPPED(ZT_TRACE_DROP_NO_PBUF, tap->_nwid, ethhdr.src.addr, ethhdr.dest.addr, 1);
+		return NULL;
 	}
-	if (ZT_MSG_TRANSFER == true) {
-		char flagbuf[32];
-		memset(&flagbuf, 0, 32);
-		char macBuf[ZT_MAC_ADDRSTRLEN], nodeBuf[ZTO_ID_LEN];
-		mac2str(macBuf, ZT_MAC_ADDRSTRLEN, ethhdr.dest.addr);
-		ZeroTier::MAC mac;
-		mac.setTo(ethhdr.src.addr, 6);
-		mac.toAddress(tap->_nwid).toString(nodeBuf);
-		DEBUG_TRANS("len=%5d dst=%s [%s RX --> %s] proto=0x%04x %s %s", len, macBuf, nodeBuf, tap->nodeId().c_str(),
-			ZeroTier::Utils::ntoh(ethhdr.type), beautify_eth_proto_nums(ZeroTier::Utils::ntoh(ethhdr.type)), flagbuf);
+	ZT_TRACE_FRAME(ZT_TRACE_ETH_RX, tap->_nwid, ethhdr.src.addr, ethhdr.dest.addr, etherType, len);
+	return p;
+}
+
+void lwip_eth_rx(ZeroTier::VirtualTap *tap, const ZeroTier::MAC &from, const ZeroTier::MAC &to, unsigned int etherType,
+	const void *data, unsigned int len)
+{
+	struct pbuf *p = lwip_eth_frame_alloc(tap, from, to, etherType, data, len);
+	if (p) {
+		lwip_eth_input(tap, p);
 	}
-	{
-		// TODO: Routing logic
+}
 
-#if defined(LIBZT_IPV4)
-			if (lwipdev.input(p, &(lwipdev)) != ERR_OK) {
-				DEBUG_ERROR("error while feeding frame into stack interface (ipv4)");
+/**
+ * A set of received frames delivered to the tcpip thread by a single message
+ */
+struct lwip_rx_batch
+{
+	struct netif *interface;
+	unsigned int count;
+	struct pbuf *frames[1];
+};
+
+// runs in the tcpip thread, feeds each frame of the batch into the stack
+static void lwip_eth_rx_batch_input(void *arg)
+{
+	struct lwip_rx_batch *batch = (struct lwip_rx_batch *)arg;
+	for (unsigned int i=0; i<batch->count; i++) {
+		if (ethernet_input(batch->frames[i], batch->interface) != ERR_OK) {
+			DEBUG_ERROR("error while feeding frame into stack interface");
+			lwip_rx_drop(ZT_TRACE_DROP_INPUT, batch->interface, batch->frames[i]);
+			pbuf_free(batch->frames[i]);
+		}
+	}
+	mem_free(batch);
+}
+
+void lwip_eth_rx_batch(ZeroTier::VirtualTap *tap, const ZeroTier::VirtualTapFrame *frames, unsigned int count)
+{
+	if (tap->_netif == NULL) {
+		return;
+	}
+	if (lwip_rx_shard_count) {
+		// frames of one batch may belong to different shards
+		for (unsigned int i=0; i<count; i++) {
+			lwip_eth_rx(tap, frames[i].from, frames[i].to, frames[i].etherType, frames[i].data, frames[i].len);
+		}
+		return;
+	}
+	while (count) {
+		unsigned int n = count < ZT_RX_BATCH_MAX ? count : ZT_RX_BATCH_MAX;
+		struct lwip_rx_batch *batch = (struct lwip_rx_batch *)mem_malloc(
+			sizeof(struct lwip_rx_batch) + (n - 1) * sizeof(struct pbuf *));
+		if (batch == NULL) {
+			DEBUG_ERROR("dropped %d packets: unable to allocate batch", count);
+			tap->_rxDrops.fetch_add(count, std::memory_order_relaxed);
+			ZT_TRACE_DROPPED(ZT_TRACE_DROP_NO_MEM, tap->_nwid, NULL, NULL, count);
+			return;
+		}
+		batch->interface = (struct netif *)tap->_netif;
+		batch->count = 0;
+		// allocate and fill every pbuf up front so the tcpip thread is only woken once
+		for (unsigned int i=0; i<n; i++) {
+			struct pbuf *p = lwip_eth_frame_alloc(tap, frames[i].from, frames[i].to, frames[i].etherType,
+				frames[i].data, frames[i].len);
+			if (p) {
+				batch->frames[batch->count++] = p;
 			}
-#endif
+		}
+		frames += n;
+		count -= n;
+		if (batch->count == 0) {
+			mem_free(batch);
+			continue;
+		}
+		unsigned int delivered = batch->count;
+		if (lwip_eth_input_inline()) {
+			LOCK_TCPIP_CORE();
+			lwip_eth_rx_batch_input(batch);
+			UNLOCK_TCPIP_CORE();
+			tap->recordRxBatch(delivered);
+			continue;
+		}
+		if (tcpip_callback_with_block(lwip_eth_rx_batch_input, batch, 0) != ERR_OK) {
+			DEBUG_ERROR("dropped %d packets: tcpip mbox full", batch->count);
+			tap->_rxDrops.fetch_add(batch->count, std::memory_order_relaxed);
+			ZT_TRACE_DROPPED(ZT_TRACE_DROP_MBOX_FULL, tap->_nwid, NULL, NULL, batch->count);
+			for (unsigned int i=0; i<batch->count; i++) {
+				pbuf_free(batch->frames[i]);
+			}
+			mem_free(batch);
+			continue;
+		}
+		tap->recordRxBatch(delivered);
 	}
 }
 
+// called by lwIP (from whichever thread drops the last reference) once it is done with a loaned frame
+static void lwip_loaned_pbuf_free(struct pbuf *p)
+{
+	struct zt_loaned_pbuf *lp = (struct zt_loaned_pbuf *)p;
+	lp->release(lp->arg, lp->buf);
+	LWIP_MEMPOOL_FREE(ZT_LOANED_PBUF, lp);
+}
+
+void lwip_eth_rx_loaned(ZeroTier::VirtualTap *tap, const ZeroTier::MAC &from, const ZeroTier::MAC &to, unsigned int etherType,
+	void *data, unsigned int len, unsigned int headroom, void (*release)(void *, void *), void *arg)
+{
+	struct zt_loaned_pbuf *lp = NULL;
+	if (headroom >= SIZEOF_ETH_HDR && (len + SIZEOF_ETH_HDR) <= 0xFFFF) {
+		lp = (struct zt_loaned_pbuf *)LWIP_MEMPOOL_ALLOC(ZT_LOANED_PBUF);
+	}
+	if (lp == NULL) {
+		// buffer can't be loaned, copy it into pool pbufs and hand it straight back
+		lwip_eth_rx(tap, from, to, etherType, data, len);
+		release(arg, data);
+		return;
+	}
+	// write the ethernet header into the room reserved in front of the payload
+	struct eth_hdr *ethhdr = (struct eth_hdr *)((char *)data - SIZEOF_ETH_HDR);
+	from.copyTo(ethhdr->src.addr, 6);
+	to.copyTo(ethhdr->dest.addr, 6);
+	ethhdr->type = ZeroTier::Utils::hton((uint16_t)etherType);
+
+	lp->pc.custom_free_function = lwip_loaned_pbuf_free;
+	lp->release = release;
+	lp->arg = arg;
+	lp->buf = data;
+	struct pbuf *p = pbuf_alloced_custom(PBUF_RAW, len + SIZEOF_ETH_HDR, PBUF_REF, &(lp->pc),
+		ethhdr, len + SIZEOF_ETH_HDR);
+	ZT_TRACE_FRAME(ZT_TRACE_ETH_RX_LOANED, tap->_nwid, ethhdr->src.addr, ethhdr->dest.addr, etherType, len);
+	lwip_eth_input(tap, p);
+}
@@ -0,0 +1,207 @@
+/*
+ * ZeroTier SDK - Network Virtualization Everywhere
+ * Copyright (C) 2011-2017  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+// Coroutine tests for include/ZTCoroutine.hpp. They need C++20, so they are built separately from
+// selftest.cpp (which stays C++11) and linked into the selftest when LIBZT_CORO_TEST is defined
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#include "libzt.h"
+#include "ZTCoroutine.hpp"
+
+#define SOCKET zts_socket
+#define BIND zts_bind
+#define LISTEN zts_listen
+#define CLOSE zts_close
+
+#define TCP_UNIT_TEST_SIG_4    struct sockaddr_in *addr, int op, int cnt, char *details, \
+									bool *passed
+
+#define CORO_CONNS             32
+#define CORO_ROUNDS            200
+#define CORO_MSG               64
+#define CORO_SLEEP_MS          50
+
+long int get_now_ts(); // defined in selftest.cpp
+
+using ZeroTier::Coro::Reactor;
+using ZeroTier::Coro::Task;
+
+struct coro_stats
+{
+	int rounds;
+	int mismatched;
+	int failed;
+	int closed;
+	long int echoed;
+};
+
+static Task<> coro_client_conn(Reactor &r, struct sockaddr_in *addr, int k, struct coro_stats &st)
+{
+	char out[CORO_MSG], in[CORO_MSG];
+	int fd = SOCKET(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0 || co_await r.connect(fd, (struct sockaddr *)addr, sizeof(struct sockaddr_in)) < 0) {
+		st.failed++;
+		co_return;
+	}
+	for (int n=0; n<CORO_ROUNDS; n++) {
+		for (int i=0; i<CORO_MSG; i++) {
+			out[i] = (char)(k * 31 + n + i);
+		}
+		if (co_await r.write_all(fd, out, CORO_MSG) != CORO_MSG) {
+			st.failed++;
+			break;
+		}
+		int got = 0;
+		while (got < CORO_MSG) {
+			ssize_t res = co_await r.read(fd, in + got, CORO_MSG - got);
+			if (res <= 0) {
+				break;
+			}
+			got += (int)res;
+		}
+		if (got < CORO_MSG) {
+			st.failed++;
+			break;
+		}
+		st.mismatched += (memcmp(in, out, CORO_MSG) != 0);
+		st.rounds++;
+	}
+	st.closed += (co_await r.close(fd) == 0);
+}
+
+static Task<> coro_sleeper(Reactor &r, bool &slept)
+{
+	long int t0 = get_now_ts();
+	co_await r.sleep(CORO_SLEEP_MS);
+	slept = (get_now_ts() - t0 >= CORO_SLEEP_MS);
+}
+
+// drive CORO_CONNS connections from coroutines on one thread, with a timer running alongside
+void tcp_client_coro_4(TCP_UNIT_TEST_SIG_4)
+{
+	std::string testname = "tcp_client_coro_4";
+	fprintf(stderr, "\n\n%s (ts=%ld)\n", testname.c_str(), get_now_ts());
+	fprintf(stderr, "connect %d coroutines to remote host with IPv4 address, exchange %d messages each.\n",
+		CORO_CONNS, CORO_ROUNDS);
+	struct coro_stats st;
+	memset(&st, 0, sizeof(st));
+	bool slept = false;
+	int err = 0;
+	{
+		Reactor r(CORO_CONNS * 2);
+		if (!r.valid()) {
+			DEBUG_ERROR("error creating reactor");
+			*passed = false;
+			return;
+		}
+		for (int k=0; k<CORO_CONNS; k++) {
+			r.spawn(coro_client_conn(r, addr, k, st));
+		}
+		r.spawn(coro_sleeper(r, slept));
+		err = r.run();
+	}
+	sprintf(details, "%s, rounds=%d, mismatched=%d, failed=%d, closed=%d, slept=%d", testname.c_str(),
+		st.rounds, st.mismatched, st.failed, st.closed, slept);
+	*passed = (st.rounds == CORO_CONNS * CORO_ROUNDS && !st.mismatched && !st.failed && st.closed == CORO_CONNS
+		&& slept && !err);
+}
+
+static Task<> coro_echo(Reactor &r, int fd, struct coro_stats &st)
+{
+	char buf[CORO_MSG];
+	for (;;) {
+		ssize_t n = co_await r.read(fd, buf, sizeof(buf));
+		if (n <= 0) {
+			st.failed += (n < 0);
+			break;
+		}
+		if (co_await r.write_all(fd, buf, n) != n) {
+			st.failed++;
+			break;
+		}
+		st.echoed += n;
+	}
+	st.closed += (co_await r.close(fd) == 0);
+}
+
+static Task<> coro_acceptor(Reactor &r, int fd, struct coro_stats &st)
+{
+	for (int k=0; k<CORO_CONNS; k++) {
+		ssize_t c = co_await r.accept(fd);
+		if (c < 0) {
+			st.failed++;
+			break;
+		}
+		r.spawn(coro_echo(r, (int)c, st));
+	}
+}
+
+// accept CORO_CONNS connections from one coroutine and echo each one from its own coroutine
+void tcp_server_coro_4(TCP_UNIT_TEST_SIG_4)
+{
+	std::string testname = "tcp_server_coro_4";
+	fprintf(stderr, "\n\n%s (ts=%ld)\n", testname.c_str(), get_now_ts());
+	fprintf(stderr, "accept %d connections with IPv4 address, echo from one coroutine each.\n", CORO_CONNS);
+	int fd, err = 0;
+	struct coro_stats st;
+	memset(&st, 0, sizeof(st));
+	if ((fd = SOCKET(AF_INET, SOCK_STREAM, 0)) < 0) {
+		DEBUG_ERROR("error creating ZeroTier socket");
+		*passed = false;
+		return;
+	}
+	if ((err = BIND(fd, (struct sockaddr *)addr, sizeof(struct sockaddr_in)) < 0)) {
+		DEBUG_ERROR("error binding to interface (%d)", err);
+		*passed = false;
+		return;
+	}
+	if ((err = LISTEN(fd, CORO_CONNS)) < 0) {
+		DEBUG_ERROR("error placing socket in LISTENING state (%d)", err);
+		*passed = false;
+		return;
+	}
+	{
+		Reactor r(CORO_CONNS * 2);
+		if (!r.valid()) {
+			DEBUG_ERROR("error creating reactor");
+			CLOSE(fd);
+			*passed = false;
+			return;
+		}
+		r.spawn(coro_acceptor(r, fd, st));
+		err = r.run();
+	}
+	err |= CLOSE(fd);
+	sprintf(details, "%s, echoed=%ld, failed=%d, closed=%d", testname.c_str(), st.echoed, st.failed, st.closed);
+	*passed = (st.echoed == (long int)CORO_CONNS * CORO_ROUNDS * CORO_MSG && !st.failed && st.closed == CORO_CONNS
+		&& !err);
+}
+
@@ -254,6 +254,13 @@ long int get_now_ts()
 	return tp.tv_sec * 1000 + tp.tv_usec / 1000;
 }
 
+long int get_now_us()
+{
+	struct timeval tp;
+	gettimeofday(&tp, NULL);
+	return tp.tv_sec * 1000000 + tp.tv_usec;
+}
+
 // for syncronizing tests
 void wait_until_tplus(long int original_time, int tplus_ms) 
 {
@@ -1618,6 +1625,123 @@ void tcp_server_perf_4(TCP_UNIT_TEST_SIG_4)
 
 
 
+/****************************************************************************/
+/* LATENCY (request/response between library instances)                     */
+/****************************************************************************/
+
+#define RR_MSG_SZ              64
+
+// Time cnt small request/response exchanges, report round-trip latency percentiles
+void tcp_client_rr_latency_4(TCP_UNIT_TEST_SIG_4)
+{
+	std::string testname = "tcp_client_rr_latency_4";
+	fprintf(stderr, "\n\n%s (ts=%lu)\n", testname.c_str(), get_now_ts);
+	fprintf(stderr, "connect to remote host with IPv4 address, time a sequence of request/response exchanges.\n");
+	int n, r, w, fd, err = 0, flag = 1;
+	char buf[RR_MSG_SZ];
+	memset(buf, 0, sizeof buf);
+	if ((fd = SOCKET(AF_INET, SOCK_STREAM, 0)) < 0) {
+		DEBUG_ERROR("error creating ZeroTier socket");
+		perror("socket");
+		*passed = false;
+		return;
+	}
+	if ((err = CONNECT(fd, (const struct sockaddr *)addr, sizeof(*addr))) < 0) {
+		DEBUG_ERROR("error connecting to remote host (%d)", err);
+		perror("connect");
+		*passed = false;
+		return;
+	}
+	SETSOCKOPT(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+	std::vector<long int> rtt;
+	for (int i=0; i<cnt; i++) {
+		long int ti = get_now_us();
+		for (w=0; w<RR_MSG_SZ; w+=n) {
+			if ((n = WRITE(fd, &buf[w], RR_MSG_SZ-w)) <= 0) {
+				break;
+			}
+		}
+		for (r=0; r<RR_MSG_SZ; r+=n) {
+			if ((n = READ(fd, &buf[r], RR_MSG_SZ-r)) <= 0) {
+				break;
+			}
+		}
+		if (w != RR_MSG_SZ || r != RR_MSG_SZ) {
+			DEBUG_ERROR("exchange %d failed, r=%d, w=%d", i, r, w);
+			break;
+		}
+		rtt.push_back(get_now_us() - ti);
+	}
+	err = CLOSE(fd);
+	std::sort(rtt.begin(), rtt.end());
+	if (rtt.size() == 0) {
+		rtt.push_back(0);
+	}
+	sprintf(details, "%s, n=%d, p50=%ldus, p90=%ldus, p99=%ldus, max=%ldus", testname.c_str(), (int)rtt.size(),
+		rtt[rtt.size()/2], rtt[rtt.size()*9/10], rtt[rtt.size()*99/100], rtt[rtt.size()-1]);
+	*passed = (rtt.size() == cnt && !err);
+}
+
+// Echo fixed-size requests back to the client until it disconnects
+void tcp_server_rr_latency_4(TCP_UNIT_TEST_SIG_4)
+{
+	std::string testname = "tcp_server_rr_latency_4";
+	fprintf(stderr, "\n\n%s (ts=%lu)\n", testname.c_str(), get_now_ts);
+	fprintf(stderr, "accept connection with IPv4 address, echo a sequence of requests.\n");
+	int n, r, w, fd, client_fd, err = 0, flag = 1, exchanges = 0;
+	char buf[RR_MSG_SZ];
+	if ((fd = SOCKET(AF_INET, SOCK_STREAM, 0)) < 0) {
+		DEBUG_ERROR("error creating ZeroTier socket");
+		perror("socket");
+		*passed = false;
+		return;
+	}
+	if ((err = BIND(fd, (struct sockaddr *)addr, sizeof(struct sockaddr_in)) < 0)) {
+		DEBUG_ERROR("error binding to interface (%d)", err);
+		perror("bind");
+		*passed = false;
+		return;
+	}
+	if ((err = LISTEN(fd, 1)) < 0) {
+		DEBUG_ERROR("error placing socket in LISTENING state (%d)", err);
+		perror("listen");
+		*passed = false;
+		return;
+	}
+	struct sockaddr_in client;
+	socklen_t client_addrlen = sizeof(sockaddr_in);
+	if ((client_fd = ACCEPT(fd, (struct sockaddr *)&client, &client_addrlen)) < 0) {
+		perror("accept");
+		*passed = false;
+		return;
+	}
+	SETSOCKOPT(client_fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+	for (;;) {
+		for (r=0; r<RR_MSG_SZ; r+=n) {
+			if ((n = READ(client_fd, &buf[r], RR_MSG_SZ-r)) <= 0) {
+				break;
+			}
+		}
+		if (r != RR_MSG_SZ) {
+			break;
+		}
+		for (w=0; w<RR_MSG_SZ; w+=n) {
+			if ((n = WRITE(client_fd, &buf[w], RR_MSG_SZ-w)) <= 0) {
+				break;
+			}
+		}
+		exchanges++;
+	}
+	err = CLOSE(client_fd);
+	err = CLOSE(fd);
+	sprintf(details, "%s, n=%d, exchanges=%d", testname.c_str(), cnt, exchanges);
+	*passed = (exchanges == cnt && !err);
+}
+
+
+
+
+
 /****************************************************************************/
 /* PERFORMANCE (between library and native)                                 */
 /****************************************************************************/
@@ -2474,6 +2598,39 @@ void close_test(struct sockaddr *bind_addr)
 	}
 }
 
+// open enough sockets to grow the socket table, then close and reopen every other one so their
+// table entries get reused, descriptors of the closed sockets must keep failing from then on
+void stale_descriptor_test(char *details, bool *passed)
+{
+	fprintf(stderr, "\n\nstale_descriptor_test\n\n");
+	int nsockets = 2000, opened = 0, accepted = 0;
+	std::vector<int> fds, stale;
+	for (int i=0; i<nsockets; i++) {
+		int fd;
+		if ((fd = SOCKET(AF_INET, SOCK_DGRAM, 0)) < 0) {
+			DEBUG_ERROR("error creating socket %d", i);
+			break;
+		}
+		fds.push_back(fd);
+	}
+	opened = fds.size();
+	for (size_t i=0; i<fds.size(); i+=2) {
+		CLOSE(fds[i]);
+		stale.push_back(fds[i]);
+		fds[i] = SOCKET(AF_INET, SOCK_DGRAM, 0);
+	}
+	for (size_t i=0; i<stale.size(); i++) {
+		if (CLOSE(stale[i]) == 0) {
+			accepted++;
+		}
+	}
+	for (size_t i=0; i<fds.size(); i++) {
+		CLOSE(fds[i]);
+	}
+	*passed = (opened == nsockets && accepted == 0);
+	sprintf(details, "stale_descriptor_test, n=%d, opened=%d, stale accepted=%d", nsockets, opened, accepted);
+}
+
 void bind_to_localhost_test(int port)
 {
 	fprintf(stderr, "\n\nbind_to_localhost_test\n\n");
@@ -2543,122 +2700,1419 @@ void bind_to_localhost_test(int port)
 #endif // __SELFTEST__
 
 /****************************************************************************/
-/* main(), calls test_driver(...)                                           */
+/* CONTENTION (many threads sending between library instances)              */
 /****************************************************************************/
 
-int main(int argc , char *argv[])
-{
-	if (argc < 6) {
-		fprintf(stderr, "usage: selftest <num_repeats> <selftest.conf> <alice|bob|ted|carol> to <bob|alice|ted|carol>\n");
-		fprintf(stderr, "e.g. : selftest 3 test/test.conf alice to bob\n");
-		return 1;
-	}
-
-	int num_repeats = atoi(argv[1]);
-	std::string path = argv[2];
-	std::string from = argv[3];
-	std::string   to = argv[5];
-	std::string   me = from;
-	std::vector<std::string> results;
-	std::string remote_echo_ipv4, smode;
+#define CONTENTION_THREADS     16    // concurrent senders, each on its own connection
+#define CONTENTION_SEND_SZ     1024  // bytes per send() call
 
-	std::string nwid, stype;
-	std::string ipstr, ipstr6, local_ipstr, local_ipstr6, remote_ipstr, remote_ipstr6;
+struct contention_arg {
+	int fd;
+	int cnt;
+	long int bytes;
+	long int calls;
+};
 
-	int err         = 0;
-	int mode        = 0;
-	int port        = 0;
-	int op          = 0;
-	int start_port  = 0;
-	int cnt         = 0;
-	int ipv;
-	// for timing
-	// how long we expect the specific test to take
-	int subtest_expected_duration;
-	// (T+X), when we plan to start this test 
-	int subtest_start_time_offset = 0;
+// issue cnt sends of CONTENTION_SEND_SZ on one connection
+void* worker_contention_send(void *arg)
+{
+	struct contention_arg *ca = (struct contention_arg*)arg;
+	char buf[CONTENTION_SEND_SZ];
+	memset(buf, 0, sizeof buf);
+	int n;
+	for (int i=0; i<ca->cnt; i++) {
+		for (int w=0; w<CONTENTION_SEND_SZ; w+=n) {
+			if ((n = SEND(ca->fd, &buf[w], CONTENTION_SEND_SZ-w, 0)) <= 0) {
+				DEBUG_ERROR("error sending on fd=%d, err=%d", ca->fd, errno);
+				return NULL;
+			}
+			ca->bytes += n;
+			ca->calls++;
+		}
+	}
+	return NULL;
+}
 
-	char details[128];
-	memset(&details, 0, sizeof details);
-	bool passed = 0; 
-	struct sockaddr_storage local_addr;
-	struct sockaddr_storage remote_addr;
+// drain one connection until the peer closes it
+void* worker_contention_recv(void *arg)
+{
+	struct contention_arg *ca = (struct contention_arg*)arg;
+	char buf[DATA_BUF_SZ];
+	int n;
+	while ((n = READ(ca->fd, buf, sizeof buf)) > 0) {
+		ca->bytes += n;
+	}
+	return NULL;
+}
 
-	// load config file
-	if (path.find(".conf") == std::string::npos) {
-		fprintf(stderr, "Possibly invalid conf file. Exiting...\n");
-		exit(0);
+// many application threads calling send() at once, measures aggregate throughput through the stack
+void tcp_client_send_contention_4(TCP_UNIT_TEST_SIG_4)
+{
+	std::string testname = "tcp_client_send_contention_4";
+	fprintf(stderr, "\n\n%s (ts=%lu)\n", testname.c_str(), get_now_ts);
+	fprintf(stderr, "open %d connections to remote host with IPv4 address, send from one thread per connection.\n", CONTENTION_THREADS);
+	pthread_t senders[CONTENTION_THREADS];
+	struct contention_arg args[CONTENTION_THREADS];
+	int err = 0;
+	memset(args, 0, sizeof args);
+	for (int i=0; i<CONTENTION_THREADS; i++) {
+		if ((args[i].fd = SOCKET(AF_INET, SOCK_STREAM, 0)) < 0) {
+			DEBUG_ERROR("error creating ZeroTier socket");
+			perror("socket");
+			*passed = false;
+			return;
+		}
+		if ((err = CONNECT(args[i].fd, (const struct sockaddr *)addr, sizeof(*addr))) < 0) {
+			DEBUG_ERROR("error connecting to remote host (%d)", err);
+			perror("connect");
+			*passed = false;
+			return;
+		}
+		args[i].cnt = cnt;
 	}
-	loadTestConfigFile(path);
-	// get origin details
-	local_ipstr      = testConf[me + ".ipv4"];
-	local_ipstr6     = testConf[me + ".ipv6"];
-	nwid             = testConf[me + ".nwid"];
-	path             = testConf[me + ".path"];
-	stype            = testConf[me + ".test"];
-	smode            = testConf[me + ".mode"];
-	start_port       = atoi(testConf[me + ".port"].c_str());
-	remote_echo_ipv4 = testConf[to + ".echo_ipv4"];
-	remote_ipstr     = testConf[to + ".ipv4"];
-	remote_ipstr6    = testConf[to + ".ipv6"];
+	long int ts = get_now_us();
+	for (int i=0; i<CONTENTION_THREADS; i++) {
+		if ((err = pthread_create(&senders[i], NULL, &worker_contention_send, (void*)&args[i])) != 0) {
+			fprintf(stderr, "there was a problem while creating thread [%d]\n", i);
+			*passed = false;
+			return;
+		}
+	}
+	long int bytes = 0, calls = 0;
+	for (int i=0; i<CONTENTION_THREADS; i++) {
+		pthread_join(senders[i], NULL);
+		bytes += args[i].bytes;
+		calls += args[i].calls;
+	}
+	long int elapsed = get_now_us() - ts;
+	for (int i=0; i<CONTENTION_THREADS; i++) {
+		err |= CLOSE(args[i].fd);
+	}
+	float secs = elapsed > 0 ? (float)elapsed / 1000000 : 1;
+	sprintf(details, "%s, threads=%d, sent=%ld, %.2f MB/s, %.0f sends/s", testname.c_str(), CONTENTION_THREADS,
+		bytes, (float)bytes / secs / ONE_MEGABYTE, (float)calls / secs);
+	*passed = (bytes == (long int)CONTENTION_THREADS * cnt * CONTENTION_SEND_SZ && !err);
+}
 
-	if (strcmp(smode.c_str(), "server") == 0)
-		mode = TEST_MODE_SERVER;
-	else
-		mode = TEST_MODE_CLIENT;
+// accept one connection per sending thread on the remote side and drain them concurrently
+void tcp_server_send_contention_4(TCP_UNIT_TEST_SIG_4)
+{
+	std::string testname = "tcp_server_send_contention_4";
+	fprintf(stderr, "\n\n%s (ts=%lu)\n", testname.c_str(), get_now_ts);
+	fprintf(stderr, "accept %d connections with IPv4 address, receive on one thread per connection.\n", CONTENTION_THREADS);
+	pthread_t receivers[CONTENTION_THREADS];
+	struct contention_arg args[CONTENTION_THREADS];
+	int fd, err = 0;
+	memset(args, 0, sizeof args);
+	if ((fd = SOCKET(AF_INET, SOCK_STREAM, 0)) < 0) {
+		DEBUG_ERROR("error creating ZeroTier socket");
+		perror("socket");
+		*passed = false;
+		return;
+	}
+	if ((err = BIND(fd, (struct sockaddr *)addr, sizeof(struct sockaddr_in)) < 0)) {
+		DEBUG_ERROR("error binding to interface (%d)", err);
+		perror("bind");
+		*passed = false;
+		return;
+	}
+	if ((err = LISTEN(fd, CONTENTION_THREADS)) < 0) {
+		DEBUG_ERROR("error placing socket in LISTENING state (%d)", err);
+		perror("listen");
+		*passed = false;
+		return;
+	}
+	struct sockaddr_in client;
+	socklen_t client_addrlen = sizeof(sockaddr_in);
+	for (int i=0; i<CONTENTION_THREADS; i++) {
+		if ((args[i].fd = ACCEPT(fd, (struct sockaddr *)&client, &client_addrlen)) < 0) {
+			perror("accept");
+			*passed = false;
+			return;
+		}
+		if ((err = pthread_create(&receivers[i], NULL, &worker_contention_recv, (void*)&args[i])) != 0) {
+			fprintf(stderr, "there was a problem while creating thread [%d]\n", i);
+			*passed = false;
+			return;
+		}
+	}
+	long int bytes = 0;
+	for (int i=0; i<CONTENTION_THREADS; i++) {
+		pthread_join(receivers[i], NULL);
+		bytes += args[i].bytes;
+		err |= CLOSE(args[i].fd);
+	}
+	err |= CLOSE(fd);
+	sprintf(details, "%s, threads=%d, received=%ld", testname.c_str(), CONTENTION_THREADS, bytes);
+	*passed = (bytes == (long int)CONTENTION_THREADS * cnt * CONTENTION_SEND_SZ && !err);
+}
 
-	fprintf(stderr, "\n\nORIGIN:\n\n");
-	fprintf(stderr, "\tlocal_ipstr      = %s\n", local_ipstr.c_str());
-	fprintf(stderr, "\tlocal_ipstr6     = %s\n", local_ipstr6.c_str());
-	fprintf(stderr, "\tstart_port       = %d\n", start_port);
-	fprintf(stderr, "\tpath             = %s\n", path.c_str());
-	fprintf(stderr, "\tnwid             = %s\n", nwid.c_str());
-	fprintf(stderr, "\ttype             = %s\n\n", stype.c_str());
-	fprintf(stderr, "DESTINATION:\n\n");
-	fprintf(stderr, "\tremote_ipstr     = %s\n", remote_ipstr.c_str());
-	fprintf(stderr, "\tremote_ipstr6    = %s\n", remote_ipstr6.c_str());
-	fprintf(stderr, "\tremote_echo_ipv4 = %s\n", remote_echo_ipv4.c_str());
+/****************************************************************************/
+/* READINESS (zts_select vs zts_epoll_wait over many connections)           */
+/****************************************************************************/
 
 #if defined(__SELFTEST__)
-	// set start time here since we need to wait for both libzt instances to be online
-	long int selftest_start_time = get_now_ts();
-	subtest_expected_duration = 5;
-
-	DEBUG_TEST("Waiting for libzt to come online...\n");
-	zts_simple_start(path.c_str(), nwid.c_str());
-	char device_id[ZTO_ID_LEN];
-	zts_get_device_id(device_id);
-	DEBUG_TEST("I am %s, %s", device_id, me.c_str());
-	if (mode == TEST_MODE_SERVER) {
-		DEBUG_TEST("Ready. You should start selftest program on second host now...\n\n");
-	}
-	if (mode == TEST_MODE_CLIENT) {
-		DEBUG_TEST("Ready. Contacting selftest program on first host.\n\n");
-	}
-#endif // __SELFTEST__
 
-	// What follows is a long-form of zts_simple_start():
-	/*
-	 zts_start(path.c_str());
-	 printf("waiting for service to start...\n");
-	 while (zts_running() == false)
-		sleep(1);
-	 printf("joining network...\n");
-	 zts_join(nwid.c_str());
-	 printf("waiting for address assignment...\n");
-	 while (zts_has_address(nwid.c_str()) == false)
-		sleep(1);
-	*/
+#define READINESS_ROUNDS       2000  // single-byte echoes timed per readiness mechanism
 
-for (int i=0; i<num_repeats; i++)
+// read or write exactly len bytes
+int readiness_xfer(int fd, char *buf, int len, bool wr)
 {
-	DEBUG_TEST("\n\n\n --- COMPREHENSIVE TEST ITERATION: %d out of %d ---\n\n\n", i, num_repeats);
+	int n;
+	for (int w=0; w<len; w+=n) {
+		if ((n = wr ? WRITE(fd, &buf[w], len-w) : READ(fd, &buf[w], len-w)) <= 0) {
+			return -1;
+		}
+	}
+	return len;
+}
 
-#if defined(__SELFTEST__)
-	if (false) {
-		port = 1000; 
-		// closure test
-		struct sockaddr_in in4;
+// open (up to) nsockets connections and bounce single bytes off randomly chosen ones, once while the remote
+// host waits with zts_select() and once while it waits with zts_epoll_wait()
+void tcp_client_readiness_4(TCP_UNIT_TEST_SIG_4, int nsockets)
+{
+	std::string testname = "tcp_client_readiness_4";
+	fprintf(stderr, "\n\n%s (ts=%lu)\n", testname.c_str(), get_now_ts);
+	fprintf(stderr, "open %d connections to remote host with IPv4 address, echo single bytes on random connections.\n", nsockets);
+	std::vector<int> fds;
+	int ctl, fd, err = 0;
+	char c = 'x', use_select = 0;
+	if ((ctl = SOCKET(AF_INET, SOCK_STREAM, 0)) < 0) {
+		DEBUG_ERROR("error creating ZeroTier socket");
+		*passed = false;
+		return;
+	}
+	// reserve descriptors first, the remote host needs one more than we do (for its listening socket)
+	while ((int)fds.size() <= nsockets && (fd = SOCKET(AF_INET, SOCK_STREAM, 0)) >= 0) {
+		fds.push_back(fd);
+	}
+	if (fds.size()) {
+		CLOSE(fds.back());
+		fds.pop_back();
+	}
+	uint32_t n = htonl(fds.size());
+	if ((err = CONNECT(ctl, (const struct sockaddr *)addr, sizeof(*addr))) < 0
+		|| readiness_xfer(ctl, (char*)&n, sizeof n, true) < 0) {
+		DEBUG_ERROR("error connecting to remote host (%d)", err);
+		*passed = false;
+		return;
+	}
+	for (size_t i=0; i<fds.size(); i++) {
+		if ((err = CONNECT(fds[i], (const struct sockaddr *)addr, sizeof(*addr))) < 0) {
+			DEBUG_ERROR("error connecting to remote host (%d)", err);
+			*passed = false;
+			return;
+		}
+	}
+	// remote host tells us whether its descriptors fit in an fd_set
+	if (readiness_xfer(ctl, &use_select, 1, false) < 0) {
+		*passed = false;
+		return;
+	}
+	float rate[2] = { 0, 0 };
+	for (int phase=use_select ? 0 : 1; phase<2 && fds.size(); phase++) {
+		long int ts = get_now_us();
+		for (int i=0; i<READINESS_ROUNDS; i++) {
+			fd = fds[rand() % fds.size()];
+			if (readiness_xfer(fd, &c, 1, true) < 0 || readiness_xfer(fd, &c, 1, false) < 0) {
+				DEBUG_ERROR("error echoing on fd=%d", fd);
+				*passed = false;
+				return;
+			}
+		}
+		long int elapsed = get_now_us() - ts;
+		rate[phase] = (float)READINESS_ROUNDS / (elapsed > 0 ? (float)elapsed / 1000000 : 1);
+	}
+	for (size_t i=0; i<fds.size(); i++) {
+		err |= CLOSE(fds[i]);
+	}
+	err |= CLOSE(ctl);
+	sprintf(details, "%s, sockets=%d, select=%.0f echo/s, epoll=%.0f echo/s", testname.c_str(), (int)fds.size(),
+		rate[0], rate[1]);
+	*passed = (fds.size() > 0 && !err);
+}
+
+// accept the connections and echo bytes back, first finding ready connections with zts_select(), then
+// with zts_epoll_wait()
+void tcp_server_readiness_4(TCP_UNIT_TEST_SIG_4, int nsockets)
+{
+	std::string testname = "tcp_server_readiness_4";
+	fprintf(stderr, "\n\n%s (ts=%lu)\n", testname.c_str(), get_now_ts);
+	fprintf(stderr, "accept up to %d connections with IPv4 address, echo whatever arrives.\n", nsockets);
+	std::vector<int> fds;
+	int fd, ctl, epfd, err = 0;
+	char c, use_select = 1;
+	uint32_t n;
+	if ((fd = SOCKET(AF_INET, SOCK_STREAM, 0)) < 0) {
+		DEBUG_ERROR("error creating ZeroTier socket");
+		*passed = false;
+		return;
+	}
+	if ((err = BIND(fd, (struct sockaddr *)addr, sizeof(struct sockaddr_in)) < 0)) {
+		DEBUG_ERROR("error binding to interface (%d)", err);
+		*passed = false;
+		return;
+	}
+	if ((err = LISTEN(fd, 128)) < 0) {
+		DEBUG_ERROR("error placing socket in LISTENING state (%d)", err);
+		*passed = false;
+		return;
+	}
+	if ((ctl = ACCEPT(fd, NULL, NULL)) < 0 || readiness_xfer(ctl, (char*)&n, sizeof n, false) < 0) {
+		perror("accept");
+		*passed = false;
+		return;
+	}
+	n = ntohl(n);
+	int maxfd = 0;
+	for (uint32_t i=0; i<n; i++) {
+		int cfd;
+		if ((cfd = ACCEPT(fd, NULL, NULL)) < 0) {
+			perror("accept");
+			*passed = false;
+			return;
+		}
+		fds.push_back(cfd);
+		maxfd = cfd > maxfd ? cfd : maxfd;
+	}
+	// zts_select() can't watch descriptors beyond FD_SETSIZE at all
+	use_select = maxfd < FD_SETSIZE;
+	if (readiness_xfer(ctl, &use_select, 1, true) < 0) {
+		*passed = false;
+		return;
+	}
+	float us_per_wait[2] = { 0, 0 };
+	if (use_select) {
+		fd_set readfds;
+		long int ts = get_now_us(), waits = 0;
+		for (int handled=0; handled<READINESS_ROUNDS; waits++) {
+			FD_ZERO(&readfds);
+			for (size_t i=0; i<fds.size(); i++) {
+				FD_SET(fds[i], &readfds);
+			}
+			if (SELECT(maxfd + 1, &readfds, NULL, NULL, NULL) <= 0) {
+				DEBUG_ERROR("error waiting in select()");
+				*passed = false;
+				return;
+			}
+			for (size_t i=0; i<fds.size(); i++) {
+				if (FD_ISSET(fds[i], &readfds)) {
+					if (readiness_xfer(fds[i], &c, 1, false) < 0 || readiness_xfer(fds[i], &c, 1, true) < 0) {
+						*passed = false;
+						return;
+					}
+					handled++;
+				}
+			}
+		}
+		us_per_wait[0] = (float)(get_now_us() - ts) / waits;
+	}
+	if ((epfd = zts_epoll_create(1)) < 0) {
+		DEBUG_ERROR("error creating epoll set");
+		*passed = false;
+		return;
+	}
+	struct zts_epoll_event ev, events[64];
+	for (size_t i=0; i<fds.size(); i++) {
+		ev.events = ZTS_EPOLLIN;
+		ev.data.fd = fds[i];
+		if (zts_epoll_ctl(epfd, ZTS_EPOLL_CTL_ADD, fds[i], &ev) < 0) {
+			DEBUG_ERROR("error adding fd=%d to epoll set", fds[i]);
+			*passed = false;
+			return;
+		}
+	}
+	long int ts = get_now_us(), waits = 0;
+	for (int handled=0; handled<READINESS_ROUNDS && fds.size(); waits++) {
+		int nready = zts_epoll_wait(epfd, events, 64, -1);
+		if (nready <= 0) {
+			DEBUG_ERROR("error waiting in epoll_wait()");
+			*passed = false;
+			return;
+		}
+		for (int i=0; i<nready; i++) {
+			if (readiness_xfer(events[i].data.fd, &c, 1, false) < 0 || readiness_xfer(events[i].data.fd, &c, 1, true) < 0) {
+				*passed = false;
+				return;
+			}
+			handled++;
+		}
+	}
+	us_per_wait[1] = waits ? (float)(get_now_us() - ts) / waits : 0;
+	err |= CLOSE(epfd);
+	for (size_t i=0; i<fds.size(); i++) {
+		err |= CLOSE(fds[i]);
+	}
+	err |= CLOSE(ctl);
+	err |= CLOSE(fd);
+	sprintf(details, "%s, sockets=%d, select=%.1f us/wait, epoll=%.1f us/wait", testname.c_str(), (int)fds.size(),
+		us_per_wait[0], us_per_wait[1]);
+	*passed = (fds.size() > 0 && !err);
+}
+
+/****************************************************************************/
+/* DEMUX (per-segment cost of finding a connection among many)              */
+/****************************************************************************/
+
+#define DEMUX_ROUNDS           4000  // single-byte echoes timed, cycling through all connections
+
+// open (up to) nsockets connections and bounce single bytes off each of them in turn. Visiting the connections
+// round-robin means the one a segment belongs to is never among the most recently used ones, so any per-segment
+// search through the connections shows up in the time per echo as nsockets grows
+void tcp_client_demux_4(TCP_UNIT_TEST_SIG_4, int nsockets)
+{
+	std::string testname = "tcp_client_demux_4";
+	fprintf(stderr, "\n\n%s (ts=%lu)\n", testname.c_str(), get_now_ts);
+	fprintf(stderr, "open %d connections to remote host with IPv4 address, echo single bytes on each in turn.\n", nsockets);
+	std::vector<int> fds;
+	int ctl, fd, err = 0;
+	char c = 'x';
+	if ((ctl = SOCKET(AF_INET, SOCK_STREAM, 0)) < 0) {
+		DEBUG_ERROR("error creating ZeroTier socket");
+		*passed = false;
+		return;
+	}
+	// reserve descriptors first, the remote host needs one more than we do (for its listening socket)
+	while ((int)fds.size() <= nsockets && (fd = SOCKET(AF_INET, SOCK_STREAM, 0)) >= 0) {
+		fds.push_back(fd);
+	}
+	if (fds.size()) {
+		CLOSE(fds.back());
+		fds.pop_back();
+	}
+	uint32_t n = htonl(fds.size());
+	if ((err = CONNECT(ctl, (const struct sockaddr *)addr, sizeof(*addr))) < 0
+		|| readiness_xfer(ctl, (char*)&n, sizeof n, true) < 0) {
+		DEBUG_ERROR("error connecting to remote host (%d)", err);
+		*passed = false;
+		return;
+	}
+	for (size_t i=0; i<fds.size(); i++) {
+		if ((err = CONNECT(fds[i], (const struct sockaddr *)addr, sizeof(*addr))) < 0) {
+			DEBUG_ERROR("error connecting to remote host (%d)", err);
+			*passed = false;
+			return;
+		}
+	}
+	long int ts = get_now_us();
+	for (int i=0; i<DEMUX_ROUNDS && fds.size(); i++) {
+		fd = fds[i % fds.size()];
+		if (readiness_xfer(fd, &c, 1, true) < 0 || readiness_xfer(fd, &c, 1, false) < 0) {
+			DEBUG_ERROR("error echoing on fd=%d", fd);
+			*passed = false;
+			return;
+		}
+	}
+	float us_per_echo = (float)(get_now_us() - ts) / DEMUX_ROUNDS;
+	for (size_t i=0; i<fds.size(); i++) {
+		err |= CLOSE(fds[i]);
+	}
+	err |= CLOSE(ctl);
+	sprintf(details, "%s, sockets=%d, %.1f us/echo", testname.c_str(), (int)fds.size(), us_per_echo);
+	*passed = (fds.size() > 0 && !err);
+}
+
+// accept the connections and echo whatever arrives, finding ready connections with zts_epoll_wait()
+void tcp_server_demux_4(TCP_UNIT_TEST_SIG_4, int nsockets)
+{
+	std::string testname = "tcp_server_demux_4";
+	fprintf(stderr, "\n\n%s (ts=%lu)\n", testname.c_str(), get_now_ts);
+	fprintf(stderr, "accept up to %d connections with IPv4 address, echo whatever arrives.\n", nsockets);
+	std::vector<int> fds;
+	int fd, ctl, epfd, err = 0;
+	char c;
+	uint32_t n;
+	if ((fd = SOCKET(AF_INET, SOCK_STREAM, 0)) < 0) {
+		DEBUG_ERROR("error creating ZeroTier socket");
+		*passed = false;
+		return;
+	}
+	if ((err = BIND(fd, (struct sockaddr *)addr, sizeof(struct sockaddr_in)) < 0)) {
+		DEBUG_ERROR("error binding to interface (%d)", err);
+		*passed = false;
+		return;
+	}
+	if ((err = LISTEN(fd, 128)) < 0) {
+		DEBUG_ERROR("error placing socket in LISTENING state (%d)", err);
+		*passed = false;
+		return;
+	}
+	if ((ctl = ACCEPT(fd, NULL, NULL)) < 0 || readiness_xfer(ctl, (char*)&n, sizeof n, false) < 0) {
+		perror("accept");
+		*passed = false;
+		return;
+	}
+	n = ntohl(n);
+	if ((epfd = zts_epoll_create(1)) < 0) {
+		DEBUG_ERROR("error creating epoll set");
+		*passed = false;
+		return;
+	}
+	struct zts_epoll_event ev, events[64];
+	for (uint32_t i=0; i<n; i++) {
+		int cfd;
+		if ((cfd = ACCEPT(fd, NULL, NULL)) < 0) {
+			perror("accept");
+			*passed = false;
+			return;
+		}
+		fds.push_back(cfd);
+		ev.events = ZTS_EPOLLIN;
+		ev.data.fd = cfd;
+		if (zts_epoll_ctl(epfd, ZTS_EPOLL_CTL_ADD, cfd, &ev) < 0) {
+			DEBUG_ERROR("error adding fd=%d to epoll set", cfd);
+			*passed = false;
+			return;
+		}
+	}
+	for (int handled=0; handled<DEMUX_ROUNDS && fds.size(); ) {
+		int nready = zts_epoll_wait(epfd, events, 64, -1);
+		if (nready <= 0) {
+			DEBUG_ERROR("error waiting in epoll_wait()");
+			*passed = false;
+			return;
+		}
+		for (int i=0; i<nready; i++) {
+			if (readiness_xfer(events[i].data.fd, &c, 1, false) < 0 || readiness_xfer(events[i].data.fd, &c, 1, true) < 0) {
+				*passed = false;
+				return;
+			}
+			handled++;
+		}
+	}
+	err |= CLOSE(epfd);
+	for (size_t i=0; i<fds.size(); i++) {
+		err |= CLOSE(fds[i]);
+	}
+	err |= CLOSE(ctl);
+	err |= CLOSE(fd);
+	sprintf(details, "%s, sockets=%d", testname.c_str(), (int)fds.size());
+	*passed = (fds.size() > 0 && !err);
+}
+
+#define UDP_DEMUX_PORT_OFFSET  20000 // the datagram sockets use ports port+offset ... port+offset+nsockets-1
+
+// bind a datagram socket to each of nsockets consecutive remote ports and bounce a datagram off each in turn,
+// a reply that doesn't show up within a second counts as lost
+void udp_client_demux_4(TCP_UNIT_TEST_SIG_4, int nsockets)
+{
+	std::string testname = "udp_client_demux_4";
+	fprintf(stderr, "\n\n%s (ts=%lu)\n", testname.c_str(), get_now_ts);
+	fprintf(stderr, "connect %d datagram sockets to remote host with IPv4 address, echo on each in turn.\n", nsockets);
+	std::vector<int> fds;
+	int fd, epfd, lost = 0, err = 0;
+	char buf[STR_SIZE];
+	if ((epfd = zts_epoll_create(1)) < 0) {
+		DEBUG_ERROR("error creating epoll set");
+		*passed = false;
+		return;
+	}
+	struct zts_epoll_event ev, events[64];
+	struct sockaddr_in raddr = *addr;
+	for (int i=0; i<nsockets; i++) {
+		raddr.sin_port = htons(ntohs(addr->sin_port) + UDP_DEMUX_PORT_OFFSET + i);
+		if ((fd = SOCKET(AF_INET, SOCK_DGRAM, 0)) < 0
+			|| (err = CONNECT(fd, (const struct sockaddr *)&raddr, sizeof(raddr))) < 0) {
+			DEBUG_ERROR("error creating and connecting datagram socket (%d)", err);
+			*passed = false;
+			return;
+		}
+		fds.push_back(fd);
+		ev.events = ZTS_EPOLLIN;
+		ev.data.fd = fd;
+		zts_epoll_ctl(epfd, ZTS_EPOLL_CTL_ADD, fd, &ev);
+	}
+	long int ts = get_now_us();
+	for (int i=0; i<DEMUX_ROUNDS; i++) {
+		if (WRITE(fds[i % fds.size()], "demux", 5) != 5) {
+			DEBUG_ERROR("error sending on fd=%d", fds[i % fds.size()]);
+			*passed = false;
+			return;
+		}
+		int nready = zts_epoll_wait(epfd, events, 64, 1000);
+		if (nready <= 0) {
+			lost++;
+		}
+		for (int j=0; j<nready; j++) {
+			READ(events[j].data.fd, buf, sizeof buf);
+		}
+	}
+	float us_per_echo = (float)(get_now_us() - ts) / DEMUX_ROUNDS;
+	err |= CLOSE(epfd);
+	for (size_t i=0; i<fds.size(); i++) {
+		err |= CLOSE(fds[i]);
+	}
+	sprintf(details, "%s, sockets=%d, lost=%d, %.1f us/echo", testname.c_str(), nsockets, lost, us_per_echo);
+	*passed = (lost < DEMUX_ROUNDS / 10 && !err);
+}
+
+// bind nsockets consecutive ports and echo datagrams back to their senders until things go quiet
+void udp_server_demux_4(TCP_UNIT_TEST_SIG_4, int nsockets)
+{
+	std::string testname = "udp_server_demux_4";
+	fprintf(stderr, "\n\n%s (ts=%lu)\n", testname.c_str(), get_now_ts);
+	fprintf(stderr, "bind %d datagram sockets with IPv4 address, echo whatever arrives.\n", nsockets);
+	std::vector<int> fds;
+	int fd, epfd, handled = 0, err = 0;
+	char buf[STR_SIZE];
+	if ((epfd = zts_epoll_create(1)) < 0) {
+		DEBUG_ERROR("error creating epoll set");
+		*passed = false;
+		return;
+	}
+	struct zts_epoll_event ev, events[64];
+	struct sockaddr_in laddr = *addr;
+	for (int i=0; i<nsockets; i++) {
+		laddr.sin_port = htons(ntohs(addr->sin_port) + UDP_DEMUX_PORT_OFFSET + i);
+		if ((fd = SOCKET(AF_INET, SOCK_DGRAM, 0)) < 0
+			|| (err = BIND(fd, (struct sockaddr *)&laddr, sizeof(laddr))) < 0) {
+			DEBUG_ERROR("error creating and binding datagram socket (%d)", err);
+			*passed = false;
+			return;
+		}
+		fds.push_back(fd);
+		ev.events = ZTS_EPOLLIN;
+		ev.data.fd = fd;
+		zts_epoll_ctl(epfd, ZTS_EPOLL_CTL_ADD, fd, &ev);
+	}
+	// the first datagram may take a while, after that stop once none arrive for 5 seconds
+	int nready;
+	while (handled < DEMUX_ROUNDS && (nready = zts_epoll_wait(epfd, events, 64, handled ? 5000 : 30000)) > 0) {
+		for (int i=0; i<nready; i++) {
+			struct sockaddr_storage saddr;
+			socklen_t slen = sizeof saddr;
+			int r = RECVFROM(events[i].data.fd, buf, sizeof buf, 0, (struct sockaddr *)&saddr, &slen);
+			if (r > 0 && SENDTO(events[i].data.fd, buf, r, 0, (struct sockaddr *)&saddr, slen) == r) {
+				handled++;
+			}
+		}
+	}
+	err |= CLOSE(epfd);
+	for (size_t i=0; i<fds.size(); i++) {
+		err |= CLOSE(fds[i]);
+	}
+	sprintf(details, "%s, sockets=%d, echoed=%d", testname.c_str(), nsockets, handled);
+	*passed = (handled > 0 && !err);
+}
+
+/****************************************************************************/
+/* PPS (datagrams per second, one call per datagram vs batched calls)       */
+/****************************************************************************/
+
+#define PPS_DATAGRAMS          200000 // datagrams sent with each method
+#define PPS_DATAGRAM_SZ        64     // header + payload
+#define PPS_BATCH              64     // datagrams per zts_sendmmsg()/zts_recvmmsg() call
+#define PPS_MAGIC              0x7a7470u
+#define PPS_OVERSIZE_SEQ       0xffffffffu // sequence number of the datagrams that don't fit the receive buffers
+
+// every datagram starts with this, the payload follows in a separate IO vector
+struct pps_header
+{
+	uint32_t magic;
+	uint32_t seq;
+};
+
+// send PPS_DATAGRAMS small datagrams with one zts_sendto() each, then as many again with zts_sendmmsg(),
+// and compare the send rates
+void udp_client_pps_4(UDP_UNIT_TEST_SIG_4)
+{
+	std::string testname = "udp_client_pps_4";
+	fprintf(stderr, "\n\n%s (ts=%lu)\n", testname.c_str(), get_now_ts);
+	fprintf(stderr, "send %d datagrams to remote host with IPv4 address using zts_sendto(), then zts_sendmmsg().\n", PPS_DATAGRAMS);
+	int fd, err = 0;
+	char buf[PPS_DATAGRAM_SZ];
+	memset(buf, 'p', sizeof buf);
+	struct pps_header *hdr = (struct pps_header *)buf;
+	if ((fd = SOCKET(AF_INET, SOCK_DGRAM, 0)) < 0) {
+		DEBUG_ERROR("error creating socket (%d)", fd);
+		*passed = false;
+		return;
+	}
+	hdr->magic = htonl(PPS_MAGIC);
+	long int ts = get_now_us();
+	int sent_single = 0;
+	for (int i=0; i<PPS_DATAGRAMS; i++) {
+		hdr->seq = htonl(i);
+		if (SENDTO(fd, buf, sizeof buf, 0, (const struct sockaddr *)remote_addr, sizeof(*remote_addr)) == sizeof buf) {
+			sent_single++;
+		}
+	}
+	float pps_single = sent_single / ((get_now_us() - ts) / 1000000.0f);
+	// header and payload of each datagram come from separate IO vectors
+	struct pps_header hdrs[PPS_BATCH];
+	struct iovec iov[PPS_BATCH][2];
+	struct zts_mmsghdr msgs[PPS_BATCH];
+	memset(msgs, 0, sizeof msgs);
+	for (int i=0; i<PPS_BATCH; i++) {
+		hdrs[i].magic = htonl(PPS_MAGIC);
+		iov[i][0].iov_base = &hdrs[i];
+		iov[i][0].iov_len = sizeof(struct pps_header);
+		iov[i][1].iov_base = buf + sizeof(struct pps_header);
+		iov[i][1].iov_len = sizeof buf - sizeof(struct pps_header);
+		msgs[i].msg_hdr.msg_name = (void *)remote_addr;
+		msgs[i].msg_hdr.msg_namelen = sizeof(*remote_addr);
+		msgs[i].msg_hdr.msg_iov = iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 2;
+	}
+	ts = get_now_us();
+	int sent_batched = 0;
+	while (sent_batched < PPS_DATAGRAMS) {
+		int n = std::min(PPS_BATCH, PPS_DATAGRAMS - sent_batched);
+		for (int i=0; i<n; i++) {
+			hdrs[i].seq = htonl(PPS_DATAGRAMS + sent_batched + i);
+		}
+		int r = zts_sendmmsg(fd, msgs, n, 0);
+		if (r <= 0) {
+			break;
+		}
+		for (int i=0; i<r; i++) {
+			err |= (msgs[i].msg_len != sizeof buf);
+		}
+		sent_batched += r;
+	}
+	float pps_batched = sent_batched / ((get_now_us() - ts) / 1000000.0f);
+	// finally a few datagrams too large for the remote host's buffers, which must see them flagged as truncated
+	char big[PPS_DATAGRAM_SZ * 2];
+	memset(big, 't', sizeof big);
+	((struct pps_header *)big)->magic = htonl(PPS_MAGIC);
+	((struct pps_header *)big)->seq = htonl(PPS_OVERSIZE_SEQ);
+	for (int i=0; i<10; i++) {
+		usleep(100000);
+		SENDTO(fd, big, sizeof big, 0, (const struct sockaddr *)remote_addr, sizeof(*remote_addr));
+	}
+	err |= CLOSE(fd);
+	sprintf(details, "%s, sendto=%.0f pps, sendmmsg=%.0f pps (x%.1f)", testname.c_str(), pps_single, pps_batched,
+		pps_single > 0 ? pps_batched / pps_single : 0);
+	*passed = (sent_single == PPS_DATAGRAMS && sent_batched == PPS_DATAGRAMS && !err);
+}
+
+// receive datagrams with zts_recvmmsg(), scattering header and payload into separate buffers, until things go quiet
+void udp_server_pps_4(UDP_UNIT_TEST_SIG_4)
+{
+	std::string testname = "udp_server_pps_4";
+	fprintf(stderr, "\n\n%s (ts=%lu)\n", testname.c_str(), get_now_ts);
+	fprintf(stderr, "bind to interface with IPv4 address, receive datagrams with zts_recvmmsg().\n");
+	int fd, err = 0, received = 0, malformed = 0, truncated = 0;
+	if ((fd = SOCKET(AF_INET, SOCK_DGRAM, 0)) < 0) {
+		DEBUG_ERROR("error creating socket (%d)", fd);
+		*passed = false;
+		return;
+	}
+	if ((err = BIND(fd, (struct sockaddr *)local_addr, sizeof(struct sockaddr_in))) < 0) {
+		DEBUG_ERROR("error binding to interface (%d)", err);
+		*passed = false;
+		return;
+	}
+	struct pps_header hdrs[PPS_BATCH];
+	char payloads[PPS_BATCH][PPS_DATAGRAM_SZ - sizeof(struct pps_header)];
+	struct iovec iov[PPS_BATCH][2];
+	struct sockaddr_in from[PPS_BATCH];
+	struct zts_mmsghdr msgs[PPS_BATCH];
+	// the first datagram may take a while, after that stop once none arrive for 5 seconds
+	int timeout = 30000;
+	long int ts = 0, last = 0;
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while (zts_poll(&pfd, 1, timeout) > 0) {
+		if (!ts) {
+			ts = get_now_us();
+		}
+		timeout = 5000;
+		memset(msgs, 0, sizeof msgs);
+		for (int i=0; i<PPS_BATCH; i++) {
+			iov[i][0].iov_base = &hdrs[i];
+			iov[i][0].iov_len = sizeof(struct pps_header);
+			iov[i][1].iov_base = payloads[i];
+			iov[i][1].iov_len = sizeof payloads[i];
+			msgs[i].msg_hdr.msg_name = &from[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof from[i];
+			msgs[i].msg_hdr.msg_iov = iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 2;
+		}
+		int r = zts_recvmmsg(fd, msgs, PPS_BATCH, ZTS_MSG_DONTWAIT);
+		for (int i=0; i<r; i++) {
+			if (ntohl(hdrs[i].seq) == PPS_OVERSIZE_SEQ) {
+				truncated += (msgs[i].msg_len == PPS_DATAGRAM_SZ && (msgs[i].msg_hdr.msg_flags & ZTS_MSG_TRUNC));
+				continue;
+			}
+			if (msgs[i].msg_len != PPS_DATAGRAM_SZ || ntohl(hdrs[i].magic) != PPS_MAGIC
+				|| payloads[i][0] != 'p' || (msgs[i].msg_hdr.msg_flags & ZTS_MSG_TRUNC)) {
+				malformed++;
+			}
+			received++;
+			last = get_now_us();
+		}
+	}
+	float pps = last > ts ? received / ((last - ts) / 1000000.0f) : 0;
+	err |= CLOSE(fd);
+	sprintf(details, "%s, received=%d, malformed=%d, truncated=%d, %.0f pps", testname.c_str(), received, malformed,
+		truncated, pps);
+	*passed = (received > 0 && !malformed && truncated > 0 && !err);
+}
+
+/****************************************************************************/
+/* VECTORED I/O (header and payload in separate buffers over TCP)           */
+/****************************************************************************/
+
+#define IOV_FRAMES             20000
+#define IOV_PAYLOAD_SZ         1000
+#define IOV_MAGIC              0x7a7476u
+
+struct iov_header
+{
+	uint32_t magic;
+	uint32_t seq;
+};
+
+// advance an IO vector array past n bytes that were already transferred
+static void iov_advance(struct iovec **iov, int *iovcnt, size_t n)
+{
+	while (*iovcnt > 0 && n >= (*iov)->iov_len) {
+		n -= (*iov)->iov_len;
+		(*iov)++;
+		(*iovcnt)--;
+	}
+	if (*iovcnt > 0) {
+		(*iov)->iov_base = (char *)(*iov)->iov_base + n;
+		(*iov)->iov_len -= n;
+	}
+}
+
+// send IOV_FRAMES frames, each a header and a payload written with a single zts_writev()
+void tcp_client_iov_4(TCP_UNIT_TEST_SIG_4)
+{
+	std::string testname = "tcp_client_iov_4";
+	fprintf(stderr, "\n\n%s (ts=%lu)\n", testname.c_str(), get_now_ts);
+	fprintf(stderr, "connect to remote host with IPv4 address, write %d header+payload frames with zts_writev().\n", IOV_FRAMES);
+	int fd, err = 0, sent = 0;
+	struct iov_header hdr;
+	char payload[IOV_PAYLOAD_SZ];
+	char c;
+	if ((fd = SOCKET(AF_INET, SOCK_STREAM, 0)) < 0) {
+		DEBUG_ERROR("error creating ZeroTier socket");
+		*passed = false;
+		return;
+	}
+	if ((err = CONNECT(fd, (const struct sockaddr *)addr, sizeof(*addr))) < 0) {
+		DEBUG_ERROR("error connecting to remote host (%d)", err);
+		CLOSE(fd);
+		*passed = false;
+		return;
+	}
+	hdr.magic = htonl(IOV_MAGIC);
+	long int ts = get_now_us();
+	for (sent=0; sent<IOV_FRAMES; sent++) {
+		hdr.seq = htonl(sent);
+		memset(payload, 'a' + (sent % 26), sizeof payload);
+		struct iovec vecs[2], *iov = vecs;
+		int iovcnt = 2;
+		vecs[0].iov_base = &hdr;
+		vecs[0].iov_len = sizeof hdr;
+		vecs[1].iov_base = payload;
+		vecs[1].iov_len = sizeof payload;
+		while (iovcnt > 0) {
+			ssize_t w = zts_writev(fd, iov, iovcnt);
+			if (w <= 0) {
+				break;
+			}
+			iov_advance(&iov, &iovcnt, w);
+		}
+		if (iovcnt > 0) {
+			break;
+		}
+	}
+	// the remote host answers with one byte once it has checked every frame
+	int r = READ(fd, &c, 1);
+	float rate = (sent * (float)(sizeof hdr + IOV_PAYLOAD_SZ)) / ((get_now_us() - ts) / 1000000.0f);
+	err |= CLOSE(fd);
+	sprintf(details, "%s, frames=%d, %.2f MB/s", testname.c_str(), sent, rate / float(ONE_MEGABYTE));
+	*passed = (sent == IOV_FRAMES && r == 1 && c == 'k' && !err);
+}
+
+// receive frames with zts_readv(), scattering each header and payload into separate buffers, and check them
+void tcp_server_iov_4(TCP_UNIT_TEST_SIG_4)
+{
+	std::string testname = "tcp_server_iov_4";
+	fprintf(stderr, "\n\n%s (ts=%lu)\n", testname.c_str(), get_now_ts);
+	fprintf(stderr, "accept connection with IPv4 address, read %d header+payload frames with zts_readv().\n", IOV_FRAMES);
+	int fd, client_fd, err = 0, received = 0, malformed = 0;
+	struct iov_header hdr;
+	char payload[IOV_PAYLOAD_SZ];
+	if ((fd = SOCKET(AF_INET, SOCK_STREAM, 0)) < 0) {
+		DEBUG_ERROR("error creating ZeroTier socket");
+		*passed = false;
+		return;
+	}
+	if ((err = BIND(fd, (struct sockaddr *)addr, sizeof(struct sockaddr_in)) < 0)) {
+		DEBUG_ERROR("error binding to interface (%d)", err);
+		*passed = false;
+		return;
+	}
+	if ((err = LISTEN(fd, 1)) < 0) {
+		DEBUG_ERROR("error placing socket in LISTENING state (%d)", err);
+		*passed = false;
+		return;
+	}
+	if ((client_fd = ACCEPT(fd, NULL, NULL)) < 0) {
+		DEBUG_ERROR("error accepting connection (%d)", client_fd);
+		CLOSE(fd);
+		*passed = false;
+		return;
+	}
+	for (received=0; received<IOV_FRAMES; received++) {
+		struct iovec vecs[2], *iov = vecs;
+		int iovcnt = 2;
+		vecs[0].iov_base = &hdr;
+		vecs[0].iov_len = sizeof hdr;
+		vecs[1].iov_base = payload;
+		vecs[1].iov_len = sizeof payload;
+		while (iovcnt > 0) {
+			ssize_t r = zts_readv(client_fd, iov, iovcnt);
+			if (r <= 0) {
+				break;
+			}
+			iov_advance(&iov, &iovcnt, r);
+		}
+		if (iovcnt > 0) {
+			break;
+		}
+		char expected = 'a' + (received % 26);
+		if (ntohl(hdr.magic) != IOV_MAGIC || ntohl(hdr.seq) != (uint32_t)received
+			|| payload[0] != expected || payload[IOV_PAYLOAD_SZ - 1] != expected) {
+			malformed++;
+		}
+	}
+	err |= (WRITE(client_fd, "k", 1) != 1);
+	err |= CLOSE(client_fd);
+	err |= CLOSE(fd);
+	sprintf(details, "%s, frames=%d, malformed=%d", testname.c_str(), received, malformed);
+	*passed = (received == IOV_FRAMES && !malformed && !err);
+}
+
+/****************************************************************************/
+/* ZERO-COPY RECEIVE (parse received data in place, release it afterwards)  */
+/****************************************************************************/
+
+#define ZC_BYTES               (64 * ONE_MEGABYTE)
+#define ZC_IOV_MAX             16
+#define ZC_PATTERN(i)          ((char)((i) % 251))
+
+// write ZC_BYTES of a known pattern
+void tcp_client_zc_4(TCP_UNIT_TEST_SIG_4)
+{
+	std::string testname = "tcp_client_zc_4";
+	fprintf(stderr, "\n\n%s (ts=%lu)\n", testname.c_str(), get_now_ts);
+	fprintf(stderr, "connect to remote host with IPv4 address, write %d bytes of a known pattern.\n", ZC_BYTES);
+	int fd, err = 0;
+	long int w = 0;
+	static char buf[251 * 64];
+	char c;
+	for (size_t i=0; i<sizeof buf; i++) {
+		buf[i] = ZC_PATTERN(i);
+	}
+	if ((fd = SOCKET(AF_INET, SOCK_STREAM, 0)) < 0) {
+		DEBUG_ERROR("error creating ZeroTier socket");
+		*passed = false;
+		return;
+	}
+	if ((err = CONNECT(fd, (const struct sockaddr *)addr, sizeof(*addr))) < 0) {
+		DEBUG_ERROR("error connecting to remote host (%d)", err);
+		CLOSE(fd);
+		*passed = false;
+		return;
+	}
+	while (w < ZC_BYTES) {
+		// the buffer is a whole number of pattern periods, so any write continues the pattern
+		int r = WRITE(fd, buf + (w % sizeof buf), std::min(sizeof buf - (w % sizeof buf), (size_t)(ZC_BYTES - w)));
+		if (r <= 0) {
+			break;
+		}
+		w += r;
+	}
+	// the remote host answers with one byte once it has checked everything
+	int r = READ(fd, &c, 1);
+	err |= CLOSE(fd);
+	sprintf(details, "%s, wrote=%ld", testname.c_str(), w);
+	*passed = (w == ZC_BYTES && r == 1 && c == 'k' && !err);
+}
+
+#define ZC_SEND_CHUNK          (251 * 1024) // a whole number of pattern periods
+#define ZC_SEND_BUFS           8
+
+// write ZC_BYTES of the same pattern with zts_send_zc(), reusing each buffer only once its completion is in
+void tcp_client_send_zc_4(TCP_UNIT_TEST_SIG_4)
+{
+	std::string testname = "tcp_client_send_zc_4";
+	fprintf(stderr, "\n\n%s (ts=%lu)\n", testname.c_str(), get_now_ts);
+	fprintf(stderr, "connect to remote host with IPv4 address, write %d bytes with zts_send_zc().\n", ZC_BYTES);
+	int fd, err = 0, sends = 0, completions = 0, strays = 0;
+	long int w = 0;
+	static char bufs[ZC_SEND_BUFS][ZC_SEND_CHUNK];
+	int pending[ZC_SEND_BUFS] = { 0 }; // completions still due per buffer
+	char c;
+	for (int i=0; i<ZC_SEND_BUFS; i++) {
+		for (int j=0; j<ZC_SEND_CHUNK; j++) {
+			bufs[i][j] = ZC_PATTERN(j);
+		}
+	}
+	if ((fd = SOCKET(AF_INET, SOCK_STREAM, 0)) < 0) {
+		DEBUG_ERROR("error creating ZeroTier socket");
+		*passed = false;
+		return;
+	}
+	if ((err = CONNECT(fd, (const struct sockaddr *)addr, sizeof(*addr))) < 0) {
+		DEBUG_ERROR("error connecting to remote host (%d)", err);
+		CLOSE(fd);
+		*passed = false;
+		return;
+	}
+	struct zts_zc_completion done[ZC_SEND_BUFS * 4];
+	for (int i=0; w < ZC_BYTES; i = (i + 1) % ZC_SEND_BUFS) {
+		while (pending[i] > 0) {
+			int n = zts_send_zc_reap(done, ZC_SEND_BUFS * 4, 10000);
+			if (n <= 0) {
+				break;
+			}
+			for (int k=0; k<n; k++) {
+				long int b = (long int)done[k].cookie;
+				if (done[k].fd != fd || b < 0 || b >= ZC_SEND_BUFS || pending[b] <= 0) {
+					strays++;
+					continue;
+				}
+				pending[b]--;
+				completions++;
+			}
+		}
+		if (pending[i] > 0) {
+			DEBUG_ERROR("no completion for buffer %d", i);
+			break;
+		}
+		// the buffer is a whole number of pattern periods, so any write continues the pattern
+		size_t len = std::min((long int)ZC_SEND_CHUNK, ZC_BYTES - w), off = 0;
+		while (off < len) {
+			ssize_t r = zts_send_zc(fd, bufs[i] + off, len - off, 0, (void *)(long int)i);
+			sends++;
+			pending[i]++;
+			if (r <= 0) {
+				break;
+			}
+			off += r;
+		}
+		w += off;
+		if (off < len) {
+			break;
+		}
+	}
+	// the remote host answers with one byte once it has checked everything, by then all data is ACKed
+	int r = READ(fd, &c, 1);
+	while (completions + strays < sends) {
+		int n = zts_send_zc_reap(done, ZC_SEND_BUFS * 4, 10000);
+		if (n <= 0) {
+			break;
+		}
+		completions += n;
+	}
+	err |= CLOSE(fd);
+	sprintf(details, "%s, wrote=%ld, sends=%d, completions=%d, strays=%d", testname.c_str(), w, sends, completions, strays);
+	*passed = (w == ZC_BYTES && r == 1 && c == 'k' && completions == sends && !strays && !err);
+}
+
+// receive with zts_recv_zc(), check the data where it lies in the network stack's buffers, then release them
+void tcp_server_zc_4(TCP_UNIT_TEST_SIG_4)
+{
+	std::string testname = "tcp_server_zc_4";
+	fprintf(stderr, "\n\n%s (ts=%lu)\n", testname.c_str(), get_now_ts);
+	fprintf(stderr, "accept connection with IPv4 address, receive %d bytes with zts_recv_zc().\n", ZC_BYTES);
+	int fd, client_fd, err = 0, loans = 0;
+	long int received = 0, malformed = 0;
+	if ((fd = SOCKET(AF_INET, SOCK_STREAM, 0)) < 0) {
+		DEBUG_ERROR("error creating ZeroTier socket");
+		*passed = false;
+		return;
+	}
+	if ((err = BIND(fd, (struct sockaddr *)addr, sizeof(struct sockaddr_in)) < 0)) {
+		DEBUG_ERROR("error binding to interface (%d)", err);
+		*passed = false;
+		return;
+	}
+	if ((err = LISTEN(fd, 1)) < 0) {
+		DEBUG_ERROR("error placing socket in LISTENING state (%d)", err);
+		*passed = false;
+		return;
+	}
+	if ((client_fd = ACCEPT(fd, NULL, NULL)) < 0) {
+		DEBUG_ERROR("error accepting connection (%d)", client_fd);
+		CLOSE(fd);
+		*passed = false;
+		return;
+	}
+	long int ts = get_now_us();
+	while (received < ZC_BYTES) {
+		struct iovec iov[ZC_IOV_MAX];
+		int iovcnt = ZC_IOV_MAX;
+		void *handle;
+		ssize_t r = zts_recv_zc(client_fd, iov, &iovcnt, &handle, 0);
+		if (r <= 0) {
+			break;
+		}
+		long int n = 0;
+		for (int i=0; i<iovcnt; i++) {
+			const char *p = (const char *)iov[i].iov_base;
+			for (size_t j=0; j<iov[i].iov_len; j++, n++) {
+				malformed += (p[j] != ZC_PATTERN(received + n));
+			}
+		}
+		malformed += (n != r);
+		received += r;
+		loans++;
+		err |= zts_buf_release(handle);
+	}
+	float rate = received / ((get_now_us() - ts) / 1000000.0f);
+	err |= (WRITE(client_fd, "k", 1) != 1);
+	err |= CLOSE(client_fd);
+	err |= CLOSE(fd);
+	sprintf(details, "%s, received=%ld, malformed=%ld, loans=%d, %.2f MB/s", testname.c_str(), received, malformed,
+		loans, rate / float(ONE_MEGABYTE));
+	*passed = (received == ZC_BYTES && !malformed && !err);
+}
+
+#define RING_CONNS             8
+#define RING_ROUNDS            500
+#define RING_MSG               64
+
+struct ring_conn
+{
+	int fd;
+	char buf[RING_MSG];
+	int off;    // bytes of the current message moved so far
+	int len;    // length of the current message
+	int rounds;
+};
+
+static struct zts_ring_sqe ring_sqe(int op, int fd, void *buf, size_t len, long int conn)
+{
+	struct zts_ring_sqe sqe;
+	memset(&sqe, 0, sizeof(sqe));
+	sqe.op = op;
+	sqe.fd = fd;
+	sqe.buf = buf;
+	sqe.len = len;
+	sqe.user_data = (void *)conn;
+	return sqe;
+}
+
+// connect RING_CONNS sockets and exchange messages on all of them through one ring
+void tcp_client_ring_4(TCP_UNIT_TEST_SIG_4)
+{
+	std::string testname = "tcp_client_ring_4";
+	fprintf(stderr, "\n\n%s (ts=%lu)\n", testname.c_str(), get_now_ts);
+	fprintf(stderr, "connect %d sockets to remote host with IPv4 address, %d request/response rounds each through a zts_ring.\n",
+		RING_CONNS, RING_ROUNDS);
+	int err = 0, closed = 0, rounds = 0, mismatched = 0, unexpected = 0;
+	static struct ring_conn conns[RING_CONNS];
+	struct zts_ring_sqe sqes[RING_CONNS * 2 + 1];
+	struct zts_ring_cqe cqes[RING_CONNS * 2];
+	struct zts_ring *ring = zts_ring_create(RING_CONNS * 2);
+	if (!ring) {
+		DEBUG_ERROR("error creating ring");
+		*passed = false;
+		return;
+	}
+	// a full ring takes no more until completions are reaped
+	for (int i=0; i<RING_CONNS * 2 + 1; i++) {
+		sqes[i] = ring_sqe(ZTS_RING_NOP, -1, NULL, 0, -1);
+	}
+	err |= (zts_ring_submit(ring, sqes, RING_CONNS * 2 + 1) != RING_CONNS * 2);
+	err |= (zts_ring_wait(ring, cqes, RING_CONNS * 2, 0) != RING_CONNS * 2);
+	for (int i=0; i<RING_CONNS; i++) {
+		if ((conns[i].fd = SOCKET(AF_INET, SOCK_STREAM, 0)) < 0) {
+			DEBUG_ERROR("error creating ZeroTier socket");
+			*passed = false;
+			return;
+		}
+		conns[i].off = conns[i].rounds = 0;
+		sqes[i] = ring_sqe(ZTS_RING_CONNECT, conns[i].fd, NULL, 0, i);
+		sqes[i].addr = (struct sockaddr *)addr;
+		sqes[i].addrlen = sizeof(*addr);
+	}
+	err |= (zts_ring_submit(ring, sqes, RING_CONNS) != RING_CONNS);
+	while (closed < RING_CONNS) {
+		int n = zts_ring_wait(ring, cqes, RING_CONNS * 2, 30000);
+		if (n <= 0) {
+			DEBUG_ERROR("timed out waiting for completions");
+			break;
+		}
+		for (int i=0; i<n; i++) {
+			long int k = (long int)cqes[i].user_data;
+			struct ring_conn &c = conns[k];
+			struct zts_ring_sqe next[2];
+			int nnext = 0;
+			if (cqes[i].op == ZTS_RING_CLOSE) {
+				closed++;
+				err |= (cqes[i].res != 0);
+				continue;
+			}
+			if (cqes[i].res < 0 || (cqes[i].op == ZTS_RING_RECV && cqes[i].res == 0)) {
+				// only the send queued behind each close is meant to fail
+				unexpected += !(cqes[i].op == ZTS_RING_SEND && c.rounds == RING_ROUNDS);
+				continue;
+			}
+			if (cqes[i].op == ZTS_RING_SEND) {
+				unexpected += (cqes[i].res != RING_MSG);
+				continue;
+			}
+			if (cqes[i].op == ZTS_RING_RECV && (c.off += (int)cqes[i].res) < RING_MSG) {
+				next[nnext++] = ring_sqe(ZTS_RING_RECV, c.fd, c.buf + c.off, RING_MSG - c.off, k);
+			}
+			else {
+				if (cqes[i].op == ZTS_RING_RECV) {
+					for (int j=0; j<RING_MSG; j++) {
+						mismatched += (c.buf[j] != (char)(k * RING_ROUNDS + c.rounds + j));
+					}
+					c.rounds++;
+					rounds++;
+				}
+				if (c.rounds < RING_ROUNDS) {
+					for (int j=0; j<RING_MSG; j++) {
+						c.buf[j] = (char)(k * RING_ROUNDS + c.rounds + j);
+					}
+					c.off = 0;
+					next[nnext++] = ring_sqe(ZTS_RING_SEND, c.fd, c.buf, RING_MSG, k);
+					next[nnext++] = ring_sqe(ZTS_RING_RECV, c.fd, c.buf, RING_MSG, k);
+				}
+				else {
+					// anything submitted after a close on the same socket fails
+					next[nnext++] = ring_sqe(ZTS_RING_CLOSE, c.fd, NULL, 0, k);
+					next[nnext++] = ring_sqe(ZTS_RING_SEND, c.fd, c.buf, RING_MSG, k);
+				}
+			}
+			if (zts_ring_submit(ring, next, nnext) != nnext) {
+				DEBUG_ERROR("ring unexpectedly full");
+				unexpected++;
+			}
+		}
+	}
+	// collect the failed sends queued behind the closes
+	while (zts_ring_wait(ring, cqes, RING_CONNS * 2, 0) > 0) {}
+	err |= zts_ring_close(ring);
+	sprintf(details, "%s, rounds=%d, mismatched=%d, unexpected=%d, closed=%d", testname.c_str(), rounds, mismatched,
+		unexpected, closed);
+	*passed = (rounds == RING_CONNS * RING_ROUNDS && !mismatched && !unexpected && closed == RING_CONNS && !err);
+}
+
+// accept RING_CONNS connections and echo everything back through one ring until the remote host closes them
+void tcp_server_ring_4(TCP_UNIT_TEST_SIG_4)
+{
+	std::string testname = "tcp_server_ring_4";
+	fprintf(stderr, "\n\n%s (ts=%lu)\n", testname.c_str(), get_now_ts);
+	fprintf(stderr, "accept %d connections with IPv4 address, echo through a zts_ring.\n", RING_CONNS);
+	int fd, err = 0, closed = 0, failed = 0;
+	long int echoed = 0;
+	static struct ring_conn conns[RING_CONNS];
+	struct zts_ring_sqe sqes[RING_CONNS];
+	struct zts_ring_cqe cqes[RING_CONNS * 2];
+	if ((fd = SOCKET(AF_INET, SOCK_STREAM, 0)) < 0) {
+		DEBUG_ERROR("error creating ZeroTier socket");
+		*passed = false;
+		return;
+	}
+	if ((err = BIND(fd, (struct sockaddr *)addr, sizeof(struct sockaddr_in)) < 0)) {
+		DEBUG_ERROR("error binding to interface (%d)", err);
+		*passed = false;
+		return;
+	}
+	if ((err = LISTEN(fd, RING_CONNS)) < 0) {
+		DEBUG_ERROR("error placing socket in LISTENING state (%d)", err);
+		*passed = false;
+		return;
+	}
+	struct zts_ring *ring = zts_ring_create(RING_CONNS * 2);
+	if (!ring) {
+		DEBUG_ERROR("error creating ring");
+		CLOSE(fd);
+		*passed = false;
+		return;
+	}
+	for (int i=0; i<RING_CONNS; i++) {
+		sqes[i] = ring_sqe(ZTS_RING_ACCEPT, fd, NULL, 0, i);
+	}
+	err |= (zts_ring_submit(ring, sqes, RING_CONNS) != RING_CONNS);
+	while (closed < RING_CONNS) {
+		int n = zts_ring_wait(ring, cqes, RING_CONNS * 2, 30000);
+		if (n <= 0) {
+			DEBUG_ERROR("timed out waiting for completions");
+			break;
+		}
+		for (int i=0; i<n; i++) {
+			long int k = (long int)cqes[i].user_data;
+			struct ring_conn &c = conns[k];
+			struct zts_ring_sqe next;
+			if (cqes[i].op == ZTS_RING_CLOSE) {
+				closed++;
+				err |= (cqes[i].res != 0);
+				continue;
+			}
+			if (cqes[i].res < 0) {
+				failed++;
+				continue;
+			}
+			if (cqes[i].op == ZTS_RING_ACCEPT) {
+				c.fd = (int)cqes[i].res;
+				next = ring_sqe(ZTS_RING_RECV, c.fd, c.buf, RING_MSG, k);
+			}
+			else if (cqes[i].op == ZTS_RING_RECV && cqes[i].res == 0) {
+				next = ring_sqe(ZTS_RING_CLOSE, c.fd, NULL, 0, k);
+			}
+			else if (cqes[i].op == ZTS_RING_RECV) {
+				c.off = 0;
+				c.len = (int)cqes[i].res;
+				next = ring_sqe(ZTS_RING_SEND, c.fd, c.buf, c.len, k);
+			}
+			else {
+				// a stream socket may take only part of a send, the rest goes out next
+				c.off += (int)cqes[i].res;
+				echoed += cqes[i].res;
+				next = c.off < c.len ? ring_sqe(ZTS_RING_SEND, c.fd, c.buf + c.off, c.len - c.off, k)
+					: ring_sqe(ZTS_RING_RECV, c.fd, c.buf, RING_MSG, k);
+			}
+			if (zts_ring_submit(ring, &next, 1) != 1) {
+				DEBUG_ERROR("ring unexpectedly full");
+				failed++;
+			}
+		}
+	}
+	err |= zts_ring_close(ring);
+	err |= CLOSE(fd);
+	sprintf(details, "%s, echoed=%ld, failed=%d, closed=%d", testname.c_str(), echoed, failed, closed);
+	*passed = (echoed == (long int)RING_CONNS * RING_ROUNDS * RING_MSG && !failed && closed == RING_CONNS && !err);
+}
+
+#if defined(LIBZT_CORO_TEST)
+// test/corotest.cpp, built as C++20
+void tcp_client_coro_4(TCP_UNIT_TEST_SIG_4);
+void tcp_server_coro_4(TCP_UNIT_TEST_SIG_4);
+#endif
+
+#endif // __SELFTEST__
+
+/****************************************************************************/
+/* main(), calls test_driver(...)                                           */
+/****************************************************************************/
+
+int main(int argc , char *argv[])
+{
+	if (argc < 6) {
+		fprintf(stderr, "usage: selftest <num_repeats> <selftest.conf> <alice|bob|ted|carol> to <bob|alice|ted|carol>\n");
+		fprintf(stderr, "e.g. : selftest 3 test/test.conf alice to bob\n");
+		return 1;
+	}
+
+	int num_repeats = atoi(argv[1]);
+	std::string path = argv[2];
+	std::string from = argv[3];
+	std::string   to = argv[5];
+	std::string   me = from;
+	std::vector<std::string> results;
+	std::string remote_echo_ipv4, smode;
+
+	std::string nwid, stype;
+	std::string ipstr, ipstr6, local_ipstr, local_ipstr6, remote_ipstr, remote_ipstr6;
+
+	int err         = 0;
+	int mode        = 0;
+	int port        = 0;
+	int op          = 0;
+	int start_port  = 0;
+	int cnt         = 0;
+	int ipv;
+	// for timing
+	// how long we expect the specific test to take
+	int subtest_expected_duration;
+	// (T+X), when we plan to start this test 
+	int subtest_start_time_offset = 0;
+
+	char details[128];
+	memset(&details, 0, sizeof details);
+	bool passed = 0; 
+	struct sockaddr_storage local_addr;
+	struct sockaddr_storage remote_addr;
+
+	// load config file
+	if (path.find(".conf") == std::string::npos) {
+		fprintf(stderr, "Possibly invalid conf file. Exiting...\n");
+		exit(0);
+	}
+	loadTestConfigFile(path);
+	// get origin details
+	local_ipstr      = testConf[me + ".ipv4"];
+	local_ipstr6     = testConf[me + ".ipv6"];
+	nwid             = testConf[me + ".nwid"];
+	path             = testConf[me + ".path"];
+	stype            = testConf[me + ".test"];
+	smode            = testConf[me + ".mode"];
+	start_port       = atoi(testConf[me + ".port"].c_str());
+	remote_echo_ipv4 = testConf[to + ".echo_ipv4"];
+	remote_ipstr     = testConf[to + ".ipv4"];
+	remote_ipstr6    = testConf[to + ".ipv6"];
+
+	if (strcmp(smode.c_str(), "server") == 0)
+		mode = TEST_MODE_SERVER;
+	else
+		mode = TEST_MODE_CLIENT;
+
+	fprintf(stderr, "\n\nORIGIN:\n\n");
+	fprintf(stderr, "\tlocal_ipstr      = %s\n", local_ipstr.c_str());
+	fprintf(stderr, "\tlocal_ipstr6     = %s\n", local_ipstr6.c_str());
+	fprintf(stderr, "\tstart_port       = %d\n", start_port);
+	fprintf(stderr, "\tpath             = %s\n", path.c_str());
+	fprintf(stderr, "\tnwid             = %s\n", nwid.c_str());
+	fprintf(stderr, "\ttype             = %s\n\n", stype.c_str());
+	fprintf(stderr, "DESTINATION:\n\n");
+	fprintf(stderr, "\tremote_ipstr     = %s\n", remote_ipstr.c_str());
+	fprintf(stderr, "\tremote_ipstr6    = %s\n", remote_ipstr6.c_str());
+	fprintf(stderr, "\tremote_echo_ipv4 = %s\n", remote_echo_ipv4.c_str());
+
+#if defined(__SELFTEST__)
+	// set start time here since we need to wait for both libzt instances to be online
+	long int selftest_start_time = get_now_ts();
+	subtest_expected_duration = 5;
+
+	DEBUG_TEST("Waiting for libzt to come online...\n");
+	zts_simple_start(path.c_str(), nwid.c_str());
+	char device_id[ZTO_ID_LEN];
+	zts_get_device_id(device_id);
+	DEBUG_TEST("I am %s, %s", device_id, me.c_str());
+	if (mode == TEST_MODE_SERVER) {
+		DEBUG_TEST("Ready. You should start selftest program on second host now...\n\n");
+	}
+	if (mode == TEST_MODE_CLIENT) {
+		DEBUG_TEST("Ready. Contacting selftest program on first host.\n\n");
+	}
+#endif // __SELFTEST__
+
+	// What follows is a long-form of zts_simple_start():
+	/*
+	 zts_start(path.c_str());
+	 printf("waiting for service to start...\n");
+	 while (zts_running() == false)
+		sleep(1);
+	 printf("joining network...\n");
+	 zts_join(nwid.c_str());
+	 printf("waiting for address assignment...\n");
+	 while (zts_has_address(nwid.c_str()) == false)
+		sleep(1);
+	*/
+
+for (int i=0; i<num_repeats; i++)
+{
+	DEBUG_TEST("\n\n\n --- COMPREHENSIVE TEST ITERATION: %d out of %d ---\n\n\n", i, num_repeats);
+
+#if defined(__SELFTEST__)
+	if (false) {
+		port = 1000; 
+		// closure test
+		struct sockaddr_in in4;
 		DEBUG_TEST("testing closures by binding to: %s", local_ipstr.c_str());
 		str2addr(local_ipstr, port, 4, (struct sockaddr *)&in4);
 		close_test((struct sockaddr*)&in4);
@@ -2904,6 +4358,234 @@ for (int i=0; i<num_repeats; i++)
 		RECORD_RESULTS(passed, details, &results);
 		port++;
 
+	// TCP 4 request/response latency, RX frames queued for the stack thread vs. processed inline
+
+		ipv = 4;
+		for (int rx_inline=0; rx_inline<2; rx_inline++) {
+#if defined(__SELFTEST__)
+			zts_set_rx_inline(rx_inline);
+#endif
+			subtest_start_time_offset+=subtest_expected_duration;
+			subtest_expected_duration = 30;
+
+			if (mode == TEST_MODE_SERVER) {
+				str2addr(local_ipstr, port, ipv, (struct sockaddr *)&local_addr);
+				wait_until_tplus_s(selftest_start_time, subtest_start_time_offset);
+				tcp_server_rr_latency_4((struct sockaddr_in *)&local_addr, op, cnt, details, &passed);
+			}
+			else if (mode == TEST_MODE_CLIENT) {
+				str2addr(remote_ipstr, port, ipv, (struct sockaddr *)&remote_addr);
+				wait_until_tplus_s(selftest_start_time, subtest_start_time_offset+5);
+				tcp_client_rr_latency_4((struct sockaddr_in *)&remote_addr, op, cnt, details, &passed);
+			}
+			strcat(details, rx_inline ? " (inline rx)" : " (queued rx)");
+			RECORD_RESULTS(passed, details, &results);
+			port++;
+		}
+#if defined(__SELFTEST__)
+		zts_set_rx_inline(ZT_RX_INLINE);
+#endif
+
+	// TCP 4 many threads sending concurrently, one connection each
+
+		ipv = 4;
+		subtest_start_time_offset+=subtest_expected_duration;
+		subtest_expected_duration = 60;
+		if (mode == TEST_MODE_SERVER) {
+			str2addr(local_ipstr, port, ipv, (struct sockaddr *)&local_addr);
+			wait_until_tplus_s(selftest_start_time, subtest_start_time_offset);
+			tcp_server_send_contention_4((struct sockaddr_in *)&local_addr, op, cnt, details, &passed);
+		}
+		else if (mode == TEST_MODE_CLIENT) {
+			str2addr(remote_ipstr, port, ipv, (struct sockaddr *)&remote_addr);
+			wait_until_tplus_s(selftest_start_time, subtest_start_time_offset+5);
+			tcp_client_send_contention_4((struct sockaddr_in *)&remote_addr, op, cnt, details, &passed);
+		}
+		RECORD_RESULTS(passed, details, &results);
+		port++;
+
+#if defined(__SELFTEST__)
+	// TCP 4 readiness, zts_select() vs zts_epoll_wait() at growing numbers of connections
+
+		int readiness_sockets[] = { 10, 1000, 10000 };
+		for (int r=0; r<3; r++) {
+			ipv = 4;
+			subtest_start_time_offset+=subtest_expected_duration;
+			subtest_expected_duration = 60;
+			if (mode == TEST_MODE_SERVER) {
+				str2addr(local_ipstr, port, ipv, (struct sockaddr *)&local_addr);
+				wait_until_tplus_s(selftest_start_time, subtest_start_time_offset);
+				tcp_server_readiness_4((struct sockaddr_in *)&local_addr, op, cnt, details, &passed, readiness_sockets[r]);
+			}
+			else if (mode == TEST_MODE_CLIENT) {
+				str2addr(remote_ipstr, port, ipv, (struct sockaddr *)&remote_addr);
+				wait_until_tplus_s(selftest_start_time, subtest_start_time_offset+5);
+				tcp_client_readiness_4((struct sockaddr_in *)&remote_addr, op, cnt, details, &passed, readiness_sockets[r]);
+			}
+			RECORD_RESULTS(passed, details, &results);
+			port++;
+		}
+
+	// TCP 4 demultiplexing, time per echo while cycling through growing numbers of connections
+
+		int demux_sockets[] = { 10, 1000, 10000 };
+		for (int r=0; r<3; r++) {
+			ipv = 4;
+			subtest_start_time_offset+=subtest_expected_duration;
+			subtest_expected_duration = 60;
+			if (mode == TEST_MODE_SERVER) {
+				str2addr(local_ipstr, port, ipv, (struct sockaddr *)&local_addr);
+				wait_until_tplus_s(selftest_start_time, subtest_start_time_offset);
+				tcp_server_demux_4((struct sockaddr_in *)&local_addr, op, cnt, details, &passed, demux_sockets[r]);
+			}
+			else if (mode == TEST_MODE_CLIENT) {
+				str2addr(remote_ipstr, port, ipv, (struct sockaddr *)&remote_addr);
+				wait_until_tplus_s(selftest_start_time, subtest_start_time_offset+5);
+				tcp_client_demux_4((struct sockaddr_in *)&remote_addr, op, cnt, details, &passed, demux_sockets[r]);
+			}
+			RECORD_RESULTS(passed, details, &results);
+			port++;
+		}
+
+	// UDP 4 demultiplexing, time per echo while cycling through growing numbers of bound ports
+
+		int udp_demux_sockets[] = { 10, 500 };
+		for (int r=0; r<2; r++) {
+			ipv = 4;
+			subtest_start_time_offset+=subtest_expected_duration;
+			subtest_expected_duration = 60;
+			if (mode == TEST_MODE_SERVER) {
+				str2addr(local_ipstr, port, ipv, (struct sockaddr *)&local_addr);
+				wait_until_tplus_s(selftest_start_time, subtest_start_time_offset);
+				udp_server_demux_4((struct sockaddr_in *)&local_addr, op, cnt, details, &passed, udp_demux_sockets[r]);
+			}
+			else if (mode == TEST_MODE_CLIENT) {
+				str2addr(remote_ipstr, port, ipv, (struct sockaddr *)&remote_addr);
+				wait_until_tplus_s(selftest_start_time, subtest_start_time_offset+5);
+				udp_client_demux_4((struct sockaddr_in *)&remote_addr, op, cnt, details, &passed, udp_demux_sockets[r]);
+			}
+			RECORD_RESULTS(passed, details, &results);
+			port++;
+		}
+
+	// UDP 4 packet rate, one zts_sendto() per datagram vs zts_sendmmsg() batches
+
+		ipv = 4;
+		subtest_start_time_offset+=subtest_expected_duration;
+		subtest_expected_duration = 60;
+		if (mode == TEST_MODE_SERVER) {
+			str2addr(local_ipstr, port, ipv, (struct sockaddr *)&local_addr);
+			str2addr(remote_ipstr, port, ipv, (struct sockaddr *)&remote_addr);
+			wait_until_tplus_s(selftest_start_time, subtest_start_time_offset);
+			udp_server_pps_4((struct sockaddr_in *)&local_addr, (struct sockaddr_in *)&remote_addr, op, cnt, details, &passed);
+		}
+		else if (mode == TEST_MODE_CLIENT) {
+			str2addr(local_ipstr, port, ipv, (struct sockaddr *)&local_addr);
+			str2addr(remote_ipstr, port, ipv, (struct sockaddr *)&remote_addr);
+			wait_until_tplus_s(selftest_start_time, subtest_start_time_offset+5);
+			udp_client_pps_4((struct sockaddr_in *)&local_addr, (struct sockaddr_in *)&remote_addr, op, cnt, details, &passed);
+		}
+		RECORD_RESULTS(passed, details, &results);
+		port++;
+
+	// TCP 4 framing, header and payload of each frame in separate buffers with zts_writev()/zts_readv()
+
+		ipv = 4;
+		subtest_start_time_offset+=subtest_expected_duration;
+		subtest_expected_duration = 30;
+		if (mode == TEST_MODE_SERVER) {
+			str2addr(local_ipstr, port, ipv, (struct sockaddr *)&local_addr);
+			wait_until_tplus_s(selftest_start_time, subtest_start_time_offset);
+			tcp_server_iov_4((struct sockaddr_in *)&local_addr, op, cnt, details, &passed);
+		}
+		else if (mode == TEST_MODE_CLIENT) {
+			str2addr(remote_ipstr, port, ipv, (struct sockaddr *)&remote_addr);
+			wait_until_tplus_s(selftest_start_time, subtest_start_time_offset+5);
+			tcp_client_iov_4((struct sockaddr_in *)&remote_addr, op, cnt, details, &passed);
+		}
+		RECORD_RESULTS(passed, details, &results);
+		port++;
+
+	// TCP 4 zero-copy receive, data checked in place with zts_recv_zc() and handed back with zts_buf_release()
+
+		ipv = 4;
+		subtest_start_time_offset+=subtest_expected_duration;
+		subtest_expected_duration = 30;
+		if (mode == TEST_MODE_SERVER) {
+			str2addr(local_ipstr, port, ipv, (struct sockaddr *)&local_addr);
+			wait_until_tplus_s(selftest_start_time, subtest_start_time_offset);
+			tcp_server_zc_4((struct sockaddr_in *)&local_addr, op, cnt, details, &passed);
+		}
+		else if (mode == TEST_MODE_CLIENT) {
+			str2addr(remote_ipstr, port, ipv, (struct sockaddr *)&remote_addr);
+			wait_until_tplus_s(selftest_start_time, subtest_start_time_offset+5);
+			tcp_client_zc_4((struct sockaddr_in *)&remote_addr, op, cnt, details, &passed);
+		}
+		RECORD_RESULTS(passed, details, &results);
+		port++;
+
+	// TCP 4 zero-copy send, zts_send_zc() buffers reused as their completions come in
+
+		ipv = 4;
+		subtest_start_time_offset+=subtest_expected_duration;
+		subtest_expected_duration = 30;
+		if (mode == TEST_MODE_SERVER) {
+			str2addr(local_ipstr, port, ipv, (struct sockaddr *)&local_addr);
+			wait_until_tplus_s(selftest_start_time, subtest_start_time_offset);
+			tcp_server_zc_4((struct sockaddr_in *)&local_addr, op, cnt, details, &passed);
+		}
+		else if (mode == TEST_MODE_CLIENT) {
+			str2addr(remote_ipstr, port, ipv, (struct sockaddr *)&remote_addr);
+			wait_until_tplus_s(selftest_start_time, subtest_start_time_offset+5);
+			tcp_client_send_zc_4((struct sockaddr_in *)&remote_addr, op, cnt, details, &passed);
+		}
+		RECORD_RESULTS(passed, details, &results);
+		port++;
+
+	// TCP 4 submission/completion ring, several connections driven by one thread on each side
+
+		ipv = 4;
+		subtest_start_time_offset+=subtest_expected_duration;
+		subtest_expected_duration = 30;
+		if (mode == TEST_MODE_SERVER) {
+			str2addr(local_ipstr, port, ipv, (struct sockaddr *)&local_addr);
+			wait_until_tplus_s(selftest_start_time, subtest_start_time_offset);
+			tcp_server_ring_4((struct sockaddr_in *)&local_addr, op, cnt, details, &passed);
+		}
+		else if (mode == TEST_MODE_CLIENT) {
+			str2addr(remote_ipstr, port, ipv, (struct sockaddr *)&remote_addr);
+			wait_until_tplus_s(selftest_start_time, subtest_start_time_offset+5);
+			tcp_client_ring_4((struct sockaddr_in *)&remote_addr, op, cnt, details, &passed);
+		}
+		RECORD_RESULTS(passed, details, &results);
+		port++;
+
+#if defined(LIBZT_CORO_TEST)
+	// TCP 4 coroutines, one thread multiplexing many connections through ZTCoroutine.hpp
+
+		ipv = 4;
+		subtest_start_time_offset+=subtest_expected_duration;
+		subtest_expected_duration = 30;
+		if (mode == TEST_MODE_SERVER) {
+			str2addr(local_ipstr, port, ipv, (struct sockaddr *)&local_addr);
+			wait_until_tplus_s(selftest_start_time, subtest_start_time_offset);
+			tcp_server_coro_4((struct sockaddr_in *)&local_addr, op, cnt, details, &passed);
+		}
+		else if (mode == TEST_MODE_CLIENT) {
+			str2addr(remote_ipstr, port, ipv, (struct sockaddr *)&remote_addr);
+			wait_until_tplus_s(selftest_start_time, subtest_start_time_offset+5);
+			tcp_client_coro_4((struct sockaddr_in *)&remote_addr, op, cnt, details, &passed);
+		}
+		RECORD_RESULTS(passed, details, &results);
+		port++;
+#endif
+
+	// stale descriptors, more sockets than the old fixed table held, with their entries reused
+
+		stale_descriptor_test(details, &passed);
+		RECORD_RESULTS(passed, details, &results);
+#endif
+
 		// PERFORMANCE (between this library instance and a native non library instance (echo) )
 		// Client/Server mode isn't being tested here, so it isn't important, we'll just set it to client
 